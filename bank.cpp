@@ -1,77 +1,39 @@
+// Basic interactive banking system (accounts and loans, no transaction log).
+// Build: g++ -std=c++17 -O2 -pthread bank.cpp bankengine.cpp bankstats.cpp bankvelocity.cpp bankidempotency.cpp bankschedule.cpp bankrank.cpp banksearch.cpp bankcolumns.cpp bankcdc.cpp bankreplica.cpp bankshard.cpp bankstore.cpp -o bank
+#include "bankengine.h"
+
 #include <iostream>
 #include <vector>
 #include <string>
-#include <fstream>
-#include <sstream>
-#include <algorithm>
 #include <cstdlib>  // for system()
 #include <unistd.h> // for sleep() on Unix-like systems
 #include <cctype>   // for tolower()
 
 using namespace std;
 
-// Trim function to remove leading and trailing spaces from input strings
-string trim(const string &str) {
-    size_t first = str.find_first_not_of(' ');
-    if (first == string::npos) return "";
-    size_t last = str.find_last_not_of(' ');
-    return str.substr(first, (last - first + 1));
-}
-
-// Structure to represent a bank account with account number, customer name, balance, and interest rate
-struct Account {
-    int accountNumber;      // Unique account number assigned by user
-    string customerName;    // Name of the account holder
-    double balance;         // Current balance in the account
-    double interestRate;    // Annual interest rate in percentage
-};
-
-// Structure to represent a loan with loan ID, customer name, loan amount, interest rate, duration, and remaining balance
-struct Loan {
-    int loanID;             // Unique loan identifier generated automatically
-    string customerName;    // Name of the loan customer
-    double loanAmount;      // Original loan amount
-    double interestRate;    // Interest rate for the loan in percentage
-    int duration;           // Duration of the loan in months
-    double remainingBalance;// Remaining balance to be repaid
-};
-
-// Global vectors to store all accounts and loans in memory
-vector<Account> accounts;
-vector<Loan> loanBook;
-
-// File names used to persist account and loan data between program runs
-const string accountsFile = "accounts.txt";
-const string loanBookFile = "loanbook.txt";
+// Engine holding all accounts and loans, reading and writing the basic file format
+BankEngine bank(FileFormat::Basic);
 
 // Function declarations for account management operations
-void loadAccounts();            // Load accounts from file into memory
-void saveAccounts();            // Save accounts from memory to file
-bool accountNumberExists(int);  // Check if an account number already exists
-int findAccountIndexByNumber(int);// Find index of account by account number
 void createAccount();           // Create a new account with user input
 void depositFunds();            // Deposit funds into an existing account
 void withdrawFunds();           // Withdraw funds from an existing account
 void transferFunds();           // Transfer funds between two accounts
 void viewCurrentBalance();      // View balance of a specific account
 void calculateAndAddInterest(); // Calculate and add interest to an account balance
-void closeAccount();            // Close an account and remove it from records
+void closeAccount();            // Close an account and retire its number
 void listAllAccounts();         // List all existing accounts with details
 void deleteAllAccounts();       // Delete all accounts from records
 
 // Function declarations for loan management operations
-void loadLoanBook();            // Load loans from file into memory
-void saveLoanBook();            // Save loans from memory to file
-int generateUniqueLoanID();     // Generate a unique loan ID for new loans
-Loan* findLoanByID(int);        // Find a loan by its ID
 void createLoanAgreement();     // Create a new loan agreement with user input
 void makeMonthlyRepayment();    // Make a monthly repayment on a loan
 void displayLoanBook();         // Display all loans with details
 
 int main() {
     // Load existing accounts and loans from files at program start
-    loadAccounts();
-    loadLoanBook();
+    bank.loadAccounts();
+    bank.loadLoanBook();
 
     int choice;
     do {
@@ -98,8 +60,8 @@ int main() {
         // Execute the selected menu option by calling the corresponding function
         switch(choice) {
             case 0:
-                saveAccounts();     // Save accounts before exiting
-                saveLoanBook();     // Save loans before exiting
+                bank.saveAccounts();    // Save accounts before exiting
+                bank.saveLoanBook();    // Save loans before exiting
                 cout << "Exiting program. Data saved.\n";
                 break;
             case 1:
@@ -130,7 +92,7 @@ int main() {
                 deleteAllAccounts();
                 break;
             case 10:
-                loadLoanBook();
+                bank.loadLoanBook();
                 cout << "Loan book loaded from file.\n";
                 break;
             case 11:
@@ -150,66 +112,6 @@ int main() {
     return 0;
 }
 
-// Load accounts from the accounts file into the accounts vector
-void loadAccounts() {
-    accounts.clear();
-    ifstream inFile(accountsFile);
-    if (!inFile) {
-        // File does not exist yet, so no accounts to load
-        return;
-    }
-    string line;
-    while (getline(inFile, line)) {
-        istringstream iss(line);
-        Account acc;
-        string name;
-        // Read account number, then ignore the space, then read name until '|'
-        if (iss >> acc.accountNumber) {
-            iss.ignore(); // Ignore space before name
-            getline(iss, name, '|'); // Read customer name until delimiter '|'
-            acc.customerName = trim(name);
-            iss >> acc.balance >> acc.interestRate;
-            accounts.push_back(acc);
-        }
-    }
-    inFile.close();
-}
-
-// Save all accounts from the accounts vector to the accounts file
-void saveAccounts() {
-    ofstream outFile(accountsFile);
-    if (!outFile) {
-        cerr << "Error: Unable to open accounts file for saving.\n"; // cerr for errors
-        return;
-    }
-    for (int i = 0; i < (int)accounts.size(); ++i) {
-        outFile << accounts[i].accountNumber << " " << accounts[i].customerName << "|"
-                << accounts[i].balance << " " << accounts[i].interestRate << "\n";
-    }
-    outFile.close();
-}
-
-// Check if an account number already exists in the accounts vector
-bool accountNumberExists(int accountNumber) {
-    for (int i = 0; i < (int)accounts.size(); ++i) {
-        if (accounts[i].accountNumber == accountNumber) {
-            return true;
-        }
-    }
-    return false;
-}
-
-// Find the index of an account in the accounts vector by account number
-// Returns -1 if not found
-int findAccountIndexByNumber(int accountNumber) {
-    for (int i = 0; i < (int)accounts.size(); ++i) {
-        if (accounts[i].accountNumber == accountNumber) {
-            return i;
-        }
-    }
-    return -1;
-}
-
 // Create a new account by taking user input for account number, name, initial deposit, and interest rate
 void createAccount() {
     Account newAcc;
@@ -218,10 +120,10 @@ void createAccount() {
         cout << "Enter account number: ";
         cin >> accNum;
         cin.ignore();
-        if (accountNumberExists(accNum)) {
+        if (bank.accountNumberExists(accNum)) {
             cout << "Account number already exists. Please enter a different number.\n";
         }
-    } while (accountNumberExists(accNum));
+    } while (bank.accountNumberExists(accNum));
     newAcc.accountNumber = accNum;
 
     cout << "Enter customer name: ";
@@ -248,8 +150,19 @@ void createAccount() {
     }
     cin.ignore();
 
-    accounts.push_back(newAcc);
-    saveAccounts();
+    switch (bank.createAccount(newAcc)) {
+        case OP_OK:
+            break;
+        case OP_DUPLICATE_ACCOUNT:
+            cout << "Account number already exists. Account not created.\n";
+            return;
+        case OP_CLOSED:
+            cout << "Account number belonged to a closed account and cannot be reused. Account not created.\n";
+            return;
+        default:
+            cout << "Unable to create the account.\n";
+            return;
+    }
 
     cout << "Account created successfully.\n";
     cout << "Account Number: " << newAcc.accountNumber << "\n"
@@ -265,8 +178,7 @@ void depositFunds() {
     cin >> accNum;
     cin.ignore();
 
-    int idx = findAccountIndexByNumber(accNum);
-    if (idx == -1) {
+    if (!bank.findAccount(accNum)) {
         cout << "Account not found.\n";
         return;
     }
@@ -276,15 +188,12 @@ void depositFunds() {
     cin >> amount;
     cin.ignore();
 
-    if (amount <= 0) {
+    if (bank.deposit(accNum, amount) != OP_OK) {
         cout << "Invalid deposit amount. Must be positive.\n";
         return;
     }
 
-    accounts[idx].balance += amount;
-    saveAccounts();
-
-    cout << "Deposit successful. New balance: " << accounts[idx].balance << "\n";
+    cout << "Deposit successful. New balance: " << bank.findAccount(accNum)->balance << "\n";
 }
 
 // Withdraw funds from an existing account by account number
@@ -294,8 +203,7 @@ void withdrawFunds() {
     cin >> accNum;
     cin.ignore();
 
-    int idx = findAccountIndexByNumber(accNum);
-    if (idx == -1) {
+    if (!bank.findAccount(accNum)) {
         cout << "Account not found.\n";
         return;
     }
@@ -305,20 +213,18 @@ void withdrawFunds() {
     cin >> amount;
     cin.ignore();
 
-    if (amount <= 0) {
+    OpStatus status = bank.withdraw(accNum, amount);
+    if (status == OP_INVALID_AMOUNT) {
         cout << "Invalid withdrawal amount. Must be positive.\n";
         return;
     }
 
-    if (amount > accounts[idx].balance) {
+    if (status == OP_INSUFFICIENT_FUNDS) {
         cout << "Insufficient funds.\n";
         return;
     }
 
-    accounts[idx].balance -= amount;
-    saveAccounts();
-
-    cout << "Withdrawal successful. New balance: " << accounts[idx].balance << "\n";
+    cout << "Withdrawal successful. New balance: " << bank.findAccount(accNum)->balance << "\n";
 }
 
 // Transfer funds between two accounts by their account numbers
@@ -328,8 +234,7 @@ void transferFunds() {
     cin >> srcAccNum;
     cin.ignore();
 
-    int srcIdx = findAccountIndexByNumber(srcAccNum);
-    if (srcIdx == -1) {
+    if (!bank.findAccount(srcAccNum)) {
         cout << "Source account not found.\n";
         return;
     }
@@ -339,8 +244,7 @@ void transferFunds() {
     cin >> destAccNum;
     cin.ignore();
 
-    int destIdx = findAccountIndexByNumber(destAccNum);
-    if (destIdx == -1) {
+    if (!bank.findAccount(destAccNum)) {
         cout << "Destination account not found.\n";
         return;
     }
@@ -355,23 +259,20 @@ void transferFunds() {
     cin >> amount;
     cin.ignore();
 
-    if (amount <= 0) {
+    OpStatus status = bank.transfer(srcAccNum, destAccNum, amount);
+    if (status == OP_INVALID_AMOUNT) {
         cout << "Invalid transfer amount. Must be positive.\n";
         return;
     }
 
-    if (amount > accounts[srcIdx].balance) {
+    if (status == OP_INSUFFICIENT_FUNDS) {
         cout << "Insufficient funds in source account.\n";
         return;
     }
 
-    accounts[srcIdx].balance -= amount;
-    accounts[destIdx].balance += amount;
-    saveAccounts();
-
     cout << "Transfer successful.\n";
-    cout << "Source account new balance: " << accounts[srcIdx].balance << "\n";
-    cout << "Destination account new balance: " << accounts[destIdx].balance << "\n";
+    cout << "Source account new balance: " << bank.findAccount(srcAccNum)->balance << "\n";
+    cout << "Destination account new balance: " << bank.findAccount(destAccNum)->balance << "\n";
 }
 
 // View the current balance of an account by account number
@@ -381,13 +282,13 @@ void viewCurrentBalance() {
     cin >> accNum;
     cin.ignore();
 
-    int idx = findAccountIndexByNumber(accNum);
-    if (idx == -1) {
+    const Account* acc = bank.findAccount(accNum);
+    if (acc == nullptr) {
         cout << "Account not found.\n";
         return;
     }
 
-    cout << "Current balance: " << accounts[idx].balance << "\n";
+    cout << "Current balance: " << acc->balance << "\n";
 }
 
 // Calculate and add simple interest to an account's balance
@@ -397,41 +298,33 @@ void calculateAndAddInterest() {
     cin >> accNum;
     cin.ignore();
 
-    int idx = findAccountIndexByNumber(accNum);
-    if (idx == -1) {
+    // Simple interest calculation for one year
+    if (bank.addInterest(accNum) != OP_OK) {
         cout << "Account not found.\n";
         return;
     }
 
-    // Simple interest calculation for one year
-    double interest = accounts[idx].balance * (accounts[idx].interestRate / 100.0);
-    accounts[idx].balance += interest;
-    saveAccounts();
-
-    cout << "Interest added. New balance: " << accounts[idx].balance << "\n";
+    cout << "Interest added. New balance: " << bank.findAccount(accNum)->balance << "\n";
 }
 
-// Close an account by removing it from the accounts vector
+// Close an account; the engine keeps the record for audit and retires its number
 void closeAccount() {
     cout << "Enter account number to close: ";
     int accNum;
     cin >> accNum;
     cin.ignore();
 
-    for (int i = 0; i < (int)accounts.size(); ++i) {
-        if (accounts[i].accountNumber == accNum) {
-            accounts.erase(accounts.begin() + i);
-            saveAccounts();
-            cout << "Account closed successfully.\n";
-            return;
-        }
+    if (bank.closeAccount(accNum) == OP_OK) {
+        cout << "Account closed successfully. Its number cannot be used for a new account.\n";
+        return;
     }
     cout << "Account not found.\n";
 }
 
 // List all accounts with their details
 void listAllAccounts() {
-    if (accounts.empty()) {
+    AccountSnapshot book = bank.snapshotAccounts(); // Consistent view of every account
+    if (book.liveCount == 0) {
         cout << "No accounts found.\n";
         return;
     }
@@ -439,7 +332,9 @@ void listAllAccounts() {
     system("clear"); // Clear screen for Unix-like systems
 
     cout << "Accounts List:\n";
-    for (auto a = accounts.cbegin(); a != accounts.cend(); ++a) {
+    for (size_t i = 0; i < book.accounts.size(); ++i) {
+        if (book.isClosedAt(i)) continue; // Closed, awaiting compaction
+        const Account* a = &book.accounts[i];
         cout << "Account Number: " << a->accountNumber << "\n"
              << "Customer Name: " << a->customerName << "\n"
              << "Balance: " << a->balance << "\n"
@@ -456,79 +351,16 @@ void deleteAllAccounts() {
     cin >> confirm;
     cin.ignore();
     if (tolower(confirm) == 'y') { // `tolower` requires <cctype>
-        accounts.clear();
-        saveAccounts();
+        bank.deleteAllAccounts();
         cout << "All accounts deleted.\n";
     } else {
         cout << "Account deletion cancelled.\n";
     }
 }
 
-// Load loan records from the loan book file into memory
-void loadLoanBook() {
-    loanBook.clear();
-    ifstream inFile(loanBookFile);
-    if (!inFile) {
-        // File does not exist yet, so no loans to load
-        return;
-    }
-    string line;
-    while (getline(inFile, line)) {
-        istringstream iss(line);
-        Loan loan;
-        string name;
-        // Read loan ID, then ignore the space, then read name until '|'
-        if (iss >> loan.loanID) {
-            iss.ignore(); // Ignore space before name
-            getline(iss, name, '|'); // Read customer name until delimiter '|'
-            loan.customerName = trim(name);
-            iss >> loan.loanAmount >> loan.interestRate >> loan.duration >> loan.remainingBalance;
-            loanBook.push_back(loan);
-        }
-    }
-    inFile.close();
-}
-
-// Save all loan records from memory to the loan book file
-void saveLoanBook() {
-    ofstream outFile(loanBookFile);
-    if (!outFile) {
-        cerr << "Error: Unable to open loan book file for saving.\n"; // cerr for errors
-        return;
-    }
-    for (auto a = loanBook.cbegin(); a != loanBook.cend(); ++a) {
-        outFile << a->loanID << " " << a->customerName << "|"
-                << a->loanAmount << " " << a->interestRate << " "
-                << a->duration << " " << a->remainingBalance << "\n";
-    }
-    outFile.close();
-}
-
-// Generate a unique loan ID by finding the maximum existing ID and adding 1
-int generateUniqueLoanID() {
-    int maxID = 0;
-    for (int i = 0; i < (int)loanBook.size(); ++i) {
-        if (loanBook[i].loanID > maxID) {
-            maxID = loanBook[i].loanID;
-        }
-    }
-    return maxID + 1;
-}
-
-// Find a loan record by its loan ID, returns pointer or nullptr if not found
-Loan* findLoanByID(int id) {
-    for (int i = 0; i < (int)loanBook.size(); ++i) {
-        if (loanBook[i].loanID == id) {
-            return &loanBook[i];
-        }
-    }
-    return nullptr;
-}
-
 // Create a new loan agreement by collecting details from the user
 void createLoanAgreement() {
     Loan newLoan;
-    newLoan.loanID = generateUniqueLoanID();
 
     cout << "Enter customer name: ";
     string name;
@@ -557,10 +389,8 @@ void createLoanAgreement() {
     }
     cin.ignore(); // Consume the newline left by cin
 
-    newLoan.remainingBalance = newLoan.loanAmount;
-
-    loanBook.push_back(newLoan);
-    saveLoanBook();
+    newLoan = bank.createLoan(newLoan.customerName, newLoan.loanAmount,
+                              newLoan.interestRate, newLoan.duration);
 
     system("clear"); // Clear screen for Unix-like systems
 
@@ -583,7 +413,7 @@ void makeMonthlyRepayment() {
     cin >> id;
     cin.ignore();
 
-    Loan* loan = findLoanByID(id);
+    const Loan* loan = bank.findLoanByID(id);
     if (loan == nullptr) {
         cout << "Loan ID not found.\n";
         return;
@@ -604,20 +434,21 @@ void makeMonthlyRepayment() {
         return;
     }
 
-    loan->remainingBalance -= repayment;
-    saveLoanBook();
+    bank.repayLoan(id, repayment);
 
     cout << "Repayment successful. Updated remaining balance: " << loan->remainingBalance << "\n";
 }
 
 // Display all loans in the loan book with their details
 void displayLoanBook() {
+    PagedSnapshot<Loan> loanBook = bank.snapshotLoans(); // Consistent view of every loan
     if (loanBook.empty()) {
         cout << "Loan book is empty.\n";
         return;
     }
     cout << "Loan Book:\n";
-    for (auto a = loanBook.cbegin(); a != loanBook.cend(); ++a) {
+    for (size_t i = 0; i < loanBook.size(); ++i) {
+        const Loan* a = &loanBook[i];
         cout << "Loan ID: " << a->loanID << "\n"
              << "Customer Name: " << a->customerName << "\n"
              << "Loan Amount: " << a->loanAmount << "\n"
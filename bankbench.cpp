@@ -0,0 +1,1512 @@
+// Benchmark and load-testing tool for BankEngine.
+// Build: g++ -std=c++17 -O2 -pthread bankbench.cpp bankengine.cpp bankstats.cpp bankvelocity.cpp bankidempotency.cpp bankschedule.cpp bankrank.cpp banksearch.cpp bankcolumns.cpp bankcdc.cpp bankreplica.cpp bankshard.cpp bankstore.cpp -o bankbench
+#include "bankengine.h"
+#include "bankshard.h"
+#include "bankstats.h"
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <iomanip>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <thread>
+#include <unistd.h>   // for chdir(), rmdir(), fork(), pipe()
+#include <poll.h>     // for poll()
+#include <signal.h>   // for kill()
+#include <sys/stat.h> // for mkdir()
+#include <sys/wait.h> // for waitpid()
+
+using namespace std;
+
+// Every mode drives one engine over the files in its working directory
+BankEngine bank;
+
+int runBenchmarks(int argc, char* argv[]);
+int runGenerator(int argc, char* argv[]);
+int runLoadTest(int argc, char* argv[]);
+int runTailChangeFeed(int argc, char* argv[]);
+int runFailoverDrill(int argc, char* argv[]);
+int runShardBench(int argc, char* argv[]);
+int runStoreBench(int argc, char* argv[]);
+int runNettingBench(int argc, char* argv[]);
+
+int main(int argc, char* argv[]) {
+    string mode = argc > 1 ? argv[1] : "";
+    if (mode == "--bench") return runBenchmarks(argc, argv);
+    if (mode == "--generate") return runGenerator(argc, argv);
+    if (mode == "--loadtest") return runLoadTest(argc, argv);
+    if (mode == "--tail-cdc") return runTailChangeFeed(argc, argv);
+    if (mode == "--failover-drill") return runFailoverDrill(argc, argv);
+    if (mode == "--shard-bench") return runShardBench(argc, argv);
+    if (mode == "--store-bench") return runStoreBench(argc, argv);
+    if (mode == "--netting-bench") return runNettingBench(argc, argv);
+
+    cerr << "Usage: bankbench --bench | --generate | --loadtest | --tail-cdc PATH | --failover-drill | --shard-bench | --store-bench | --netting-bench [options]\n";
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark mode
+//   ./bankbench --bench [--scales 1k,10k,100k] [--reps N] [--warmup N]
+//                       [--seed N] [--filter NAME] [--out FILE]
+// Results are written as CSV (one row per benchmark and scale) so runs can be
+// diffed or compared by a script. Each run works in a fresh temporary directory,
+// so the real accounts.txt, loanbook.txt and transactions.txt are never touched.
+// ---------------------------------------------------------------------------
+
+// Settings shared by every benchmark in a run
+struct BenchConfig {
+    vector<size_t> scales = {1000, 10000, 100000};
+    int reps = 20;              // Timed repetitions per benchmark
+    int warmup = 3;             // Untimed repetitions run before timing
+    unsigned seed = 42;         // Seed for the synthetic datasets and key choices
+    string filter;              // Only run benchmarks whose name contains this text
+};
+
+// Parse a scale such as "1000", "10k" or "10M"
+size_t parseScale(const string& text) {
+    size_t multiplier = 1;
+    string digits = text;
+    if (!digits.empty() && (digits.back() == 'k' || digits.back() == 'K')) multiplier = 1000;
+    if (!digits.empty() && (digits.back() == 'm' || digits.back() == 'M')) multiplier = 1000000;
+    if (multiplier != 1) digits.pop_back();
+    return stoul(digits) * multiplier;
+}
+
+// A made-up "First Last" name: a common first name and a surname of two or three
+// syllables, which gives millions of distinct names with realistic repetition
+string syntheticName(mt19937_64& rng) {
+    static const char* firstNames[] = {
+        "James", "Mary", "John", "Patricia", "Robert", "Jennifer", "Michael", "Linda", "David", "Elizabeth",
+        "William", "Barbara", "Richard", "Susan", "Joseph", "Jessica", "Thomas", "Sarah", "Charles", "Karen",
+        "Daniel", "Nancy", "Matthew", "Lisa", "Anthony", "Betty", "Mark", "Margaret", "Paul", "Sandra",
+        "Steven", "Ashley", "Andrew", "Emily", "Kenneth", "Donna", "Joshua", "Michelle", "Kevin", "Carol",
+        "Brian", "Amanda", "George", "Melissa", "Edward", "Deborah", "Ronald", "Stephanie", "Timothy", "Rebecca",
+        "Ahmed", "Fatima", "Wei", "Mei", "Raj", "Priya", "Carlos", "Lucia", "Olga", "Ivan"};
+    static const char* syllables[] = {
+        "an", "ber", "cal", "den", "el", "far", "gar", "hol", "is", "jen", "kel", "lan", "mor", "nor",
+        "ol", "per", "quin", "ros", "sel", "tor", "ul", "van", "wes", "yar", "zel", "bran", "dor", "ford",
+        "ham", "ley", "ton", "son", "wood", "field", "man", "ric", "stein", "berg", "ov", "ez"};
+    const size_t firstCount = sizeof(firstNames) / sizeof(firstNames[0]);
+    const size_t syllableCount = sizeof(syllables) / sizeof(syllables[0]);
+    string last;
+    size_t parts = 2 + rng() % 2;
+    for (size_t i = 0; i < parts; ++i) last += syllables[rng() % syllableCount];
+    last[0] = (char)toupper((unsigned char)last[0]);
+    return string(firstNames[rng() % firstCount]) + " " + last;
+}
+
+// Replace the engine's book with deterministic synthetic data. Transactions are
+// spread over one month and loans are issued to existing customers.
+void generateSyntheticData(size_t accountCount, size_t loanCount, size_t transactionCount, unsigned seed) {
+    vector<Account> accounts;
+    vector<Loan> loanBook;
+    vector<Transaction> transactions;
+
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> balanceDist(1000.0, 100000.0);
+    uniform_real_distribution<double> rateDist(0.0, 5.0);
+    uniform_real_distribution<double> amountDist(1.0, 500.0);
+    uniform_int_distribution<size_t> accountDist(0, accountCount - 1);
+    const char* types[] = {"deposit", "withdrawal", "transfer_in", "transfer_out"};
+
+    accounts.reserve(accountCount);
+    for (size_t i = 0; i < accountCount; ++i) {
+        Account acc;
+        acc.accountNumber = (int)(100000 + i);
+        acc.customerName = syntheticName(rng);
+        acc.balance = balanceDist(rng);
+        acc.interestRate = rateDist(rng);
+        accounts.push_back(acc);
+    }
+
+    transactions.reserve(transactionCount);
+    for (size_t i = 0; i < transactionCount && accountCount > 0; ++i) {
+        const Account& acc = accounts[accountDist(rng)];
+        char dateTime[20];
+        snprintf(dateTime, sizeof(dateTime), "2026-01-%02d %02d:%02d:%02d",
+                 (int)(1 + i % 28), (int)(i / 3600 % 24), (int)(i / 60 % 60), (int)(i % 60));
+        Transaction t;
+        t.transactionID = (int)(i + 1);
+        t.accountNumber = acc.accountNumber;
+        t.dateTime = dateTime;
+        t.type = types[i % 4];
+        t.amount = amountDist(rng);
+        t.balanceAfter = acc.balance;
+        transactions.push_back(t);
+    }
+
+    for (size_t i = 0; i < loanCount && accountCount > 0; ++i) {
+        Loan loan;
+        loan.loanID = (int)(i + 1);
+        loan.customerName = accounts[i % accountCount].customerName;
+        loan.loanAmount = balanceDist(rng);
+        loan.interestRate = rateDist(rng);
+        loan.duration = 12 + (int)(i % 48);
+        loan.remainingBalance = loan.loanAmount;
+        loan.linkedAccountNumber = accounts[i % accountCount].accountNumber;
+        loanBook.push_back(loan);
+    }
+
+    bank.replaceAll(move(accounts), move(loanBook), move(transactions));
+}
+
+// Run `body` for the warm-up and timed repetitions and write one CSV row.
+// Each call of `body` performs opsPerRep operations; timings are per operation.
+void runBenchmark(ostream& out, const BenchConfig& cfg, const string& name, size_t scale,
+                  size_t opsPerRep, const function<void()>& body) {
+    if (!cfg.filter.empty() && name.find(cfg.filter) == string::npos) return;
+
+    for (int i = 0; i < cfg.warmup; ++i) body();
+
+    vector<double> samples;
+    for (int i = 0; i < cfg.reps; ++i) {
+        auto start = chrono::steady_clock::now();
+        body();
+        auto elapsed = chrono::steady_clock::now() - start;
+        samples.push_back(chrono::duration<double, nano>(elapsed).count() / opsPerRep);
+    }
+    sort(samples.begin(), samples.end());
+    double mean = 0;
+    for (double s : samples) mean += s;
+    mean /= samples.size();
+    double median = samples[samples.size() / 2];
+
+    out << name << "," << scale << "," << cfg.reps << "," << opsPerRep << ","
+        << samples.front() << "," << median << "," << mean << "," << samples.back() << ","
+        << (median > 0 ? 1e9 / median : 0) << "\n";
+    out.flush();
+    cerr << name << " @ " << scale << ": median " << median << " ns/op\n";
+}
+
+// Interest clocks for the accrual benchmark
+int64_t wallClock() { return time(nullptr); }
+int64_t monthAheadClock() { return time(nullptr) + 30 * 86400; }
+
+// Interest clock for the auto-debit benchmark, benchMonths months ahead
+int benchMonths = 0;
+int64_t benchMonthClock() { return time(nullptr) + benchMonths * 31 * 86400LL; }
+
+// Run every benchmark at one dataset scale
+void runBenchmarksAtScale(ostream& out, const BenchConfig& cfg, size_t scale) {
+    generateSyntheticData(scale, max<size_t>(1, scale / 10), scale, cfg.seed);
+    bank.saveAll();
+    const vector<Account>& accounts = bank.getAccounts();
+
+    mt19937_64 rng(cfg.seed + scale);
+    uniform_int_distribution<size_t> accountDist(0, scale - 1);
+    auto randomAccount = [&]() { return accounts[accountDist(rng)].accountNumber; };
+
+    // History queries scan the whole log, so batch fewer of them as the book grows
+    size_t scanOps = min<size_t>(1000, max<size_t>(1, 10000000 / scale));
+    vector<int> keys(scanOps);
+    for (auto& k : keys) k = randomAccount();
+
+    volatile long sink = 0;
+    runBenchmark(out, cfg, "lookup_hit", scale, scanOps, [&]() {
+        for (int k : keys) sink += bank.findAccountIndexByNumber(k);
+    });
+    runBenchmark(out, cfg, "lookup_miss", scale, scanOps, [&]() {
+        for (int k : keys) sink += bank.accountNumberExists(-k);
+    });
+    runBenchmark(out, cfg, "history_query", scale, scanOps, [&]() {
+        for (int k : keys) sink += bank.getTransactionHistory(k).size();
+    });
+
+    // Balance read with a month of daily interest outstanding on every account
+    bank.setInterestClock(monthAheadClock);
+    runBenchmark(out, cfg, "balance_with_interest", scale, scanOps, [&]() {
+        for (int k : keys) sink += (long)bank.balanceWithInterest(*bank.findAccount(k));
+    });
+    bank.setInterestClock(wallClock);
+
+    // Order-statistic queries against the incrementally maintained rankings
+    const RankIndex& ranking = bank.balanceRanking();
+    runBenchmark(out, cfg, "top_100_balances", scale, 1, [&]() {
+        sink += ranking.top(100).size();
+    });
+    runBenchmark(out, cfg, "balance_rank", scale, scanOps, [&]() {
+        for (int k : keys) sink += ranking.rank(k);
+    });
+    runBenchmark(out, cfg, "balance_percentile", scale, scanOps, [&]() {
+        for (size_t i = 0; i < keys.size(); ++i) sink += (long)ranking.valueAtPercentile(i % 100);
+    });
+
+    // Fuzzy name search for existing customers' names with one typo: a dropped, a
+    // doubled or a wrong letter
+    vector<string> typoNames;
+    for (size_t i = 0; i < 100; ++i) {
+        string name = bank.findAccount(keys[i % keys.size()])->customerName;
+        size_t pos = 1 + rng() % (name.size() - 1);
+        if (i % 3 == 0) name.erase(pos, 1);
+        else if (i % 3 == 1) name.insert(pos, 1, name[pos]);
+        else name[pos] = name[pos] == 'e' ? 'a' : 'e';
+        typoNames.push_back(name);
+    }
+    runBenchmark(out, cfg, "fuzzy_name_search", scale, typoNames.size(), [&]() {
+        for (const string& name : typoNames) sink += bank.searchCustomerNames(name).size();
+    });
+    vector<string> exactNames;
+    for (int k : keys) exactNames.push_back(bank.findAccount(k)->customerName);
+    runBenchmark(out, cfg, "name_lookup_exact", scale, exactNames.size(), [&]() {
+        for (const string& name : exactNames) sink += bank.findAccountNumbersByName(name).size();
+    });
+
+    // "Active accounts with balance > 50000 and rate > 2.5, or balance < 2000": the
+    // column scan, and the same loop over the account structs for comparison.
+    // Timings are per account scanned.
+    AccountQuery query;
+    query.frozen = 0;
+    query.anyOf = {{{AccountField::Balance, CompareOp::Greater, 50000.0},
+                    {AccountField::InterestRate, CompareOp::Greater, 2.5}},
+                   {{AccountField::Balance, CompareOp::Less, 2000.0}}};
+    runBenchmark(out, cfg, "column_filter_sum", scale, scale, [&]() {
+        sink += (long)bank.queryAccounts(query).sum;
+    });
+    runBenchmark(out, cfg, "struct_filter_sum", scale, scale, [&]() {
+        double sum = 0;
+        for (size_t i = 0; i < accounts.size(); ++i) {
+            const Account& a = accounts[i];
+            if (bank.isClosedAt(i) || bank.isFrozenAt(i)) continue;
+            if ((a.balance > 50000.0 && a.interestRate > 2.5) || a.balance < 2000.0) sum += a.balance;
+        }
+        sink += (long)sum;
+    });
+
+    // Change feed: publishing into a ring large enough never to lap a reader, reading
+    // the events back, and, given a spare core, the round trip to a reader thread that
+    // acknowledges each event as it sees it
+    {
+        const size_t feedOps = 10000;
+        ChangeFeed feed;
+        ChangeFeedReader reader;
+        if (feed.open("bench.cdc", 1 << 16) && reader.open("bench.cdc")) {
+            ChangeEvent event = {};
+            event.type = CHANGE_TRANSACTION;
+            event.amount = 10.0;
+            strcpy(event.kind, "deposit");
+            runBenchmark(out, cfg, "cdc_publish", scale, feedOps, [&]() {
+                for (size_t i = 0; i < feedOps; ++i) {
+                    event.accountNumber = keys[i % keys.size()];
+                    feed.publish(event);
+                }
+            });
+            ChangeEvent seen;
+            runBenchmark(out, cfg, "cdc_read", scale, feedOps, [&]() {
+                reader.seek(reader.nextSequence() - feedOps);
+                while (reader.read(seen) == CHANGE_READ) sink += seen.accountNumber;
+            });
+
+            if (thread::hardware_concurrency() > 1) {
+                const size_t trips = 1000;
+                atomic<uint64_t> acked(0);
+                atomic<bool> stop(false);
+                thread consumer([&]() {
+                    ChangeFeedReader tail;
+                    ChangeEvent e;
+                    tail.open("bench.cdc");
+                    while (!stop.load(memory_order_relaxed)) {
+                        if (tail.read(e) == CHANGE_READ) acked.store(e.sequence, memory_order_release);
+                    }
+                });
+                runBenchmark(out, cfg, "cdc_round_trip", scale, trips, [&]() {
+                    for (size_t i = 0; i < trips; ++i) {
+                        feed.publish(event);
+                        while (acked.load(memory_order_acquire) < event.sequence) {}
+                    }
+                });
+                stop = true;
+                consumer.join();
+            } else {
+                cerr << "cdc_round_trip skipped: needs a second core for the reader\n";
+            }
+        }
+        reader.close();
+        feed.close();
+        remove("bench.cdc");
+    }
+
+    // Velocity check as run on every withdrawal and transfer, including the clock read.
+    // Limits are tight enough that rings fill and expire during the run.
+    VelocityGuard guard;
+    VelocityLimits limits;
+    limits.windowSeconds = 1;
+    limits.maxAmount = 5000.0;
+    limits.maxCount = 16;
+    guard.configure(limits);
+    vector<int> velocityKeys(10000);
+    for (auto& k : velocityKeys) k = randomAccount();
+    runBenchmark(out, cfg, "velocity_check", scale, velocityKeys.size(), [&]() {
+        for (int k : velocityKeys) sink += guard.allow(k, 25.0, velocityClockNs());
+    });
+
+    // Idempotency key lookup with one remembered key per account, as a retry finds it
+    IdempotencyCache idempotency;
+    idempotency.configure(scale, 3600);
+    int64_t keyNow = time(nullptr);
+    for (size_t i = 0; i < scale; ++i) {
+        idempotency.insert({"req-" + to_string(i), i, OP_OK, 0, keyNow + 3600}, keyNow);
+    }
+    vector<string> retryKeys(10000);
+    for (auto& k : retryKeys) k = "req-" + to_string(rng() % scale);
+    runBenchmark(out, cfg, "idempotency_lookup", scale, retryKeys.size(), [&]() {
+        for (const string& k : retryKeys) sink += idempotency.find(k, keyNow) != nullptr;
+    });
+
+    // Standing-order wheel with one daily order per account, due times spread over
+    // the day: arming every order, then one day of ticks firing and re-arming them all
+    TimerWheel wheel;
+    vector<int64_t> dueTimes(scale);
+    for (auto& due : dueTimes) due = rng() % 86400;
+    runBenchmark(out, cfg, "standing_order_schedule", scale, scale, [&]() {
+        wheel.reset(0);
+        for (size_t i = 0; i < scale; ++i) wheel.schedule((uint32_t)i, dueTimes[i]);
+    });
+    vector<uint32_t> fired;
+    runBenchmark(out, cfg, "standing_order_fire", scale, scale, [&]() {
+        fired.clear();
+        int64_t dayEnd = wheel.nextTick() + 86400 - 1;
+        wheel.advance(dayEnd, fired);
+        for (uint32_t id : fired) wheel.schedule(id, dayEnd + 1 + dueTimes[id]);
+        sink += fired.size();
+    });
+
+    // Report snapshot with no writes since the previous one: page pointers and the
+    // status bitmaps are shared or copied, no account records are
+    bank.snapshotAccounts();
+    runBenchmark(out, cfg, "snapshot_clean", scale, 1, [&]() {
+        sink += bank.snapshotAccounts().liveCount;
+    });
+
+    // Mutations persist the whole book on every call, exactly as the menu does
+    runBenchmark(out, cfg, "deposit", scale, 1, [&]() {
+        bank.deposit(randomAccount(), 10.0);
+    });
+    runBenchmark(out, cfg, "withdraw", scale, 1, [&]() {
+        bank.withdraw(randomAccount(), 1.0);
+    });
+    runBenchmark(out, cfg, "transfer", scale, 1, [&]() {
+        int src = randomAccount(), dest = randomAccount();
+        if (src == dest) dest = accounts[(bank.findAccountIndexByNumber(src) + 1) % scale].accountNumber;
+        bank.transfer(src, dest, 1.0);
+    });
+    runBenchmark(out, cfg, "interest", scale, 1, [&]() {
+        bank.addInterest(randomAccount());
+    });
+
+    // A compliance list covering a tenth of the book, applied in one save; alternate
+    // reps freeze and unfreeze so every rep changes every account
+    vector<int> freezeList(max<size_t>(1, scale / 10));
+    for (size_t i = 0; i < freezeList.size(); ++i) freezeList[i] = accounts[i * 10 % scale].accountNumber;
+    bool freezeNext = true;
+    runBenchmark(out, cfg, "bulk_freeze", scale, 1, [&]() {
+        bank.setFrozenBulk(freezeList, freezeNext);
+        freezeNext = !freezeNext;
+    });
+    if (!freezeNext) bank.setFrozenBulk(freezeList, false);
+
+    // Monthly auto-debit over the whole loan book, each loan linked to its customer's account.
+    // A month is collected only once, so every rep runs a month later on the interest clock.
+    size_t loanCount = bank.getLoanBook().size();
+    bank.setInterestClock(benchMonthClock);
+    runBenchmark(out, cfg, "loan_auto_debit", scale, loanCount, [&]() {
+        ++benchMonths;
+        bank.autoDebitLoans("autodebit_failures.csv");
+    });
+    bank.setInterestClock(wallClock);
+    benchMonths = 0;
+    remove("autodebit_failures.csv");
+
+    runBenchmark(out, cfg, "save_accounts", scale, 1, [&]() { bank.saveAccounts(); });
+    runBenchmark(out, cfg, "load_accounts", scale, 1, [&]() { bank.loadAccounts(); });
+    runBenchmark(out, cfg, "save_loanbook", scale, 1, [&]() { bank.saveLoanBook(); });
+    runBenchmark(out, cfg, "load_loanbook", scale, 1, [&]() { bank.loadLoanBook(); });
+    runBenchmark(out, cfg, "save_transactions", scale, 1, [&]() { bank.saveTransactions(); });
+    runBenchmark(out, cfg, "load_transactions", scale, 1, [&]() { bank.loadTransactions(); });
+
+    // Bulk import of a partner-bank file the size of the book, with 1% duplicate rows,
+    // into a fresh engine each rep so every rep creates the same accounts
+    {
+        ofstream csv("import.csv");
+        csv << "accountNumber,customerName,balance,interestRate\n";
+        for (size_t i = 0; i < scale; ++i) {
+            size_t n = (i % 100 == 99) ? i - 1 : i;
+            csv << 900000000 + n << ",Partner Customer " << n << "," << (n % 5000) << ".25,1.5\n";
+        }
+    }
+    mkdir("import", 0755);
+    runBenchmark(out, cfg, "bulk_import", scale, scale, [&]() {
+        BankEngine fresh(FileFormat::Extended, "import");
+        fresh.importAccounts("import.csv", "import/rejects.csv");
+    });
+    remove("import/accounts.txt");
+    remove("import/rejects.csv");
+    rmdir("import");
+    remove("import.csv");
+
+    // Closure tombstones accounts for good, so it runs last and closes each account once;
+    // background compactions kick in every 1024 closures along the way
+    size_t closeOps = max<size_t>(1, scale / (4 * (cfg.reps + cfg.warmup)));
+    vector<int> closeOrder;
+    for (const auto& acc : accounts) closeOrder.push_back(acc.accountNumber);
+    shuffle(closeOrder.begin(), closeOrder.end(), rng);
+    size_t nextClose = 0;
+    runBenchmark(out, cfg, "close_account", scale, closeOps, [&]() {
+        for (size_t i = 0; i < closeOps && nextClose < closeOrder.size(); ++i) {
+            bank.closeAccount(closeOrder[nextClose++]);
+        }
+    });
+    bank.waitForCompaction();
+    remove("closed_accounts.txt");
+}
+
+// Entry point for --bench; returns the process exit code
+int runBenchmarks(int argc, char* argv[]) {
+    BenchConfig cfg;
+    string outPath;
+    for (int i = 2; i < argc; ++i) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            cerr << "Missing value for " << arg << "\n";
+            return 1;
+        }
+        string value = argv[++i];
+        if (arg == "--scales") {
+            cfg.scales.clear();
+            istringstream iss(value);
+            string item;
+            while (getline(iss, item, ',')) cfg.scales.push_back(parseScale(item));
+        } else if (arg == "--reps") {
+            cfg.reps = max(1, stoi(value));
+        } else if (arg == "--warmup") {
+            cfg.warmup = max(0, stoi(value));
+        } else if (arg == "--seed") {
+            cfg.seed = (unsigned)stoul(value);
+        } else if (arg == "--filter") {
+            cfg.filter = value;
+        } else if (arg == "--out") {
+            outPath = value;
+        } else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    ofstream outFile;
+    if (!outPath.empty()) {
+        outFile.open(outPath);
+        if (!outFile) {
+            cerr << "Error: Unable to open " << outPath << " for writing.\n";
+            return 1;
+        }
+    }
+    ostream& out = outPath.empty() ? cout : outFile;
+    out << fixed << setprecision(1);
+
+    char workDir[] = "/tmp/bankbench.XXXXXX";
+    if (!mkdtemp(workDir) || chdir(workDir) != 0) {
+        cerr << "Error: Unable to create a scratch directory for benchmark data.\n";
+        return 1;
+    }
+
+    out << "benchmark,scale,reps,ops_per_rep,min_ns,median_ns,mean_ns,max_ns,ops_per_sec\n";
+    for (size_t scale : cfg.scales) {
+        if (scale == 0) continue;
+        runBenchmarksAtScale(out, cfg, scale);
+    }
+
+    remove("accounts.txt");
+    remove("loanbook.txt");
+    remove("transactions.txt");
+    rmdir(workDir);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Workload generation and load testing
+//   ./bankbench --generate [--dir DIR] [--accounts N] [--loans N]
+//                           [--transactions N] [--seed N]
+//   ./bankbench --loadtest [--dir DIR] [--ops N] [--mix deposit=40,...]
+//                           [--zipf THETA] [--report-every SECONDS] [--seed N]
+//                           [--stats-interval SECONDS] [--profile TRACE_FILE]
+//                           [--cdc-ring PATH] [--account-store PATH]
+// Both modes work inside DIR (default "loadtest-data") so generated data
+// never overwrites the live files in the current directory.
+// ---------------------------------------------------------------------------
+
+const string loadTestDir = "loadtest-data";
+
+// Create a working directory if needed and switch into it
+bool enterWorkDir(const string& dir) {
+    mkdir(dir.c_str(), 0755);
+    if (chdir(dir.c_str()) != 0) {
+        cerr << "Error: Unable to enter directory " << dir << ".\n";
+        return false;
+    }
+    return true;
+}
+
+// Entry point for --generate; writes accounts.txt, loanbook.txt and transactions.txt
+int runGenerator(int argc, char* argv[]) {
+    string dir = loadTestDir;
+    size_t accountCount = 100000, loanCount = 10000, transactionCount = 1000000;
+    unsigned seed = 42;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string arg = argv[i], value = argv[i + 1];
+        if (arg == "--dir") dir = value;
+        else if (arg == "--accounts") accountCount = parseScale(value);
+        else if (arg == "--loans") loanCount = parseScale(value);
+        else if (arg == "--transactions") transactionCount = parseScale(value);
+        else if (arg == "--seed") seed = (unsigned)stoul(value);
+        else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    if (!enterWorkDir(dir)) return 1;
+
+    auto start = chrono::steady_clock::now();
+    generateSyntheticData(accountCount, loanCount, transactionCount, seed);
+    bank.saveAll();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "Generated " << bank.getAccounts().size() << " accounts, " << bank.getLoanBook().size()
+         << " loans and " << bank.getTransactions().size() << " transactions in " << dir << " (" << seconds << " s)\n";
+    return 0;
+}
+
+// Zipfian rank sampler (Gray et al., "Quickly Generating Billion-Record Synthetic
+// Databases"): O(n) setup, O(1) per sample. Rank 0 is the hottest item.
+struct ZipfSampler {
+    size_t n;
+    double theta, alpha, zetan, eta;
+
+    ZipfSampler(size_t items, double skew) : n(items), theta(skew) {
+        zetan = 0;
+        for (size_t i = 1; i <= n; ++i) zetan += 1.0 / pow((double)i, theta);
+        double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+
+    size_t next(mt19937_64& rng) {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetan;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + pow(0.5, theta)) return min<size_t>(1, n - 1);
+        return min(n - 1, (size_t)(n * pow(eta * u - eta + 1.0, alpha)));
+    }
+};
+
+// Latency summary of one reporting window, in microseconds
+void printLatencyWindow(double elapsed, size_t ops, size_t rejected, double windowSeconds,
+                        vector<double>& latencies) {
+    if (latencies.empty()) return;
+    sort(latencies.begin(), latencies.end());
+    auto pct = [&](double p) { return latencies[min(latencies.size() - 1, (size_t)(p * latencies.size()))]; };
+    cout << elapsed << "," << ops << "," << rejected << "," << latencies.size() / windowSeconds << ","
+         << pct(0.50) << "," << pct(0.99) << "," << pct(0.999) << "," << latencies.back() << "\n";
+    cout.flush();
+}
+
+// Entry point for --loadtest: replays a weighted mix of operations against the data in
+// DIR as a single closed-loop client, so each operation starts when the previous ends
+int runLoadTest(int argc, char* argv[]) {
+    string dir = loadTestDir;
+    size_t totalOps = 10000;
+    double zipfTheta = 0.99, reportEvery = 1.0;
+    unsigned seed = 42;
+    int statsInterval = 10;
+    string profileFile;
+    string mix = "deposit=40,withdraw=30,transfer=20,freeze=5,repay=5";
+    string cdcRing;             // Publish every change here, for --tail-cdc to measure lag
+    string accountStore;        // Save accounts to this B+tree in DIR instead of accounts.txt
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string arg = argv[i], value = argv[i + 1];
+        if (arg == "--dir") dir = value;
+        else if (arg == "--ops") totalOps = parseScale(value);
+        else if (arg == "--mix") mix = value;
+        else if (arg == "--zipf") zipfTheta = stod(value);
+        else if (arg == "--report-every") reportEvery = stod(value);
+        else if (arg == "--stats-interval") statsInterval = stoi(value);
+        else if (arg == "--profile") profileFile = value;
+        else if (arg == "--seed") seed = (unsigned)stoul(value);
+        else if (arg == "--cdc-ring") cdcRing = value;
+        else if (arg == "--account-store") accountStore = value;
+        else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    if (zipfTheta <= 0 || zipfTheta >= 1) {
+        cerr << "Zipf skew must be between 0 and 1 (exclusive).\n";
+        return 1;
+    }
+
+    const vector<string> opNames = {"deposit", "withdraw", "transfer", "freeze", "repay"};
+    vector<double> weights(opNames.size(), 0);
+    istringstream mixStream(mix);
+    string item;
+    while (getline(mixStream, item, ',')) {
+        size_t eq = item.find('=');
+        auto it = find(opNames.begin(), opNames.end(), item.substr(0, eq));
+        if (eq == string::npos || it == opNames.end()) {
+            cerr << "Invalid mix entry: " << item << "\n";
+            return 1;
+        }
+        weights[it - opNames.begin()] = stod(item.substr(eq + 1));
+    }
+
+    // The ring path is taken relative to where the tool was started, not DIR
+    if (!cdcRing.empty() && !bank.enableChangeFeed(cdcRing)) {
+        cerr << "Error: Unable to open change feed " << cdcRing << ".\n";
+        return 1;
+    }
+    if (!enterWorkDir(dir)) return 1;
+    startStatsDumper(statsInterval);
+    if (!profileFile.empty()) startProfiling(profileFile);
+    if (!accountStore.empty() && !bank.enableAccountStore(accountStore)) {
+        cerr << "Error: Unable to open account store " << accountStore << ".\n";
+        stopStatsDumper();
+        stopProfiling();
+        return 1;
+    }
+    bank.loadAll();
+    const vector<Account>& accounts = bank.getAccounts();
+    const vector<Loan>& loanBook = bank.getLoanBook();
+    if (accounts.size() < 2) {
+        cerr << "Load test needs at least two accounts in " << dir << "; run --generate first.\n";
+        stopStatsDumper();
+        stopProfiling();
+        return 1;
+    }
+
+    mt19937_64 rng(seed);
+    discrete_distribution<int> opDist(weights.begin(), weights.end());
+    uniform_real_distribution<double> amountDist(1.0, 500.0);
+
+    // Map Zipf ranks onto a shuffled order so the hot accounts are scattered through the book
+    vector<int> hotOrder(accounts.size());
+    for (size_t i = 0; i < accounts.size(); ++i) hotOrder[i] = accounts[i].accountNumber;
+    shuffle(hotOrder.begin(), hotOrder.end(), rng);
+    ZipfSampler zipf(accounts.size(), zipfTheta);
+    auto pickAccount = [&]() { return hotOrder[zipf.next(rng)]; };
+
+    vector<size_t> okCount(opNames.size(), 0), rejectCount(opNames.size(), 0);
+    vector<double> window;
+    size_t windowRejected = 0;
+
+    cout << fixed << setprecision(1)
+         << "elapsed_s,ops,rejected,ops_per_sec,p50_us,p99_us,p999_us,max_us\n";
+    auto start = chrono::steady_clock::now();
+    auto windowStart = start;
+    for (size_t n = 0; n < totalOps; ++n) {
+        int op = opDist(rng);
+        auto opStart = chrono::steady_clock::now();
+        OpStatus status = OP_OK;
+        switch (op) {
+            case 0:
+                status = bank.deposit(pickAccount(), amountDist(rng));
+                break;
+            case 1:
+                status = bank.withdraw(pickAccount(), amountDist(rng));
+                break;
+            case 2:
+                status = bank.transfer(pickAccount(), pickAccount(), amountDist(rng));
+                break;
+            case 3: {
+                // Toggle so the book does not drift towards every account being frozen
+                int accNum = pickAccount();
+                status = bank.setFrozen(accNum, !bank.isFrozen(accNum));
+                break;
+            }
+            case 4:
+                if (loanBook.empty()) {
+                    status = OP_NOT_FOUND;
+                } else {
+                    const Loan& loan = loanBook[rng() % loanBook.size()];
+                    status = bank.repayLoan(loan.loanID, min(loan.remainingBalance, amountDist(rng)));
+                }
+                break;
+        }
+        auto opEnd = chrono::steady_clock::now();
+        window.push_back(chrono::duration<double, micro>(opEnd - opStart).count());
+        if (status == OP_OK) {
+            ++okCount[op];
+        } else {
+            ++rejectCount[op];
+            ++windowRejected;
+        }
+
+        double windowSeconds = chrono::duration<double>(opEnd - windowStart).count();
+        if (windowSeconds >= reportEvery || n + 1 == totalOps) {
+            printLatencyWindow(chrono::duration<double>(opEnd - start).count(), n + 1,
+                               windowRejected, windowSeconds, window);
+            window.clear();
+            windowRejected = 0;
+            windowStart = opEnd;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    stopStatsDumper();
+    stopProfiling();
+
+    cerr << "Completed " << totalOps << " operations in " << seconds << " s ("
+         << totalOps / seconds << " ops/s)\n";
+    for (size_t i = 0; i < opNames.size(); ++i) {
+        cerr << "  " << opNames[i] << ": " << okCount[i] << " ok, " << rejectCount[i] << " rejected\n";
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Change feed tailing
+//   ./bankbench --tail-cdc PATH [--from SEQ] [--follow 0|1]
+// Prints the events in a ring published by banksystem --cdc-ring (or --loadtest
+// --cdc-ring) as CSV, with each event's lag from publish to read. Starts at
+// sequence SEQ, or with the next new event by default; with --follow 0 it stops
+// once caught up and prints the sequence to pass as --from to resume.
+// ---------------------------------------------------------------------------
+
+// Entry point for --tail-cdc
+int runTailChangeFeed(int argc, char* argv[]) {
+    if (argc < 3) {
+        cerr << "Usage: bankbench --tail-cdc PATH [--from SEQ] [--follow 0|1]\n";
+        return 1;
+    }
+    string path = argv[2];
+    uint64_t from = 0;
+    bool follow = true;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        string arg = argv[i], value = argv[i + 1];
+        if (arg == "--from") from = stoull(value);
+        else if (arg == "--follow") follow = stoi(value) != 0;
+        else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    ChangeFeedReader reader;
+    if (!reader.open(path)) {
+        cerr << "Error: Unable to open change feed " << path << ".\n";
+        return 1;
+    }
+    if (from > 0) reader.seek(from);
+
+    cout << fixed << setprecision(2)
+         << "sequence,type,account,transaction_id,kind,amount,balance_after,lag_us\n";
+    ChangeEvent event;
+    size_t idleSpins = 0;
+    while (true) {
+        ChangeRead result = reader.read(event);
+        if (result == CHANGE_READ) {
+            int64_t now = chrono::duration_cast<chrono::nanoseconds>(
+                chrono::system_clock::now().time_since_epoch()).count();
+            cout << event.sequence << "," << changeTypeName(event.type) << "," << event.accountNumber << ","
+                 << event.transactionID << "," << event.kind << "," << event.amount << ","
+                 << event.balanceAfter << "," << (now - event.publishedNs) / 1000.0 << "\n";
+            idleSpins = 0;
+        } else if (result == CHANGE_LOST) {
+            cerr << "Warning: Fell a whole ring behind; resuming at sequence " << reader.position() << ".\n";
+        } else if (!follow) {
+            break;
+        } else {
+            // Spin briefly to keep the lag low, then back off so an idle feed costs no CPU
+            cout.flush();
+            if (++idleSpins < 1000) this_thread::yield();
+            else this_thread::sleep_for(chrono::microseconds(200));
+        }
+    }
+    cerr << "Caught up; resume with --from " << reader.position() << "\n";
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Failover drill
+//   ./bankbench --failover-drill [--dir DIR] [--accounts N] [--transfers N]
+//                                [--kill-after-ms MS] [--seed N]
+// Starts a standby process and a primary process replicating to it (data in
+// DIR/standby and DIR/primary), has the primary run random transfers and
+// report each one that returns OP_OK, then kills the primary with SIGKILL in the
+// middle of the stream. The standby notices, promotes itself and saves. The
+// drill passes if every reported transfer is in the standby's log, in order and
+// between the same accounts, with at most one more that was in flight, and every
+// account's balance on the standby is its opening balance replayed through
+// exactly those transfers. It exits non-zero otherwise, so it doubles as the
+// replication regression test.
+// ---------------------------------------------------------------------------
+
+// A transfer the primary reported as committed
+struct DrillTransfer {
+    int src;
+    int dest;
+    double amount;
+};
+
+static const double drillOpeningBalance = 5000.0;
+
+// Read from fd until end of file
+static string readToEnd(int fd) {
+    string data;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) data.append(buffer, n);
+    return data;
+}
+
+// Standby process: apply shipments until the primary is lost, then promote and
+// report the promotion time, the total balance, every transfer ("T src dest amount",
+// in log order) and every balance ("B account balance")
+static void runDrillStandby(const string& socketPath, int readyFd, int resultFd) {
+    BankEngine replica(FileFormat::Extended, "standby");
+    StandbyReceiver receiver;
+    char ready = receiver.start(socketPath, [&](const string& batch) { return replica.applyReplicationBatch(batch); });
+    if (write(readyFd, &ready, 1) != 1 || !ready) _exit(1);
+    receiver.waitForPrimaryLoss();
+
+    auto start = chrono::steady_clock::now();
+    receiver.stop();
+    replica.saveAll();
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    ostringstream out;
+    out << setprecision(17);
+    double total = 0;
+    size_t live = 0;
+    for (size_t i = 0; i < replica.getAccounts().size(); ++i) {
+        if (replica.isClosedAt(i)) continue;
+        total += replica.getAccounts()[i].balance;
+        ++live;
+    }
+    out << ms << " " << total << " " << live << "\n";
+    // A transfer is logged as its transfer_out followed by its transfer_in
+    const vector<Transaction>& log = replica.getTransactions();
+    for (size_t i = 0; i + 1 < log.size(); ++i) {
+        if (log[i].type != "transfer_out" || log[i + 1].type != "transfer_in") continue;
+        out << "T " << log[i].accountNumber << " " << log[i + 1].accountNumber << " " << log[i].amount << "\n";
+    }
+    for (size_t i = 0; i < replica.getAccounts().size(); ++i) {
+        if (replica.isClosedAt(i)) continue;
+        out << "B " << replica.getAccounts()[i].accountNumber << " " << replica.getAccounts()[i].balance << "\n";
+    }
+    string report = out.str();
+    bool sent = write(resultFd, report.data(), report.size()) == (ssize_t)report.size();
+    _exit(sent ? 0 : 1);
+}
+
+// Primary process: a fresh book, replicated, then transfers until killed
+static void runDrillPrimary(const string& socketPath, size_t accountCount, size_t transferCount,
+                            unsigned seed, int committedFd) {
+    BankEngine primary(FileFormat::Extended, "primary");
+    vector<Account> accounts(accountCount);
+    for (size_t i = 0; i < accountCount; ++i) {
+        accounts[i] = {100000 + (int)i, "Drill Customer " + to_string(i), drillOpeningBalance, 1.5};
+    }
+    primary.replaceAll(move(accounts), {}, {});
+    primary.saveAll();
+    if (!primary.enableReplication(socketPath)) _exit(1);
+
+    mt19937_64 rng(seed);
+    uniform_int_distribution<int> accountDist(0, (int)accountCount - 1);
+    uniform_int_distribution<int> centsDist(1, 50000);
+    for (size_t n = 0; n < transferCount; ++n) {
+        DrillTransfer t;
+        t.src = 100000 + accountDist(rng);
+        t.dest = 100000 + accountDist(rng);
+        t.amount = centsDist(rng) / 100.0;
+        if (t.src == t.dest || primary.transfer(t.src, t.dest, t.amount) != OP_OK) continue;
+        // Reported only once transfer() has returned, as a client would see it
+        if (write(committedFd, &t, sizeof(t)) != (ssize_t)sizeof(t)) _exit(1);
+    }
+    _exit(0);
+}
+
+// Entry point for --failover-drill; returns 0 if the drill passes
+int runFailoverDrill(int argc, char* argv[]) {
+    string dir = "failover-drill";
+    size_t accountCount = 1000, transferCount = 1000000;
+    int killAfterMs = 500;
+    unsigned seed = 42;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string arg = argv[i], value = argv[i + 1];
+        if (arg == "--dir") dir = value;
+        else if (arg == "--accounts") accountCount = parseScale(value);
+        else if (arg == "--transfers") transferCount = parseScale(value);
+        else if (arg == "--kill-after-ms") killAfterMs = stoi(value);
+        else if (arg == "--seed") seed = (unsigned)stoul(value);
+        else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    if (accountCount < 2) {
+        cerr << "The drill needs at least two accounts.\n";
+        return 1;
+    }
+    if (!enterWorkDir(dir)) return 1;
+    mkdir("primary", 0755);
+    mkdir("standby", 0755);
+    remove("primary/closed_accounts.txt");
+    const string socketPath = "standby.sock";
+
+    int readyPipe[2], resultPipe[2], committedPipe[2];
+    if (pipe(readyPipe) != 0 || pipe(resultPipe) != 0 || pipe(committedPipe) != 0) {
+        cerr << "Error: Unable to create pipes.\n";
+        return 1;
+    }
+    cout.flush();
+    pid_t standbyPid = fork();
+    if (standbyPid == 0) {
+        close(readyPipe[0]);
+        close(resultPipe[0]);
+        close(committedPipe[0]);
+        close(committedPipe[1]);
+        runDrillStandby(socketPath, readyPipe[1], resultPipe[1]);
+    }
+    close(readyPipe[1]);
+    close(resultPipe[1]);
+    char ready = 0;
+    if (read(readyPipe[0], &ready, 1) != 1 || !ready) {
+        cerr << "Error: The standby could not listen on " << dir << "/" << socketPath << ".\n";
+        waitpid(standbyPid, nullptr, 0);
+        return 1;
+    }
+
+    pid_t primaryPid = fork();
+    if (primaryPid == 0) {
+        close(committedPipe[0]);
+        close(resultPipe[0]);
+        runDrillPrimary(socketPath, accountCount, transferCount, seed, committedPipe[1]);
+    }
+    close(committedPipe[1]);
+
+    // Collect committed transfers until the kill, then whatever was reported before it died
+    vector<DrillTransfer> committed;
+    string pending;
+    auto start = chrono::steady_clock::now();
+    auto collect = [&](int timeoutMs) {
+        pollfd p = {committedPipe[0], POLLIN, 0};
+        if (poll(&p, 1, timeoutMs) <= 0) return true;
+        char buffer[4096];
+        ssize_t n = read(committedPipe[0], buffer, sizeof(buffer));
+        if (n <= 0) return false;
+        pending.append(buffer, n);
+        size_t whole = pending.size() / sizeof(DrillTransfer) * sizeof(DrillTransfer);
+        for (size_t off = 0; off < whole; off += sizeof(DrillTransfer)) {
+            DrillTransfer t;
+            memcpy(&t, pending.data() + off, sizeof(t));
+            committed.push_back(t);
+        }
+        pending.erase(0, whole);
+        return true;
+    };
+    bool primaryRunning = true;
+    while (primaryRunning) {
+        int left = killAfterMs - (int)chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        if (left <= 0) break;
+        primaryRunning = collect(left);
+    }
+    bool killed = primaryRunning && kill(primaryPid, SIGKILL) == 0;
+    while (collect(-1)) {}
+    int status = 0;
+    waitpid(primaryPid, &status, 0);
+    size_t committedAtKill = committed.size();
+
+    string report = readToEnd(resultPipe[0]);
+    waitpid(standbyPid, &status, 0);
+    istringstream in(report);
+    double promotionMs = 0, total = 0;
+    size_t live = 0;
+    if (!(in >> promotionMs >> total >> live)) {
+        cerr << "Error: The standby did not report after promotion.\n";
+        return 1;
+    }
+    vector<DrillTransfer> shipped;
+    map<int, double> standbyBalances;
+    string tag;
+    while (in >> tag) {
+        if (tag == "T") {
+            DrillTransfer t = {};
+            if (in >> t.src >> t.dest >> t.amount) shipped.push_back(t);
+        } else if (tag == "B") {
+            int accountNumber;
+            double balance;
+            if (in >> accountNumber >> balance) standbyBalances[accountNumber] = balance;
+        }
+    }
+
+    size_t lost = 0, mismatched = 0;
+    for (size_t i = 0; i < committed.size(); ++i) {
+        if (i >= shipped.size()) ++lost;
+        else if (shipped[i].src != committed[i].src || shipped[i].dest != committed[i].dest ||
+                 fabs(shipped[i].amount - committed[i].amount) > 1e-9) ++mismatched;
+    }
+    // Replay what the standby holds from the opening balances; anything more than a cent
+    // off (interest accrues for the length of the drill) means the ledger diverged
+    map<int, double> replayed;
+    for (size_t i = 0; i < accountCount; ++i) replayed[100000 + (int)i] = drillOpeningBalance;
+    for (const DrillTransfer& t : shipped) {
+        replayed[t.src] -= t.amount;
+        replayed[t.dest] += t.amount;
+    }
+    size_t wrongBalances = 0;
+    for (const auto& entry : replayed) {
+        auto found = standbyBalances.find(entry.first);
+        if (found == standbyBalances.end() || fabs(found->second - entry.second) > 0.01) ++wrongBalances;
+    }
+    double expectedTotal = accountCount * drillOpeningBalance;
+    bool conserved = fabs(total - expectedTotal) < 1e-6 * expectedTotal && live == accountCount;
+    bool passed = killed && lost == 0 && mismatched == 0 && wrongBalances == 0 && conserved &&
+                  shipped.size() <= committed.size() + 1;
+
+    cout << "Failover drill: " << accountCount << " accounts, primary "
+         << (killed ? "killed with SIGKILL after " + to_string(killAfterMs) + " ms" : "finished before the kill") << "\n"
+         << "  transfers committed on the primary: " << committedAtKill << "\n"
+         << "  transfers on the promoted standby:   " << shipped.size() << "\n"
+         << "  committed transfers lost:           " << lost << "\n"
+         << "  out of order or altered:            " << mismatched << "\n"
+         << "  balances off the replayed ledger:   " << wrongBalances << "\n"
+         << fixed << setprecision(2)
+         << "  total balance: " << total << " (expected " << expectedTotal << ")\n"
+         << "  promotion took " << promotionMs << " ms\n"
+         << (passed ? "PASS" : "FAIL") << "\n";
+    if (!killed) cerr << "Raise --transfers or lower --kill-after-ms so the kill lands mid-stream.\n";
+    return passed ? 0 : 1;
+}
+
+// ---------------------------------------------------------------------------
+// Shard scaling benchmark
+//   ./bankbench --shard-bench [--dir DIR] [--shards 1,2,4] [--accounts N]
+//                             [--ops N] [--cross PCT] [--seed N]
+// For each shard count S, splits N accounts over S shard server processes (data
+// in DIR/S-shards/shardK) and runs N ops transfers from S client processes at
+// once, PCT percent of them between shards. Prints one CSV row per shard count;
+// conserved is 1 when the total balance over every shard is unchanged.
+// ---------------------------------------------------------------------------
+
+static const double shardOpeningBalance = 1000.0;
+
+// What one client process did
+struct ShardClientResult {
+    size_t local;
+    size_t cross;
+    size_t rejected;
+    size_t undelivered;
+};
+
+// Shard server process: a fresh book holding this shard's accounts, served until killed
+static void runShardServer(size_t shard, size_t shardCount, size_t accountCount, const string& socketPath,
+                           int readyFd) {
+    string dir = "shard" + to_string(shard);
+    mkdir(dir.c_str(), 0755);
+    remove((dir + "/closed_accounts.txt").c_str());
+    remove((dir + "/idempotency.journal").c_str());
+    remove((dir + "/prepare.log").c_str());
+    BankEngine engine(FileFormat::Extended, dir);
+    vector<Account> accounts;
+    for (size_t i = 0; i < accountCount; ++i) {
+        int accNum = 100000 + (int)i;
+        if (shardOf(accNum, shardCount) != shard) continue;
+        accounts.push_back({accNum, "Shard Customer " + to_string(i), shardOpeningBalance, 1.5});
+    }
+    engine.replaceAll(move(accounts), {}, {});
+    engine.saveAll();
+    ShardServer server(engine, dir + "/prepare.log");
+    // Listening starts inside serve(), so connect with retries on the client side
+    char ready = 1;
+    if (write(readyFd, &ready, 1) != 1) _exit(1);
+    server.serve(socketPath);
+    _exit(1);
+}
+
+// Client process: wait for the start signal, then run its share of the transfers
+static void runShardClient(size_t client, const vector<string>& sockets, size_t accountCount, size_t ops,
+                           int crossPct, unsigned seed, int startFd, int resultFd) {
+    ShardedLedger ledger;
+    string logPath = "client" + to_string(client) + ".log";
+    remove(logPath.c_str());
+    bool connected = false;
+    for (int attempt = 0; attempt < 200 && !connected; ++attempt) {
+        connected = ledger.connect(sockets, logPath, (uint32_t)client + 1);
+        if (!connected) this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    if (!connected) _exit(1);
+    char go;
+    if (read(startFd, &go, 1) < 0) _exit(1);
+
+    mt19937_64 rng(seed + client);
+    uniform_int_distribution<int> accountDist(0, (int)accountCount - 1);
+    uniform_int_distribution<int> centsDist(1, 20000);
+    ShardClientResult result = {0, 0, 0, 0};
+    size_t shardCount = sockets.size();
+    for (size_t n = 0; n < ops; ++n) {
+        int src = 100000 + accountDist(rng), dest;
+        bool cross = shardCount > 1 && (int)(rng() % 100) < crossPct;
+        do {
+            dest = 100000 + accountDist(rng);
+        } while (dest == src || (shardOf(src, shardCount) != shardOf(dest, shardCount)) != cross);
+        if (ledger.transfer(src, dest, centsDist(rng) / 100.0) != OP_OK) ++result.rejected;
+        ++(cross ? result.cross : result.local);
+    }
+    result.undelivered = ledger.undeliveredDecisions();
+    _exit(write(resultFd, &result, sizeof(result)) == (ssize_t)sizeof(result) ? 0 : 1);
+}
+
+// Entry point for --shard-bench
+int runShardBench(int argc, char* argv[]) {
+    string dir = "shard-bench";
+    vector<size_t> shardCounts = {1, 2, 4};
+    size_t accountCount = 10000, totalOps = 2000;
+    int crossPct = 10;
+    unsigned seed = 42;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string arg = argv[i], value = argv[i + 1];
+        if (arg == "--dir") {
+            dir = value;
+        } else if (arg == "--shards") {
+            shardCounts.clear();
+            istringstream iss(value);
+            string item;
+            while (getline(iss, item, ',')) shardCounts.push_back(parseScale(item));
+        } else if (arg == "--accounts") {
+            accountCount = parseScale(value);
+        } else if (arg == "--ops") {
+            totalOps = parseScale(value);
+        } else if (arg == "--cross") {
+            crossPct = stoi(value);
+        } else if (arg == "--seed") {
+            seed = (unsigned)stoul(value);
+        } else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    for (size_t shardCount : shardCounts) {
+        if (shardCount == 0 || shardCount > 64 || accountCount < 2 * shardCount) {
+            cerr << "Shard counts must be 1 to 64, with at least two accounts per shard.\n";
+            return 1;
+        }
+    }
+    if (crossPct < 0 || crossPct > 100) {
+        cerr << "--cross must be a percentage.\n";
+        return 1;
+    }
+    if (!enterWorkDir(dir)) return 1;
+
+    cout << "shards,clients,ops,cross_pct,seconds,ops_per_sec,local,cross,rejected,undelivered,conserved\n";
+    for (size_t shardCount : shardCounts) {
+        string runDir = to_string(shardCount) + "-shards";
+        if (!enterWorkDir(runDir)) return 1;
+        vector<string> sockets;
+        vector<pid_t> servers;
+        int readyPipe[2];
+        if (pipe(readyPipe) != 0) {
+            cerr << "Error: Unable to create pipes.\n";
+            return 1;
+        }
+        cout.flush();
+        for (size_t s = 0; s < shardCount; ++s) {
+            sockets.push_back("shard" + to_string(s) + ".sock");
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(readyPipe[0]);
+                runShardServer(s, shardCount, accountCount, sockets.back(), readyPipe[1]);
+            }
+            servers.push_back(pid);
+        }
+        close(readyPipe[1]);
+        char ready;
+        size_t readyCount = 0;
+        while (readyCount < shardCount && read(readyPipe[0], &ready, 1) == 1) ++readyCount;
+        close(readyPipe[0]);
+
+        // One client per shard; all start together when the start pipe closes
+        int startPipe[2], resultPipe[2];
+        if (pipe(startPipe) != 0 || pipe(resultPipe) != 0) {
+            cerr << "Error: Unable to create pipes.\n";
+            return 1;
+        }
+        vector<pid_t> clients;
+        for (size_t c = 0; c < shardCount; ++c) {
+            size_t ops = totalOps / shardCount + (c < totalOps % shardCount ? 1 : 0);
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(startPipe[1]);
+                close(resultPipe[0]);
+                runShardClient(c, sockets, accountCount, ops, crossPct, seed, startPipe[0], resultPipe[1]);
+            }
+            clients.push_back(pid);
+        }
+        close(startPipe[0]);
+        close(resultPipe[1]);
+        // Let every client connect before the clock starts
+        this_thread::sleep_for(chrono::milliseconds(100));
+        auto start = chrono::steady_clock::now();
+        close(startPipe[1]);
+        ShardClientResult total = {0, 0, 0, 0};
+        size_t reported = 0;
+        ShardClientResult result;
+        while (read(resultPipe[0], &result, sizeof(result)) == (ssize_t)sizeof(result)) {
+            total.local += result.local;
+            total.cross += result.cross;
+            total.rejected += result.rejected;
+            total.undelivered += result.undelivered;
+            ++reported;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        close(resultPipe[0]);
+        for (pid_t pid : clients) waitpid(pid, nullptr, 0);
+
+        ShardedLedger ledger;
+        double balanceTotal = 0;
+        bool conserved = ledger.connect(sockets, "audit.log", 0) && ledger.totalBalance(balanceTotal) == OP_OK &&
+                         fabs(balanceTotal - accountCount * shardOpeningBalance) < 1e-6 * accountCount;
+        ledger.close();
+        for (pid_t pid : servers) kill(pid, SIGKILL);
+        for (pid_t pid : servers) waitpid(pid, nullptr, 0);
+        if (chdir("..") != 0) return 1;
+        if (reported != shardCount) {
+            cerr << "Error: " << shardCount - reported << " client(s) failed with " << shardCount << " shards.\n";
+            return 1;
+        }
+
+        size_t ops = total.local + total.cross;
+        cout << shardCount << "," << shardCount << "," << ops << "," << crossPct << "," << fixed << setprecision(3)
+             << seconds << "," << setprecision(1) << ops / seconds << "," << total.local << "," << total.cross
+             << "," << total.rejected << "," << total.undelivered << "," << conserved << "\n";
+        cout.unsetf(ios::fixed);
+        cout.flush();
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Account store benchmark
+//   ./bankbench --store-bench [--dir DIR] [--accounts N] [--lookups N]
+//                             [--cache 64,1k,16k] [--zipf THETA] [--seed N]
+// Builds a B+tree account store of N accounts in DIR, then reopens it with each
+// page cache size and times point lookups: uniform over every account (the
+// working set is the whole tree), Zipf-skewed (a small hot set), and numbers
+// that are not stored, which the bloom filter should answer without a read.
+// Prints CSV with the page reads per lookup, i.e. the cache misses.
+// ---------------------------------------------------------------------------
+
+// Entry point for --store-bench
+int runStoreBench(int argc, char* argv[]) {
+    string dir = "store-bench";
+    size_t accountCount = 1000000, lookups = 200000;
+    vector<size_t> cacheSizes = {64, 1024, 16384};
+    double zipfTheta = 0.99;
+    unsigned seed = 42;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string arg = argv[i], value = argv[i + 1];
+        if (arg == "--dir") {
+            dir = value;
+        } else if (arg == "--accounts") {
+            accountCount = parseScale(value);
+        } else if (arg == "--lookups") {
+            lookups = parseScale(value);
+        } else if (arg == "--cache") {
+            cacheSizes.clear();
+            istringstream iss(value);
+            string item;
+            while (getline(iss, item, ',')) cacheSizes.push_back(parseScale(item));
+        } else if (arg == "--zipf") {
+            zipfTheta = stod(value);
+        } else if (arg == "--seed") {
+            seed = (unsigned)stoul(value);
+        } else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    if (accountCount == 0 || zipfTheta <= 0 || zipfTheta >= 1) {
+        cerr << "Need at least one account and a Zipf skew between 0 and 1 (exclusive).\n";
+        return 1;
+    }
+    if (!enterWorkDir(dir)) return 1;
+
+    // Even numbers are stored, so odd ones make misses with the same key spread
+    const string path = "accounts.store";
+    remove(path.c_str());
+    remove((path + ".bloom").c_str());
+    mt19937_64 rng(seed);
+    auto start = chrono::steady_clock::now();
+    size_t pages;
+    {
+        AccountStore store;
+        if (!store.open(path, 1024)) {
+            cerr << "Error: Unable to create " << dir << "/" << path << ".\n";
+            return 1;
+        }
+        for (size_t i = 0; i < accountCount; ++i) {
+            StoredAccount account = {};
+            account.accountNumber = 100000 + 2 * (int)i;
+            account.balance = 1000.0 + (double)(rng() % 100000) / 100.0;
+            account.interestRate = 1.5;
+            syntheticName(rng).copy(account.customerName, sizeof(account.customerName) - 1);
+            store.put(account);
+        }
+        store.flush();
+        pages = store.pageCount();
+    }
+    double buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << "Built " << accountCount << " accounts in " << pages << " pages (" << pages * 4 / 1024 << " MiB) in "
+         << buildSeconds << " s\n";
+
+    vector<int> hotOrder(accountCount);
+    for (size_t i = 0; i < accountCount; ++i) hotOrder[i] = 100000 + 2 * (int)i;
+    shuffle(hotOrder.begin(), hotOrder.end(), rng);
+    ZipfSampler zipf(accountCount, zipfTheta);
+    uniform_int_distribution<size_t> uniform(0, accountCount - 1);
+
+    cout << "cache_pages,cache_pct,pattern,lookups,ns_per_lookup,page_reads_per_lookup,found\n";
+    for (size_t cachePages : cacheSizes) {
+        AccountStore store;
+        if (!store.open(path, cachePages)) {
+            cerr << "Error: Unable to open " << dir << "/" << path << ".\n";
+            return 1;
+        }
+        const char* patterns[] = {"uniform", "zipf", "absent"};
+        for (int p = 0; p < 3; ++p) {
+            // One untimed pass warms the cache to its steady state
+            for (int pass = 0; pass < 2; ++pass) {
+                mt19937_64 keyRng(seed + p);
+                uint64_t readsBefore = store.stats().cacheMisses;
+                size_t found = 0;
+                StoredAccount account;
+                auto t0 = chrono::steady_clock::now();
+                for (size_t n = 0; n < lookups; ++n) {
+                    int accNum;
+                    if (p == 0) accNum = 100000 + 2 * (int)uniform(keyRng);
+                    else if (p == 1) accNum = hotOrder[zipf.next(keyRng)];
+                    else accNum = 100001 + 2 * (int)uniform(keyRng);
+                    found += store.find(accNum, account);
+                }
+                double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count();
+                if (pass == 0) continue;
+                cout << cachePages << "," << fixed << setprecision(1) << 100.0 * cachePages / pages << ","
+                     << patterns[p] << "," << lookups << "," << ns / lookups << "," << setprecision(3)
+                     << (double)(store.stats().cacheMisses - readsBefore) / lookups << "," << found << "\n";
+                cout.unsetf(ios::fixed);
+            }
+        }
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Netting benchmark
+//   ./bankbench --netting-bench [--dir DIR] [--accounts N] [--transfers N]
+//                               [--one-way PCT] [--seed N]
+// Builds a batch of transfers that mostly cancel out (pairs A->B->A and rings
+// A->B->C->A of one amount each, shuffled together) plus PCT percent one-way
+// transfers, against accounts with small opening balances. The batch is run once
+// as individual transfers and once through clearTransfers, each over a fresh copy
+// of the same accounts in DIR. Prints CSV with a conservation check per run.
+// ---------------------------------------------------------------------------
+
+// Entry point for --netting-bench
+int runNettingBench(int argc, char* argv[]) {
+    string dir = "netting-bench";
+    size_t accountCount = 10000, transferCount = 5000;
+    int oneWayPercent = 20;
+    unsigned seed = 42;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string arg = argv[i], value = argv[i + 1];
+        if (arg == "--dir") {
+            dir = value;
+        } else if (arg == "--accounts") {
+            accountCount = parseScale(value);
+        } else if (arg == "--transfers") {
+            transferCount = parseScale(value);
+        } else if (arg == "--one-way") {
+            oneWayPercent = stoi(value);
+        } else if (arg == "--seed") {
+            seed = (unsigned)stoul(value);
+        } else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    if (accountCount < 3 || oneWayPercent < 0 || oneWayPercent > 100) {
+        cerr << "Need at least three accounts and a one-way share between 0 and 100.\n";
+        return 1;
+    }
+    if (!enterWorkDir(dir)) return 1;
+
+    mt19937_64 rng(seed);
+    const double openingBalance = 100;
+    vector<Account> accounts(accountCount);
+    for (size_t i = 0; i < accountCount; ++i) {
+        accounts[i] = {100000 + (int)i, syntheticName(rng), openingBalance, 1.5, 0};
+    }
+    uniform_int_distribution<size_t> pick(0, accountCount - 1);
+    uniform_int_distribution<int> cents(100, 50000);
+    vector<vector<BatchTransfer>> groups;   // Each ring stays in order; the groups are interleaved
+    size_t planned = 0;
+    while (planned < transferCount) {
+        double amount = cents(rng) / 100.0;
+        size_t length = (int)(rng() % 100) < oneWayPercent ? 1 : 2 + rng() % 2;
+        vector<int> ring;
+        while (ring.size() < max<size_t>(length, 2)) {
+            int accNum = accounts[pick(rng)].accountNumber;
+            if (find(ring.begin(), ring.end(), accNum) == ring.end()) ring.push_back(accNum);
+        }
+        vector<BatchTransfer> group;
+        for (size_t k = 0; k < length; ++k) group.push_back({ring[k], ring[(k + 1) % ring.size()], amount});
+        planned += group.size();
+        groups.push_back(move(group));
+    }
+    vector<BatchTransfer> batch;
+    vector<size_t> nextInGroup(groups.size(), 0), open(groups.size());
+    for (size_t g = 0; g < groups.size(); ++g) open[g] = g;
+    while (!open.empty()) {
+        size_t slot = rng() % open.size();
+        size_t g = open[slot];
+        batch.push_back(groups[g][nextInGroup[g]++]);
+        if (nextInGroup[g] == groups[g].size()) {
+            open[slot] = open.back();
+            open.pop_back();
+        }
+    }
+
+    cout << "mode,transfers,cleared,refused,seconds,transfers_per_s,conserved\n";
+    for (int netting = 0; netting < 2; ++netting) {
+        bank.replaceAll(accounts, {}, {});
+        bank.saveAll();
+        size_t cleared = 0;
+        auto start = chrono::steady_clock::now();
+        if (netting) {
+            cleared = bank.clearTransfers(batch).cleared;
+        } else {
+            for (const BatchTransfer& t : batch) {
+                cleared += bank.transfer(t.srcAccountNumber, t.destAccountNumber, t.amount) == OP_OK;
+            }
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        double total = 0;
+        for (size_t i = 0; i < bank.getAccounts().size(); ++i) {
+            if (!bank.isClosedAt(i)) total += bank.getAccounts()[i].balance;
+        }
+        bool conserved = fabs(total - accountCount * openingBalance) < 1e-6 * accountCount;
+        cout << (netting ? "netting" : "per_transfer") << "," << batch.size() << "," << cleared << ","
+             << batch.size() - cleared << "," << seconds << "," << batch.size() / seconds << ","
+             << (conserved ? "yes" : "no") << "\n";
+    }
+    return 0;
+}
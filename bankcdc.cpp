@@ -0,0 +1,209 @@
+#include "bankcdc.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>      // for open()
+#include <sys/mman.h>   // for mmap()
+#include <sys/stat.h>   // for fstat()
+#include <unistd.h>     // for ftruncate(), pread(), close()
+
+using namespace std;
+
+static const uint64_t RING_MAGIC = 0x314344434b4e4142ULL; // "BANKCDC1"
+
+// Event fields after the sequence number, as laid out in a slot
+struct SlotPayload {
+    uint32_t type;
+    int32_t accountNumber;
+    int32_t transactionID;
+    uint32_t reserved;
+    double amount;
+    double balanceAfter;
+    int64_t publishedNs;
+    char kind[16];
+};
+static const size_t PAYLOAD_WORDS = sizeof(SlotPayload) / sizeof(uint64_t);
+
+// One event per cache line. The payload is stored as relaxed atomic words so a
+// reader racing the writer reads torn data, which the version check then rejects,
+// rather than undefined behaviour.
+struct ChangeSlot {
+    atomic<uint64_t> version;               // 2s + 1 while event s is written, 2s + 2 once it is complete
+    atomic<uint64_t> words[PAYLOAD_WORDS];
+};
+
+// File header; capacity slots follow it
+struct ChangeRing {
+    uint64_t magic;                         // Set last, once the ring is initialised
+    uint64_t capacity;                      // Slots, a power of two
+    alignas(64) atomic<uint64_t> nextSequence;
+};
+
+static_assert(sizeof(SlotPayload) == 56 && sizeof(ChangeSlot) == 64, "a slot must fill one cache line");
+static_assert(sizeof(ChangeRing) == 128, "the header must keep the writer's counter on its own line");
+static_assert(atomic<uint64_t>::is_always_lock_free, "atomics in shared memory must be lock-free");
+
+static ChangeSlot* slotsOf(ChangeRing* ring) {
+    return reinterpret_cast<ChangeSlot*>(reinterpret_cast<char*>(ring) + sizeof(ChangeRing));
+}
+
+static const ChangeSlot* slotsOf(const ChangeRing* ring) {
+    return reinterpret_cast<const ChangeSlot*>(reinterpret_cast<const char*>(ring) + sizeof(ChangeRing));
+}
+
+const char* changeTypeName(uint32_t type) {
+    switch (type) {
+        case CHANGE_TRANSACTION: return "transaction";
+        case CHANGE_ACCOUNT_OPENED: return "account_opened";
+        case CHANGE_ACCOUNT_CLOSED: return "account_closed";
+        case CHANGE_FROZEN: return "frozen";
+        case CHANGE_UNFROZEN: return "unfrozen";
+        case CHANGE_ALL_DELETED: return "all_deleted";
+        default: return "unknown";
+    }
+}
+
+bool ChangeFeed::open(const string& path, size_t capacity) {
+    close();
+    uint64_t slots = 2;
+    while (slots < capacity) slots <<= 1;
+    size_t bytes = sizeof(ChangeRing) + slots * sizeof(ChangeSlot);
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+    // Reuse a ring of the same size as it stands. A ring of another size is refused:
+    // resizing the file under readers that have it mapped would crash them (SIGBUS).
+    // Anything else at the path is replaced by a new ring.
+    bool reuse = false;
+    struct stat st;
+    uint64_t head[2];
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ChangeRing) &&
+        pread(fd, head, sizeof(head), 0) == (ssize_t)sizeof(head) &&
+        head[0] == RING_MAGIC) {
+        if (head[1] != slots || (size_t)st.st_size != bytes) {
+            ::close(fd);
+            return false;
+        }
+        reuse = true;
+    }
+    if (!reuse && (ftruncate(fd, 0) != 0 || ftruncate(fd, bytes) != 0)) {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) return false;
+
+    ring = static_cast<ChangeRing*>(mapped);
+    mappedBytes = bytes;
+    if (!reuse) {
+        ring->capacity = slots;
+        ring->nextSequence.store(1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        ring->magic = RING_MAGIC;
+    }
+    return true;
+}
+
+void ChangeFeed::close() {
+    if (ring) munmap(ring, mappedBytes);
+    ring = nullptr;
+}
+
+void ChangeFeed::publish(ChangeEvent& event) {
+    if (!ring) return;
+    uint64_t seq = ring->nextSequence.load(memory_order_relaxed);
+    event.sequence = seq;
+    event.publishedNs = chrono::duration_cast<chrono::nanoseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+
+    SlotPayload payload;
+    payload.type = event.type;
+    payload.accountNumber = event.accountNumber;
+    payload.transactionID = event.transactionID;
+    payload.reserved = 0;
+    payload.amount = event.amount;
+    payload.balanceAfter = event.balanceAfter;
+    payload.publishedNs = event.publishedNs;
+    memcpy(payload.kind, event.kind, sizeof(payload.kind));
+    uint64_t words[PAYLOAD_WORDS];
+    memcpy(words, &payload, sizeof(words));
+
+    ChangeSlot& slot = slotsOf(ring)[seq & (ring->capacity - 1)];
+    slot.version.store(2 * seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (size_t i = 0; i < PAYLOAD_WORDS; ++i) slot.words[i].store(words[i], memory_order_relaxed);
+    slot.version.store(2 * seq + 2, memory_order_release);
+    ring->nextSequence.store(seq + 1, memory_order_release);
+}
+
+bool ChangeFeedReader::open(const string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ChangeRing)) {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) return false;
+
+    ring = static_cast<const ChangeRing*>(mapped);
+    mappedBytes = st.st_size;
+    if (ring->magic != RING_MAGIC || sizeof(ChangeRing) + ring->capacity * sizeof(ChangeSlot) != mappedBytes) {
+        close();
+        return false;
+    }
+    next = nextSequence();
+    return true;
+}
+
+void ChangeFeedReader::close() {
+    if (ring) munmap(const_cast<ChangeRing*>(ring), mappedBytes);
+    ring = nullptr;
+}
+
+uint64_t ChangeFeedReader::nextSequence() const {
+    return ring ? ring->nextSequence.load(memory_order_acquire) : 1;
+}
+
+// The slot of the oldest full lap is the next to be overwritten, so it is not counted
+uint64_t ChangeFeedReader::oldestSequence() const {
+    uint64_t newest = nextSequence();
+    return ring && newest > ring->capacity ? newest - ring->capacity + 1 : 1;
+}
+
+ChangeRead ChangeFeedReader::read(ChangeEvent& event) {
+    if (!ring) return CHANGE_EMPTY;
+    const ChangeSlot& slot = slotsOf(ring)[next & (ring->capacity - 1)];
+    uint64_t expected = 2 * next + 2;
+    uint64_t before = slot.version.load(memory_order_acquire);
+    if (before < expected) return CHANGE_EMPTY; // An older lap, or this event still being written
+
+    if (before == expected) {
+        uint64_t words[PAYLOAD_WORDS];
+        for (size_t i = 0; i < PAYLOAD_WORDS; ++i) words[i] = slot.words[i].load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (slot.version.load(memory_order_relaxed) == before) {
+            SlotPayload payload;
+            memcpy(&payload, words, sizeof(payload));
+            event.sequence = next++;
+            event.type = payload.type;
+            event.accountNumber = payload.accountNumber;
+            event.transactionID = payload.transactionID;
+            event.amount = payload.amount;
+            event.balanceAfter = payload.balanceAfter;
+            event.publishedNs = payload.publishedNs;
+            memcpy(event.kind, payload.kind, sizeof(event.kind));
+            event.kind[sizeof(event.kind) - 1] = '\0';
+            return CHANGE_READ;
+        }
+    }
+    // Overwritten by a later lap before it could be read
+    next = oldestSequence();
+    return CHANGE_LOST;
+}
@@ -0,0 +1,96 @@
+// Change-data capture feed: the engine publishes every transaction record, account
+// opening, closure and freeze change into a ring of fixed 64-byte slots in a shared
+// memory-mapped file, and any number of processes tail it. The single producer never
+// waits for readers. Each slot carries a seqlock version, so a reader sees an event
+// the moment its version is stored and detects a slot overwritten under it.
+// Sequence numbers keep counting across producer restarts, so a reader can resume
+// from the last one it handled as long as the ring still holds it.
+#ifndef BANKCDC_H
+#define BANKCDC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum ChangeType {
+    CHANGE_TRANSACTION = 1,     // A transaction record (deposit, withdrawal, transfer, interest, ...)
+    CHANGE_ACCOUNT_OPENED,
+    CHANGE_ACCOUNT_CLOSED,
+    CHANGE_FROZEN,
+    CHANGE_UNFROZEN,
+    CHANGE_ALL_DELETED          // Every live account was deleted
+};
+
+struct ChangeRing;             // Shared layout, defined in bankcdc.cpp
+
+// Short name of a change type, e.g. "account_closed"
+const char* changeTypeName(uint32_t type);
+
+struct ChangeEvent {
+    uint64_t sequence;          // Position in the feed, from 1
+    uint32_t type;              // ChangeType
+    int32_t accountNumber;
+    int32_t transactionID;      // 0 unless a logged transaction
+    double amount;              // Transaction amount, or the balance when opened or closed
+    double balanceAfter;
+    int64_t publishedNs;        // Wall clock (Unix epoch) nanoseconds when published
+    char kind[16];              // Transaction type, e.g. "transfer_out"; empty otherwise
+};
+
+// Writer side, owned by the engine and called under its write lock
+class ChangeFeed {
+public:
+    ChangeFeed() = default;
+    ChangeFeed(const ChangeFeed&) = delete;
+    ChangeFeed& operator=(const ChangeFeed&) = delete;
+    ~ChangeFeed() { close(); }
+
+    // Map the ring at path, creating it with capacity slots (rounded up to a power of
+    // two) or reopening it and carrying on from its last sequence number. Fails on a
+    // ring of another capacity, which readers may still have mapped
+    bool open(const std::string& path, size_t capacity);
+    void close();
+    bool isOpen() const { return ring != nullptr; }
+
+    // Fill in the sequence number and time and publish the event
+    void publish(ChangeEvent& event);
+
+private:
+    ChangeRing* ring = nullptr;
+    size_t mappedBytes = 0;
+};
+
+enum ChangeRead {
+    CHANGE_READ,                // An event was returned
+    CHANGE_EMPTY,               // Nothing new yet
+    CHANGE_LOST                 // The reader fell a whole ring behind; it now points at the oldest event kept
+};
+
+// Reader side, for consumer processes
+class ChangeFeedReader {
+public:
+    ChangeFeedReader() = default;
+    ChangeFeedReader(const ChangeFeedReader&) = delete;
+    ChangeFeedReader& operator=(const ChangeFeedReader&) = delete;
+    ~ChangeFeedReader() { close(); }
+
+    // Map an existing ring read-only, positioned at the next event to be published
+    bool open(const std::string& path);
+    void close();
+
+    // Next sequence number this reader will return; seek to resume after a restart
+    uint64_t position() const { return next; }
+    void seek(uint64_t sequence) { next = sequence == 0 ? 1 : sequence; }
+    uint64_t oldestSequence() const;            // Oldest event the ring still holds
+    uint64_t nextSequence() const;              // Sequence the next published event gets
+
+    // Non-blocking read of the event at position()
+    ChangeRead read(ChangeEvent& event);
+
+private:
+    const ChangeRing* ring = nullptr;
+    size_t mappedBytes = 0;
+    uint64_t next = 1;
+};
+
+#endif
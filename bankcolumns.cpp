@@ -0,0 +1,180 @@
+#include "bankcolumns.h"
+
+#include <algorithm>
+#include <thread>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+void AccountColumns::clear() {
+    numbers.clear();
+    balances.clear();
+    rates.clear();
+}
+
+void AccountColumns::reserve(size_t rows) {
+    numbers.reserve(rows);
+    balances.reserve(rows);
+    rates.reserve(rows);
+}
+
+void AccountColumns::push(int accountNumber, double balance, double interestRate) {
+    numbers.push_back(accountNumber);
+    balances.push_back(balance);
+    rates.push_back(interestRate);
+}
+
+const double* AccountColumns::column(AccountField field) const {
+    return field == AccountField::Balance ? balances.data() : rates.data();
+}
+
+template <CompareOp Op>
+static inline bool compareScalar(double x, double v) {
+    if constexpr (Op == CompareOp::Less) return x < v;
+    else if constexpr (Op == CompareOp::LessEqual) return x <= v;
+    else if constexpr (Op == CompareOp::Greater) return x > v;
+    else if constexpr (Op == CompareOp::GreaterEqual) return x >= v;
+    else if constexpr (Op == CompareOp::Equal) return x == v;
+    else return x != v;
+}
+
+// Bit j set where col[j] passes the comparison, for up to 64 rows. The vector paths
+// compare 4 (AVX) or 2 (SSE2) doubles per instruction and movemask the sign bits
+// straight into the result; NaN compares as the scalar operators do.
+template <CompareOp Op>
+static uint64_t compareRows(const double* col, size_t count, double v) {
+    uint64_t mask = 0;
+    size_t j = 0;
+#if defined(__AVX__)
+    constexpr int predicate = Op == CompareOp::Less ? _CMP_LT_OQ
+                            : Op == CompareOp::LessEqual ? _CMP_LE_OQ
+                            : Op == CompareOp::Greater ? _CMP_GT_OQ
+                            : Op == CompareOp::GreaterEqual ? _CMP_GE_OQ
+                            : Op == CompareOp::Equal ? _CMP_EQ_OQ : _CMP_NEQ_UQ;
+    __m256d pivot = _mm256_set1_pd(v);
+    for (; j + 4 <= count; j += 4) {
+        __m256d passed = _mm256_cmp_pd(_mm256_loadu_pd(col + j), pivot, predicate);
+        mask |= (uint64_t)_mm256_movemask_pd(passed) << j;
+    }
+#elif defined(__SSE2__)
+    __m128d pivot = _mm_set1_pd(v);
+    for (; j + 2 <= count; j += 2) {
+        __m128d x = _mm_loadu_pd(col + j);
+        __m128d passed;
+        if constexpr (Op == CompareOp::Less) passed = _mm_cmplt_pd(x, pivot);
+        else if constexpr (Op == CompareOp::LessEqual) passed = _mm_cmple_pd(x, pivot);
+        else if constexpr (Op == CompareOp::Greater) passed = _mm_cmpgt_pd(x, pivot);
+        else if constexpr (Op == CompareOp::GreaterEqual) passed = _mm_cmpge_pd(x, pivot);
+        else if constexpr (Op == CompareOp::Equal) passed = _mm_cmpeq_pd(x, pivot);
+        else passed = _mm_cmpneq_pd(x, pivot);
+        mask |= (uint64_t)_mm_movemask_pd(passed) << j;
+    }
+#endif
+    for (; j < count; ++j) {
+        if (compareScalar<Op>(col[j], v)) mask |= 1ULL << j;
+    }
+    return mask;
+}
+
+static uint64_t compareRows(const double* col, size_t count, CompareOp op, double v) {
+    switch (op) {
+        case CompareOp::Less: return compareRows<CompareOp::Less>(col, count, v);
+        case CompareOp::LessEqual: return compareRows<CompareOp::LessEqual>(col, count, v);
+        case CompareOp::Greater: return compareRows<CompareOp::Greater>(col, count, v);
+        case CompareOp::GreaterEqual: return compareRows<CompareOp::GreaterEqual>(col, count, v);
+        case CompareOp::Equal: return compareRows<CompareOp::Equal>(col, count, v);
+        default: return compareRows<CompareOp::NotEqual>(col, count, v);
+    }
+}
+
+// Rows of one 64-row word that the query selects
+uint64_t AccountColumns::selectWord(const AccountQuery& query, size_t word,
+                                    const vector<uint64_t>& frozenBits, const vector<uint64_t>& closedBits) const {
+    size_t first = word * 64;
+    size_t count = min<size_t>(64, numbers.size() - first);
+    uint64_t live = (count == 64 ? ~0ULL : (1ULL << count) - 1) & ~closedBits[word];
+    if (query.frozen == 1) live &= frozenBits[word];
+    else if (query.frozen == 0) live &= ~frozenBits[word];
+    if (live == 0 || query.anyOf.empty()) return live;
+
+    uint64_t selected = 0;
+    for (const auto& group : query.anyOf) {
+        uint64_t rows = live & ~selected;
+        for (const FieldCondition& c : group) {
+            if (rows == 0) break;
+            rows &= compareRows(column(c.field) + first, count, c.op, c.value);
+        }
+        selected |= rows;
+        if (selected == live) break;
+    }
+    return selected;
+}
+
+void AccountColumns::evaluateWords(const AccountQuery& query, AccountField aggregate, size_t firstWord,
+                                   size_t endWord, const vector<uint64_t>& frozenBits,
+                                   const vector<uint64_t>& closedBits, AccountAggregate& result,
+                                   vector<int>* matches) const {
+    const double* values = column(aggregate);
+    for (size_t w = firstWord; w < endWord; ++w) {
+        uint64_t rows = selectWord(query, w, frozenBits, closedBits);
+        while (rows != 0) {
+            size_t row = w * 64 + __builtin_ctzll(rows);
+            rows &= rows - 1;
+            double x = values[row];
+            if (result.count == 0) {
+                result.min = result.max = x;
+            } else {
+                result.min = min(result.min, x);
+                result.max = max(result.max, x);
+            }
+            ++result.count;
+            result.sum += x;
+            if (matches) matches->push_back(numbers[row]);
+        }
+    }
+}
+
+AccountAggregate AccountColumns::evaluate(const AccountQuery& query, AccountField aggregate,
+                                          const vector<uint64_t>& frozenBits, const vector<uint64_t>& closedBits,
+                                          vector<int>* matches, size_t workers) const {
+    size_t words = (numbers.size() + 63) / 64;
+    if (workers == 0) {
+        // Below a few thousand words a thread costs more than the scan it takes over
+        workers = max<size_t>(1, min<size_t>(thread::hardware_concurrency(), words / 4096));
+    }
+
+    vector<AccountAggregate> partial(workers);
+    vector<vector<int>> found(workers);
+    if (workers == 1) {
+        evaluateWords(query, aggregate, 0, words, frozenBits, closedBits, partial[0], matches);
+        return partial[0];
+    }
+    vector<thread> pool;
+    size_t chunk = (words + workers - 1) / workers;
+    for (size_t t = 0; t < workers; ++t) {
+        pool.emplace_back([&, t]() {
+            size_t begin = min(t * chunk, words);
+            size_t end = min(begin + chunk, words);
+            evaluateWords(query, aggregate, begin, end, frozenBits, closedBits, partial[t],
+                          matches ? &found[t] : nullptr);
+        });
+    }
+    for (auto& th : pool) th.join();
+
+    AccountAggregate result;
+    for (size_t t = 0; t < workers; ++t) {
+        const AccountAggregate& p = partial[t];
+        if (p.count == 0) continue;
+        result.min = result.count == 0 ? p.min : min(result.min, p.min);
+        result.max = result.count == 0 ? p.max : max(result.max, p.max);
+        result.count += p.count;
+        result.sum += p.sum;
+        if (matches) matches->insert(matches->end(), found[t].begin(), found[t].end());
+    }
+    return result;
+}
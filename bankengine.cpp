@@ -0,0 +1,2325 @@
+#include "bankengine.h"
+#include "bankstats.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <ctime>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
+#include <atomic>
+#include <memory>
+#include <iterator>
+#include <cmath>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <sys/stat.h>     // for mkdir()
+#include <sys/resource.h> // for getrusage()
+
+using namespace std;
+
+// Trim function to remove leading and trailing spaces from input strings
+string trim(const string &str) {
+    size_t first = str.find_first_not_of(' ');
+    if (first == string::npos) return "";
+    size_t last = str.find_last_not_of(' ');
+    return str.substr(first, (last - first + 1));
+}
+
+string getCurrentDateTime() {
+    time_t now = time(0);
+    tm local;
+    tm *ltm = localtime_r(&now, &local); // Reentrant: the stats dumper also formats times
+    char buffer[80];
+    snprintf(buffer, sizeof(buffer), "%04d-%02d-%02d %02d:%02d:%02d",
+             1900 + ltm->tm_year, 1 + ltm->tm_mon, ltm->tm_mday,
+             ltm->tm_hour, ltm->tm_min, ltm->tm_sec);
+    return string(buffer);
+}
+
+// Unix time of a getCurrentDateTime() string, or 0 if it does not parse
+static int64_t parseDateTime(const string& dateTime) {
+    tm local = {};
+    if (sscanf(dateTime.c_str(), "%d-%d-%d %d:%d:%d", &local.tm_year, &local.tm_mon, &local.tm_mday,
+               &local.tm_hour, &local.tm_min, &local.tm_sec) != 6) return 0;
+    local.tm_year -= 1900;
+    local.tm_mon -= 1;
+    local.tm_isdst = -1;
+    return mktime(&local);
+}
+
+const char* opStatusName(OpStatus status) {
+    static const char* names[OP_STATUS_COUNT] = {
+        "ok", "not_found", "dest_not_found", "frozen", "dest_frozen", "invalid_amount",
+        "insufficient_funds", "same_account", "no_change", "overpayment", "duplicate_account",
+        "velocity_limit", "closed", "key_reused", "invalid_key", "unavailable",
+        "key_in_doubt", "name_too_long"
+    };
+    return (status >= 0 && status < OP_STATUS_COUNT) ? names[status] : "unknown";
+}
+
+static int64_t wallClockSeconds() {
+    return time(nullptr);
+}
+
+// Record layouts of the data files, which the replication stream reuses; the
+// numbers are written at the stream's precision
+static void writeAccountRecord(ostream& out, FileFormat format, const Account& acc, bool frozen) {
+    if (format == FileFormat::Extended) {
+        out << acc.accountNumber << " " << acc.customerName << "|" << " "
+            << acc.balance << " " << acc.interestRate << " " << (frozen ? 1 : 0) << " "
+            << acc.lastAccrual << "\n";
+    } else {
+        out << acc.accountNumber << " " << acc.customerName << "|"
+            << acc.balance << " " << acc.interestRate << "\n";
+    }
+}
+
+static bool parseAccountRecord(const string& line, FileFormat format, Account& acc, bool& frozen) {
+    istringstream iss(line);
+    string name;
+    int frozenInt = 0;
+    // Read account number, then ignore the space, then read name until '|'
+    if (!(iss >> acc.accountNumber)) return false;
+    iss.ignore();
+    getline(iss, name, '|');
+    acc.customerName = trim(name);
+    iss >> acc.balance >> acc.interestRate;
+    acc.lastAccrual = 0;
+    if (format == FileFormat::Extended) iss >> frozenInt >> acc.lastAccrual;
+    frozen = frozenInt == 1;
+    return true;
+}
+
+static void writeLoanRecord(ostream& out, FileFormat format, const Loan& loan) {
+    const char* separator = (format == FileFormat::Extended) ? "| " : "|";
+    out << loan.loanID << " " << loan.customerName << separator
+        << loan.loanAmount << " " << loan.interestRate << " "
+        << loan.duration << " " << loan.remainingBalance;
+    if (loan.linkedAccountNumber != 0 || loan.lastDebitedPeriod != 0) out << " " << loan.linkedAccountNumber;
+    if (loan.lastDebitedPeriod != 0) out << " " << loan.lastDebitedPeriod;
+    out << "\n";
+}
+
+static bool parseLoanRecord(const string& line, Loan& loan) {
+    istringstream iss(line);
+    string name;
+    if (!(iss >> loan.loanID)) return false;
+    iss.ignore();
+    getline(iss, name, '|');
+    loan.customerName = trim(name);
+    iss >> loan.loanAmount >> loan.interestRate >> loan.duration >> loan.remainingBalance;
+    // Optional trailing fields
+    if (!(iss >> loan.linkedAccountNumber)) loan.linkedAccountNumber = 0;
+    if (!(iss >> loan.lastDebitedPeriod)) loan.lastDebitedPeriod = 0;
+    return true;
+}
+
+static void writeTransactionRecord(ostream& out, const Transaction& t) {
+    out << t.transactionID << " " << t.accountNumber << " " << t.dateTime << "| "
+        << t.type << " " << t.amount << " " << t.balanceAfter << "\n";
+}
+
+static bool parseTransactionRecord(const string& line, Transaction& t) {
+    istringstream iss(line);
+    if (!(iss >> t.transactionID >> t.accountNumber)) return false;
+    iss.ignore();
+    getline(iss, t.dateTime, '|');
+    iss >> t.type >> t.amount >> t.balanceAfter;
+    return true;
+}
+
+// Read a transaction log, or only one account's records from it. The account number
+// is checked before the rest of a line is parsed, so a filtered read is mostly I/O.
+static vector<Transaction> readTransactionFile(const string& path, const int* onlyAccount = nullptr) {
+    vector<Transaction> records;
+    ifstream inFile(path);
+    if (!inFile) return records;
+    string line;
+    while (getline(inFile, line)) {
+        if (onlyAccount) {
+            char* end;
+            strtol(line.c_str(), &end, 10);
+            if (strtol(end, nullptr, 10) != *onlyAccount) continue;
+        }
+        Transaction t;
+        if (parseTransactionRecord(line, t)) records.push_back(t);
+    }
+    return records;
+}
+
+BankEngine::BankEngine(FileFormat format, const string& dataDir)
+    : format(format),
+      accountsFile(dataDir + "/accounts.txt"),
+      loanBookFile(dataDir + "/loanbook.txt"),
+      transactionsFile(dataDir + "/transactions.txt"),
+      statementsDir(dataDir + "/statements"),
+      closedAccountsFile(dataDir + "/closed_accounts.txt"),
+      journalFile(dataDir + "/idempotency.journal"),
+      standingOrdersFile(dataDir + "/standing_orders.txt"),
+      standingWheel(time(nullptr)),
+      interestClock(wallClockSeconds) {}
+
+BankEngine::~BankEngine() {
+    if (compactor.joinable()) compactor.join();
+    if (transactionLoader.joinable()) transactionLoader.join();
+}
+
+void BankEngine::loadAll(bool transactionsInBackground) {
+    loadAccounts();
+    loadLoanBook();
+    if (transactionsInBackground) {
+        loadTransactionsInBackground();
+    } else {
+        loadTransactions();
+    }
+    loadStandingOrders();
+    loadIdempotencyJournal();
+}
+
+void BankEngine::saveAll() {
+    saveAccounts();
+    saveLoanBook();
+    saveTransactions();
+    if (!standingOrders.empty()) saveStandingOrders();
+}
+
+// Load accounts from the accounts file into memory
+void BankEngine::loadAccounts() {
+    OpTimer timer(STAT_LOAD_ACCOUNTS);
+    ProfileSpan span("loadAccounts");
+    auto lock = lockForWrite();
+    resetAccountBook();
+    loadClosedAccounts();
+    if (accountStore.size() > 0) {
+        accountStore.forEach([this](const StoredAccount& stored) {
+            auto retired = accountIndex.find(stored.accountNumber);
+            if (retired != accountIndex.end() && retired->second == RETIRED) return;
+            Account acc = {stored.accountNumber, stored.customerName, stored.balance, stored.interestRate,
+                           stored.lastAccrual};
+            appendAccount(acc, stored.frozen != 0);
+        });
+        storeChanged.clear();
+        storeResyncPending = false;
+        return;
+    }
+    ifstream inFile(accountsFile);
+    if (!inFile) return; // File does not exist yet, so no accounts to load
+    string line;
+    while (getline(inFile, line)) {
+        Account acc;
+        bool frozen;
+        if (parseAccountRecord(line, format, acc, frozen)) {
+            // Closure does not rewrite this file, so it may still list retired numbers
+            auto retired = accountIndex.find(acc.accountNumber);
+            if (retired != accountIndex.end() && retired->second == RETIRED) continue;
+            appendAccount(acc, frozen);
+        }
+    }
+    inFile.close();
+    // An empty store is filled from this file at the first save; refuse to start it
+    // if a name would not fit, leaving accounts.txt the only copy
+    if (accountStore.isOpen()) {
+        for (const Account& acc : accounts) {
+            if (AccountStore::fitsName(acc.customerName)) continue;
+            cerr << "Error: Account " << acc.accountNumber << " has a name too long for the account store; "
+                 << "keeping the accounts in " << accountsFile << ".\n";
+            accountStore.close();
+            break;
+        }
+    }
+}
+
+// Drop every account record, live or closed, and everything indexed by them
+void BankEngine::resetAccountBook() {
+    accounts.clear();
+    accountIndex.clear();
+    frozenBits.clear();
+    closedBits.clear();
+    tombstones = 0;
+    accountVersions.touchAll();
+    columns.clear();
+    balanceRanks.clear();
+    accountNames.clear();
+    resyncPending = true;
+    storeResyncPending = true;
+}
+
+// Save all accounts from memory to the accounts file, or the changed ones to the store
+void BankEngine::saveAccounts() {
+    OpTimer timer(STAT_SAVE_ACCOUNTS);
+    ProfileSpan span("saveAccounts");
+    shipChanges();
+    if (accountStore.isOpen()) {
+        // Every route into the book refuses such names while the store is open, so
+        // this is a bug; saving nothing keeps the store as the one copy of the accounts
+        if (saveAccountStore()) publishSaved();
+        else cerr << "Error: A customer name is too long for the account store; accounts not saved.\n";
+        return;
+    }
+    ofstream outFile(accountsFile);
+    if (!outFile) {
+        cerr << "Error: Unable to open accounts file for saving.\n";
+        return;
+    }
+    for (size_t i = 0; i < accounts.size(); ++i) {
+        if (!isClosedAt(i)) writeAccountRecord(outFile, format, accounts[i], isFrozenAt(i));
+    }
+    recordBytesPersisted(STAT_SAVE_ACCOUNTS, outFile.tellp());
+    outFile.close();
+    if (outFile) publishSaved();
+}
+
+// Load loan records from the loan book file into memory
+void BankEngine::loadLoanBook() {
+    OpTimer timer(STAT_LOAD_LOANBOOK);
+    ProfileSpan span("loadLoanBook");
+    auto lock = lockForWrite();
+    resetLoanBook();
+    ifstream inFile(loanBookFile);
+    if (!inFile) return; // File does not exist yet, so no loans to load
+    string line;
+    while (getline(inFile, line)) {
+        Loan loan;
+        if (parseLoanRecord(line, loan)) {
+            loanBook.push_back(loan);
+            loanRanks.set(loan.loanID, loan.remainingBalance);
+            loanNames.add(loan.loanID, loan.customerName);
+        }
+    }
+    inFile.close();
+}
+
+void BankEngine::resetLoanBook() {
+    loanBook.clear();
+    loanVersions.touchAll();
+    loanRanks.clear();
+    loanNames.clear();
+    resyncPending = true;
+}
+
+// Save all loan records from memory to the loan book file
+void BankEngine::saveLoanBook() {
+    OpTimer timer(STAT_SAVE_LOANBOOK);
+    ProfileSpan span("saveLoanBook");
+    shipChanges();
+    ofstream outFile(loanBookFile);
+    if (!outFile) {
+        cerr << "Error: Unable to open loan book file for saving.\n";
+        return;
+    }
+    for (const auto& loan : loanBook) writeLoanRecord(outFile, format, loan);
+    recordBytesPersisted(STAT_SAVE_LOANBOOK, outFile.tellp());
+    outFile.close();
+    if (outFile) publishSaved();
+}
+
+// Load the transaction log; the basic format has none
+void BankEngine::loadTransactions() {
+    OpTimer timer(STAT_LOAD_TRANSACTIONS);
+    ProfileSpan span("loadTransactions");
+    waitForTransactions();
+    transactions.clear();
+    transactionsUnsaved = false;
+    resyncPending = true;
+    if (!logsTransactions()) return;
+    transactions = readTransactionFile(transactionsFile);
+}
+
+// Start reading the transaction log on a background thread. Until it is installed the
+// in-memory log is empty, so everything that reads or appends to it waits first (see
+// installTransactions); other writes go ahead.
+void BankEngine::loadTransactionsInBackground() {
+    waitForTransactions();
+    transactions.clear();
+    transactionsUnsaved = false;
+    resyncPending = true;
+    if (!logsTransactions()) return;
+    transactionsReady = false;
+    transactionsLoading = true;
+    transactionLoader = thread([this]() {
+        OpTimer timer(STAT_LOAD_TRANSACTIONS);
+        ProfileSpan span("loadTransactions");
+        loadedTransactions = readTransactionFile(transactionsFile);
+        transactionsReady = true;
+    });
+}
+
+void BankEngine::waitForTransactions() {
+    installTransactions(true);
+}
+
+// Swap in the background-loaded log; without wait, only if the loader has finished
+void BankEngine::installTransactions(bool wait) {
+    if (!transactionsLoading) return;
+    if (!wait && !transactionsReady) return;
+    lock_guard<mutex> lock(loaderMutex);
+    if (!transactionsLoading) return; // Another thread installed it meanwhile
+    transactionLoader.join();
+    transactions = move(loadedTransactions);
+    loadedTransactions = vector<Transaction>();
+    transactionsLoading = false;
+}
+
+void BankEngine::saveTransactions() {
+    OpTimer timer(STAT_SAVE_TRANSACTIONS);
+    ProfileSpan span("saveTransactions");
+    waitForTransactions();
+    shipChanges();
+    if (!logsTransactions()) {
+        publishSaved(); // Nothing to write in the basic format
+        return;
+    }
+    // Written beside the log and renamed over it, so a reader of the file (a history
+    // lookup while the loader runs) or a crash mid-save never sees half a log
+    string tmpFile = transactionsFile + ".tmp";
+    ofstream outFile(tmpFile);
+    if (!outFile) {
+        cerr << "Error: Unable to open transactions file for saving.\n";
+        return;
+    }
+    for (const auto& t : transactions) writeTransactionRecord(outFile, t);
+    recordBytesPersisted(STAT_SAVE_TRANSACTIONS, outFile.tellp());
+    outFile.close();
+    if (!outFile || rename(tmpFile.c_str(), transactionsFile.c_str()) != 0) return;
+    transactionsUnsaved = false;
+    publishSaved();
+}
+
+// Retire the numbers listed in the closed-accounts audit file so they stay reserved
+void BankEngine::loadClosedAccounts() {
+    ifstream inFile(closedAccountsFile);
+    if (!inFile) return;
+    string line;
+    while (getline(inFile, line)) {
+        istringstream iss(line);
+        int accNum;
+        if (iss >> accNum) accountIndex[accNum] = RETIRED;
+    }
+}
+
+// Audit record of a closure: "number name| balance rate frozen closedAt"
+void BankEngine::appendClosedRecord(const Account& acc, bool frozen) {
+    ostringstream record;
+    record << acc.accountNumber << " " << acc.customerName << "| "
+           << acc.balance << " " << acc.interestRate << " " << (frozen ? 1 : 0) << " "
+           << getCurrentDateTime();
+    if (replica.isOpen()) closedRecords.push_back(record.str());
+    ofstream outFile(closedAccountsFile, ios::app);
+    if (!outFile) {
+        cerr << "Error: Unable to open closed accounts file for saving.\n";
+        return;
+    }
+    outFile << record.str() << "\n";
+}
+
+// Add an account record at the end, keeping the index and bitmaps in step.
+// If a number appears twice in the file the first record wins, as it did for lookups.
+void BankEngine::appendAccount(const Account& account, bool frozen) {
+    accounts.push_back(account);
+    // New accounts, and files written before accrual existed, start accruing now
+    if (format == FileFormat::Extended && account.lastAccrual == 0) accounts.back().lastAccrual = interestClock();
+    columns.push(account.accountNumber, account.balance, account.interestRate);
+    touchAccount(accounts.size() - 1);
+    accountIndex.emplace(account.accountNumber, (int)accounts.size() - 1);
+    accountNames.add(account.accountNumber, account.customerName);
+    if (frozenBits.size() * 64 < accounts.size()) {
+        frozenBits.push_back(0);
+        closedBits.push_back(0);
+    }
+    setFrozenBit(accounts.size() - 1, frozen);
+}
+
+// Record i of accounts changed: mark its snapshot page, update its balance column
+// and re-rank it
+void BankEngine::touchAccount(size_t index) {
+    accountVersions.touch(index);
+    columns.setBalance(index, accounts[index].balance);
+    balanceRanks.set(accounts[index].accountNumber, accounts[index].balance);
+    if (replica.isOpen()) changedAccounts.push_back(accounts[index].accountNumber);
+    if (accountStore.isOpen()) storeChanged.push_back(accounts[index].accountNumber);
+}
+
+void BankEngine::touchLoan(size_t index) {
+    loanVersions.touch(index);
+    loanRanks.set(loanBook[index].loanID, loanBook[index].remainingBalance);
+    if (replica.isOpen()) changedLoans.push_back(loanBook[index].loanID);
+}
+
+void BankEngine::setFrozenBit(size_t index, bool frozen) {
+    if (replica.isOpen()) changedAccounts.push_back(accounts[index].accountNumber);
+    if (accountStore.isOpen()) storeChanged.push_back(accounts[index].accountNumber);
+    uint64_t mask = 1ULL << (index & 63);
+    if (frozen) frozenBits[index >> 6] |= mask;
+    else frozenBits[index >> 6] &= ~mask;
+}
+
+// Recreate the index for the current records with every account active
+void BankEngine::rebuildAccountIndex() {
+    accountIndex.clear();
+    accountIndex.reserve(accounts.size());
+    balanceRanks.clear();
+    accountNames.clear();
+    columns.clear();
+    columns.reserve(accounts.size());
+    for (size_t i = 0; i < accounts.size(); ++i) {
+        accountIndex.emplace(accounts[i].accountNumber, (int)i);
+        columns.push(accounts[i].accountNumber, accounts[i].balance, accounts[i].interestRate);
+        balanceRanks.set(accounts[i].accountNumber, accounts[i].balance);
+        accountNames.add(accounts[i].accountNumber, accounts[i].customerName);
+    }
+    frozenBits.assign((accounts.size() + 63) / 64, 0);
+    closedBits.assign(frozenBits.size(), 0);
+    tombstones = 0;
+    accountVersions.touchAll();
+    resyncPending = true;
+    storeResyncPending = true;
+}
+
+// True for live and retired (closed) account numbers alike. Answered from the index
+// in memory, so the account store is never read for a number that is not there.
+bool BankEngine::accountNumberExists(int accountNumber) const {
+    return accountIndex.count(accountNumber) != 0;
+}
+
+// Returns -1 if not found or closed
+int BankEngine::findAccountIndexByNumber(int accountNumber) const {
+    ProfileSpan span("findAccountIndexByNumber");
+    auto it = accountIndex.find(accountNumber);
+    if (it == accountIndex.end() || it->second == RETIRED || isClosedAt(it->second)) return -1;
+    return it->second;
+}
+
+bool BankEngine::isFrozen(int accountNumber) const {
+    int idx = findAccountIndexByNumber(accountNumber);
+    return idx != -1 && isFrozenAt(idx);
+}
+
+// First live account whose name matches exactly, case included
+int BankEngine::findAccountIndexByName(const string& name) const {
+    for (int accNum : accountNames.lookup(name)) {
+        int idx = findAccountIndexByNumber(accNum);
+        if (idx != -1 && accounts[idx].customerName == name) return idx;
+    }
+    return -1;
+}
+
+AccountAggregate BankEngine::queryAccounts(const AccountQuery& query, AccountField aggregate,
+                                          vector<int>* matches) const {
+    ProfileSpan span("queryAccounts");
+    return columns.evaluate(query, aggregate, frozenBits, closedBits, matches);
+}
+
+vector<NameSearchHit> BankEngine::searchCustomerNames(const string& query, int maxDistance) const {
+    ProfileSpan span("searchCustomerNames");
+    vector<NameSearchHit> hits;
+    for (const NameMatch& m : accountNames.search(query, maxDistance)) {
+        const Account* acc = findAccount(m.key);
+        if (acc) hits.push_back({false, m.key, acc->customerName, m.distance, m.wholeName});
+    }
+    for (const NameMatch& m : loanNames.search(query, maxDistance)) {
+        const Loan* loan = findLoanByID(m.key);
+        if (loan) hits.push_back({true, m.key, loan->customerName, m.distance, m.wholeName});
+    }
+    stable_sort(hits.begin(), hits.end(), [](const NameSearchHit& a, const NameSearchHit& b) {
+        if (a.distance != b.distance) return a.distance < b.distance;
+        return a.wholeName && !b.wholeName;
+    });
+    return hits;
+}
+
+const Account* BankEngine::findAccount(int accountNumber) const {
+    int idx = findAccountIndexByNumber(accountNumber);
+    return idx == -1 ? nullptr : &accounts[idx];
+}
+
+AccountSnapshot BankEngine::snapshotAccounts() {
+    ProfileSpan span("snapshotAccounts");
+    lock_guard<mutex> lock(writeMutex);
+    AccountSnapshot snap;
+    snap.accounts = accountVersions.capture(accounts);
+    snap.frozenBits = frozenBits;
+    snap.closedBits = closedBits;
+    snap.liveCount = accounts.size() - tombstones;
+    return snap;
+}
+
+PagedSnapshot<Loan> BankEngine::snapshotLoans() {
+    ProfileSpan span("snapshotLoans");
+    lock_guard<mutex> lock(writeMutex);
+    return loanVersions.capture(loanBook);
+}
+
+const vector<Transaction>& BankEngine::getTransactions() {
+    waitForTransactions();
+    return transactions;
+}
+
+// Collect every logged transaction for an account, oldest first
+vector<Transaction> BankEngine::getTransactionHistory(int accountNumber) {
+    installTransactions(false);
+    // Nothing is logged while the loader runs, so the file holds the whole history.
+    // Saves replace the file by rename, so the read sees one whole version of it.
+    if (transactionsLoading) return readTransactionFile(transactionsFile, &accountNumber);
+    lock_guard<mutex> lock(writeMutex); // Writers append to the log in memory
+    vector<Transaction> history;
+    for (const auto& t : transactions) {
+        if (t.accountNumber == accountNumber) history.push_back(t);
+    }
+    return history;
+}
+
+int BankEngine::generateTransactionID() {
+    waitForTransactions(); // IDs follow the whole log
+    int maxID = 0;
+    for (const auto& t : transactions) {
+        if (t.transactionID > maxID) maxID = t.transactionID;
+    }
+    return maxID + 1;
+}
+
+// Append a transaction record for an account to the in-memory log
+// and the change feed (which still sees it, without an ID, in the basic format)
+void BankEngine::logTransaction(int accountNumber, const string& type, double amount, double balanceAfter) {
+    if (!logsTransactions()) {
+        publishChange(CHANGE_TRANSACTION, accountNumber, amount, balanceAfter, type);
+        return;
+    }
+    Transaction t;
+    t.transactionID = generateTransactionID();
+    t.accountNumber = accountNumber;
+    t.dateTime = getCurrentDateTime();
+    t.type = type;
+    t.amount = amount;
+    t.balanceAfter = balanceAfter;
+    transactions.push_back(t);
+    transactionsUnsaved = true;
+    publishChange(CHANGE_TRANSACTION, accountNumber, amount, balanceAfter, type, t.transactionID);
+}
+
+bool BankEngine::enableChangeFeed(const string& path, size_t capacity) {
+    auto lock = lockForWrite();
+    return changeFeed.open(path, capacity);
+}
+
+// Publish the changes held back by publishChange once the save that makes them
+// durable has succeeded. The saves call this; while transactions.txt is behind
+// (an operation saves it last) the changes wait for that save.
+void BankEngine::publishSaved() {
+    if (transactionsUnsaved) return;
+    for (ChangeEvent& event : unpublished) changeFeed.publish(event);
+    unpublished.clear();
+}
+
+// Queue a change for the feed; it is published after the next successful save
+void BankEngine::publishChange(ChangeType type, int accountNumber, double amount, double balanceAfter,
+                               const string& kind, int transactionID) {
+    if (!changeFeed.isOpen()) return;
+    ChangeEvent event = {};
+    event.type = type;
+    event.accountNumber = accountNumber;
+    event.transactionID = transactionID;
+    event.amount = amount;
+    event.balanceAfter = balanceAfter;
+    kind.copy(event.kind, sizeof(event.kind) - 1);
+    unpublished.push_back(event);
+}
+
+bool BankEngine::enableReplication(const string& socketPath) {
+    auto lock = lockForWrite();
+    if (!replica.connect(socketPath)) return false;
+    resyncPending = true;
+    shipChanges();
+    return replica.isOpen();
+}
+
+bool BankEngine::enableAccountStore(const string& path, size_t cachePages) {
+    auto lock = lockForWrite();
+    if (!accountStore.open(path, cachePages)) return false;
+    storeResyncPending = true;
+    storeChanged.clear();
+    return true;
+}
+
+static StoredAccount toStoredAccount(const Account& acc, bool frozen) {
+    StoredAccount stored;
+    memset(&stored, 0, sizeof(stored));
+    stored.accountNumber = acc.accountNumber;
+    stored.frozen = frozen ? 1 : 0;
+    stored.balance = acc.balance;
+    stored.interestRate = acc.interestRate;
+    stored.lastAccrual = acc.lastAccrual;
+    // A name that does not fit leaves no terminator, and the store refuses the record
+    acc.customerName.copy(stored.customerName, sizeof(stored.customerName));
+    return stored;
+}
+
+// Write the records touched since the last save to the store (all of them after a
+// reload or a bulk change), dropping closed ones, then flush the dirty pages.
+// Records go in number order so neighbouring changes share pages. Writes nothing
+// and returns false if one of the names does not fit in a record.
+bool BankEngine::saveAccountStore() {
+    if (storeResyncPending) {
+        vector<int> live;
+        live.reserve(accounts.size() - tombstones);
+        for (size_t i = 0; i < accounts.size(); ++i) {
+            if (isClosedAt(i)) continue;
+            if (!AccountStore::fitsName(accounts[i].customerName)) return false;
+            live.push_back((int)i);
+        }
+        sort(live.begin(), live.end(),
+             [this](int a, int b) { return accounts[a].accountNumber < accounts[b].accountNumber; });
+        accountStore.clear();
+        for (int idx : live) accountStore.put(toStoredAccount(accounts[idx], isFrozenAt(idx)));
+    } else {
+        sort(storeChanged.begin(), storeChanged.end());
+        storeChanged.erase(unique(storeChanged.begin(), storeChanged.end()), storeChanged.end());
+        for (int accNum : storeChanged) {
+            int idx = findAccountIndexByNumber(accNum);
+            if (idx != -1 && !AccountStore::fitsName(accounts[idx].customerName)) return false;
+        }
+        for (int accNum : storeChanged) {
+            int idx = findAccountIndexByNumber(accNum);
+            if (idx == -1) accountStore.erase(accNum);
+            else accountStore.put(toStoredAccount(accounts[idx], isFrozenAt(idx)));
+        }
+    }
+    storeChanged.clear();
+    storeResyncPending = false;
+    recordBytesPersisted(STAT_SAVE_ACCOUNTS, accountStore.flush());
+    return true;
+}
+
+// Send the standby every record changed since the last shipment and wait until it
+// has applied them. The saves call this, so the standby never lags what they write.
+// Lines are tagged R (full copy follows), A (account), X (closure audit record),
+// L (loan) and T (transaction).
+void BankEngine::shipChanges() {
+    if (!replica.isOpen()) return;
+    waitForTransactions();
+    ostringstream batch;
+    batch << setprecision(17); // Exact values, unlike the data files
+    if (resyncPending) {
+        batch << "R " << (format == FileFormat::Extended ? "extended" : "basic") << "\n";
+        ifstream closed(closedAccountsFile);
+        string line;
+        while (getline(closed, line)) batch << "X " << line << "\n";
+        for (size_t i = 0; i < accounts.size(); ++i) {
+            if (isClosedAt(i)) continue;
+            batch << "A ";
+            writeAccountRecord(batch, format, accounts[i], isFrozenAt(i));
+        }
+        for (const auto& loan : loanBook) {
+            batch << "L ";
+            writeLoanRecord(batch, format, loan);
+        }
+        shippedTransactions = 0;
+    } else {
+        sort(changedAccounts.begin(), changedAccounts.end());
+        changedAccounts.erase(unique(changedAccounts.begin(), changedAccounts.end()), changedAccounts.end());
+        for (int accNum : changedAccounts) {
+            int idx = findAccountIndexByNumber(accNum);
+            if (idx == -1) continue; // Closed since; its X record carries the final state
+            batch << "A ";
+            writeAccountRecord(batch, format, accounts[idx], isFrozenAt(idx));
+        }
+        for (const string& record : closedRecords) batch << "X " << record << "\n";
+        sort(changedLoans.begin(), changedLoans.end());
+        changedLoans.erase(unique(changedLoans.begin(), changedLoans.end()), changedLoans.end());
+        for (int loanID : changedLoans) {
+            const Loan* loan = findLoan(loanID);
+            if (!loan) continue;
+            batch << "L ";
+            writeLoanRecord(batch, format, *loan);
+        }
+    }
+    for (size_t i = shippedTransactions; i < transactions.size(); ++i) {
+        batch << "T ";
+        writeTransactionRecord(batch, transactions[i]);
+    }
+    shippedTransactions = transactions.size();
+    resyncPending = false;
+    changedAccounts.clear();
+    changedLoans.clear();
+    closedRecords.clear();
+
+    string records = batch.str();
+    if (records.empty()) return;
+    if (!replica.send(records)) cerr << "Warning: Lost the standby; carrying on without replication.\n";
+}
+
+// Apply one shipment from a primary (see shipChanges). Nothing is saved: the standby
+// writes its files when it is promoted.
+bool BankEngine::applyReplicationBatch(const string& batch) {
+    waitForTransactions();
+    auto lock = lockForWrite();
+    istringstream in(batch);
+    ofstream closedFile;
+    string line;
+    while (getline(in, line)) {
+        if (line.size() < 2 || line[1] != ' ') return false;
+        string record = line.substr(2);
+        switch (line[0]) {
+            case 'R': {
+                if (record != (format == FileFormat::Extended ? "extended" : "basic")) {
+                    cerr << "Error: The primary writes the " << record << " format; this standby does not.\n";
+                    return false;
+                }
+                resetAccountBook();
+                resetLoanBook();
+                transactions.clear();
+                velocity.clear();
+                closedFile.close();
+                closedFile.open(closedAccountsFile, ios::trunc);
+                break;
+            }
+            case 'X': {
+                istringstream iss(record);
+                int accNum;
+                if (!(iss >> accNum)) return false;
+                int idx = findAccountIndexByNumber(accNum);
+                if (idx != -1) tombstone(idx);
+                else if (!accountNumberExists(accNum)) accountIndex[accNum] = RETIRED;
+                if (!closedFile.is_open()) closedFile.open(closedAccountsFile, ios::app);
+                closedFile << record << "\n";
+                break;
+            }
+            case 'A': {
+                Account acc;
+                bool frozen;
+                if (!parseAccountRecord(record, format, acc, frozen)) return false;
+                if (accountStore.isOpen() && !AccountStore::fitsName(acc.customerName)) {
+                    cerr << "Error: Account " << acc.accountNumber << " has a name too long for the account store.\n";
+                    return false;
+                }
+                int idx = findAccountIndexByNumber(acc.accountNumber);
+                if (idx == -1) {
+                    appendAccount(acc, frozen);
+                } else {
+                    accounts[idx] = acc;
+                    setFrozenBit(idx, frozen);
+                    touchAccount(idx);
+                }
+                break;
+            }
+            case 'L': {
+                Loan loan;
+                if (!parseLoanRecord(record, loan)) return false;
+                Loan* existing = findLoan(loan.loanID);
+                if (existing) {
+                    *existing = loan;
+                    touchLoan(existing - loanBook.data());
+                } else {
+                    loanBook.push_back(loan);
+                    touchLoan(loanBook.size() - 1);
+                    loanNames.add(loan.loanID, loan.customerName);
+                }
+                break;
+            }
+            case 'T': {
+                Transaction t;
+                if (!parseTransactionRecord(record, t)) return false;
+                transactions.push_back(t);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    if (compactionThreshold > 0 && tombstones >= compactionThreshold) startCompaction();
+    return true;
+}
+
+// Check a debit against the velocity limits, freezing the account if it would cross them
+bool BankEngine::passesVelocityCheck(int idx, double amount) {
+    if (velocity.allow(accounts[idx].accountNumber, amount, velocityClockNs())) return true;
+    applyFrozen(idx, true);
+    saveAccounts();
+    return false;
+}
+
+// Interest on the balance compounded daily for the given number of days
+static double compoundedInterest(const Account& acc, int64_t days) {
+    return acc.balance * (pow(1.0 + acc.interestRate / 36500.0, (double)days) - 1.0);
+}
+
+// Compound daily interest for the whole days since the account's last accrual into
+// its balance; the part-day left over carries to the next accrual. Returns the
+// interest added. Only touches the one record, so partition workers may call it.
+double BankEngine::accrueInterest(Account& acc, int64_t now) const {
+    if (format != FileFormat::Extended) return 0;
+    if (acc.lastAccrual == 0) acc.lastAccrual = now;
+    int64_t days = (now - acc.lastAccrual) / 86400;
+    if (days <= 0) return 0;
+    acc.lastAccrual += days * 86400;
+    double interest = compoundedInterest(acc, days);
+    acc.balance += interest;
+    return interest;
+}
+
+// Bring one account's interest up to date and log it; returns whether the record
+// changed. The accrual date can move even when the interest rounds to nothing, and
+// the account is marked for saving either way. Callers hold the write lock and save
+// afterwards.
+bool BankEngine::settleInterest(int idx) {
+    int64_t accruedTo = accounts[idx].lastAccrual;
+    double interest = accrueInterest(accounts[idx], interestClock());
+    if (accounts[idx].lastAccrual == accruedTo) return false;
+    touchAccount(idx);
+    if (interest != 0) logTransaction(accounts[idx].accountNumber, "interest", interest, accounts[idx].balance);
+    return true;
+}
+
+// The balance an account would show if its interest were settled now
+double BankEngine::balanceWithInterest(const Account& account) const {
+    if (format != FileFormat::Extended || account.lastAccrual == 0) return account.balance;
+    int64_t days = (interestClock() - account.lastAccrual) / 86400;
+    return days > 0 ? account.balance + compoundedInterest(account, days) : account.balance;
+}
+
+// Settle every live account, e.g. before statements; saves once if anything accrued
+size_t BankEngine::settleAllInterest() {
+    auto lock = lockForWrite();
+    size_t settled = 0;
+    for (size_t i = 0; i < accounts.size(); ++i) {
+        if (isClosedAt(i)) continue;
+        if (settleInterest((int)i)) ++settled;
+    }
+    if (settled > 0) {
+        saveAccounts();
+        saveTransactions();
+    }
+    return settled;
+}
+
+// Flip one account's frozen bit; unfreezing clears the velocity review, so start a fresh window
+void BankEngine::applyFrozen(int idx, bool frozen) {
+    setFrozenBit(idx, frozen);
+    if (!frozen) velocity.reset(accounts[idx].accountNumber);
+    publishChange(frozen ? CHANGE_FROZEN : CHANGE_UNFROZEN, accounts[idx].accountNumber, 0, accounts[idx].balance);
+}
+
+// Hash of an operation and its arguments, so a key reused for a different request
+// is told apart from a genuine retry
+static uint64_t opFingerprint(const char* op, long long a, long long b, double amount,
+                              const string& text = string()) {
+    uint64_t hash = fnv1a(op, strlen(op));
+    hash = fnv1a(&a, sizeof(a), hash);
+    hash = fnv1a(&b, sizeof(b), hash);
+    hash = fnv1a(&amount, sizeof(amount), hash);
+    return fnv1a(text.data(), text.size(), hash);
+}
+
+// Fold one more numeric argument into a fingerprint, for operations with two amounts
+static uint64_t fingerprintField(uint64_t hash, double value) {
+    return fnv1a(&value, sizeof(value), hash);
+}
+
+// Keys are written to the journal as single words
+static bool validIdempotencyKey(const string& key) {
+    if (key.size() > 64) return false;
+    for (unsigned char c : key) {
+        if (!isgraph(c)) return false;
+    }
+    return true;
+}
+
+// Run body once per key and remember its result; a repeat of the key returns that
+// result without running body. An empty key runs body unconditionally. value, when
+// given, is remembered alongside the status and restored on a repeat. The key is
+// journalled as pending before body runs, so a crash after body has saved but before
+// the result is journalled leaves the key in doubt instead of forgotten. A body that
+// posts (logs a transaction whenever it succeeds, saving the log before the balances)
+// has the ID its first record will take kept in the pending record, so loading the
+// journal can settle the key from the log. Callers hold the write lock.
+template <typename Body>
+OpStatus BankEngine::idempotent(const string& key, uint64_t fingerprint, Body body, int* value, bool posts) {
+    if (key.empty()) return body();
+    if (!validIdempotencyKey(key)) return OP_INVALID_KEY;
+
+    int64_t now = time(nullptr);
+    const IdempotencyCache::Entry* seen = idempotency.find(key, now);
+    if (seen) {
+        if (seen->fingerprint != fingerprint) return OP_KEY_REUSED;
+        if (seen->status == IdempotencyCache::PENDING) return OP_KEY_IN_DOUBT;
+        if (value) *value = seen->value;
+        return (OpStatus)seen->status;
+    }
+
+    int firstPosting = posts && logsTransactions() ? generateTransactionID() : 0;
+    IdempotencyCache::Entry entry{key, fingerprint, IdempotencyCache::PENDING, firstPosting, now + idempotency.ttl()};
+    idempotency.insert(entry, now);
+    appendJournal(entry);
+    OpStatus status = body();
+    entry.status = status;
+    entry.value = value ? *value : 0;
+    idempotency.insert(entry, now);
+    appendJournal(entry);
+    return status;
+}
+
+// One line per keyed result: "key fingerprint status value expiresAt"
+void BankEngine::appendJournal(const IdempotencyCache::Entry& e) {
+    // Expired and evicted records pile up; rewrite once they outnumber the live ones
+    if (journalLines > 4096 && journalLines > 2 * idempotency.size()) rewriteJournal();
+    if (!journal.is_open()) journal.open(journalFile, ios::app);
+    journal << e.key << " " << hex << e.fingerprint << dec << " " << e.status << " "
+            << e.value << " " << e.expiresAt << "\n";
+    journal.flush();
+    ++journalLines;
+}
+
+void BankEngine::rewriteJournal() {
+    journal.close();
+    string tmpFile = journalFile + ".tmp";
+    ofstream out(tmpFile);
+    journalLines = 0;
+    idempotency.forEach(time(nullptr), [&](const IdempotencyCache::Entry& e) {
+        out << e.key << " " << hex << e.fingerprint << dec << " " << e.status << " "
+            << e.value << " " << e.expiresAt << "\n";
+        ++journalLines;
+    });
+    out.close();
+    rename(tmpFile.c_str(), journalFile.c_str());
+}
+
+// Replay the journal into the cache, dropping keys that have since expired
+void BankEngine::loadIdempotencyJournal() {
+    auto lock = lockForWrite();
+    idempotency.configure(idempotency.maxEntries(), idempotency.ttl());
+    journal.close();
+    journalLines = 0;
+    ifstream in(journalFile);
+    int64_t now = time(nullptr);
+    IdempotencyCache::Entry e;
+    string line;
+    while (getline(in, line)) {
+        istringstream fields(line);
+        if (!(fields >> e.key >> hex >> e.fingerprint >> dec >> e.status >> e.value >> e.expiresAt)) continue;
+        ++journalLines;
+        if (e.expiresAt > now) idempotency.insert(e, now);
+    }
+    in.close();
+
+    // Keys left pending by a crash. Only the last operation before it can still have a
+    // posting to look for, since a load settles every one it can and rewrites the journal.
+    vector<IdempotencyCache::Entry> pending;
+    idempotency.forEach(now, [&](const IdempotencyCache::Entry& e) {
+        if (e.status == IdempotencyCache::PENDING && e.value > 0) pending.push_back(e);
+    });
+    if (pending.empty()) return;
+    for (IdempotencyCache::Entry& e : pending) settleInDoubtKey(e, now);
+    rewriteJournal();
+}
+
+// Settle a pending key from the transaction log. Postings save the log before the
+// balances, so with no record from its first ID on the operation never happened and
+// the key is forgotten (a retry runs it). With records it succeeded; balances the
+// crash kept out of the accounts file are restored from them and the key answers OP_OK.
+void BankEngine::settleInDoubtKey(IdempotencyCache::Entry& entry, int64_t now) {
+    waitForTransactions();
+    unordered_map<int, const Transaction*> lastPosting;     // Account number -> its last record
+    for (const Transaction& t : transactions) {
+        if (t.transactionID >= entry.value) lastPosting[t.accountNumber] = &t;
+    }
+    if (lastPosting.empty()) {
+        entry.expiresAt = now;
+        idempotency.insert(entry, now);
+        return;
+    }
+    bool repaired = false;
+    for (const auto& posting : lastPosting) {
+        int idx = findAccountIndexByNumber(posting.first);
+        if (idx == -1 || accounts[idx].balance == posting.second->balanceAfter) continue;
+        accounts[idx].balance = posting.second->balanceAfter;
+        // Interest was settled up to the posting too
+        int64_t postedAt = parseDateTime(posting.second->dateTime);
+        if (postedAt > accounts[idx].lastAccrual) accounts[idx].lastAccrual = postedAt;
+        touchAccount(idx);
+        repaired = true;
+    }
+    if (repaired) saveAccounts();
+    entry.status = OP_OK;
+    entry.value = 0;
+    idempotency.insert(entry, now);
+}
+
+OpStatus BankEngine::resolveKeyInDoubt(const string& key, bool happened, int value) {
+    auto lock = lockForWrite();
+    int64_t now = time(nullptr);
+    const IdempotencyCache::Entry* seen = idempotency.find(key, now);
+    if (!seen) return OP_NOT_FOUND;
+    if (seen->status != IdempotencyCache::PENDING) return OP_NO_CHANGE;
+    IdempotencyCache::Entry entry = *seen;
+    if (happened) {
+        entry.status = OP_OK;
+        entry.value = value;
+    } else {
+        entry.expiresAt = now;
+    }
+    idempotency.insert(entry, now);
+    rewriteJournal();
+    return OP_OK;
+}
+
+OpStatus BankEngine::createAccount(const Account& account, const string& key) {
+    auto lock = lockForWrite();
+    uint64_t fingerprint = fingerprintField(opFingerprint("create_account", account.accountNumber, 0,
+                                                          account.balance, account.customerName),
+                                            account.interestRate);
+    return idempotent(key, fingerprint, [&] {
+        auto existing = accountIndex.find(account.accountNumber);
+        if (existing != accountIndex.end()) {
+            bool closed = existing->second == RETIRED || isClosedAt(existing->second);
+            return closed ? OP_CLOSED : OP_DUPLICATE_ACCOUNT;
+        }
+        if (accountStore.isOpen() && !AccountStore::fitsName(account.customerName)) return OP_NAME_TOO_LONG;
+        appendAccount(account, false);
+        publishChange(CHANGE_ACCOUNT_OPENED, account.accountNumber, account.balance, account.balance);
+        saveAccounts();
+        return OP_OK;
+    });
+}
+
+OpStatus BankEngine::deposit(int accNum, double amount, const string& key) {
+    OpTimer timer(STAT_DEPOSIT);
+    ProfileSpan span("deposit");
+    auto lock = lockForWrite();
+    return idempotent(key, opFingerprint("deposit", accNum, 0, amount), [&] {
+        int idx = findAccountIndexByNumber(accNum);
+        if (idx == -1) return timer.reject(OP_NOT_FOUND);
+        if (isFrozenAt(idx)) return timer.reject(OP_FROZEN);
+        if (amount <= 0) return timer.reject(OP_INVALID_AMOUNT);
+
+        settleInterest(idx);
+        accounts[idx].balance += amount;
+        touchAccount(idx);
+        logTransaction(accNum, "deposit", amount, accounts[idx].balance);
+
+        savePosting();
+        return OP_OK;
+    }, nullptr, true);
+}
+
+OpStatus BankEngine::withdraw(int accNum, double amount, const string& key) {
+    OpTimer timer(STAT_WITHDRAW);
+    ProfileSpan span("withdraw");
+    auto lock = lockForWrite();
+    return idempotent(key, opFingerprint("withdraw", accNum, 0, amount), [&] {
+        int idx = findAccountIndexByNumber(accNum);
+        if (idx == -1) return timer.reject(OP_NOT_FOUND);
+        if (isFrozenAt(idx)) return timer.reject(OP_FROZEN);
+        if (amount <= 0) return timer.reject(OP_INVALID_AMOUNT);
+        // Checked against the balance with interest, which is settled only if the debit goes ahead
+        if (amount > balanceWithInterest(accounts[idx])) return timer.reject(OP_INSUFFICIENT_FUNDS);
+        if (!passesVelocityCheck(idx, amount)) return timer.reject(OP_VELOCITY_LIMIT);
+
+        settleInterest(idx);
+        accounts[idx].balance -= amount;
+        touchAccount(idx);
+        logTransaction(accNum, "withdrawal", amount, accounts[idx].balance);
+
+        savePosting();
+        return OP_OK;
+    }, nullptr, true);
+}
+
+OpStatus BankEngine::transfer(int srcAccNum, int destAccNum, double amount, const string& key) {
+    OpTimer timer(STAT_TRANSFER);
+    ProfileSpan span("transfer");
+    auto lock = lockForWrite();
+    return idempotent(key, opFingerprint("transfer", srcAccNum, destAccNum, amount), [&] {
+        OpStatus status = applyTransfer(srcAccNum, destAccNum, amount);
+        if (status != OP_OK) return timer.reject(status);
+        savePosting();
+        return OP_OK;
+    }, nullptr, true);
+}
+
+// The transfer rules and the balance change, without persisting; shared by
+// transfer and the standing-order run. Callers hold the write lock.
+OpStatus BankEngine::applyTransfer(int srcAccNum, int destAccNum, double amount) {
+    int srcIdx = findAccountIndexByNumber(srcAccNum);
+    if (srcIdx == -1) return OP_NOT_FOUND;
+    if (isFrozenAt(srcIdx)) return OP_FROZEN;
+    int destIdx = findAccountIndexByNumber(destAccNum);
+    if (destIdx == -1) return OP_DEST_NOT_FOUND;
+    if (isFrozenAt(destIdx)) return OP_DEST_FROZEN;
+    if (srcAccNum == destAccNum) return OP_SAME_ACCOUNT;
+    if (amount <= 0) return OP_INVALID_AMOUNT;
+    if (amount > balanceWithInterest(accounts[srcIdx])) return OP_INSUFFICIENT_FUNDS;
+    if (!passesVelocityCheck(srcIdx, amount)) return OP_VELOCITY_LIMIT;
+
+    settleInterest(srcIdx);
+    settleInterest(destIdx);
+    accounts[srcIdx].balance -= amount;
+    accounts[destIdx].balance += amount;
+    touchAccount(srcIdx);
+    touchAccount(destIdx);
+
+    logTransaction(srcAccNum, "transfer_out", amount, accounts[srcIdx].balance);
+    logTransaction(destAccNum, "transfer_in", amount, accounts[destIdx].balance);
+    return OP_OK;
+}
+
+OpStatus BankEngine::prepareTransferLeg(int accNum, double amount, bool outgoing, double reserved) {
+    auto lock = lockForWrite();
+    int idx = findAccountIndexByNumber(accNum);
+    if (idx == -1) return outgoing ? OP_NOT_FOUND : OP_DEST_NOT_FOUND;
+    if (isFrozenAt(idx)) return outgoing ? OP_FROZEN : OP_DEST_FROZEN;
+    if (amount <= 0) return OP_INVALID_AMOUNT;
+    if (!outgoing) return OP_OK;
+    if (amount + reserved > balanceWithInterest(accounts[idx])) return OP_INSUFFICIENT_FUNDS;
+    if (!passesVelocityCheck(idx, amount)) return OP_VELOCITY_LIMIT;
+    return OP_OK;
+}
+
+OpStatus BankEngine::commitTransferLeg(int accNum, double amount, bool outgoing, const string& key) {
+    OpTimer timer(STAT_TRANSFER);
+    ProfileSpan span("commitTransferLeg");
+    auto lock = lockForWrite();
+    return idempotent(key, opFingerprint(outgoing ? "transfer_out" : "transfer_in", accNum, 0, amount), [&] {
+        int idx = findAccountIndexByNumber(accNum);
+        if (idx == -1) return timer.reject(outgoing ? OP_NOT_FOUND : OP_DEST_NOT_FOUND);
+        settleInterest(idx);
+        accounts[idx].balance += outgoing ? -amount : amount;
+        touchAccount(idx);
+        logTransaction(accNum, outgoing ? "transfer_out" : "transfer_in", amount, accounts[idx].balance);
+        savePosting();
+        return OP_OK;
+    }, nullptr, true);
+}
+
+// Save a posting: the log first, so a crash between the two files leaves the log
+// ahead of the balances, which is what loading the idempotency journal repairs
+void BankEngine::savePosting() {
+    saveTransactions();
+    saveAccounts();
+}
+
+// Post the interest accrued so far; the basic format has no accrual and adds one
+// year of simple interest instead
+OpStatus BankEngine::addInterest(int accNum, const string& key) {
+    OpTimer timer(STAT_INTEREST);
+    auto lock = lockForWrite();
+    return idempotent(key, opFingerprint("interest", accNum, 0, 0), [&] {
+        int idx = findAccountIndexByNumber(accNum);
+        if (idx == -1) return timer.reject(OP_NOT_FOUND);
+
+        if (format == FileFormat::Extended) {
+            settleInterest(idx);
+            saveAccounts();
+            saveTransactions();
+            return OP_OK;
+        }
+        double interest = accounts[idx].balance * (accounts[idx].interestRate / 100.0);
+        accounts[idx].balance += interest;
+        touchAccount(idx);
+        logTransaction(accNum, "interest", interest, accounts[idx].balance);
+        saveAccounts();
+        return OP_OK;
+    });
+}
+
+// Tombstone the record in place; accounts.txt drops it at its next rewrite, and on
+// load the closed-accounts file keeps it from coming back
+OpStatus BankEngine::closeAccount(int accNum, const string& key) {
+    auto lock = lockForWrite();
+    return idempotent(key, opFingerprint("close", accNum, 0, 0), [&] {
+        int idx = findAccountIndexByNumber(accNum);
+        if (idx == -1) return OP_NOT_FOUND;
+
+        settleInterest(idx); // The closed record carries the final balance and accrual date
+        appendClosedRecord(accounts[idx], isFrozenAt(idx));
+        tombstone(idx);
+        publishChange(CHANGE_ACCOUNT_CLOSED, accNum, accounts[idx].balance, accounts[idx].balance);
+        saveTransactions(); // The final interest posting; this also ships the closure
+
+        if (compactionThreshold > 0 && tombstones >= compactionThreshold) startCompaction();
+        return OP_OK;
+    });
+}
+
+OpStatus BankEngine::setFrozen(int accNum, bool frozen, const string& key) {
+    OpTimer timer(STAT_FREEZE);
+    auto lock = lockForWrite();
+    return idempotent(key, opFingerprint("freeze", accNum, frozen, 0), [&] {
+        int idx = findAccountIndexByNumber(accNum);
+        if (idx == -1) return timer.reject(OP_NOT_FOUND);
+        if (isFrozenAt(idx) == frozen) return timer.reject(OP_NO_CHANGE);
+
+        applyFrozen(idx, frozen);
+        saveAccounts();
+        return OP_OK;
+    });
+}
+
+// Mark record idx closed and drop it from the live indexes
+void BankEngine::tombstone(int idx) {
+    closedBits[idx >> 6] |= 1ULL << (idx & 63);
+    ++tombstones;
+    balanceRanks.erase(accounts[idx].accountNumber);
+    accountNames.remove(accounts[idx].accountNumber);
+    velocity.reset(accounts[idx].accountNumber);
+    if (accountStore.isOpen()) storeChanged.push_back(accounts[idx].accountNumber);
+}
+
+// Remove every live account; closed numbers stay retired since their audit records remain
+void BankEngine::deleteAllAccounts() {
+    auto lock = lockForWrite();
+    for (auto it = accountIndex.begin(); it != accountIndex.end();) {
+        if (it->second == RETIRED || isClosedAt(it->second)) {
+            it->second = RETIRED;
+            ++it;
+        } else {
+            it = accountIndex.erase(it);
+        }
+    }
+    accounts.clear();
+    frozenBits.clear();
+    closedBits.clear();
+    tombstones = 0;
+    accountVersions.touchAll();
+    columns.clear();
+    balanceRanks.clear();
+    accountNames.clear();
+    velocity.clear();
+    resyncPending = true;
+    storeResyncPending = true;
+    publishChange(CHANGE_ALL_DELETED, 0, 0, 0);
+    saveAccounts();
+}
+
+// Take the write lock, first installing any compaction that finished since the last write
+unique_lock<mutex> BankEngine::lockForWrite() {
+    unique_lock<mutex> lock(writeMutex);
+    installCompaction();
+    installTransactions(false);
+    return lock;
+}
+
+// Copy the live records into a fresh book on a background thread. The copy holds the
+// write lock, so reads on the owner thread carry on while writes wait for it; the result
+// is swapped in by the next write (or waitForCompaction) on the owner thread.
+void BankEngine::startCompaction() {
+    if (compactor.joinable()) return; // One already running or waiting to be installed
+    compactor = thread([this]() {
+        lock_guard<mutex> lock(writeMutex);
+        ProfileSpan span("compaction");
+        auto book = make_unique<CompactedBook>();
+        book->accounts.reserve(accounts.size() - tombstones);
+        book->columns.reserve(accounts.size() - tombstones);
+        book->accountIndex.reserve(accountIndex.size());
+        for (const auto& entry : accountIndex) {
+            if (entry.second == RETIRED || isClosedAt(entry.second)) {
+                book->accountIndex.emplace(entry.first, RETIRED);
+            }
+        }
+        for (size_t i = 0; i < accounts.size(); ++i) {
+            if (isClosedAt(i)) continue;
+            size_t pos = book->accounts.size();
+            book->accounts.push_back(accounts[i]);
+            book->columns.push(accounts[i].accountNumber, accounts[i].balance, accounts[i].interestRate);
+            book->accountIndex.emplace(accounts[i].accountNumber, (int)pos);
+            if (book->frozenBits.size() * 64 <= pos) book->frozenBits.push_back(0);
+            if (isFrozenAt(i)) book->frozenBits[pos >> 6] |= 1ULL << (pos & 63);
+        }
+        compacted = move(book);
+    });
+}
+
+// Swap in a finished compaction; the caller holds writeMutex
+void BankEngine::installCompaction() {
+    if (!compacted) return;
+    // It set compacted just before releasing the lock, so this returns at once
+    if (compactor.joinable()) compactor.join();
+    accounts.swap(compacted->accounts);
+    accountIndex.swap(compacted->accountIndex);
+    frozenBits.swap(compacted->frozenBits);
+    columns = move(compacted->columns);
+    closedBits.assign(frozenBits.size(), 0);
+    tombstones = 0;
+    accountVersions.touchAll();
+    compacted.reset();
+}
+
+// Block until a running compaction finishes, then install it
+void BankEngine::waitForCompaction() {
+    if (compactor.joinable()) compactor.join(); // Not holding the lock, which the compactor needs
+    lock_guard<mutex> lock(writeMutex);
+    installCompaction();
+}
+
+BulkFreezeReport BankEngine::setFrozenBulk(const vector<int>& accountNumbers, bool frozen) {
+    OpTimer timer(STAT_BULK_FREEZE);
+    ProfileSpan span("setFrozenBulk");
+    auto lock = lockForWrite();
+    BulkFreezeReport report;
+    report.requested = accountNumbers.size();
+    for (int accNum : accountNumbers) {
+        int idx = findAccountIndexByNumber(accNum);
+        if (idx == -1) {
+            report.notFound.push_back(accNum);
+        } else if (isFrozenAt(idx) == frozen) {
+            ++report.unchanged;
+        } else {
+            applyFrozen(idx, frozen);
+            ++report.changed;
+        }
+    }
+    if (report.changed > 0) saveAccounts();
+    return report;
+}
+
+bool readAccountList(const string& path, vector<int>& accountNumbers, size_t& skippedLines) {
+    ifstream inFile(path);
+    if (!inFile) return false;
+    skippedLines = 0;
+    string line;
+    while (getline(inFile, line)) {
+        string entry = trim(line);
+        if (!entry.empty() && entry.back() == '\r') entry = trim(entry.substr(0, entry.size() - 1));
+        if (entry.empty() || entry[0] == '#') continue;
+        istringstream iss(entry);
+        int accNum;
+        string rest;
+        if (iss >> accNum && !(iss >> rest)) accountNumbers.push_back(accNum);
+        else ++skippedLines;
+    }
+    return true;
+}
+
+bool readTransferBatch(const string& path, vector<BatchTransfer>& batch, size_t& skippedLines) {
+    ifstream inFile(path);
+    if (!inFile) return false;
+    skippedLines = 0;
+    string line;
+    while (getline(inFile, line)) {
+        string entry = trim(line);
+        if (!entry.empty() && entry.back() == '\r') entry = trim(entry.substr(0, entry.size() - 1));
+        if (entry.empty() || entry[0] == '#') continue;
+        istringstream iss(entry);
+        BatchTransfer t;
+        char comma1, comma2;
+        string rest;
+        if (iss >> t.srcAccountNumber >> comma1 >> t.destAccountNumber >> comma2 >> t.amount && comma1 == ',' &&
+            comma2 == ',' && !(iss >> rest)) {
+            batch.push_back(t);
+        } else {
+            ++skippedLines;
+        }
+    }
+    return true;
+}
+
+// Generate a unique loan ID by finding the maximum existing ID and adding 1
+int BankEngine::generateUniqueLoanID() const {
+    int maxID = 0;
+    for (const auto& loan : loanBook) {
+        if (loan.loanID > maxID) maxID = loan.loanID;
+    }
+    return maxID + 1;
+}
+
+Loan* BankEngine::findLoan(int loanID) {
+    // IDs are issued in sequence, so the loan is nearly always at position ID - 1
+    size_t pos = (size_t)loanID - 1;
+    if (pos < loanBook.size() && loanBook[pos].loanID == loanID) return &loanBook[pos];
+    for (auto& loan : loanBook) {
+        if (loan.loanID == loanID) return &loan;
+    }
+    return nullptr;
+}
+
+const Loan* BankEngine::findLoanByID(int loanID) const {
+    return const_cast<BankEngine*>(this)->findLoan(loanID);
+}
+
+Loan BankEngine::createLoan(const string& customerName, double amount, double interestRate, int duration) {
+    Loan newLoan;
+    createLoan(customerName, amount, interestRate, duration, string(), newLoan);
+    return newLoan;
+}
+
+// Keyed form: a repeat of the key fills created with the loan the first call made
+OpStatus BankEngine::createLoan(const string& customerName, double amount, double interestRate, int duration,
+                                const string& key, Loan& created) {
+    auto lock = lockForWrite();
+    uint64_t fingerprint = fingerprintField(opFingerprint("create_loan", duration, 0, amount, customerName),
+                                            interestRate);
+    int loanID = 0;
+    OpStatus status = idempotent(key, fingerprint, [&] {
+        Loan newLoan;
+        newLoan.loanID = generateUniqueLoanID();
+        newLoan.customerName = customerName;
+        newLoan.loanAmount = amount;
+        newLoan.interestRate = interestRate;
+        newLoan.duration = duration;
+        newLoan.remainingBalance = amount;
+
+        loanBook.push_back(newLoan);
+        touchLoan(loanBook.size() - 1);
+        loanNames.add(newLoan.loanID, newLoan.customerName);
+        saveLoanBook();
+        loanID = newLoan.loanID;
+        return OP_OK;
+    }, &loanID);
+    if (status == OP_OK) {
+        const Loan* loan = findLoan(loanID);
+        if (loan) created = *loan;
+    }
+    return status;
+}
+
+OpStatus BankEngine::repayLoan(int loanID, double repayment, const string& key) {
+    OpTimer timer(STAT_REPAY);
+    auto lock = lockForWrite();
+    return idempotent(key, opFingerprint("repay", loanID, 0, repayment), [&] {
+        Loan* loan = findLoan(loanID);
+        if (!loan) return timer.reject(OP_NOT_FOUND);
+        if (repayment <= 0) return timer.reject(OP_INVALID_AMOUNT);
+        if (repayment > loan->remainingBalance) return timer.reject(OP_OVERPAYMENT);
+
+        loan->remainingBalance -= repayment;
+        touchLoan(loan - loanBook.data());
+        saveLoanBook();
+        return OP_OK;
+    });
+}
+
+OpStatus BankEngine::createStandingOrder(int srcAccNum, int destAccNum, double amount, int periodSeconds,
+                                         int64_t firstDue, int& orderID, const string& key) {
+    auto lock = lockForWrite();
+    uint64_t fingerprint = opFingerprint("standing_order", srcAccNum, destAccNum, amount,
+                                         to_string(periodSeconds) + " " + to_string(firstDue));
+    return idempotent(key, fingerprint, [&] {
+        if (findAccountIndexByNumber(srcAccNum) == -1) return OP_NOT_FOUND;
+        if (findAccountIndexByNumber(destAccNum) == -1) return OP_DEST_NOT_FOUND;
+        if (srcAccNum == destAccNum) return OP_SAME_ACCOUNT;
+        if (amount <= 0 || periodSeconds <= 0) return OP_INVALID_AMOUNT;
+
+        StandingOrder order{(int)standingOrders.size() + 1, srcAccNum, destAccNum, amount,
+                            periodSeconds, firstDue, 0, false};
+        standingOrders.push_back(order);
+        standingWheel.schedule(order.orderID, order.nextDue);
+        saveStandingOrders();
+        orderID = order.orderID;
+        return OP_OK;
+    }, &orderID);
+}
+
+OpStatus BankEngine::cancelStandingOrder(int orderID, const string& key) {
+    auto lock = lockForWrite();
+    return idempotent(key, opFingerprint("cancel_standing_order", orderID, 0, 0), [&] {
+        if (!findStandingOrder(orderID)) return OP_NOT_FOUND;
+        standingWheel.cancel(orderID);
+        standingOrders[orderID - 1].orderID = 0;
+        saveStandingOrders();
+        return OP_OK;
+    });
+}
+
+const StandingOrder* BankEngine::findStandingOrder(int orderID) const {
+    if (orderID < 1 || orderID > (int)standingOrders.size()) return nullptr;
+    const StandingOrder& order = standingOrders[orderID - 1];
+    return order.orderID == 0 ? nullptr : &order;
+}
+
+// Pay every order due at or before now as one batch, then save once
+StandingOrderReport BankEngine::runStandingOrders(int64_t now) {
+    OpTimer timer(STAT_STANDING_ORDERS);
+    ProfileSpan span("runStandingOrders");
+    auto lock = lockForWrite();
+    StandingOrderReport report;
+    vector<uint32_t> due;
+    standingWheel.advance(now, due);
+    report.due = due.size();
+    if (due.empty()) return report;
+
+    for (uint32_t id : due) {
+        StandingOrder& order = standingOrders[id - 1];
+        OpStatus status = applyTransfer(order.srcAccountNumber, order.destAccountNumber, order.amount);
+        if (status == OP_OK) {
+            order.failures = 0;
+            ++report.paid;
+            report.amountMoved += order.amount;
+        } else {
+            // A vanished account never comes back; frozen or short accounts might
+            bool permanent = status == OP_NOT_FOUND || status == OP_DEST_NOT_FOUND;
+            order.suspended = permanent || ++order.failures >= STANDING_ORDER_MAX_FAILURES;
+            report.failures.push_back({order.orderID, status, order.suspended});
+        }
+        // Periods missed while nothing ran are skipped, not paid in a burst
+        order.nextDue += order.periodSeconds;
+        if (order.nextDue <= now) {
+            order.nextDue += ((now - order.nextDue) / order.periodSeconds + 1) * order.periodSeconds;
+        }
+        if (!order.suspended) standingWheel.schedule(order.orderID, order.nextDue);
+    }
+
+    if (report.paid > 0) {
+        saveAccounts();
+        saveTransactions();
+    }
+    saveStandingOrders();
+    return report;
+}
+
+// Load standing orders and arm every one that is not suspended. Orders keep their
+// IDs; the slots of cancelled ones stay empty.
+void BankEngine::loadStandingOrders() {
+    auto lock = lockForWrite();
+    standingOrders.clear();
+    standingWheel.reset(time(nullptr));
+    ifstream inFile(standingOrdersFile);
+    if (!inFile) return;
+    string line;
+    while (getline(inFile, line)) {
+        istringstream iss(line);
+        StandingOrder order;
+        if (!(iss >> order.orderID >> order.srcAccountNumber >> order.destAccountNumber >> order.amount
+                  >> order.periodSeconds >> order.nextDue >> order.failures >> order.suspended)) continue;
+        if (order.orderID < 1 || order.periodSeconds <= 0) continue;
+        if (order.orderID > (int)standingOrders.size()) {
+            standingOrders.resize(order.orderID, StandingOrder{0, 0, 0, 0, 0, 0, 0, false});
+        }
+        standingOrders[order.orderID - 1] = order;
+        if (!order.suspended) standingWheel.schedule(order.orderID, order.nextDue);
+    }
+}
+
+// One line per order: "id src dest amount period nextDue failures suspended"
+void BankEngine::saveStandingOrders() {
+    ofstream outFile(standingOrdersFile);
+    if (!outFile) {
+        cerr << "Error: Unable to open standing orders file for saving.\n";
+        return;
+    }
+    for (const auto& order : standingOrders) {
+        if (order.orderID == 0) continue;
+        outFile << order.orderID << " " << order.srcAccountNumber << " " << order.destAccountNumber << " "
+                << order.amount << " " << order.periodSeconds << " " << order.nextDue << " "
+                << order.failures << " " << order.suspended << "\n";
+    }
+}
+
+double loanInstallment(const Loan& loan) {
+    if (loan.remainingBalance <= 0) return 0;
+    double installment = loan.duration > 0 ? loan.loanAmount / loan.duration : loan.remainingBalance;
+    return min(installment, loan.remainingBalance);
+}
+
+OpStatus BankEngine::linkLoanAccount(int loanID, int accNum) {
+    auto lock = lockForWrite();
+    Loan* loan = findLoan(loanID);
+    if (!loan) return OP_NOT_FOUND;
+    if (accNum != 0 && findAccountIndexByNumber(accNum) == -1) return OP_DEST_NOT_FOUND;
+    loan->linkedAccountNumber = accNum;
+    touchLoan(loan - loanBook.data());
+    saveLoanBook();
+    return OP_OK;
+}
+
+// Phase 1 splits the loan book into contiguous chunks, one per worker, resolves each
+// loan's linked account and installment, and buckets the debit by partition (account
+// number modulo worker count). Phase 2 gives each worker one partition to apply, so
+// every balance is touched by exactly one thread, and chunk order keeps each account's
+// debits in loan book order. Phase 3 logs and saves everything in one go.
+AutoDebitReport BankEngine::autoDebitLoans(const string& failurePath) {
+    OpTimer timer(STAT_AUTO_DEBIT);
+    ProfileSpan span("autoDebitLoans");
+    auto start = chrono::steady_clock::now();
+    auto lock = lockForWrite();
+    time_t clock = (time_t)interestClock();
+    tm local;
+    localtime_r(&clock, &local);
+    int period = (local.tm_year + 1900) * 100 + local.tm_mon + 1;
+
+    struct Debit {
+        size_t loan;            // Position in loanBook
+        int account;            // Position in accounts, or -1 when unresolved
+        double installment;
+        OpStatus status;
+        double balanceAfter;
+        double interest;        // Interest settled on the account before the debit
+        bool accrued;           // The account's accrual date moved, even if the interest rounded to 0
+    };
+
+    AutoDebitReport report;
+    size_t workers = thread::hardware_concurrency();
+    if (workers == 0) workers = 1;
+    report.workers = workers;
+    auto partitionOf = [workers](int accountNumber) {
+        return (size_t)(unsigned)accountNumber % workers;
+    };
+
+    // buckets[chunk][partition] holds the chunk's debits for that partition
+    vector<vector<vector<Debit>>> buckets(workers, vector<vector<Debit>>(workers));
+    vector<size_t> skipped(workers, 0);
+    vector<thread> pool;
+    size_t chunkSize = (loanBook.size() + workers - 1) / workers;
+    for (size_t w = 0; w < workers; ++w) {
+        pool.emplace_back([&, w]() {
+            ProfileSpan workerSpan("autodebit:resolve");
+            size_t begin = min(w * chunkSize, loanBook.size());
+            size_t end = min(begin + chunkSize, loanBook.size());
+            for (size_t i = begin; i < end; ++i) {
+                const Loan& loan = loanBook[i];
+                double installment = loanInstallment(loan);
+                if (loan.linkedAccountNumber == 0 || installment <= 0) continue;
+                if (loan.lastDebitedPeriod == period) {
+                    ++skipped[w];
+                    continue;
+                }
+                int idx = findAccountIndexByNumber(loan.linkedAccountNumber);
+                OpStatus status = idx == -1 ? OP_NOT_FOUND : (isFrozenAt(idx) ? OP_FROZEN : OP_OK);
+                buckets[w][partitionOf(loan.linkedAccountNumber)].push_back({i, idx, installment, status, 0, 0, false});
+            }
+        });
+    }
+    for (auto& th : pool) th.join();
+    pool.clear();
+    for (size_t count : skipped) report.alreadyDebited += count;
+
+    for (size_t p = 0; p < workers; ++p) {
+        pool.emplace_back([&, p]() {
+            ProfileSpan workerSpan("autodebit:apply");
+            int64_t now = interestClock();
+            for (size_t w = 0; w < workers; ++w) {
+                for (Debit& d : buckets[w][p]) {
+                    if (d.status != OP_OK) continue;
+                    Account& acc = accounts[d.account];
+                    int64_t accruedTo = acc.lastAccrual;
+                    d.interest = accrueInterest(acc, now);
+                    d.accrued = acc.lastAccrual != accruedTo;
+                    if (d.installment > acc.balance) {
+                        d.status = OP_INSUFFICIENT_FUNDS;
+                        d.balanceAfter = acc.balance;
+                        continue;
+                    }
+                    acc.balance -= d.installment;
+                    loanBook[d.loan].remainingBalance -= d.installment;
+                    loanBook[d.loan].lastDebitedPeriod = period;
+                    d.balanceAfter = acc.balance;
+                }
+            }
+        });
+    }
+    for (auto& th : pool) th.join();
+
+    // Gather the results back into loan book order for the log and the report
+    vector<const Debit*> results;
+    for (size_t w = 0; w < workers; ++w) {
+        for (size_t p = 0; p < workers; ++p) {
+            for (const Debit& d : buckets[w][p]) results.push_back(&d);
+        }
+    }
+    sort(results.begin(), results.end(), [](const Debit* a, const Debit* b) { return a->loan < b->loan; });
+
+    int nextID = generateTransactionID();
+    const int firstID = nextID;
+    string now = getCurrentDateTime();
+    for (const Debit* d : results) {
+        const Loan& loan = loanBook[d->loan];
+        if (d->accrued) {
+            touchAccount(d->account);
+            if (d->interest != 0 && logsTransactions()) {
+                double balance = d->status == OP_OK ? d->balanceAfter + d->installment : d->balanceAfter;
+                transactions.push_back({nextID++, loan.linkedAccountNumber, now, "interest", d->interest, balance});
+                publishChange(CHANGE_TRANSACTION, loan.linkedAccountNumber, d->interest, balance, "interest",
+                              nextID - 1);
+            }
+        }
+        if (d->status != OP_OK) {
+            report.failures.push_back({loan.loanID, loan.linkedAccountNumber, d->installment, d->status});
+            continue;
+        }
+        ++report.debited;
+        report.collected += d->installment;
+        touchAccount(d->account);
+        touchLoan(d->loan);
+        int transactionID = 0;
+        if (logsTransactions()) {
+            transactionID = nextID++;
+            transactions.push_back({transactionID, loan.linkedAccountNumber, now, "loan_repayment",
+                                    d->installment, d->balanceAfter});
+        }
+        publishChange(CHANGE_TRANSACTION, loan.linkedAccountNumber, d->installment, d->balanceAfter,
+                      "loan_repayment", transactionID);
+    }
+    report.loans = results.size();
+    if (nextID != firstID) transactionsUnsaved = true;
+
+    if (!results.empty()) {
+        saveAccounts();
+        if (report.debited > 0) saveLoanBook();
+        saveTransactions();
+    }
+    if (!report.failures.empty()) {
+        ofstream out(failurePath);
+        out << "loan_id,account,installment,reason\n";
+        for (const auto& f : report.failures) {
+            out << f.loanID << "," << f.accountNumber << "," << f.installment << "," << opStatusName(f.status) << "\n";
+        }
+        report.failureFile = failurePath;
+    }
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+// Phase 1 checks each transfer on its own (accounts, freezes, amount) and folds it into
+// the net positions of its two accounts. Phase 2 refuses the latest transfers out of
+// every account that cannot cover its net outflow until it can; each refusal lowers the
+// payee's position, so the payee is checked again. Payers then pass the velocity check
+// on everything they still send, however much comes back in; one that fails is frozen
+// and refused every transfer in or out, and phase 2 runs again. Phase 3 logs the cleared
+// transfers in batch order, each with the balance its account settles at, and writes
+// each changed balance once.
+ClearingReport BankEngine::clearTransfers(const vector<BatchTransfer>& batch) {
+    OpTimer timer(STAT_CLEARING);
+    ProfileSpan span("clearTransfers");
+    auto start = chrono::steady_clock::now();
+    auto lock = lockForWrite();
+    ClearingReport report;
+    report.transfers = batch.size();
+    report.statuses.assign(batch.size(), OP_OK);
+
+    struct Position {
+        int index;                  // Position in accounts
+        double available = 0;       // Balance with interest, which is settled only if a transfer clears
+        double net = 0;             // Transfers in less transfers out
+        vector<size_t> outgoing;    // Transfers out, in batch order
+        vector<size_t> incoming;    // Transfers in, in batch order
+    };
+    vector<Position> positions;
+    unordered_map<int, size_t> positionOf;  // Account number -> position
+    auto positionFor = [&](int idx) {
+        auto found = positionOf.emplace(accounts[idx].accountNumber, positions.size());
+        if (found.second) {
+            positions.emplace_back();
+            positions.back().index = idx;
+            positions.back().available = balanceWithInterest(accounts[idx]);
+        }
+        return found.first->second;
+    };
+    vector<size_t> srcPos(batch.size()), destPos(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+        const BatchTransfer& t = batch[i];
+        OpStatus& status = report.statuses[i];
+        int srcIdx = findAccountIndexByNumber(t.srcAccountNumber);
+        int destIdx = findAccountIndexByNumber(t.destAccountNumber);
+        if (srcIdx == -1) status = OP_NOT_FOUND;
+        else if (isFrozenAt(srcIdx)) status = OP_FROZEN;
+        else if (destIdx == -1) status = OP_DEST_NOT_FOUND;
+        else if (isFrozenAt(destIdx)) status = OP_DEST_FROZEN;
+        else if (t.srcAccountNumber == t.destAccountNumber) status = OP_SAME_ACCOUNT;
+        else if (t.amount <= 0) status = OP_INVALID_AMOUNT;
+        if (status != OP_OK) continue;
+        srcPos[i] = positionFor(srcIdx);
+        destPos[i] = positionFor(destIdx);
+        positions[srcPos[i]].net -= t.amount;
+        positions[destPos[i]].net += t.amount;
+        positions[srcPos[i]].outgoing.push_back(i);
+        positions[destPos[i]].incoming.push_back(i);
+    }
+
+    vector<size_t> pending;     // Positions to check for cover
+    vector<bool> charged(batch.size(), false); // Counted against the velocity limits
+    for (size_t k = 0; k < positions.size(); ++k) pending.push_back(k);
+    auto refuse = [&](size_t i, OpStatus status) {
+        if (report.statuses[i] != OP_OK) return;
+        report.statuses[i] = status;
+        positions[srcPos[i]].net += batch[i].amount;
+        positions[destPos[i]].net -= batch[i].amount;
+        pending.push_back(destPos[i]);
+    };
+    while (!pending.empty()) {
+        while (!pending.empty()) {
+            Position& p = positions[pending.back()];
+            pending.pop_back();
+            while (-p.net > p.available && !p.outgoing.empty()) {
+                size_t i = p.outgoing.back();
+                p.outgoing.pop_back();
+                refuse(i, OP_INSUFFICIENT_FUNDS);
+            }
+        }
+        if (!velocity.enabled()) break;
+        // Each transfer out is one debit, charged in batch order as if posted alone
+        for (Position& p : positions) {
+            auto over = find_if(p.outgoing.begin(), p.outgoing.end(), [&](size_t i) {
+                if (report.statuses[i] != OP_OK || charged[i]) return false;
+                charged[i] = true;
+                return !velocity.allow(accounts[p.index].accountNumber, batch[i].amount, velocityClockNs());
+            });
+            if (over == p.outgoing.end()) continue;
+            // Frozen mid-batch: nothing from this transfer on moves through the account,
+            // in either direction
+            size_t frozenAt = *over;
+            applyFrozen(p.index, true);
+            for (auto it = over; it != p.outgoing.end(); ++it) refuse(*it, OP_VELOCITY_LIMIT);
+            p.outgoing.erase(over, p.outgoing.end());
+            auto later = find_if(p.incoming.begin(), p.incoming.end(), [&](size_t i) { return i > frozenAt; });
+            for (auto it = later; it != p.incoming.end(); ++it) refuse(*it, OP_DEST_FROZEN);
+            p.incoming.erase(later, p.incoming.end());
+        }
+    }
+    // Adding and backing out amounts leaves rounding behind, so net is summed again
+    // from the transfers that cleared; one whose transfers were all refused ends at 0
+    for (Position& p : positions) p.net = 0;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (report.statuses[i] != OP_OK) continue;
+        positions[srcPos[i]].net -= batch[i].amount;
+        positions[destPos[i]].net += batch[i].amount;
+    }
+
+    vector<bool> touched(positions.size(), false);
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (report.statuses[i] == OP_OK) touched[srcPos[i]] = touched[destPos[i]] = true;
+    }
+    // The batch settles as one netted posting per account, so every record carries the
+    // balance its account ends at; a running balance in batch order could dip below zero
+    // on the way to a covered position
+    vector<double> settled(positions.size());
+    for (size_t k = 0; k < positions.size(); ++k) {
+        if (touched[k]) settleInterest(positions[k].index);
+        settled[k] = accounts[positions[k].index].balance + positions[k].net;
+    }
+    int nextID = generateTransactionID();
+    string now = getCurrentDateTime();
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (report.statuses[i] != OP_OK) continue;
+        const BatchTransfer& t = batch[i];
+        double srcBalance = settled[srcPos[i]];
+        double destBalance = settled[destPos[i]];
+        int outID = 0, inID = 0;
+        if (logsTransactions()) {
+            outID = nextID++;
+            inID = nextID++;
+            transactions.push_back({outID, t.srcAccountNumber, now, "transfer_out", t.amount, srcBalance});
+            transactions.push_back({inID, t.destAccountNumber, now, "transfer_in", t.amount, destBalance});
+            transactionsUnsaved = true;
+        }
+        publishChange(CHANGE_TRANSACTION, t.srcAccountNumber, t.amount, srcBalance, "transfer_out", outID);
+        publishChange(CHANGE_TRANSACTION, t.destAccountNumber, t.amount, destBalance, "transfer_in", inID);
+        ++report.cleared;
+        report.gross += t.amount;
+    }
+    for (size_t k = 0; k < positions.size(); ++k) {
+        const Position& p = positions[k];
+        if (p.net < 0) report.net -= p.net;
+        if (p.net == 0) continue;
+        accounts[p.index].balance = settled[k];
+        touchAccount(p.index);
+        ++report.accounts;
+    }
+
+    if (!positions.empty()) {
+        saveAccounts();
+        saveTransactions();
+    }
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+void BankEngine::replaceAll(vector<Account> newAccounts, vector<Loan> newLoans,
+                            vector<Transaction> newTransactions) {
+    auto lock = lockForWrite();
+    waitForTransactions();
+    accounts = move(newAccounts);
+    loanBook = move(newLoans);
+    transactions = move(newTransactions);
+    rebuildAccountIndex();
+    if (format == FileFormat::Extended) {
+        int64_t now = interestClock();
+        for (auto& acc : accounts) {
+            if (acc.lastAccrual == 0) acc.lastAccrual = now;
+        }
+    }
+    loanVersions.touchAll();
+    loanRanks.clear();
+    loanNames.clear();
+    resyncPending = true;
+    for (const auto& loan : loanBook) {
+        loanRanks.set(loan.loanID, loan.remainingBalance);
+        loanNames.add(loan.loanID, loan.customerName);
+    }
+    velocity.clear();
+}
+
+// Signed effect of a transaction on its account's balance
+static double signedAmount(const Transaction& t) {
+    if (t.type == "withdrawal" || t.type == "transfer_out" || t.type == "loan_repayment") return -t.amount;
+    return t.amount;
+}
+
+// Render one account's statement for the given month into out
+static void writeStatement(ostream& out, const Account& acc, bool frozen, const string& month,
+                           const vector<const Transaction*>& entries) {
+    out << "Monthly Statement: " << month << "\n"
+        << "Account Number: " << acc.accountNumber << "\n"
+        << "Customer Name: " << acc.customerName << "\n"
+        << "Status: " << (frozen ? "Frozen" : "Active") << "\n"
+        << "-----------------------------------------------------------------\n";
+    if (entries.empty()) {
+        out << "No transactions for this period.\n"
+            << "Current Balance: " << acc.balance << "\n";
+    } else {
+        out << "ID\tDate & Time\t\tType\t\tAmount\tBalance After\n";
+        for (const Transaction* t : entries) {
+            out << t->transactionID << "\t" << t->dateTime << "\t" << t->type << "\t\t"
+                << t->amount << "\t" << t->balanceAfter << "\n";
+        }
+        const Transaction* first = entries.front();
+        out << "-----------------------------------------------------------------\n"
+            << "Opening Balance: " << first->balanceAfter - signedAmount(*first) << "\n"
+            << "Closing Balance: " << entries.back()->balanceAfter << "\n"
+            << "Transactions: " << entries.size() << "\n";
+    }
+    out << "=================================================================\n";
+}
+
+// Phase 1 splits `transactions` into contiguous chunks, one per worker, and buckets each
+// matching entry by partition (account number modulo worker count). Phase 2 gives each
+// worker one partition to group by account and write out, so no locking is needed and
+// chunk order keeps every account's entries in their original order.
+StatementReport BankEngine::generateStatements(const string& month, bool combinedFile) {
+    ProfileSpan span("generateStatements");
+    mkdir(statementsDir.c_str(), 0755); // Fails harmlessly if the directory already exists
+    auto start = chrono::steady_clock::now();
+    settleAllInterest(); // Statements show interest up to today
+    waitForTransactions();
+    AccountSnapshot book = snapshotAccounts();
+
+    StatementReport report;
+    size_t workers = thread::hardware_concurrency();
+    if (workers == 0) workers = 1;
+    report.workers = workers;
+    report.scanned = transactions.size();
+    auto partitionOf = [workers](int accountNumber) {
+        return (size_t)(unsigned)accountNumber % workers;
+    };
+
+    // buckets[chunk][partition] holds the chunk's matching transactions for that partition
+    vector<vector<vector<const Transaction*>>> buckets(workers, vector<vector<const Transaction*>>(workers));
+    vector<thread> pool;
+    size_t chunkSize = (transactions.size() + workers - 1) / workers;
+    for (size_t w = 0; w < workers; ++w) {
+        pool.emplace_back([&, w]() {
+            ProfileSpan workerSpan("statements:scan");
+            size_t begin = min(w * chunkSize, transactions.size());
+            size_t end = min(begin + chunkSize, transactions.size());
+            for (size_t i = begin; i < end; ++i) {
+                const Transaction& t = transactions[i];
+                if (t.dateTime.compare(0, month.size(), month) == 0) {
+                    buckets[w][partitionOf(t.accountNumber)].push_back(&t);
+                }
+            }
+        });
+    }
+    for (auto& th : pool) th.join();
+    pool.clear();
+
+    vector<string> combined(workers);
+    vector<size_t> statementCount(workers, 0);
+    vector<size_t> entryCount(workers, 0);
+    for (size_t p = 0; p < workers; ++p) {
+        pool.emplace_back([&, p]() {
+            ProfileSpan workerSpan("statements:write");
+            unordered_map<int, vector<const Transaction*>> byAccount;
+            for (size_t w = 0; w < workers; ++w) {
+                for (const Transaction* t : buckets[w][p]) {
+                    byAccount[t->accountNumber].push_back(t);
+                }
+                entryCount[p] += buckets[w][p].size();
+            }
+
+            const vector<const Transaction*> none;
+            ostringstream merged;
+            for (size_t i = 0; i < book.accounts.size(); ++i) {
+                const Account& acc = book.accounts[i];
+                if (book.isClosedAt(i) || partitionOf(acc.accountNumber) != p) continue;
+                auto it = byAccount.find(acc.accountNumber);
+                const vector<const Transaction*>& entries = (it == byAccount.end()) ? none : it->second;
+                if (combinedFile) {
+                    writeStatement(merged, acc, book.isFrozenAt(i), month, entries);
+                } else {
+                    string fileName = statementsDir + "/" + to_string(acc.accountNumber) + "_" + month + ".txt";
+                    ofstream outFile(fileName);
+                    writeStatement(outFile, acc, book.isFrozenAt(i), month, entries);
+                }
+                ++statementCount[p];
+            }
+            combined[p] = merged.str();
+        });
+    }
+    for (auto& th : pool) th.join();
+
+    for (size_t p = 0; p < workers; ++p) {
+        report.statements += statementCount[p];
+        report.entries += entryCount[p];
+    }
+
+    report.target = statementsDir + "/";
+    if (combinedFile) {
+        report.target += "statements_" + month + ".txt";
+        ofstream outFile(report.target);
+        for (const auto& part : combined) outFile << part;
+        outFile.close();
+    }
+
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    report.peakMemoryMb = usage.ru_maxrss / 1024.0;
+    return report;
+}
+
+// Fixed-capacity lock-free hash set of account numbers for the bulk import. Each
+// number remembers the lowest row that inserted it, so which of several duplicate
+// rows is kept does not depend on thread timing.
+class FirstRowSet {
+public:
+    explicit FirstRowSet(size_t expected) {
+        capacity = 16;
+        while (capacity < expected * 2) capacity *= 2;
+        keys.reset(new atomic<int64_t>[capacity]);
+        rows.reset(new atomic<uint32_t>[capacity]);
+        for (size_t i = 0; i < capacity; ++i) {
+            keys[i].store(EMPTY_KEY, memory_order_relaxed);
+            rows[i].store(UINT32_MAX, memory_order_relaxed);
+        }
+    }
+
+    void insert(int key, uint32_t row) {
+        size_t i = slotOf(key);
+        while (true) {
+            int64_t current = keys[i].load(memory_order_acquire);
+            if (current == EMPTY_KEY &&
+                keys[i].compare_exchange_strong(current, key, memory_order_acq_rel)) {
+                current = key;
+            }
+            if (current == key) {
+                uint32_t seen = rows[i].load(memory_order_relaxed);
+                while (row < seen && !rows[i].compare_exchange_weak(seen, row, memory_order_relaxed)) {}
+                return;
+            }
+            i = (i + 1) & (capacity - 1);
+        }
+    }
+
+    // Lowest row that inserted key; only meaningful once every insert has finished
+    uint32_t firstRow(int key) const {
+        for (size_t i = slotOf(key); ; i = (i + 1) & (capacity - 1)) {
+            int64_t current = keys[i].load(memory_order_acquire);
+            if (current == key) return rows[i].load(memory_order_relaxed);
+            if (current == EMPTY_KEY) return UINT32_MAX;
+        }
+    }
+
+private:
+    static const int64_t EMPTY_KEY = INT64_MIN; // Outside the range of int account numbers
+    size_t slotOf(int key) const { return ((uint32_t)key * 2654435769u) & (capacity - 1); }
+
+    size_t capacity;
+    unique_ptr<atomic<int64_t>[]> keys;
+    unique_ptr<atomic<uint32_t>[]> rows;
+};
+
+// Split one CSV line into fields; a field may be double-quoted, with "" for a quote
+static vector<string> splitCsvLine(const char* begin, const char* end) {
+    vector<string> fields(1);
+    bool quoted = false;
+    for (const char* p = begin; p < end; ++p) {
+        if (quoted) {
+            if (*p == '"' && p + 1 < end && p[1] == '"') { fields.back() += '"'; ++p; }
+            else if (*p == '"') quoted = false;
+            else fields.back() += *p;
+        } else if (*p == '"') {
+            quoted = true;
+        } else if (*p == ',') {
+            fields.emplace_back();
+        } else if (*p != '\r') {
+            fields.back() += *p;
+        }
+    }
+    return fields;
+}
+
+// Parse a whole field as a number; false on trailing text or overflow
+static bool parseIntField(const string& text, int& value) {
+    string field = trim(text);
+    if (field.empty()) return false;
+    char* end;
+    errno = 0;
+    long parsed = strtol(field.c_str(), &end, 10);
+    if (*end != '\0' || errno != 0 || parsed < INT_MIN || parsed > INT_MAX) return false;
+    value = (int)parsed;
+    return true;
+}
+
+static bool parseDoubleField(const string& text, double& value) {
+    string field = trim(text);
+    if (field.empty()) return false;
+    char* end;
+    value = strtod(field.c_str(), &end);
+    return *end == '\0' && isfinite(value);
+}
+
+// One CSV data row as parsed and validated by an import worker
+struct ImportRow {
+    const char* begin;
+    const char* end;
+    size_t lineNumber;
+    Account account;
+    bool frozen = false;
+    string error;               // Empty while the row is still accepted
+};
+
+// Validate one row's fields into row.account, or set row.error
+static void parseImportRow(ImportRow& row) {
+    vector<string> fields = splitCsvLine(row.begin, row.end);
+    if (fields.size() < 4 || fields.size() > 5) {
+        row.error = "expected 4 or 5 fields, found " + to_string(fields.size());
+        return;
+    }
+    Account& acc = row.account;
+    acc.customerName = trim(fields[1]);
+    int frozenInt = 0;
+    if (!parseIntField(fields[0], acc.accountNumber) || acc.accountNumber <= 0) {
+        row.error = "invalid account number";
+    } else if (acc.customerName.empty()) {
+        row.error = "missing customer name";
+    } else if (acc.customerName.find('|') != string::npos) {
+        row.error = "customer name contains '|'";
+    } else if (!parseDoubleField(fields[2], acc.balance) || acc.balance < 0) {
+        row.error = "invalid balance";
+    } else if (!parseDoubleField(fields[3], acc.interestRate) || acc.interestRate < 0) {
+        row.error = "invalid interest rate";
+    } else if (fields.size() == 5 && (!parseIntField(fields[4], frozenInt) || frozenInt < 0 || frozenInt > 1)) {
+        row.error = "frozen flag must be 0 or 1";
+    }
+    row.frozen = (frozenInt == 1);
+}
+
+ImportReport BankEngine::importAccounts(const string& csvPath, const string& rejectPath) {
+    OpTimer timer(STAT_IMPORT);
+    ProfileSpan span("importAccounts");
+    auto start = chrono::steady_clock::now();
+    ImportReport report;
+
+    ifstream inFile(csvPath, ios::binary);
+    if (!inFile) {
+        report.opened = false;
+        return report;
+    }
+    string data((istreambuf_iterator<char>(inFile)), istreambuf_iterator<char>());
+    inFile.close();
+
+    // Line boundaries; a first line that does not start with a number is a header
+    vector<ImportRow> rows;
+    rows.reserve(count(data.begin(), data.end(), '\n') + 1);
+    size_t lineNumber = 0;
+    for (size_t pos = 0; pos < data.size();) {
+        size_t newline = data.find('\n', pos);
+        if (newline == string::npos) newline = data.size();
+        ++lineNumber;
+        ImportRow row;
+        row.begin = data.data() + pos;
+        row.end = data.data() + newline;
+        row.lineNumber = lineNumber;
+        pos = newline + 1;
+        const char* p = row.begin;
+        while (p < row.end && (*p == ' ' || *p == '\r')) ++p;
+        if (p == row.end) continue;
+        int firstField;
+        if (lineNumber == 1 && !parseIntField(splitCsvLine(row.begin, row.end)[0], firstField)) continue;
+        rows.push_back(move(row));
+    }
+    report.rows = rows.size();
+
+    auto lock = lockForWrite(); // The workers read the account index, so hold off writers
+    size_t workers = thread::hardware_concurrency();
+    if (workers == 0) workers = 1;
+    report.workers = workers;
+    size_t chunkSize = (rows.size() + workers - 1) / workers;
+    FirstRowSet seen(rows.size());
+
+    // Pass 1: parse, validate and check against the book; register survivors in the set
+    vector<thread> pool;
+    for (size_t w = 0; w < workers; ++w) {
+        pool.emplace_back([&, w]() {
+            ProfileSpan workerSpan("import:parse");
+            size_t begin = min(w * chunkSize, rows.size());
+            size_t end = min(begin + chunkSize, rows.size());
+            for (size_t i = begin; i < end; ++i) {
+                ImportRow& row = rows[i];
+                parseImportRow(row);
+                if (row.error.empty() && accountStore.isOpen() && !AccountStore::fitsName(row.account.customerName)) {
+                    row.error = "customer name longer than the account store holds";
+                }
+                if (!row.error.empty()) continue;
+                auto existing = accountIndex.find(row.account.accountNumber);
+                if (existing != accountIndex.end()) {
+                    bool closed = existing->second == RETIRED || isClosedAt(existing->second);
+                    row.error = closed ? "account number belongs to a closed account"
+                                       : "account number already exists";
+                    continue;
+                }
+                seen.insert(row.account.accountNumber, (uint32_t)i);
+            }
+        });
+    }
+    for (auto& th : pool) th.join();
+    pool.clear();
+
+    // Pass 2: of rows sharing a number, only the first in the file is kept
+    for (size_t w = 0; w < workers; ++w) {
+        pool.emplace_back([&, w]() {
+            ProfileSpan workerSpan("import:dedupe");
+            size_t begin = min(w * chunkSize, rows.size());
+            size_t end = min(begin + chunkSize, rows.size());
+            for (size_t i = begin; i < end; ++i) {
+                ImportRow& row = rows[i];
+                if (!row.error.empty()) continue;
+                uint32_t first = seen.firstRow(row.account.accountNumber);
+                if (first != i) row.error = "duplicate of line " + to_string(rows[first].lineNumber);
+            }
+        });
+    }
+    for (auto& th : pool) th.join();
+
+    // Commit the accepted rows in file order with a single save
+    ofstream rejects;
+    for (const ImportRow& row : rows) {
+        if (row.error.empty()) {
+            appendAccount(row.account, row.frozen);
+            publishChange(CHANGE_ACCOUNT_OPENED, row.account.accountNumber, row.account.balance,
+                          row.account.balance);
+            ++report.imported;
+            continue;
+        }
+        if (!rejects.is_open()) {
+            rejects.open(rejectPath);
+            if (rejects) report.rejectFile = rejectPath;
+            else cerr << "Error: Unable to open " << rejectPath << " for the reject report.\n";
+            rejects << "line,reason,row\n";
+        }
+        rejects << row.lineNumber << ",\"" << row.error << "\",\"";
+        for (const char* p = row.begin; p < row.end; ++p) {
+            if (*p == '"') rejects << "\"\"";
+            else if (*p != '\r') rejects << *p;
+        }
+        rejects << "\"\n";
+        ++report.rejected;
+    }
+    if (report.imported > 0) saveAccounts();
+
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return report;
+}
@@ -0,0 +1,561 @@
+// BankEngine: the account, loan and transaction logic shared by every entry point.
+// The interactive programs (bank.cpp, banksystem.cpp) and the benchmark/load tools
+// (bankbench.cpp) are frontends over this class; nothing in here prompts or reads cin.
+#ifndef BANKENGINE_H
+#define BANKENGINE_H
+
+#include "bankcdc.h"
+#include "bankcolumns.h"
+#include "bankidempotency.h"
+#include "bankrank.h"
+#include "bankreplica.h"
+#include "banksearch.h"
+#include "bankschedule.h"
+#include "banksnapshot.h"
+#include "bankstore.h"
+#include "bankvelocity.h"
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Structure to represent a bank account with account number, customer name, balance and interest rate.
+// Frozen status is kept by the engine in a bitmap beside the account index (see BankEngine::isFrozen).
+struct Account {
+    int accountNumber;          // Unique account number assigned by user
+    std::string customerName;   // Name of the account holder
+    double balance;             // Current balance in the account
+    double interestRate;        // Annual interest rate in percentage
+    int64_t lastAccrual = 0;    // Unix time interest was compounded up to (extended format only)
+};
+
+// Structure to represent a transaction with ID, date/time, type, amount, and balance after transaction
+struct Transaction {
+    int transactionID;
+    int accountNumber;
+    std::string dateTime;
+    std::string type;           // deposit, withdrawal, transfer_in, transfer_out, loan_repayment
+    double amount;
+    double balanceAfter;
+};
+
+// Structure to represent a loan with loan ID, customer name, loan amount, interest rate, duration, and remaining balance
+struct Loan {
+    int loanID;                 // Unique loan identifier generated automatically
+    std::string customerName;   // Name of the loan customer
+    double loanAmount;          // Original loan amount
+    double interestRate;        // Interest rate for the loan in percentage
+    int duration;               // Duration of the loan in months
+    double remainingBalance;    // Remaining balance to be repaid
+    int linkedAccountNumber = 0; // Account monthly auto-debits are taken from; 0 for none
+    int lastDebitedPeriod = 0;  // Month of the last auto-debit collected, as YYYYMM; 0 for none
+};
+
+// Monthly installment of a loan: the amount spread evenly over its duration, or
+// whatever remains if that is less
+double loanInstallment(const Loan& loan);
+
+// Result codes returned by the engine operations
+enum OpStatus {
+    OP_OK,
+    OP_NOT_FOUND,           // Account, loan (or transfer source) does not exist
+    OP_DEST_NOT_FOUND,      // Transfer destination does not exist
+    OP_FROZEN,              // Account (or transfer source) is frozen
+    OP_DEST_FROZEN,         // Transfer destination is frozen
+    OP_INVALID_AMOUNT,      // Amount is zero or negative
+    OP_INSUFFICIENT_FUNDS,  // Balance does not cover the amount
+    OP_SAME_ACCOUNT,        // Transfer source and destination are identical
+    OP_NO_CHANGE,           // Account is already in the requested frozen state
+    OP_OVERPAYMENT,         // Repayment exceeds the loan's remaining balance
+    OP_DUPLICATE_ACCOUNT,   // Account number is already in use
+    OP_VELOCITY_LIMIT,      // Debit would cross the velocity limits; the account is now frozen
+    OP_CLOSED,              // Account number belongs to a closed account and cannot be reused
+    OP_KEY_REUSED,          // Idempotency key was already used for a different request
+    OP_INVALID_KEY,         // Idempotency key is empty-looking, too long or contains whitespace
+    OP_UNAVAILABLE,         // The shard holding the account could not be reached
+    OP_KEY_IN_DOUBT,        // The key's first attempt was cut off by a crash; it may or may not have happened
+    OP_NAME_TOO_LONG,       // Customer name does not fit in the account store's records
+    OP_STATUS_COUNT         // Number of status codes (not a status)
+};
+
+// Short machine-readable name of a status, e.g. "insufficient_funds"
+const char* opStatusName(OpStatus status);
+
+// On-disk layouts the engine can read and write
+enum class FileFormat {
+    Basic,      // bank.cpp: "number name|balance rate", loans alike, no transaction log
+    Extended    // banksystem.cpp: adds the frozen flag and transactions.txt
+};
+
+// Outcome of one bulk freeze or unfreeze
+struct BulkFreezeReport {
+    size_t requested = 0;       // Account numbers in the list
+    size_t changed = 0;         // Accounts whose status flipped
+    size_t unchanged = 0;       // Already in the requested state, or listed twice
+    std::vector<int> notFound;  // Listed numbers with no account
+};
+
+// Outcome of one bulk account import
+struct ImportReport {
+    bool opened = true;         // False if the CSV file could not be read
+    size_t rows = 0;            // Data rows read (header and blank lines excluded)
+    size_t imported = 0;        // Accounts created
+    size_t rejected = 0;        // Rows written to the reject report
+    size_t workers = 0;         // Threads used for validation
+    double seconds = 0;         // Wall time for the whole import
+    std::string rejectFile;     // Reject report path, empty if nothing was rejected
+};
+
+// Summary of one statement generation run
+struct StatementReport {
+    size_t statements = 0;      // Statements written (one per account)
+    size_t scanned = 0;         // Transactions examined
+    size_t entries = 0;         // Transactions that fell in the month
+    size_t workers = 0;         // Threads used
+    double seconds = 0;         // Wall time for the whole run
+    double peakMemoryMb = 0;    // Process RSS high-water mark afterwards
+    std::string target;         // Output directory or combined file
+};
+
+// A recurring transfer run by the standing-order scheduler
+struct StandingOrder {
+    int orderID;                // Unique standing order ID; 0 marks a cancelled order
+    int srcAccountNumber;       // Account paying
+    int destAccountNumber;      // Account paid
+    double amount;              // Amount moved each period
+    int periodSeconds;          // Time between payments
+    int64_t nextDue;            // Unix time of the next payment
+    int failures;               // Consecutive failed payments
+    bool suspended;             // Stopped after repeated or permanent failures
+};
+
+// A standing order payment that did not go through
+struct StandingOrderFailure {
+    int orderID;
+    OpStatus status;            // Why the transfer was refused
+    bool suspended;             // The order will not be tried again
+};
+
+// Outcome of one standing order run
+struct StandingOrderReport {
+    size_t due = 0;             // Orders that came due
+    size_t paid = 0;            // Transfers made
+    double amountMoved = 0;     // Total of the transfers made
+    std::vector<StandingOrderFailure> failures;
+};
+
+// A loan installment the auto-debit run could not collect
+struct AutoDebitFailure {
+    int loanID;
+    int accountNumber;          // Linked account that was to be debited
+    double installment;         // Amount that was due
+    OpStatus status;            // Why the debit was refused
+};
+
+// Outcome of one loan auto-debit run
+struct AutoDebitReport {
+    size_t loans = 0;           // Outstanding loans with a linked account
+    size_t alreadyDebited = 0;  // Loans skipped because this month was already collected
+    size_t debited = 0;         // Installments collected
+    double collected = 0;       // Total of the installments collected
+    size_t workers = 0;         // Threads used
+    double seconds = 0;         // Wall time for the whole run
+    std::vector<AutoDebitFailure> failures;
+    std::string failureFile;    // Failed-debit report path, empty if nothing failed
+};
+
+// One transfer in a batch submitted for clearing
+struct BatchTransfer {
+    int srcAccountNumber;
+    int destAccountNumber;
+    double amount;
+};
+
+// Outcome of clearing one batch of transfers
+struct ClearingReport {
+    size_t transfers = 0;       // Transfers in the batch
+    size_t cleared = 0;         // Transfers that went through
+    size_t accounts = 0;        // Accounts whose balance changed
+    double gross = 0;           // Total of the transfers cleared
+    double net = 0;             // Money that actually changed accounts: the sum of net outflows
+    double seconds = 0;         // Wall time for the whole run
+    std::vector<OpStatus> statuses; // One per transfer, in batch order
+};
+
+// One account holder or loan customer found by a fuzzy name search
+struct NameSearchHit {
+    bool loan;                  // A loan's customer rather than an account holder
+    int id;                     // Account number or loan ID
+    std::string customerName;
+    int distance;               // Typos between the query and the name, or one word of it
+    bool wholeName;             // The whole name matched, not just one word of it
+};
+
+// Point-in-time view of the accounts for reports. It never changes however long it is
+// held, and holding it does not slow writers down.
+struct AccountSnapshot {
+    PagedSnapshot<Account> accounts;
+    std::vector<uint64_t> frozenBits;
+    std::vector<uint64_t> closedBits;
+    size_t liveCount = 0;       // Accounts that are not closed
+
+    bool isFrozenAt(size_t index) const { return (frozenBits[index >> 6] >> (index & 63)) & 1; }
+    bool isClosedAt(size_t index) const { return (closedBits[index >> 6] >> (index & 63)) & 1; }
+};
+
+// Pointers and references handed out by the engine stay valid until the next call
+// that changes accounts; a finished background compaction is installed at that point.
+class BankEngine {
+public:
+    explicit BankEngine(FileFormat format = FileFormat::Extended, const std::string& dataDir = ".");
+    ~BankEngine();
+
+    // Persistence: each file is rewritten in full by its save function. With
+    // transactionsInBackground, loadAll returns once everything else is loaded and
+    // transactions.txt is read on a background thread; the first call that needs the
+    // whole log (a transaction being logged, a save, getTransactions) waits for it.
+    void loadAll(bool transactionsInBackground = false);
+    void saveAll();
+    void loadAccounts();
+    void saveAccounts();
+    void loadLoanBook();
+    void saveLoanBook();
+    void loadTransactions();
+    void loadTransactionsInBackground();
+    bool transactionsLoaded() const { return !transactionsLoading; }
+    void waitForTransactions();
+    void saveTransactions();
+
+    // Account queries; indexes are positions in getAccounts(), which also holds closed
+    // accounts until compaction reclaims them (skip those with isClosedAt). A closed
+    // account is not found by the lookups, but its number still "exists" as retired.
+    bool accountNumberExists(int accountNumber) const;
+    int findAccountIndexByNumber(int accountNumber) const;
+    int findAccountIndexByName(const std::string& name) const;
+    // Every live account and every loan under a name, ignoring case and spacing, in
+    // the order they were opened
+    const std::vector<int>& findAccountNumbersByName(const std::string& name) const {
+        return accountNames.lookup(name);
+    }
+    const std::vector<int>& findLoanIDsByName(const std::string& name) const { return loanNames.lookup(name); }
+    const Account* findAccount(int accountNumber) const;
+    bool isFrozen(int accountNumber) const;
+    bool isFrozenAt(size_t index) const { return (frozenBits[index >> 6] >> (index & 63)) & 1; }
+    bool isClosedAt(size_t index) const { return (closedBits[index >> 6] >> (index & 63)) & 1; }
+    size_t liveAccountCount() const { return accounts.size() - tombstones; }
+    const std::vector<Account>& getAccounts() const { return accounts; }
+    // While transactions are still loading, reads just this account's lines from the
+    // file rather than waiting for the rest. Safe to call from any thread, like the
+    // snapshots.
+    std::vector<Transaction> getTransactionHistory(int accountNumber);
+    const std::vector<Transaction>& getTransactions();
+
+    // Live accounts ranked by posted balance and loans by remaining balance, kept in
+    // step by every write, so top-N, rank and percentile queries need no sort
+    // (accrued interest counts once it is posted). Read them like getAccounts().
+    const RankIndex& balanceRanking() const { return balanceRanks; }
+    const RankIndex& loanRanking() const { return loanRanks; }
+
+    // Filter and aggregate over live accounts, e.g. frozen accounts with balance > X:
+    // a vectorized scan of the balance, rate and status columns, split across threads
+    // for large books. Selected account numbers are appended to matches if given.
+    AccountAggregate queryAccounts(const AccountQuery& query, AccountField aggregate = AccountField::Balance,
+                                   std::vector<int>* matches = nullptr) const;
+
+    // Typo-tolerant search over live account holders' and loan customers' names,
+    // closest first (see NameIndex::search for the distance used when negative)
+    std::vector<NameSearchHit> searchCustomerNames(const std::string& query, int maxDistance = -1) const;
+
+    // Snapshot reads for reports: safe to take from any thread and to hold while
+    // writes continue. Only pages written since the previous snapshot are copied.
+    AccountSnapshot snapshotAccounts();
+    PagedSnapshot<Loan> snapshotLoans();
+
+    // Account operations; each persists its change before returning OP_OK.
+    // A non-empty idempotencyKey makes the call safe to retry: the first result is
+    // remembered for the key's lifetime and a repeat returns it without acting again.
+    OpStatus createAccount(const Account& account, const std::string& idempotencyKey = std::string());
+    OpStatus deposit(int accountNumber, double amount, const std::string& idempotencyKey = std::string());
+    OpStatus withdraw(int accountNumber, double amount, const std::string& idempotencyKey = std::string());
+    OpStatus transfer(int srcAccountNumber, int destAccountNumber, double amount,
+                      const std::string& idempotencyKey = std::string());
+    OpStatus addInterest(int accountNumber, const std::string& idempotencyKey = std::string());
+
+    // The two phases of one side of a transfer whose other account is kept by another
+    // engine (a cross-shard transfer, see bankshard.h). prepareTransferLeg runs this
+    // side's transfer checks, with `reserved` already promised to other prepared
+    // debits, and counts a debit against the velocity limits; nothing else changes.
+    // commitTransferLeg then moves the money, logs transfer_out or transfer_in and
+    // saves; it fails only if the account has been closed since.
+    OpStatus prepareTransferLeg(int accountNumber, double amount, bool outgoing, double reserved);
+    OpStatus commitTransferLeg(int accountNumber, double amount, bool outgoing,
+                               const std::string& idempotencyKey = std::string());
+
+    // Interest in the extended format compounds daily and lazily: each account keeps
+    // the time it was last accrued to, and the days since are compounded in whenever
+    // a write touches the account, when its statement is generated, or when it is
+    // settled explicitly (addInterest settles instead of adding a year of simple
+    // interest). Idle accounts cost nothing until then.
+    double balanceWithInterest(const Account& account) const;
+    size_t settleAllInterest();
+    void setInterestClock(int64_t (*clock)()) { interestClock = clock; }
+    OpStatus setFrozen(int accountNumber, bool frozen, const std::string& idempotencyKey = std::string());
+    void deleteAllAccounts();
+
+    // Closing is O(1): the record is tombstoned in place and appended to
+    // closed_accounts.txt for audit, and its number stays retired, in the basic format
+    // too (bank.cpp could reuse a closed number when closure erased the record). The
+    // final interest posting is saved before it returns. Once tombstones
+    // reach the threshold (0 disables compaction), a background thread builds a copy
+    // of the book without them; readers carry on meanwhile and writers wait.
+    OpStatus closeAccount(int accountNumber, const std::string& idempotencyKey = std::string());
+    void setCompactionThreshold(size_t tombstoneCount) { compactionThreshold = tombstoneCount; }
+    size_t tombstoneCount() const { return tombstones; }
+    void waitForCompaction();
+
+    // Freeze or unfreeze every listed account and save once at the end, so the
+    // whole list lands in a single rewrite of the accounts file
+    BulkFreezeReport setFrozenBulk(const std::vector<int>& accountNumbers, bool frozen);
+
+    // Create accounts from a CSV of "number,name,balance,rate[,frozen]" rows (an optional
+    // header line is skipped). Rows are validated and checked for duplicate numbers,
+    // within the file and against the book, in parallel; the accepted rows are saved
+    // in one write and every rejected row goes to rejectPath with its reason.
+    ImportReport importAccounts(const std::string& csvPath, const std::string& rejectPath);
+
+    // Velocity limits on withdrawals and outgoing transfers (off by default). A debit
+    // that would cross them is refused and the account frozen until someone unfreezes it.
+    void setVelocityLimits(const VelocityLimits& limits) { velocity.configure(limits); }
+    const VelocityLimits& getVelocityLimits() const { return velocity.getLimits(); }
+
+    // Idempotency keys live for ttlSeconds, at most maxKeys of them (oldest evicted
+    // first). Every keyed operation is journalled in idempotency.journal as pending
+    // before it runs and again with its result after it is saved; loadAll replays the
+    // journal so retries after a restart are still recognised. Set before loading.
+    //
+    // A crash between the two records leaves the key pending. Loading settles deposits,
+    // withdrawals and transfers (local or one leg of a cross-shard one) from the
+    // transaction log: one that reached the log answers OP_OK, its balances restored if
+    // the crash kept them out of the accounts file, and one that did not is forgotten so
+    // a retry runs it. Any other pending key (and every key in the basic format, which
+    // keeps no log) answers OP_KEY_IN_DOUBT. A caller that gets it should check the
+    // account or loan for the change, then call resolveKeyInDoubt with what it found:
+    // happened records OP_OK (and value, e.g. the created loan's ID) as the key's result,
+    // otherwise the key is forgotten and the retry runs. OP_NOT_FOUND if the key is not
+    // held, OP_NO_CHANGE if it is not in doubt.
+    void setIdempotencyLimits(size_t maxKeys, int ttlSeconds) { idempotency.configure(maxKeys, ttlSeconds); }
+    size_t idempotencyKeyCount() const { return idempotency.size(); }
+    void loadIdempotencyJournal();
+    OpStatus resolveKeyInDoubt(const std::string& key, bool happened, int value = 0);
+
+    // Publish every change from here on into the shared-memory ring at path, which
+    // other processes tail with ChangeFeedReader. Off unless enabled; publishing costs
+    // a few stores per change and never waits for readers.
+    bool enableChangeFeed(const std::string& path, size_t capacity = 1 << 16);
+
+    // Log shipping to a hot standby listening at socketPath. Connecting ships a full
+    // copy; after that every save of the accounts, loans or transaction log, and every
+    // closure, first ships the records changed since the previous one and waits for
+    // the standby to apply them, so an operation that returned OP_OK survives the loss
+    // of this process. A standby that fails or times out is dropped with a warning.
+    // Standing orders and idempotency keys are not shipped.
+    bool enableReplication(const std::string& socketPath);
+    bool isReplicating() const { return replica.isOpen(); }
+    // Standby side: apply one shipment, with the StandbyReceiver's apply lock held.
+    // False if it is malformed or from a primary using the other file format.
+    bool applyReplicationBatch(const std::string& batch);
+
+    // Keep the accounts in a disk B+tree (see bankstore.h) instead of accounts.txt, so
+    // a save writes only the pages of records changed since the previous one. The
+    // store replaces the file, not the book: every account is still held in memory
+    // and read from there. Call before loadAll: a store holding records is loaded
+    // from, and an empty one is filled from accounts.txt at the first save. Names
+    // longer than 63 characters are refused while the store is enabled: createAccount
+    // returns OP_NAME_TOO_LONG, importAccounts rejects the row, and
+    // applyReplicationBatch fails the batch. If accounts.txt already holds one, loadAll
+    // closes the empty store and the accounts stay in accounts.txt.
+    bool enableAccountStore(const std::string& path, size_t cachePages = 4096);
+    bool hasAccountStore() const { return accountStore.isOpen(); }
+    const StoreStats& accountStoreStats() const { return accountStore.stats(); }
+
+    // Standing orders are armed in a hierarchical timer wheel keyed by due time, so
+    // creating one and firing it are O(1) however many exist. A run pays everything
+    // due as one batch under the transfer rules and saves once. A refused payment is
+    // retried at the next period; the order is suspended after
+    // STANDING_ORDER_MAX_FAILURES refusals in a row, or at once if an account is gone.
+    static const int STANDING_ORDER_MAX_FAILURES = 3;
+    OpStatus createStandingOrder(int srcAccountNumber, int destAccountNumber, double amount,
+                                 int periodSeconds, int64_t firstDue, int& orderID,
+                                 const std::string& idempotencyKey = std::string());
+    OpStatus cancelStandingOrder(int orderID, const std::string& idempotencyKey = std::string());
+    const StandingOrder* findStandingOrder(int orderID) const;
+    const std::vector<StandingOrder>& getStandingOrders() const { return standingOrders; }
+    size_t standingOrderCount() const { return standingWheel.size(); }
+    StandingOrderReport runStandingOrders(int64_t now);
+    void loadStandingOrders();
+    void saveStandingOrders();
+
+    // Loan operations
+    const std::vector<Loan>& getLoanBook() const { return loanBook; }
+    const Loan* findLoanByID(int loanID) const;
+    Loan createLoan(const std::string& customerName, double amount, double interestRate, int duration);
+    OpStatus createLoan(const std::string& customerName, double amount, double interestRate, int duration,
+                        const std::string& idempotencyKey, Loan& created);
+    OpStatus repayLoan(int loanID, double amount, const std::string& idempotencyKey = std::string());
+
+    // Link a loan to the account its installments are debited from (0 unlinks).
+    // OP_DEST_NOT_FOUND means the account does not exist.
+    OpStatus linkLoanAccount(int loanID, int accountNumber);
+
+    // Take this month's installment from every outstanding loan's linked account. The
+    // book is partitioned by account across threads, so no two threads touch the same
+    // balance; every debit is logged, accounts, loans and transactions are saved once
+    // at the end, and each refused debit is listed in failurePath. Each loan records
+    // the month it was last debited for (by the interest clock) in the same record as
+    // its remaining balance, so a second run in a month skips it.
+    AutoDebitReport autoDebitLoans(const std::string& failurePath);
+
+    // Clear a batch of transfers by multilateral netting: each account's transfers in
+    // and out are summed to one net position, funds are checked against that, and each
+    // balance changes once. An account that cannot cover its net outflow has its
+    // latest transfers out refused, one at a time, until it can (which may leave the
+    // accounts they paid short in turn). Velocity limits charge each transfer out as a
+    // debit of its own, in batch order, not the net outflow; the first one over a limit
+    // freezes the account, and it and every later transfer in or out of the account
+    // are refused. Every cleared transfer is still logged as transfer_out and
+    // transfer_in, with the balance its account settles at, and everything is saved
+    // once at the end.
+    ClearingReport clearTransfers(const std::vector<BatchTransfer>& batch);
+
+    // Write a statement for every account from one partitioned pass over the month's
+    // transactions; month is "YYYY-MM", combined selects one file instead of one per account
+    StatementReport generateStatements(const std::string& month, bool combined);
+
+    // Replace the whole in-memory book, e.g. with generated data; nothing is saved
+    void replaceAll(std::vector<Account> newAccounts, std::vector<Loan> newLoans,
+                    std::vector<Transaction> newTransactions);
+
+    bool logsTransactions() const { return format == FileFormat::Extended; }
+
+private:
+    int generateTransactionID();
+    int generateUniqueLoanID() const;
+    Loan* findLoan(int loanID);
+    void logTransaction(int accountNumber, const std::string& type, double amount, double balanceAfter);
+    void publishSaved();
+    void publishChange(ChangeType type, int accountNumber, double amount, double balanceAfter,
+                       const std::string& kind = std::string(), int transactionID = 0);
+    bool passesVelocityCheck(int index, double amount);
+    OpStatus applyTransfer(int srcAccountNumber, int destAccountNumber, double amount);
+    void appendAccount(const Account& account, bool frozen);
+    void touchAccount(size_t index);
+    void touchLoan(size_t index);
+    void setFrozenBit(size_t index, bool frozen);
+    void rebuildAccountIndex();
+    void resetAccountBook();
+    void resetLoanBook();
+    void tombstone(int index);
+    void shipChanges();
+    bool saveAccountStore();
+    void applyFrozen(int index, bool frozen);
+    double accrueInterest(Account& account, int64_t now) const;
+    bool settleInterest(int index);
+    void loadClosedAccounts();
+    void appendClosedRecord(const Account& account, bool frozen);
+    template <typename Body>
+    OpStatus idempotent(const std::string& key, uint64_t fingerprint, Body body, int* value = nullptr,
+                        bool posts = false);
+    void appendJournal(const IdempotencyCache::Entry& entry);
+    void settleInDoubtKey(IdempotencyCache::Entry& entry, int64_t now);
+    void savePosting();
+    void rewriteJournal();
+
+    // Result of a background compaction, waiting for the owner thread to swap it in
+    struct CompactedBook {
+        std::vector<Account> accounts;
+        std::unordered_map<int, int> accountIndex;
+        std::vector<uint64_t> frozenBits;
+        AccountColumns columns;
+    };
+    std::unique_lock<std::mutex> lockForWrite();
+    void startCompaction();
+    void installCompaction();
+    void installTransactions(bool wait);
+
+    FileFormat format;
+    std::string accountsFile;
+    std::string loanBookFile;
+    std::string transactionsFile;
+    std::string statementsDir;
+    std::string closedAccountsFile;
+    std::string journalFile;
+    std::string standingOrdersFile;
+
+    std::vector<Account> accounts;
+    static constexpr int RETIRED = -1;
+    std::unordered_map<int, int> accountIndex;  // Account number -> position in accounts, or RETIRED
+    std::vector<uint64_t> frozenBits;           // Bit i is set when accounts[i] is frozen
+    std::vector<uint64_t> closedBits;           // Bit i is set when accounts[i] is a tombstone
+    AccountColumns columns;                     // Numeric fields of accounts, column by column
+    size_t tombstones = 0;
+    size_t compactionThreshold = 1024;
+
+    std::mutex writeMutex;                      // Held by writers, and by the compactor while it copies
+    std::thread compactor;
+    std::unique_ptr<CompactedBook> compacted;   // Guarded by writeMutex
+    std::vector<Loan> loanBook;
+    std::vector<Transaction> transactions;
+    std::thread transactionLoader;
+    std::mutex loaderMutex;                     // Serialises installing the loader's result
+    std::atomic<bool> transactionsLoading{false};   // Until the loaded log is installed
+    std::atomic<bool> transactionsReady{false};     // Set by the loader when it is done
+    std::vector<Transaction> loadedTransactions;    // The loader's result, until installed
+    VelocityGuard velocity;
+    IdempotencyCache idempotency;               // Guarded by writeMutex, like the journal
+    std::ofstream journal;                      // Opened for appending on first use
+    size_t journalLines = 0;                    // Records in the journal, live or expired
+    std::vector<StandingOrder> standingOrders;  // Indexed by orderID - 1
+    TimerWheel standingWheel;                   // Armed orders by due time, one tick per second
+    int64_t (*interestClock)();                 // Unix time source for interest accrual
+    PageVersions<Account> accountVersions;      // Guarded by writeMutex
+    PageVersions<Loan> loanVersions;            // Guarded by writeMutex
+    RankIndex balanceRanks;                     // Live accounts by balance
+    RankIndex loanRanks;                        // Loans by remaining balance
+    NameIndex accountNames;                     // Live account holders' names by trigram
+    NameIndex loanNames;                        // Loan customers' names by trigram
+    ChangeFeed changeFeed;                      // Published to under writeMutex
+    std::vector<ChangeEvent> unpublished;       // Changes waiting for the save that makes them durable
+    bool transactionsUnsaved = false;           // Records appended since transactions.txt was last written
+    ReplicationLink replica;                    // Standby the saves ship to, if any
+    bool resyncPending = true;                  // Ship a full copy next, e.g. after a reload
+    std::vector<int> changedAccounts;           // Account numbers touched since the last shipment
+    std::vector<int> changedLoans;              // Loan IDs touched since the last shipment
+    std::vector<std::string> closedRecords;     // Closure audit records not yet shipped
+    size_t shippedTransactions = 0;             // Transactions the standby already has
+    AccountStore accountStore;                  // Replaces accounts.txt once enabled
+    bool storeResyncPending = true;             // Rewrite the whole store at the next save
+    std::vector<int> storeChanged;              // Account numbers touched since the last save to the store
+};
+
+// Trim function to remove leading and trailing spaces from input strings
+std::string trim(const std::string& str);
+
+// Read account numbers from a list file, one per line; blank lines and lines
+// starting with '#' are ignored and any other unparseable line counts as skipped.
+// Returns false if the file cannot be opened.
+bool readAccountList(const std::string& path, std::vector<int>& accountNumbers, size_t& skippedLines);
+
+// Read a transfer batch file of "source,destination,amount" lines, with the same
+// rules for blank, comment and unparseable lines as readAccountList
+bool readTransferBatch(const std::string& path, std::vector<BatchTransfer>& batch, size_t& skippedLines);
+
+// Local time formatted as "YYYY-MM-DD HH:MM:SS"
+std::string getCurrentDateTime();
+
+#endif
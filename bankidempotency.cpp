@@ -0,0 +1,119 @@
+#include "bankidempotency.h"
+
+#include <algorithm>
+
+using namespace std;
+
+uint64_t fnv1a(const void* data, size_t length, uint64_t seed) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t keyHash(const string& key) {
+    return fnv1a(key.data(), key.size());
+}
+
+void IdempotencyCache::configure(size_t maxEntries, int ttl) {
+    capacity = maxEntries == 0 ? 1 : maxEntries;
+    ttlSeconds = ttl;
+    ring.clear();
+    ring.shrink_to_fit();
+    head = 0;
+    count = 0;
+    resize(min(capacity, (size_t)64));
+}
+
+// Move the live entries to the front of a ring of ringSize entries and re-insert
+// them into a table twice that size. Rings double up to the capacity, so this is
+// O(1) amortized per insert and a small cache never pays for a large bound.
+void IdempotencyCache::resize(size_t ringSize) {
+    vector<Entry> oldRing(ringSize);
+    for (size_t i = 0; i < count; ++i) oldRing[i] = move(ring[(head + i) % ring.size()]);
+    ring.swap(oldRing);
+    head = 0;
+
+    size_t slotCount = 16;
+    while (slotCount < ringSize * 2) slotCount *= 2;
+    slots.assign(slotCount, Slot{0, 0});
+    for (size_t i = 0; i < count; ++i) {
+        if (ring[i].key.empty()) continue; // Dead, see insert()
+        uint64_t hash = keyHash(ring[i].key);
+        slots[slotFor(ring[i].key, hash)] = Slot{(uint32_t)i + 1, (uint32_t)(hash >> 32)};
+    }
+}
+
+// Slot holding key, or the empty slot where it would go
+size_t IdempotencyCache::slotFor(const string& key, uint64_t hash) const {
+    size_t mask = slots.size() - 1;
+    uint32_t tag = (uint32_t)(hash >> 32);
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        const Slot& s = slots[i];
+        if (s.position == 0) return i;
+        if (s.tag == tag && ring[s.position - 1].key == key) return i;
+    }
+}
+
+// Empty a slot, shifting later entries of its probe run back so lookups never stop
+// early at the hole
+void IdempotencyCache::removeSlot(size_t hole) {
+    size_t mask = slots.size() - 1;
+    for (size_t i = (hole + 1) & mask; slots[i].position != 0; i = (i + 1) & mask) {
+        size_t home = keyHash(ring[slots[i].position - 1].key) & mask;
+        bool homeBetween = (hole < i) ? (home > hole && home <= i) : (home > hole || home <= i);
+        if (!homeBetween) {
+            slots[hole] = slots[i];
+            hole = i;
+        }
+    }
+    slots[hole] = Slot{0, 0};
+}
+
+void IdempotencyCache::evictOldest() {
+    Entry& oldest = ring[head];
+    if (!oldest.key.empty()) removeSlot(slotFor(oldest.key, keyHash(oldest.key)));
+    oldest.key.clear();
+    oldest.key.shrink_to_fit();
+    head = (head + 1) % ring.size();
+    --count;
+}
+
+const IdempotencyCache::Entry* IdempotencyCache::find(const string& key, int64_t now) {
+    while (count > 0 && ring[head].expiresAt <= now) evictOldest();
+    size_t slot = slotFor(key, keyHash(key));
+    if (slots[slot].position == 0) return nullptr;
+    const Entry& e = ring[slots[slot].position - 1];
+    // An entry replayed from the journal under a longer TTL can outlive the ring order
+    return e.expiresAt > now ? &e : nullptr;
+}
+
+void IdempotencyCache::insert(const Entry& entry, int64_t now) {
+    while (count > 0 && ring[head].expiresAt <= now) evictOldest();
+    uint64_t hash = keyHash(entry.key);
+    size_t slot = slotFor(entry.key, hash);
+    if (slots[slot].position != 0) {
+        size_t position = slots[slot].position - 1;
+        if (position == (head + count - 1) % ring.size()) {
+            ring[position] = entry; // Already the newest, so the ring stays in expiry order
+            return;
+        }
+        // Retire the old entry in place; the find() and insert() sweeps pop it in turn
+        removeSlot(slot);
+        ring[position].key.clear();
+        ring[position].expiresAt = 0;
+        slot = slotFor(entry.key, hash);
+    }
+    if (count == ring.size()) {
+        if (ring.size() < capacity) resize(min(capacity, ring.size() * 2));
+        else evictOldest();
+        slot = slotFor(entry.key, hash); // Either may have moved the probe run
+    }
+    size_t position = (head + count) % ring.size();
+    ring[position] = entry;
+    ++count;
+    slots[slot] = Slot{(uint32_t)position + 1, (uint32_t)(hash >> 32)};
+}
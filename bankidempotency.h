@@ -0,0 +1,74 @@
+// Deduplication cache for client-supplied idempotency keys. Each key remembers the
+// result of the operation it was first used with, for a fixed time-to-live, so a
+// retried request gets the original answer instead of moving money twice.
+#ifndef BANKIDEMPOTENCY_H
+#define BANKIDEMPOTENCY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 64-bit FNV-1a, used for key hashing and operation fingerprints
+uint64_t fnv1a(const void* data, size_t length, uint64_t seed = 14695981039346656037ULL);
+
+class IdempotencyCache {
+public:
+    struct Entry {
+        std::string key;
+        uint64_t fingerprint;   // Hash of the operation and arguments the key was used with
+        int status;             // OpStatus the operation returned
+        int value;              // Extra result, e.g. the ID of a created loan
+        int64_t expiresAt;      // Unix time after which the key may be reused
+    };
+
+    static const int PENDING = -1;  // Status of a key whose operation has not finished
+
+    IdempotencyCache() { configure(1 << 20, 24 * 3600); }
+
+    // Hold at most maxEntries keys for ttlSeconds each; clears the cache
+    void configure(size_t maxEntries, int ttlSeconds);
+    int ttl() const { return ttlSeconds; }
+    size_t maxEntries() const { return capacity; }
+    size_t size() const { return count; }
+
+    // The live entry for key, or nullptr; expired entries are dropped on the way
+    const Entry* find(const std::string& key, int64_t now);
+
+    // Remember a result, replacing any earlier one for the key (which then expires with
+    // the new entry). When the cache is full the oldest key is evicted first.
+    void insert(const Entry& entry, int64_t now);
+
+    // Visit live entries oldest first (used to rewrite the journal)
+    template <typename Visit>
+    void forEach(int64_t now, Visit visit) const {
+        for (size_t i = 0; i < count; ++i) {
+            const Entry& e = ring[(head + i) % ring.size()];
+            if (e.expiresAt > now) visit(e);
+        }
+    }
+
+private:
+    // Entries sit in a ring in insertion order, which with a fixed TTL is also expiry
+    // order, so expiry and eviction pop the head. A replaced entry is left behind as
+    // a dead one (empty key, expired) and the new one appended. The open-addressing table maps key
+    // hashes to ring positions so a lookup costs the same with millions of keys.
+    struct Slot {
+        uint32_t position;      // Ring position + 1; 0 marks an empty slot
+        uint32_t tag;           // High bits of the key hash, checked before the key itself
+    };
+
+    size_t slotFor(const std::string& key, uint64_t hash) const;
+    void resize(size_t ringSize);
+    void evictOldest();
+    void removeSlot(size_t slot);
+
+    std::vector<Entry> ring;    // Grows by doubling up to capacity
+    size_t capacity = 0;
+    size_t head = 0;
+    size_t count = 0;
+    std::vector<Slot> slots;    // Power-of-two size, at most half full
+    int ttlSeconds = 0;
+};
+
+#endif
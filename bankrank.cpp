@@ -0,0 +1,166 @@
+#include "bankrank.h"
+
+#include <cmath>
+
+using namespace std;
+
+void RankIndex::clear() {
+    nodes.clear();
+    freeNodes.clear();
+    keyNode.clear();
+    root = NIL;
+}
+
+// Tree order: larger values first, ties by ascending key, so in-order is rank order
+bool RankIndex::before(uint32_t a, uint32_t b) const {
+    const Node& x = nodes[a];
+    const Node& y = nodes[b];
+    if (x.value != y.value) return x.value > y.value;
+    return x.key < y.key;
+}
+
+// Split subtree n into the nodes ordered before pivot and the rest
+void RankIndex::split(uint32_t n, uint32_t pivot, uint32_t& low, uint32_t& high) {
+    if (n == NIL) {
+        low = high = NIL;
+    } else if (before(n, pivot)) {
+        split(nodes[n].right, pivot, nodes[n].right, high);
+        low = n;
+        update(n);
+    } else {
+        split(nodes[n].left, pivot, low, nodes[n].left);
+        high = n;
+        update(n);
+    }
+}
+
+// Join two subtrees where every node of low is ordered before every node of high
+uint32_t RankIndex::merge(uint32_t low, uint32_t high) {
+    if (low == NIL) return high;
+    if (high == NIL) return low;
+    if (nodes[low].priority > nodes[high].priority) {
+        nodes[low].right = merge(nodes[low].right, high);
+        update(low);
+        return low;
+    }
+    nodes[high].left = merge(low, nodes[high].left);
+    update(high);
+    return high;
+}
+
+// Unlink target from subtree n, which must contain it
+uint32_t RankIndex::removeNode(uint32_t n, uint32_t target) {
+    if (n == target) return merge(nodes[n].left, nodes[n].right);
+    if (before(target, n)) nodes[n].left = removeNode(nodes[n].left, target);
+    else nodes[n].right = removeNode(nodes[n].right, target);
+    update(n);
+    return n;
+}
+
+void RankIndex::set(int key, double value) {
+    auto found = keyNode.find(key);
+    uint32_t n;
+    if (found != keyNode.end()) {
+        n = found->second;
+        if (nodes[n].value == value) return;
+        root = removeNode(root, n);
+    } else {
+        if (freeNodes.empty()) {
+            n = (uint32_t)nodes.size();
+            nodes.push_back(Node());
+        } else {
+            n = freeNodes.back();
+            freeNodes.pop_back();
+        }
+        keyNode.emplace(key, n);
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        nodes[n].key = key;
+        nodes[n].priority = seed;
+    }
+    nodes[n].value = value;
+    nodes[n].left = nodes[n].right = NIL;
+    nodes[n].size = 1;
+    uint32_t low, high;
+    split(root, n, low, high);
+    root = merge(merge(low, n), high);
+}
+
+void RankIndex::erase(int key) {
+    auto found = keyNode.find(key);
+    if (found == keyNode.end()) return;
+    root = removeNode(root, found->second);
+    freeNodes.push_back(found->second);
+    keyNode.erase(found);
+}
+
+vector<RankEntry> RankIndex::top(size_t n) const {
+    vector<RankEntry> result;
+    result.reserve(min(n, size()));
+    vector<uint32_t> path;  // Ancestors still to be listed after their left subtrees
+    uint32_t cur = root;
+    while (result.size() < n && (cur != NIL || !path.empty())) {
+        while (cur != NIL) {
+            path.push_back(cur);
+            cur = nodes[cur].left;
+        }
+        cur = path.back();
+        path.pop_back();
+        result.push_back({nodes[cur].key, nodes[cur].value});
+        cur = nodes[cur].right;
+    }
+    return result;
+}
+
+size_t RankIndex::rank(int key) const {
+    auto found = keyNode.find(key);
+    if (found == keyNode.end()) return 0;
+    uint32_t target = found->second;
+    size_t ahead = 0;
+    uint32_t cur = root;
+    while (cur != target) {
+        if (before(target, cur)) {
+            cur = nodes[cur].left;
+        } else {
+            ahead += sizeOf(nodes[cur].left) + 1;
+            cur = nodes[cur].right;
+        }
+    }
+    return ahead + sizeOf(nodes[target].left) + 1;
+}
+
+bool RankIndex::at(size_t rank, RankEntry& entry) const {
+    if (rank == 0 || rank > size()) return false;
+    uint32_t cur = root;
+    for (;;) {
+        size_t leftSize = sizeOf(nodes[cur].left);
+        if (rank <= leftSize) {
+            cur = nodes[cur].left;
+        } else if (rank == leftSize + 1) {
+            entry = {nodes[cur].key, nodes[cur].value};
+            return true;
+        } else {
+            rank -= leftSize + 1;
+            cur = nodes[cur].right;
+        }
+    }
+}
+
+double RankIndex::percentileOf(int key) const {
+    size_t r = rank(key);
+    if (r == 0) return 0;
+    return 100.0 * (double)(size() - r) / (double)size();
+}
+
+double RankIndex::valueAtPercentile(double percent) const {
+    size_t n = size();
+    if (n == 0) return 0;
+    // Ascending nearest rank, converted to a position counted from the largest
+    size_t ascending = (size_t)ceil(percent / 100.0 * (double)n);
+    if (ascending < 1) ascending = 1;
+    if (ascending > n) ascending = n;
+    RankEntry entry{0, 0};
+    at(n - ascending + 1, entry);
+    return entry.value;
+}
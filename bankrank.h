@@ -0,0 +1,70 @@
+// Order-statistic index for "largest balances" style queries. Entries are kept in a
+// treap ordered by value, largest first, with subtree sizes, so an update, a rank
+// lookup or finding the entry at a rank is O(log n) and listing the top N is
+// O(log n + N). Nodes live in one vector and are found by key through a hash map.
+#ifndef BANKRANK_H
+#define BANKRANK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// One ranked entry: an account number or loan ID and its value
+struct RankEntry {
+    int key;
+    double value;
+};
+
+class RankIndex {
+public:
+    void clear();
+
+    // Insert key with value, or move it if it is already indexed
+    void set(int key, double value);
+    void erase(int key);
+    size_t size() const { return keyNode.size(); }
+
+    // The n largest entries, largest first; equal values are listed by ascending key
+    std::vector<RankEntry> top(size_t n) const;
+
+    // 1-based position of key counting from the largest, or 0 if it is not indexed
+    size_t rank(int key) const;
+
+    // Entry at a 1-based rank; false if the rank is out of range
+    bool at(size_t rank, RankEntry& entry) const;
+
+    // Share of entries, in percent, ranked below key (0 for the smallest, or if absent)
+    double percentileOf(int key) const;
+
+    // Nearest-rank percentile: the smallest value with at least percent% of the entries
+    // at or below it, e.g. 50 for the median. 0 when the index is empty.
+    double valueAtPercentile(double percent) const;
+
+private:
+    static const uint32_t NIL = UINT32_MAX;
+
+    struct Node {
+        int key;
+        double value;
+        uint32_t priority;
+        uint32_t left;
+        uint32_t right;
+        uint32_t size;          // Nodes in this subtree
+    };
+
+    bool before(uint32_t a, uint32_t b) const;
+    uint32_t sizeOf(uint32_t n) const { return n == NIL ? 0 : nodes[n].size; }
+    void update(uint32_t n) { nodes[n].size = 1 + sizeOf(nodes[n].left) + sizeOf(nodes[n].right); }
+    void split(uint32_t n, uint32_t pivot, uint32_t& low, uint32_t& high);
+    uint32_t merge(uint32_t low, uint32_t high);
+    uint32_t removeNode(uint32_t n, uint32_t target);
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> freeNodes;
+    std::unordered_map<int, uint32_t> keyNode;  // Key -> its node
+    uint32_t root = NIL;
+    uint32_t seed = 2463534242u;                // xorshift state for node priorities
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "bankreplica.h"
+
+#include <chrono>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/time.h>   // for timeval
+#include <sys/un.h>     // for sockaddr_un
+#include <unistd.h>     // for close(), unlink()
+
+using namespace std;
+
+// Every batch is preceded by its sequence number and length; the standby answers
+// with the sequence number once the batch is applied
+struct BatchHeader {
+    uint64_t sequence;
+    uint64_t bytes;
+};
+
+bool sendAll(int fd, const void* data, size_t length) {
+    const char* p = static_cast<const char*>(data);
+    while (length > 0) {
+        ssize_t n = ::send(fd, p, length, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool receiveAll(int fd, void* data, size_t length) {
+    char* p = static_cast<char*>(data);
+    while (length > 0) {
+        ssize_t n = ::recv(fd, p, length, 0);
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool socketAddress(const string& path, sockaddr_un& addr) {
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+int listenOnSocket(const string& path) {
+    sockaddr_un addr;
+    if (!socketAddress(path, addr)) return -1;
+    int s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0) return -1;
+    unlink(path.c_str());
+    if (::bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(s, 64) != 0) {
+        ::close(s);
+        return -1;
+    }
+    return s;
+}
+
+int connectToSocket(const string& path) {
+    sockaddr_un addr;
+    if (!socketAddress(path, addr)) return -1;
+    int s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0) return -1;
+    if (::connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::close(s);
+        return -1;
+    }
+    return s;
+}
+
+bool ReplicationLink::connect(const string& socketPath, int timeoutMs) {
+    close();
+    int s = connectToSocket(socketPath);
+    if (s < 0) return false;
+    timeval timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    fd = s;
+    sequence = 0;
+    return true;
+}
+
+void ReplicationLink::close() {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+}
+
+bool ReplicationLink::send(const string& batch) {
+    if (fd < 0) return false;
+    BatchHeader header = {sequence + 1, batch.size()};
+    uint64_t ack = 0;
+    if (!sendAll(fd, &header, sizeof(header)) || !sendAll(fd, batch.data(), batch.size()) ||
+        !receiveAll(fd, &ack, sizeof(ack)) || ack != header.sequence) {
+        close();
+        return false;
+    }
+    sequence = header.sequence;
+    return true;
+}
+
+bool StandbyReceiver::start(const string& socketPath, ApplyBatch applyBatch) {
+    stop();
+    int s = listenOnSocket(socketPath);
+    if (s < 0) return false;
+    path = socketPath;
+    apply = move(applyBatch);
+    listenFd = s;
+    stopping = false;
+    receiver = thread(&StandbyReceiver::run, this);
+    return true;
+}
+
+void StandbyReceiver::stop() {
+    if (!receiver.joinable()) return;
+    stopping = true;
+    // Shutting the sockets down wakes the receiver from accept() or recv()
+    ::shutdown(listenFd, SHUT_RDWR);
+    int client = clientFd.load();
+    if (client >= 0) ::shutdown(client, SHUT_RDWR);
+    receiver.join();
+    ::close(listenFd);
+    listenFd = -1;
+    unlink(path.c_str());
+    lock_guard<mutex> lock(stateMutex);
+    lost.notify_all();
+}
+
+void StandbyReceiver::waitForPrimaryLoss() {
+    unique_lock<mutex> lock(stateMutex);
+    lost.wait(lock, [this] { return disconnects > 0 || stopping; });
+}
+
+// Accept primaries one after another until stopped; a primary that restarts
+// reconnects and begins with a full copy
+void StandbyReceiver::run() {
+    while (!stopping) {
+        int client = ::accept(listenFd, nullptr, nullptr);
+        if (client < 0) {
+            if (stopping) break;
+            continue;
+        }
+        clientFd = client;
+        connected = true;
+        if (stopping) ::shutdown(client, SHUT_RDWR); // stop() may have missed it
+        serve(client);
+        connected = false;
+        clientFd = -1;
+        ::close(client);
+        lock_guard<mutex> lock(stateMutex);
+        ++disconnects;
+        lost.notify_all();
+    }
+}
+
+void StandbyReceiver::serve(int client) {
+    BatchHeader header;
+    string batch;
+    while (receiveAll(client, &header, sizeof(header))) {
+        batch.resize(header.bytes);
+        if (header.bytes > 0 && !receiveAll(client, &batch[0], header.bytes)) return;
+        {
+            lock_guard<mutex> lock(applyMutex);
+            if (!apply(batch)) return;
+        }
+        ++applied;
+        lastBatch = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+        if (!sendAll(client, &header.sequence, sizeof(header.sequence))) return;
+    }
+}
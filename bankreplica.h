@@ -0,0 +1,92 @@
+// Log shipping to a hot standby over a Unix domain socket. The primary sends each
+// batch of changed records as one framed message and waits for the standby to
+// acknowledge it, so a change is in the standby's memory before the operation that
+// made it returns. The standby applies batches on a background thread, answers
+// read-only queries between them and can be promoted by stopping the receiver.
+#ifndef BANKREPLICA_H
+#define BANKREPLICA_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Unix stream socket helpers, shared with the shard protocol (bankshard.h)
+int listenOnSocket(const std::string& path);    // Replaces a stale socket file; -1 on failure
+int connectToSocket(const std::string& path);   // -1 on failure
+bool sendAll(int fd, const void* data, size_t length);
+bool receiveAll(int fd, void* data, size_t length);
+
+// Primary side of the link
+class ReplicationLink {
+public:
+    ReplicationLink() = default;
+    ReplicationLink(const ReplicationLink&) = delete;
+    ReplicationLink& operator=(const ReplicationLink&) = delete;
+    ~ReplicationLink() { close(); }
+
+    // Connect to a standby listening at socketPath. A standby that takes longer than
+    // timeoutMs to acknowledge a batch counts as gone.
+    bool connect(const std::string& socketPath, int timeoutMs = 2000);
+    void close();
+    bool isOpen() const { return fd >= 0; }
+
+    // Send one batch and wait for its acknowledgement; false (with the link closed)
+    // if the standby refused it, went away or timed out
+    bool send(const std::string& batch);
+    uint64_t batchesSent() const { return sequence; }
+
+private:
+    int fd = -1;
+    uint64_t sequence = 0;
+};
+
+// Standby side: accepts one primary at a time and hands each batch to apply,
+// acknowledging it once apply returns true. A false return drops the primary.
+class StandbyReceiver {
+public:
+    using ApplyBatch = std::function<bool(const std::string& batch)>;
+
+    StandbyReceiver() = default;
+    StandbyReceiver(const StandbyReceiver&) = delete;
+    StandbyReceiver& operator=(const StandbyReceiver&) = delete;
+    ~StandbyReceiver() { stop(); }
+
+    // Listen at socketPath (replacing a stale socket file) and start receiving
+    bool start(const std::string& socketPath, ApplyBatch apply);
+    // Stop accepting, disconnect the primary and wait for the receiver thread
+    void stop();
+
+    // Hold the returned lock to read the engine between batches
+    std::unique_lock<std::mutex> pause() { return std::unique_lock<std::mutex>(applyMutex); }
+
+    bool primaryConnected() const { return connected; }
+    uint64_t batchesApplied() const { return applied; }
+    int64_t lastBatchNs() const { return lastBatch; }     // Steady clock, 0 before the first
+    // Block until a primary has connected and gone again (or the receiver is stopped)
+    void waitForPrimaryLoss();
+
+private:
+    void run();
+    void serve(int client);
+
+    std::string path;
+    ApplyBatch apply;
+    int listenFd = -1;
+    std::atomic<int> clientFd{-1};
+    std::thread receiver;
+    std::mutex applyMutex;                      // Held while a batch is applied
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> connected{false};
+    std::atomic<uint64_t> applied{0};
+    std::atomic<int64_t> lastBatch{0};
+    std::mutex stateMutex;
+    std::condition_variable lost;
+    uint64_t disconnects = 0;                   // Guarded by stateMutex
+};
+
+#endif
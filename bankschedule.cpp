@@ -0,0 +1,120 @@
+#include "bankschedule.h"
+
+#include <algorithm>
+
+using namespace std;
+
+void TimerWheel::reset(int64_t startTick) {
+    currentTick = startTick;
+    armed = 0;
+    links.clear();
+    for (uint32_t& head : heads) head = NIL;
+    for (size_t& n : levelCount) n = 0;
+}
+
+// Put an armed timer in the slot for its due tick: the finest level whose span
+// still reaches it, indexed by the due tick's bits at that level
+void TimerWheel::link(uint32_t id) {
+    Link& l = links[id];
+    int64_t due = l.due;
+    int64_t delta = due - currentTick;
+    if (delta < 0) {
+        l.slot = OVERDUE;
+    } else {
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (int64_t(1) << (LEVEL_BITS * (level + 1)))) ++level;
+        // Beyond the horizon: park in the last slot within reach and re-cascade from there
+        int64_t horizon = (int64_t(1) << (LEVEL_BITS * LEVELS)) - 1;
+        if (delta > horizon) due = currentTick + horizon;
+        int index = (int)((due >> (LEVEL_BITS * level)) & (SLOTS - 1));
+        l.slot = (uint16_t)(level * SLOTS + index);
+    }
+    ++levelCount[l.slot / SLOTS];
+    l.prev = NIL;
+    l.next = heads[l.slot];
+    if (l.next != NIL) links[l.next].prev = id;
+    heads[l.slot] = id;
+}
+
+void TimerWheel::unlink(uint32_t id) {
+    Link& l = links[id];
+    if (l.prev != NIL) links[l.prev].next = l.next;
+    else heads[l.slot] = l.next;
+    if (l.next != NIL) links[l.next].prev = l.prev;
+    --levelCount[l.slot / SLOTS];
+    l.slot = UNARMED;
+}
+
+void TimerWheel::schedule(uint32_t id, int64_t dueTick) {
+    if (id >= links.size()) links.resize(id + 1, Link{NIL, NIL, 0, UNARMED});
+    if (links[id].slot != UNARMED) unlink(id);
+    else ++armed;
+    links[id].due = dueTick;
+    link(id);
+}
+
+void TimerWheel::cancel(uint32_t id) {
+    if (!scheduled(id)) return;
+    unlink(id);
+    --armed;
+}
+
+// Re-file the timers of the level's current slot; they now fall within a finer level
+void TimerWheel::cascade(int level) {
+    int index = (int)((currentTick >> (LEVEL_BITS * level)) & (SLOTS - 1));
+    uint32_t id = heads[level * SLOTS + index];
+    heads[level * SLOTS + index] = NIL;
+    while (id != NIL) {
+        uint32_t next = links[id].next;
+        --levelCount[level];
+        link(id);
+        id = next;
+    }
+}
+
+// Move a slot's timers onto due and disarm them, in the order they were armed
+void TimerWheel::fire(uint16_t slot, vector<uint32_t>& due) {
+    uint32_t id = heads[slot];
+    heads[slot] = NIL;
+    size_t first = due.size();
+    while (id != NIL) {
+        uint32_t next = links[id].next;
+        links[id].slot = UNARMED;
+        --levelCount[slot / SLOTS];
+        --armed;
+        due.push_back(id);
+        id = next;
+    }
+    // Slots are filled newest first
+    reverse(due.begin() + first, due.end());
+}
+
+void TimerWheel::advance(int64_t tick, vector<uint32_t>& due) {
+    fire(OVERDUE, due);
+    while (currentTick <= tick) {
+        if (armed == 0) {
+            currentTick = tick + 1; // Nothing can fire; skip the idle ticks
+            return;
+        }
+        // While the finest levels are empty nothing can fire or cascade before the
+        // next boundary of the first occupied level, so jump straight there
+        int empty = 0;
+        while (empty < LEVELS - 1 && levelCount[empty] == 0) ++empty;
+        if (empty > 0) {
+            int64_t mask = (int64_t(1) << (LEVEL_BITS * empty)) - 1;
+            int64_t boundary = (currentTick + mask) & ~mask;
+            if (boundary > currentTick) {
+                currentTick = min(boundary, tick + 1);
+                continue;
+            }
+        }
+        // At a level boundary pull the coarser slots down, coarsest first so its
+        // timers can land in a finer slot that is cascaded in this same tick
+        int top = 0;
+        while (top + 1 < LEVELS && (currentTick & ((int64_t(1) << (LEVEL_BITS * (top + 1))) - 1)) == 0) ++top;
+        for (int level = top; level >= 1; --level) cascade(level);
+
+        fire((uint16_t)(currentTick & (SLOTS - 1)), due);
+        ++currentTick;
+    }
+}
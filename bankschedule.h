@@ -0,0 +1,62 @@
+// Hierarchical timer wheel for standing orders. Timers are small integer IDs with
+// an intrusive doubly linked list per slot, so scheduling and cancelling are O(1)
+// and each tick only touches the slot that comes due. Far-off timers sit in coarser
+// levels and are cascaded down as their time approaches, which costs O(1) amortized
+// per timer per level.
+#ifndef BANKSCHEDULE_H
+#define BANKSCHEDULE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class TimerWheel {
+public:
+    static const int LEVEL_BITS = 6;
+    static const int SLOTS = 1 << LEVEL_BITS;      // Slots per level
+    static const int LEVELS = 5;                   // Horizon of 2^30 ticks (~34 years in seconds)
+
+    explicit TimerWheel(int64_t startTick = 0) { reset(startTick); }
+
+    // Drop every timer and restart the clock at startTick
+    void reset(int64_t startTick);
+
+    // Arm timer id to fire at dueTick; an already armed id is moved. A dueTick that
+    // has already been processed fires on the next advance, whatever tick it is given.
+    void schedule(uint32_t id, int64_t dueTick);
+    void cancel(uint32_t id);
+    bool scheduled(uint32_t id) const { return id < links.size() && links[id].slot != UNARMED; }
+    size_t size() const { return armed; }
+
+    // Next tick that advance has not processed yet
+    int64_t nextTick() const { return currentTick; }
+
+    // Process every tick up to and including tick, appending the IDs that fire, in
+    // due order, to due. Fired timers are disarmed.
+    void advance(int64_t tick, std::vector<uint32_t>& due);
+
+private:
+    static const uint32_t NIL = UINT32_MAX;
+    static const uint16_t UNARMED = UINT16_MAX;
+    static const uint16_t OVERDUE = LEVELS * SLOTS;     // Extra slot for timers armed in the past
+
+    struct Link {
+        uint32_t prev;
+        uint32_t next;
+        int64_t due;
+        uint16_t slot;          // level * SLOTS + index, or UNARMED
+    };
+
+    void link(uint32_t id);
+    void unlink(uint32_t id);
+    void cascade(int level);
+    void fire(uint16_t slot, std::vector<uint32_t>& due);
+
+    int64_t currentTick = 0;
+    size_t armed = 0;
+    std::vector<Link> links;                // Indexed by timer ID
+    size_t levelCount[LEVELS + 1];          // Timers filed per level; the last entry counts OVERDUE
+    uint32_t heads[LEVELS * SLOTS + 1];     // First timer in each slot
+};
+
+#endif
@@ -0,0 +1,254 @@
+#include "banksearch.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+using namespace std;
+
+string normalizeName(const string& name) {
+    string result;
+    result.reserve(name.size());
+    bool space = false;
+    for (unsigned char c : name) {
+        if (isspace(c)) {
+            space = !result.empty();
+            continue;
+        }
+        if (space) result += ' ';
+        space = false;
+        result += (char)tolower(c);
+    }
+    return result;
+}
+
+// Distinct trigrams of a normalized name padded as "  name ", so the start and end
+// of the name count as much as its middle; each is packed into the low 24 bits
+static vector<uint32_t> trigrams(const string& name) {
+    string padded = "  " + name + " ";
+    vector<uint32_t> grams;
+    grams.reserve(padded.size());
+    for (size_t i = 0; i + 2 < padded.size(); ++i) {
+        grams.push_back((uint32_t)(unsigned char)padded[i] << 16 |
+                        (uint32_t)(unsigned char)padded[i + 1] << 8 |
+                        (uint32_t)(unsigned char)padded[i + 2]);
+    }
+    sort(grams.begin(), grams.end());
+    grams.erase(unique(grams.begin(), grams.end()), grams.end());
+    return grams;
+}
+
+// Plain dynamic programming, one row at a time, for patterns too long for a word
+static int editDistanceRows(const string& a, const string& b, int bound) {
+    vector<int> row(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); ++j) row[j] = (int)j;
+    for (size_t i = 1; i <= a.size(); ++i) {
+        int diagonal = row[0];
+        row[0] = (int)i;
+        int best = row[0];
+        for (size_t j = 1; j <= b.size(); ++j) {
+            int above = row[j];
+            row[j] = min(min(above, row[j - 1]) + 1, diagonal + (a[i - 1] == b[j - 1] ? 0 : 1));
+            diagonal = above;
+            best = min(best, row[j]);
+        }
+        if (best > bound) return bound + 1;
+    }
+    return min(row[b.size()], bound + 1);
+}
+
+// Myers' bit-vector edit distance (Hyyro's Levenshtein form): one DP column of a
+// pattern of up to 64 characters is held in two words of +1/-1 deltas and advanced
+// by a few word operations per text character. Built once per query and reused.
+struct BitPattern {
+    uint64_t peq[256];          // Bit i set where the pattern has that character at i
+    size_t length;
+
+    explicit BitPattern(const string& pattern) : length(pattern.size()) {
+        fill(begin(peq), end(peq), 0);
+        for (size_t i = 0; i < length; ++i) peq[(unsigned char)pattern[i]] |= 1ULL << i;
+    }
+
+    int distance(const char* text, size_t textLength, int bound) const {
+        if ((size_t)abs((long)textLength - (long)length) > (size_t)bound) return bound + 1;
+        if (length == 0) return (int)textLength;
+        uint64_t pv = ~0ULL, mv = 0;
+        uint64_t high = 1ULL << (length - 1);
+        int score = (int)length;
+        for (size_t j = 0; j < textLength; ++j) {
+            uint64_t eq = peq[(unsigned char)text[j]];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+            if (ph & high) ++score;
+            else if (mh & high) --score;
+            ph = (ph << 1) | 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+            // The score falls by at most one per remaining character
+            if (score - (int)(textLength - j - 1) > bound) return bound + 1;
+        }
+        return min(score, bound + 1);
+    }
+};
+
+int editDistance(const string& a, const string& b, int bound) {
+    if ((size_t)abs((long)a.size() - (long)b.size()) > (size_t)bound) return bound + 1;
+    const string& pattern = a.size() <= b.size() ? a : b;
+    const string& text = a.size() <= b.size() ? b : a;
+    if (pattern.size() > 64) return editDistanceRows(pattern, text, bound);
+    return BitPattern(pattern).distance(text.data(), text.size(), bound);
+}
+
+void NameIndex::clear() {
+    entries.clear();
+    keyEntry.clear();
+    postings.clear();
+    keysByName.clear();
+    seen.clear();
+    hits.clear();
+    dead = 0;
+}
+
+void NameIndex::addPostings(uint32_t entry) {
+    for (uint32_t gram : trigrams(entries[entry].name)) postings[gram].push_back(entry);
+}
+
+void NameIndex::add(int key, const string& name) {
+    if (keyEntry.count(key)) remove(key);
+    uint32_t entry = (uint32_t)entries.size();
+    entries.push_back({key, true, normalizeName(name)});
+    keyEntry.emplace(key, entry);
+    keysByName[entries[entry].name].push_back(key);
+    addPostings(entry);
+}
+
+// Removal only marks the entry; posting lists are rebuilt once most entries are dead
+void NameIndex::remove(int key) {
+    auto found = keyEntry.find(key);
+    if (found == keyEntry.end()) return;
+    Entry& e = entries[found->second];
+    auto named = keysByName.find(e.name);
+    vector<int>& keys = named->second;
+    keys.erase(find(keys.begin(), keys.end(), key));
+    if (keys.empty()) keysByName.erase(named);
+    e.live = false;
+    e.name.clear();
+    e.name.shrink_to_fit();
+    keyEntry.erase(found);
+    if (++dead > 1024 && dead > keyEntry.size()) compact();
+}
+
+void NameIndex::compact() {
+    vector<Entry> live;
+    live.reserve(keyEntry.size());
+    for (Entry& e : entries) {
+        if (e.live) live.push_back(move(e));
+    }
+    entries.swap(live);
+    keyEntry.clear();
+    postings.clear();
+    seen.clear();
+    hits.clear();
+    dead = 0;
+    for (uint32_t i = 0; i < entries.size(); ++i) {
+        keyEntry.emplace(entries[i].key, i);
+        addPostings(i);
+    }
+}
+
+const vector<int>& NameIndex::lookup(const string& name) const {
+    static const vector<int> none;
+    auto found = keysByName.find(normalizeName(name));
+    return found == keysByName.end() ? none : found->second;
+}
+
+vector<NameMatch> NameIndex::search(const string& query, int maxDistance) const {
+    vector<NameMatch> matches;
+    string q = normalizeName(query);
+    if (q.empty()) return matches;
+    bool oneWord = q.find(' ') == string::npos;
+    vector<uint32_t> grams = trigrams(q);
+    int total = (int)grams.size();
+
+    // A word after the first lacks the name's "  x" trigram, so a one-word query
+    // may share one trigram fewer with a name it matches a word of
+    int slack = oneWord ? 1 : 0;
+    int k = maxDistance >= 0 ? maxDistance : (q.size() <= 4 ? 1 : 2);
+    while (k > 0 && total - 3 * k - slack < 1) --k;
+    int shared = max(1, total - 3 * k - slack);
+
+    // A match holds at least `shared` of the query's trigrams, so it appears in at
+    // least shared - (total - scanned) of any `scanned` lists. The shortest
+    // total - shared + 1 lists are enough to find every match; further lists that
+    // are still short are scanned too, since the higher count they allow weeds out
+    // candidates for less than it costs to verify them.
+    vector<const vector<uint32_t>*> lists;
+    static const vector<uint32_t> none;
+    for (uint32_t gram : grams) {
+        auto found = postings.find(gram);
+        lists.push_back(found == postings.end() ? &none : &found->second);
+    }
+    sort(lists.begin(), lists.end(),
+         [](const vector<uint32_t>* a, const vector<uint32_t>* b) { return a->size() < b->size(); });
+    size_t scanned = total - shared + 1;
+    size_t budget = 0;
+    for (size_t i = 0; i < scanned; ++i) budget += lists[i]->size();
+    budget *= 2;
+    while (scanned < lists.size() && lists[scanned]->size() <= budget) budget -= lists[scanned++]->size();
+    int minHits = shared - (total - (int)scanned);
+
+    if (seen.size() < entries.size()) {
+        seen.resize(entries.size(), 0);
+        hits.resize(entries.size(), 0);
+    }
+    if (++searchStamp == 0) {
+        fill(seen.begin(), seen.end(), 0);
+        searchStamp = 1;
+    }
+    vector<uint32_t> candidates;
+    for (size_t i = 0; i < scanned; ++i) {
+        for (uint32_t id : *lists[i]) {
+            if (seen[id] != searchStamp) {
+                seen[id] = searchStamp;
+                hits[id] = 0;
+                candidates.push_back(id);
+            }
+            ++hits[id];
+        }
+    }
+
+    bool bitParallel = q.size() <= 64;
+    BitPattern pattern(bitParallel ? q : string());
+    auto distanceTo = [&](const char* text, size_t length) {
+        if (bitParallel) return pattern.distance(text, length, k);
+        return editDistance(q, string(text, length), k);
+    };
+
+    for (uint32_t id : candidates) {
+        const Entry& e = entries[id];
+        if (hits[id] < minHits || !e.live) continue;
+
+        int whole = distanceTo(e.name.data(), e.name.size());
+        int word = k + 1;
+        if (oneWord && whole > 0) {
+            size_t start = 0;
+            while (start <= e.name.size() && word > 0) {
+                size_t end = e.name.find(' ', start);
+                if (end == string::npos) end = e.name.size();
+                word = min(word, distanceTo(e.name.data() + start, end - start));
+                start = end + 1;
+            }
+        }
+        if (whole <= k && whole <= word) matches.push_back({e.key, whole, true});
+        else if (word <= k) matches.push_back({e.key, word, false});
+    }
+    sort(matches.begin(), matches.end(), [](const NameMatch& a, const NameMatch& b) {
+        if (a.distance != b.distance) return a.distance < b.distance;
+        if (a.wholeName != b.wholeName) return a.wholeName;
+        return a.key < b.key;
+    });
+    return matches;
+}
@@ -0,0 +1,68 @@
+// Customer name search. Names are normalized (lowercase, single spaces); exact
+// lookups go through a hash multimap and typo-tolerant ones through trigrams. A name within k edits
+// of the query shares all but at most 3k of its trigrams, so only the rarest few
+// posting lists need scanning to find every candidate; each candidate is then
+// checked with a bit-parallel edit distance, 64 DP cells per machine word.
+#ifndef BANKSEARCH_H
+#define BANKSEARCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Lowercase, trim and collapse runs of whitespace to one space
+std::string normalizeName(const std::string& name);
+
+// Levenshtein distance between a and b, or bound + 1 as soon as it must exceed bound
+int editDistance(const std::string& a, const std::string& b, int bound);
+
+// One name within the search distance
+struct NameMatch {
+    int key;                // Account number or loan ID
+    int distance;           // Edits from the query to the name, or to its closest word
+    bool wholeName;         // The whole name matched, not just one word of it
+};
+
+class NameIndex {
+public:
+    void clear();
+
+    // Index key under name, replacing any name it had
+    void add(int key, const std::string& name);
+    void remove(int key);
+    size_t size() const { return keyEntry.size(); }
+
+    // Keys indexed under exactly this name once normalized, in the order they were
+    // added; costs one hash lookup plus the matches
+    const std::vector<int>& lookup(const std::string& name) const;
+
+    // Every name within maxDistance edits of the query, closest first; a one-word
+    // query also matches any single word of a name (a surname, say). A negative
+    // maxDistance picks 1 for queries up to 4 characters and 2 otherwise, and the
+    // distance is lowered for queries too short to tell that many typos apart.
+    // Not safe to call from several threads at once.
+    std::vector<NameMatch> search(const std::string& query, int maxDistance = -1) const;
+
+private:
+    struct Entry {
+        int key;
+        bool live;
+        std::string name;       // Normalized
+    };
+
+    void addPostings(uint32_t entry);
+    void compact();
+
+    std::vector<Entry> entries;                             // Removed entries stay until compaction
+    std::unordered_map<int, uint32_t> keyEntry;             // Key -> its live entry
+    std::unordered_map<uint32_t, std::vector<uint32_t>> postings; // Trigram -> entries containing it
+    std::unordered_map<std::string, std::vector<int>> keysByName;  // Normalized name -> keys
+    size_t dead = 0;
+    mutable std::vector<uint32_t> seen;                     // Per-entry search stamp, to visit each candidate once
+    mutable std::vector<uint16_t> hits;                     // Query trigrams found per candidate this search
+    mutable uint32_t searchStamp = 0;
+};
+
+#endif
@@ -0,0 +1,435 @@
+#include "bankshard.h"
+#include "bankidempotency.h"
+#include "bankreplica.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <poll.h>       // for poll()
+#include <sys/socket.h> // for accept()
+#include <unistd.h>     // for close()
+
+using namespace std;
+
+// Log lines appended before a log is rewritten without its finished entries
+static const size_t LOG_REWRITE_LINES = 4096;
+static const int COORDINATOR_SHIFT = 40;
+
+size_t shardOf(int accountNumber, size_t shardCount) {
+    return fnv1a(&accountNumber, sizeof(accountNumber)) % shardCount;
+}
+
+static ShardRequest makeRequest(uint32_t op, int accountNumber, double amount = 0, uint64_t txid = 0,
+                                int otherAccount = 0) {
+    ShardRequest request;
+    memset(&request, 0, sizeof(request));
+    request.op = op;
+    request.accountNumber = accountNumber;
+    request.otherAccount = otherAccount;
+    request.amount = amount;
+    request.txid = txid;
+    return request;
+}
+
+// ---------------------------------------------------------------------------
+// Shard server
+// Prepare log lines: "P txid account amount outgoing" before a yes vote, then
+// "D txid" once the leg is committed or aborted.
+// ---------------------------------------------------------------------------
+
+ShardServer::ShardServer(BankEngine& bankEngine, const string& logPath)
+    : engine(bankEngine), prepareLogPath(logPath) {
+    ifstream in(prepareLogPath);
+    string line;
+    while (getline(in, line)) {
+        istringstream iss(line);
+        char step;
+        uint64_t txid;
+        if (!(iss >> step >> txid)) continue;
+        PreparedLeg leg;
+        if (step == 'P' && iss >> leg.accountNumber >> leg.amount >> leg.outgoing) {
+            prepared[txid] = leg;
+            if (leg.outgoing) reservations[leg.accountNumber] += leg.amount;
+        } else if (step == 'D') {
+            auto it = prepared.find(txid);
+            if (it == prepared.end()) continue;
+            if (it->second.outgoing) reservations[it->second.accountNumber] -= it->second.amount;
+            prepared.erase(it);
+        }
+    }
+    in.close();
+    for (auto it = reservations.begin(); it != reservations.end();) {
+        if (it->second <= 0) it = reservations.erase(it);
+        else ++it;
+    }
+    rewritePrepareLog();
+}
+
+double ShardServer::reservedFrom(int accountNumber) const {
+    auto it = reservations.find(accountNumber);
+    return it == reservations.end() ? 0 : it->second;
+}
+
+// A local debit may not spend money reserved for a prepared transfer
+OpStatus ShardServer::checkDebit(int accountNumber, double amount) const {
+    double reserved = reservedFrom(accountNumber);
+    if (reserved <= 0) return OP_OK;
+    const Account* account = engine.findAccount(accountNumber);
+    if (account && amount > 0 && amount + reserved > engine.balanceWithInterest(*account)) {
+        return OP_INSUFFICIENT_FUNDS;
+    }
+    return OP_OK;
+}
+
+void ShardServer::logLine(const string& line) {
+    prepareLog << line << "\n";
+    prepareLog.flush();
+}
+
+// Keep only the legs still in doubt
+void ShardServer::rewritePrepareLog() {
+    prepareLog.close();
+    string tmpFile = prepareLogPath + ".tmp";
+    ofstream out(tmpFile);
+    out << setprecision(17);
+    for (const auto& entry : prepared) {
+        const PreparedLeg& leg = entry.second;
+        out << "P " << entry.first << " " << leg.accountNumber << " " << leg.amount << " " << leg.outgoing << "\n";
+    }
+    out.close();
+    rename(tmpFile.c_str(), prepareLogPath.c_str());
+    prepareLog.open(prepareLogPath, ios::app);
+    prepareLog << setprecision(17);
+    decidedSinceRewrite = 0;
+}
+
+ShardReply ShardServer::handle(const ShardRequest& request) {
+    ShardReply reply = {OP_OK, 0, 0};
+    OpStatus status = OP_OK;
+    int acc = request.accountNumber;
+    switch (request.op) {
+        case SHARD_CREATE: {
+            if (!memchr(request.name, '\0', sizeof(request.name))) {
+                status = OP_NAME_TOO_LONG;
+                break;
+            }
+            Account account = {acc, request.name, request.amount, request.interestRate};
+            status = engine.createAccount(account);
+            break;
+        }
+        case SHARD_DEPOSIT:
+            status = engine.deposit(acc, request.amount);
+            break;
+        case SHARD_WITHDRAW:
+            status = checkDebit(acc, request.amount);
+            if (status == OP_OK) status = engine.withdraw(acc, request.amount);
+            break;
+        case SHARD_TRANSFER:
+            status = checkDebit(acc, request.amount);
+            if (status == OP_OK) status = engine.transfer(acc, request.otherAccount, request.amount);
+            break;
+        case SHARD_BALANCE: {
+            const Account* account = engine.findAccount(acc);
+            if (account) reply.value = engine.balanceWithInterest(*account);
+            else status = OP_NOT_FOUND;
+            break;
+        }
+        case SHARD_TOTAL: {
+            const vector<Account>& accounts = engine.getAccounts();
+            for (size_t i = 0; i < accounts.size(); ++i) {
+                if (!engine.isClosedAt(i)) reply.value += engine.balanceWithInterest(accounts[i]);
+            }
+            break;
+        }
+        case SHARD_PREPARE_DEBIT:
+        case SHARD_PREPARE_CREDIT: {
+            if (prepared.count(request.txid)) break; // A retried prepare keeps its vote
+            bool outgoing = request.op == SHARD_PREPARE_DEBIT;
+            status = engine.prepareTransferLeg(acc, request.amount, outgoing, outgoing ? reservedFrom(acc) : 0);
+            if (status != OP_OK) break;
+            ostringstream line;
+            line << setprecision(17) << "P " << request.txid << " " << acc << " " << request.amount << " " << outgoing;
+            logLine(line.str());
+            prepared[request.txid] = {acc, request.amount, outgoing};
+            if (outgoing) reservations[acc] += request.amount;
+            break;
+        }
+        case SHARD_COMMIT:
+        case SHARD_ABORT: {
+            // An unknown txid was decided before (or never prepared here): nothing to do
+            auto it = prepared.find(request.txid);
+            if (it == prepared.end()) break;
+            PreparedLeg leg = it->second;
+            if (request.op == SHARD_COMMIT) {
+                string key = "2pc-" + to_string(request.txid) + (leg.outgoing ? "-out" : "-in");
+                // A crash inside an earlier commit of this leg left its key pending; the
+                // engine settled it from its log on load, so this is OP_OK if the leg was
+                // posted (its balance restored if need be) or a fresh run if it was not.
+                // Only a key the log cannot settle stays in doubt, held for an operator.
+                status = engine.commitTransferLeg(leg.accountNumber, leg.amount, leg.outgoing, key);
+                if (status == OP_KEY_IN_DOUBT) {
+                    cerr << "Error: Commit of transfer " << request.txid << " is in doubt; check account "
+                         << leg.accountNumber << " and settle key " << key << " with resolveKeyInDoubt.\n";
+                }
+                if (status != OP_OK) break; // Held until the account can take it
+            }
+            if (leg.outgoing) {
+                double& reserved = reservations[leg.accountNumber];
+                reserved -= leg.amount;
+                if (reserved <= 1e-9) reservations.erase(leg.accountNumber);
+            }
+            prepared.erase(it);
+            logLine("D " + to_string(request.txid));
+            if (++decidedSinceRewrite >= LOG_REWRITE_LINES) rewritePrepareLog();
+            break;
+        }
+        default:
+            status = OP_UNAVAILABLE;
+            break;
+    }
+    reply.status = status;
+    return reply;
+}
+
+bool ShardServer::serve(const string& socketPath) {
+    int listenFd = listenOnSocket(socketPath);
+    if (listenFd < 0) return false;
+    vector<pollfd> fds = {{listenFd, POLLIN, 0}};
+    while (true) {
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        // Clients first, newest to oldest, so a dropped one can be erased in place
+        for (size_t i = fds.size() - 1; i > 0; --i) {
+            if (!fds[i].revents) continue;
+            ShardRequest request;
+            bool ok = receiveAll(fds[i].fd, &request, sizeof(request));
+            if (ok) {
+                ShardReply reply = handle(request);
+                ok = sendAll(fds[i].fd, &reply, sizeof(reply));
+            }
+            if (!ok) {
+                ::close(fds[i].fd);
+                fds.erase(fds.begin() + i);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int client = ::accept(listenFd, nullptr, nullptr);
+            if (client >= 0) fds.push_back({client, POLLIN, 0});
+        }
+    }
+    for (const pollfd& p : fds) ::close(p.fd);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Sharded ledger (coordinator)
+// Recovery log lines: "N next" carries the transfer ID sequence over a rewrite;
+// "B txid src dest amount" is written before either shard is asked to prepare,
+// "C txid" once both voted yes and "E txid" once both shards have the decision.
+// A B without a C is presumed aborted.
+// ---------------------------------------------------------------------------
+
+bool ShardedLedger::connect(const vector<string>& shardSockets, const string& logPath, uint32_t coordinatorID) {
+    close();
+    if (shardSockets.empty()) return false;
+    socketPaths = shardSockets;
+    shards.assign(socketPaths.size(), -1);
+    for (size_t s = 0; s < shards.size(); ++s) {
+        shards[s] = connectToSocket(socketPaths[s]);
+        if (shards[s] < 0) {
+            close();
+            return false;
+        }
+    }
+    recoveryLogPath = logPath;
+    coordinator = (uint64_t)coordinatorID << COORDINATOR_SHIFT;
+    nextTxid = 1;
+    crossShard = 0;
+    recover();
+    if (!recoveryLog.is_open()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ShardedLedger::close() {
+    for (int fd : shards) {
+        if (fd >= 0) ::close(fd);
+    }
+    shards.clear();
+    socketPaths.clear();
+    recoveryLog.close();
+}
+
+// Reconnect a shard lost earlier before sending to it
+bool ShardedLedger::send(size_t shard, const ShardRequest& request) {
+    if (shards[shard] < 0) shards[shard] = connectToSocket(socketPaths[shard]);
+    if (shards[shard] < 0) return false;
+    if (sendAll(shards[shard], &request, sizeof(request))) return true;
+    ::close(shards[shard]);
+    shards[shard] = -1;
+    return false;
+}
+
+bool ShardedLedger::receive(size_t shard, ShardReply& reply) {
+    if (shards[shard] < 0) return false;
+    if (receiveAll(shards[shard], &reply, sizeof(reply))) return true;
+    ::close(shards[shard]);
+    shards[shard] = -1;
+    return false;
+}
+
+OpStatus ShardedLedger::call(size_t shard, ShardRequest request, ShardReply& reply) {
+    if (!send(shard, request) || !receive(shard, reply)) return OP_UNAVAILABLE;
+    return (OpStatus)reply.status;
+}
+
+void ShardedLedger::logStep(char step, uint64_t txid, int src, int dest, double amount) {
+    recoveryLog << step << " " << txid;
+    if (step == 'B') recoveryLog << " " << src << " " << dest << " " << amount;
+    recoveryLog << "\n";
+    recoveryLog.flush();
+    ++loggedSteps;
+}
+
+// Tell both shards the outcome; true once both have acknowledged it
+bool ShardedLedger::deliver(uint64_t txid, int src, int dest, double amount, bool commit) {
+    uint32_t op = commit ? SHARD_COMMIT : SHARD_ABORT;
+    ShardReply reply;
+    bool srcDone = call(shardOf(src, shards.size()), makeRequest(op, src, amount, txid), reply) == OP_OK;
+    bool destDone = call(shardOf(dest, shards.size()), makeRequest(op, dest, amount, txid), reply) == OP_OK;
+    return srcDone && destDone;
+}
+
+size_t ShardedLedger::recover() {
+    struct InDoubt {
+        int src;
+        int dest;
+        double amount;
+        bool commit;
+    };
+    map<uint64_t, InDoubt> inDoubt;
+    uint64_t sequenceMask = ((uint64_t)1 << COORDINATOR_SHIFT) - 1;
+    recoveryLog.close();
+    ifstream in(recoveryLogPath);
+    string line;
+    while (getline(in, line)) {
+        istringstream iss(line);
+        char step;
+        uint64_t txid;
+        if (!(iss >> step >> txid)) continue;
+        InDoubt entry = {0, 0, 0, false};
+        if (step == 'N') {
+            nextTxid = max(nextTxid, txid);
+        } else if (step == 'B' && iss >> entry.src >> entry.dest >> entry.amount) {
+            inDoubt[txid] = entry;
+            nextTxid = max(nextTxid, (txid & sequenceMask) + 1);
+        } else if (step == 'C' && inDoubt.count(txid)) {
+            inDoubt[txid].commit = true;
+        } else if (step == 'E') {
+            inDoubt.erase(txid);
+        }
+    }
+    in.close();
+
+    size_t finished = 0;
+    for (auto it = inDoubt.begin(); it != inDoubt.end();) {
+        const InDoubt& t = it->second;
+        if (deliver(it->first, t.src, t.dest, t.amount, t.commit)) {
+            ++finished;
+            it = inDoubt.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Rewrite the log with only what is still undelivered
+    string tmpFile = recoveryLogPath + ".tmp";
+    ofstream out(tmpFile);
+    out << setprecision(17) << "N " << nextTxid << "\n";
+    for (const auto& entry : inDoubt) {
+        const InDoubt& t = entry.second;
+        out << "B " << entry.first << " " << t.src << " " << t.dest << " " << t.amount << "\n";
+        if (t.commit) out << "C " << entry.first << "\n";
+    }
+    out.close();
+    if (out) rename(tmpFile.c_str(), recoveryLogPath.c_str());
+    recoveryLog.open(recoveryLogPath, ios::app);
+    recoveryLog << setprecision(17);
+    loggedSteps = 0;
+    undelivered = inDoubt.size();
+    return finished;
+}
+
+OpStatus ShardedLedger::createAccount(const Account& account) {
+    // The name travels in a fixed field with its terminator; a longer one is refused, not cut
+    if (account.customerName.size() >= sizeof(ShardRequest::name)) return OP_NAME_TOO_LONG;
+    ShardRequest request = makeRequest(SHARD_CREATE, account.accountNumber, account.balance);
+    request.interestRate = account.interestRate;
+    account.customerName.copy(request.name, sizeof(request.name) - 1);
+    ShardReply reply;
+    return call(shardOf(account.accountNumber, shards.size()), request, reply);
+}
+
+OpStatus ShardedLedger::deposit(int accountNumber, double amount) {
+    ShardReply reply;
+    return call(shardOf(accountNumber, shards.size()), makeRequest(SHARD_DEPOSIT, accountNumber, amount), reply);
+}
+
+OpStatus ShardedLedger::withdraw(int accountNumber, double amount) {
+    ShardReply reply;
+    return call(shardOf(accountNumber, shards.size()), makeRequest(SHARD_WITHDRAW, accountNumber, amount), reply);
+}
+
+OpStatus ShardedLedger::balance(int accountNumber, double& balance) {
+    ShardReply reply;
+    OpStatus status = call(shardOf(accountNumber, shards.size()), makeRequest(SHARD_BALANCE, accountNumber), reply);
+    if (status == OP_OK) balance = reply.value;
+    return status;
+}
+
+OpStatus ShardedLedger::totalBalance(double& total) {
+    total = 0;
+    for (size_t s = 0; s < shards.size(); ++s) {
+        ShardReply reply;
+        OpStatus status = call(s, makeRequest(SHARD_TOTAL, 0), reply);
+        if (status != OP_OK) return status;
+        total += reply.value;
+    }
+    return OP_OK;
+}
+
+OpStatus ShardedLedger::transfer(int src, int dest, double amount) {
+    size_t srcShard = shardOf(src, shards.size()), destShard = shardOf(dest, shards.size());
+    ShardReply reply;
+    if (srcShard == destShard) return call(srcShard, makeRequest(SHARD_TRANSFER, src, amount, 0, dest), reply);
+    if (amount <= 0) return OP_INVALID_AMOUNT;
+
+    uint64_t txid = coordinator | nextTxid++;
+    ++crossShard;
+    logStep('B', txid, src, dest, amount);
+
+    // Phase one: both shards prepare at once
+    ShardReply debitVote = {OP_UNAVAILABLE, 0, 0}, creditVote = {OP_UNAVAILABLE, 0, 0};
+    bool debitSent = send(srcShard, makeRequest(SHARD_PREPARE_DEBIT, src, amount, txid, dest));
+    bool creditSent = send(destShard, makeRequest(SHARD_PREPARE_CREDIT, dest, amount, txid, src));
+    if (debitSent && !receive(srcShard, debitVote)) debitVote.status = OP_UNAVAILABLE;
+    if (creditSent && !receive(destShard, creditVote)) creditVote.status = OP_UNAVAILABLE;
+
+    // Phase two: the decision is durable once logged
+    bool commit = debitVote.status == OP_OK && creditVote.status == OP_OK;
+    if (commit) logStep('C', txid);
+    if (deliver(txid, src, dest, amount, commit)) logStep('E', txid);
+    else ++undelivered;
+    if (loggedSteps >= LOG_REWRITE_LINES) recover();
+
+    if (commit) return OP_OK;
+    return debitVote.status != OP_OK ? (OpStatus)debitVote.status : (OpStatus)creditVote.status;
+}
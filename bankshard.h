@@ -0,0 +1,143 @@
+// Sharded ledger: accounts are spread across several engine processes on one host
+// by a hash of the account number, each process (a ShardServer) owning its own data
+// directory and answering requests on a Unix socket. Clients route through a
+// ShardedLedger. An operation on one shard runs there as usual; a transfer between
+// shards is a two-phase commit driven by the client, which logs each step to a
+// recovery log so a transfer left in doubt by a crash is finished on restart.
+//
+// Phase one asks the source shard to reserve the amount and the destination shard
+// to accept it; each writes the promise to its prepare log before voting yes. Once
+// both have, the client logs the commit decision and asks both to post their leg.
+// A reserved amount cannot be spent by other debits until the decision arrives.
+#ifndef BANKSHARD_H
+#define BANKSHARD_H
+
+#include "bankengine.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Shard holding an account number, out of shardCount
+size_t shardOf(int accountNumber, size_t shardCount);
+
+enum ShardOp : uint32_t {
+    SHARD_CREATE = 1,           // account, amount = opening balance, rate, name (NUL-terminated)
+    SHARD_DEPOSIT,
+    SHARD_WITHDRAW,
+    SHARD_TRANSFER,             // Both accounts on this shard
+    SHARD_BALANCE,              // Reply value = balance with accrued interest
+    SHARD_TOTAL,                // Reply value = sum of live balances (reserved amounts are still in them)
+    SHARD_PREPARE_DEBIT,        // Reserve amount from account for transfer txid
+    SHARD_PREPARE_CREDIT,       // Check account can take amount for transfer txid
+    SHARD_COMMIT,               // Post the prepared leg of txid
+    SHARD_ABORT                 // Drop the prepared leg of txid
+};
+
+// Fixed-size messages, so a request or reply is a single read
+struct ShardRequest {
+    uint32_t op;
+    int32_t accountNumber;
+    int32_t otherAccount;       // Transfer destination
+    uint32_t reserved;
+    double amount;
+    double interestRate;        // For SHARD_CREATE
+    uint64_t txid;              // Cross-shard transfer ID: coordinator ID in the top 24 bits
+    char name[32];              // Customer name for SHARD_CREATE, at most 31 characters
+};
+
+struct ShardReply {
+    int32_t status;             // OpStatus
+    uint32_t reserved;
+    double value;
+};
+
+// One shard: an engine over its own directory plus the prepared legs of transfers
+// in doubt. Requests from every client are handled one at a time.
+class ShardServer {
+public:
+    // The engine must already be loaded. Legs still in the prepare log from before a
+    // restart are held again until their coordinator decides them.
+    explicit ShardServer(BankEngine& engine, const std::string& prepareLogPath);
+
+    // Serve clients on socketPath until the process is stopped; returns false if the
+    // socket cannot be opened
+    bool serve(const std::string& socketPath);
+    ShardReply handle(const ShardRequest& request);
+
+private:
+    struct PreparedLeg {
+        int accountNumber;
+        double amount;
+        bool outgoing;
+    };
+    double reservedFrom(int accountNumber) const;
+    OpStatus checkDebit(int accountNumber, double amount) const;
+    void logLine(const std::string& line);
+    void rewritePrepareLog();
+
+    BankEngine& engine;
+    std::string prepareLogPath;
+    std::ofstream prepareLog;
+    size_t decidedSinceRewrite = 0;
+    std::unordered_map<uint64_t, PreparedLeg> prepared;     // By txid
+    std::unordered_map<int, double> reservations;           // Reserved debits by account
+};
+
+// Client side: routes each operation to its shard and coordinates cross-shard
+// transfers. Not thread-safe; each client thread or process needs its own, with its
+// own coordinator ID and recovery log.
+class ShardedLedger {
+public:
+    ShardedLedger() = default;
+    ShardedLedger(const ShardedLedger&) = delete;
+    ShardedLedger& operator=(const ShardedLedger&) = delete;
+    ~ShardedLedger() { close(); }
+
+    // Connect to every shard (socket paths in shard order) and finish any transfer
+    // the recovery log shows in doubt. The log also carries the last transfer ID
+    // used, so keep it: IDs must never repeat for a coordinator.
+    bool connect(const std::vector<std::string>& shardSockets, const std::string& recoveryLogPath,
+                 uint32_t coordinatorID);
+    void close();
+    size_t shardCount() const { return shards.size(); }
+
+    // OP_NAME_TOO_LONG, without asking any shard, for a name over 31 characters
+    OpStatus createAccount(const Account& account);
+    OpStatus deposit(int accountNumber, double amount);
+    OpStatus withdraw(int accountNumber, double amount);
+    OpStatus balance(int accountNumber, double& balance);
+    // Sum of live balances over every shard
+    OpStatus totalBalance(double& total);
+    // Local to one shard when both accounts live there, two-phase commit otherwise.
+    // OP_OK means the transfer is decided; if a shard could not be told, the recovery
+    // log keeps it and the next recover() delivers it.
+    OpStatus transfer(int srcAccountNumber, int destAccountNumber, double amount);
+    // Deliver every decision the recovery log holds; returns the transfers finished
+    size_t recover();
+
+    size_t crossShardTransfers() const { return crossShard; }
+    size_t undeliveredDecisions() const { return undelivered; }
+
+private:
+    OpStatus call(size_t shard, ShardRequest request, ShardReply& reply);
+    bool send(size_t shard, const ShardRequest& request);
+    bool receive(size_t shard, ShardReply& reply);
+    void logStep(char step, uint64_t txid, int src = 0, int dest = 0, double amount = 0);
+    bool deliver(uint64_t txid, int src, int dest, double amount, bool commit);
+
+    std::vector<std::string> socketPaths;
+    std::vector<int> shards;            // Socket per shard, -1 until (re)connected
+    std::string recoveryLogPath;
+    std::ofstream recoveryLog;
+    uint64_t coordinator = 0;           // Coordinator ID, shifted into place
+    uint64_t nextTxid = 1;              // Sequence part of the next transfer ID
+    size_t crossShard = 0;
+    size_t loggedSteps = 0;             // Lines appended since the log was last rewritten
+    size_t undelivered = 0;             // Decisions a shard has not acknowledged yet
+};
+
+#endif
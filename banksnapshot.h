@@ -0,0 +1,78 @@
+// Copy-on-write page versions for snapshot reads. The engine's live record vectors
+// are split into fixed-size pages; a snapshot shares immutable copies of those pages,
+// and only pages written since the previous snapshot are copied again. Writers merely
+// mark a page dirty, and a page version is freed when the last snapshot using it goes.
+#ifndef BANKSNAPSHOT_H
+#define BANKSNAPSHOT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+template <typename T>
+class PagedSnapshot {
+public:
+    static const size_t PAGE_SHIFT = 8;
+    static const size_t PAGE_SIZE = size_t(1) << PAGE_SHIFT;   // Records per page
+    typedef std::vector<T> Page;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t i) const { return (*pages[i >> PAGE_SHIFT])[i & (PAGE_SIZE - 1)]; }
+    uint64_t version() const { return stamp; }  // Write version the snapshot was taken at
+
+private:
+    template <typename> friend class PageVersions;
+    std::vector<std::shared_ptr<const Page>> pages;
+    size_t count = 0;
+    uint64_t stamp = 0;
+};
+
+// Tracks which pages of one live vector changed since the last capture. All calls
+// must be made under the owner's write lock.
+template <typename T>
+class PageVersions {
+public:
+    // Record i was written or appended
+    void touch(size_t i) {
+        ++writes;
+        size_t page = i >> PagedSnapshot<T>::PAGE_SHIFT;
+        if (page < dirty.size()) dirty[page] = 1;
+    }
+
+    // Records were removed or reordered; the next capture copies every page
+    void touchAll() {
+        ++writes;
+        cache.clear();
+        dirty.clear();
+    }
+
+    PagedSnapshot<T> capture(const std::vector<T>& live) {
+        const size_t pageSize = PagedSnapshot<T>::PAGE_SIZE;
+        size_t pageCount = (live.size() + pageSize - 1) / pageSize;
+        cache.resize(pageCount);
+        dirty.resize(pageCount, 1);
+        for (size_t p = 0; p < pageCount; ++p) {
+            size_t begin = p * pageSize;
+            size_t end = std::min(begin + pageSize, live.size());
+            // A partly filled last page is recopied once appends have grown it
+            if (!dirty[p] && cache[p] && cache[p]->size() == end - begin) continue;
+            cache[p] = std::make_shared<const typename PagedSnapshot<T>::Page>(live.begin() + begin, live.begin() + end);
+            dirty[p] = 0;
+        }
+        PagedSnapshot<T> snap;
+        snap.pages = cache;
+        snap.count = live.size();
+        snap.stamp = writes;
+        return snap;
+    }
+
+private:
+    std::vector<std::shared_ptr<const typename PagedSnapshot<T>::Page>> cache;
+    std::vector<char> dirty;
+    uint64_t writes = 0;
+};
+
+#endif
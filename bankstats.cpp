@@ -0,0 +1,382 @@
+#include "bankstats.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <condition_variable>
+#include <iomanip>
+#include <cmath>
+#include <cstdio>
+#include <unistd.h>
+#include <linux/perf_event.h> // for the hardware counters used by --profile
+#include <sys/syscall.h>      // for syscall(), as glibc has no perf_event_open wrapper
+
+using namespace std;
+
+// ---------------------------------------------------------------------------
+// Operation statistics
+// Every thread records into its own shard, so the hot path never takes a lock
+// or a locked instruction; readers sum all shards. Latencies go into log-linear
+// histograms: each power of two is split into 16 sub-buckets by the 4 bits below
+// the leading one (HIST_SUB_BITS), so a bucket spans at most 1/16 (about 6%) of
+// its values and the midpoint reported is within about 3%. It is the layout
+// HdrHistogram uses, at roughly one significant decimal digit.
+// ---------------------------------------------------------------------------
+
+const string statsFile = "stats.json";
+const int HIST_SUB_BITS = 4;
+const int HIST_SUB_BUCKETS = 1 << HIST_SUB_BITS;
+const int HIST_BUCKETS = (64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS;
+
+const char* statOpNames[STAT_OP_COUNT] = {
+    "deposit", "withdraw", "transfer", "interest", "freeze", "repay", "bulk_freeze", "import",
+    "standing_orders", "auto_debit", "clearing", "load_accounts", "save_accounts", "load_loanbook",
+    "save_loanbook", "load_transactions", "save_transactions"
+};
+
+// Counters owned by one thread. Only that thread writes them; other threads may read.
+struct StatsShard {
+    atomic<uint64_t> buckets[STAT_OP_COUNT][HIST_BUCKETS];
+    atomic<uint64_t> totalNs[STAT_OP_COUNT];
+    atomic<uint64_t> maxNs[STAT_OP_COUNT];
+    atomic<uint64_t> rejections[OP_STATUS_COUNT];
+    atomic<uint64_t> bytesPersisted[STAT_OP_COUNT];
+};
+
+// Sum of every shard at the time it was read
+struct StatsSnapshot {
+    vector<vector<uint64_t>> buckets = vector<vector<uint64_t>>(STAT_OP_COUNT, vector<uint64_t>(HIST_BUCKETS, 0));
+    uint64_t count[STAT_OP_COUNT] = {};
+    uint64_t totalNs[STAT_OP_COUNT] = {};
+    uint64_t maxNs[STAT_OP_COUNT] = {};
+    uint64_t rejections[OP_STATUS_COUNT] = {};
+    uint64_t bytesPersisted[STAT_OP_COUNT] = {};
+};
+
+// Shards outlive their threads so counts from finished workers are not lost
+mutex statsShardsMutex;
+vector<unique_ptr<StatsShard>> statsShards;
+auto statsStartTime = chrono::steady_clock::now();
+
+StatsShard& localStatsShard() {
+    thread_local StatsShard* shard = nullptr;
+    if (!shard) {
+        lock_guard<mutex> lock(statsShardsMutex);
+        statsShards.push_back(unique_ptr<StatsShard>(new StatsShard()));
+        shard = statsShards.back().get();
+    }
+    return *shard;
+}
+
+// Single-writer increment: a plain load and store, visible to concurrent readers
+void bumpCounter(atomic<uint64_t>& counter, uint64_t amount) {
+    counter.store(counter.load(memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+int histogramBucket(uint64_t ns) {
+    if (ns < (uint64_t)HIST_SUB_BUCKETS) return (int)ns;
+    int exponent = 63 - __builtin_clzll(ns);
+    int sub = (int)((ns >> (exponent - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+    return (exponent - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS + sub;
+}
+
+// Midpoint of the range of values that fall into a bucket
+uint64_t histogramBucketValue(int bucket) {
+    if (bucket < HIST_SUB_BUCKETS) return bucket;
+    int exponent = bucket / HIST_SUB_BUCKETS + HIST_SUB_BITS - 1;
+    uint64_t width = 1ULL << (exponent - HIST_SUB_BITS);
+    uint64_t low = (uint64_t)(HIST_SUB_BUCKETS + bucket % HIST_SUB_BUCKETS) * width;
+    return low + width / 2;
+}
+
+void recordLatency(StatOp op, uint64_t ns) {
+    StatsShard& shard = localStatsShard();
+    bumpCounter(shard.buckets[op][histogramBucket(ns)], 1);
+    bumpCounter(shard.totalNs[op], ns);
+    if (ns > shard.maxNs[op].load(memory_order_relaxed)) {
+        shard.maxNs[op].store(ns, memory_order_relaxed);
+    }
+}
+
+void recordRejection(OpStatus status) {
+    bumpCounter(localStatsShard().rejections[status], 1);
+}
+
+void recordBytesPersisted(StatOp op, long long bytes) {
+    if (bytes > 0) bumpCounter(localStatsShard().bytesPersisted[op], bytes);
+}
+
+StatsSnapshot collectStats() {
+    StatsSnapshot snap;
+    lock_guard<mutex> lock(statsShardsMutex);
+    for (const auto& shard : statsShards) {
+        for (int op = 0; op < STAT_OP_COUNT; ++op) {
+            for (int b = 0; b < HIST_BUCKETS; ++b) {
+                uint64_t n = shard->buckets[op][b].load(memory_order_relaxed);
+                snap.buckets[op][b] += n;
+                snap.count[op] += n;
+            }
+            snap.totalNs[op] += shard->totalNs[op].load(memory_order_relaxed);
+            snap.maxNs[op] = max(snap.maxNs[op], shard->maxNs[op].load(memory_order_relaxed));
+            snap.bytesPersisted[op] += shard->bytesPersisted[op].load(memory_order_relaxed);
+        }
+        for (int st = 0; st < OP_STATUS_COUNT; ++st) {
+            snap.rejections[st] += shard->rejections[st].load(memory_order_relaxed);
+        }
+    }
+    return snap;
+}
+
+// Latency at the given quantile (0..1) of one operation's histogram, in nanoseconds
+uint64_t statsPercentile(const StatsSnapshot& snap, int op, double quantile) {
+    if (snap.count[op] == 0) return 0;
+    uint64_t rank = (uint64_t)ceil(quantile * snap.count[op]);
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; ++b) {
+        seen += snap.buckets[op][b];
+        if (seen >= rank && seen > 0) return min(histogramBucketValue(b), snap.maxNs[op]);
+    }
+    return snap.maxNs[op];
+}
+
+void writeStatsJson(ostream& out, const StatsSnapshot& snap) {
+    double uptime = chrono::duration<double>(chrono::steady_clock::now() - statsStartTime).count();
+    out << "{\n  \"timestamp\": \"" << getCurrentDateTime() << "\",\n"
+        << "  \"uptime_s\": " << uptime << ",\n  \"operations\": {";
+    bool first = true;
+    for (int op = 0; op < STAT_OP_COUNT; ++op) {
+        out << (first ? "\n" : ",\n") << "    \"" << statOpNames[op] << "\": {"
+            << "\"count\": " << snap.count[op]
+            << ", \"mean_ns\": " << (snap.count[op] ? snap.totalNs[op] / snap.count[op] : 0)
+            << ", \"p50_ns\": " << statsPercentile(snap, op, 0.50)
+            << ", \"p90_ns\": " << statsPercentile(snap, op, 0.90)
+            << ", \"p99_ns\": " << statsPercentile(snap, op, 0.99)
+            << ", \"p999_ns\": " << statsPercentile(snap, op, 0.999)
+            << ", \"max_ns\": " << snap.maxNs[op] << "}";
+        first = false;
+    }
+    out << "\n  },\n  \"rejections\": {";
+    first = true;
+    for (int st = OP_OK + 1; st < OP_STATUS_COUNT; ++st) {
+        out << (first ? "" : ", ") << "\"" << opStatusName((OpStatus)st) << "\": " << snap.rejections[st];
+        first = false;
+    }
+    out << "},\n  \"bytes_persisted\": {"
+        << "\"accounts\": " << snap.bytesPersisted[STAT_SAVE_ACCOUNTS]
+        << ", \"loanbook\": " << snap.bytesPersisted[STAT_SAVE_LOANBOOK]
+        << ", \"transactions\": " << snap.bytesPersisted[STAT_SAVE_TRANSACTIONS] << "}\n}\n";
+}
+
+// Write the stats to a temporary file and rename it, so readers never see a partial dump
+void dumpStatsFile() {
+    string tmpName = statsFile + ".tmp";
+    ofstream outFile(tmpName);
+    if (!outFile) return;
+    writeStatsJson(outFile, collectStats());
+    outFile.close();
+    rename(tmpName.c_str(), statsFile.c_str());
+}
+
+void printStatistics(ostream& out) {
+    StatsSnapshot snap = collectStats();
+    out << "Operation Statistics (latency in microseconds):\n"
+         << left << setw(20) << "Operation" << right << setw(10) << "Count"
+         << setw(12) << "Mean" << setw(12) << "p50" << setw(12) << "p99" << setw(12) << "Max" << "\n"
+         << "------------------------------------------------------------------------------\n"
+         << fixed << setprecision(1);
+    for (int op = 0; op < STAT_OP_COUNT; ++op) {
+        if (snap.count[op] == 0) continue;
+        out << left << setw(20) << statOpNames[op] << right << setw(10) << snap.count[op]
+             << setw(12) << snap.totalNs[op] / (double)snap.count[op] / 1000.0
+             << setw(12) << statsPercentile(snap, op, 0.50) / 1000.0
+             << setw(12) << statsPercentile(snap, op, 0.99) / 1000.0
+             << setw(12) << snap.maxNs[op] / 1000.0 << "\n";
+    }
+    out.unsetf(ios::fixed);
+    out << setprecision(6) << "\nRejections:\n";
+    for (int st = OP_OK + 1; st < OP_STATUS_COUNT; ++st) {
+        if (snap.rejections[st] > 0) out << "  " << opStatusName((OpStatus)st) << ": " << snap.rejections[st] << "\n";
+    }
+    out << "\nBytes persisted:\n"
+         << "  accounts: " << snap.bytesPersisted[STAT_SAVE_ACCOUNTS] << "\n"
+         << "  loanbook: " << snap.bytesPersisted[STAT_SAVE_LOANBOOK] << "\n"
+         << "  transactions: " << snap.bytesPersisted[STAT_SAVE_TRANSACTIONS] << "\n";
+}
+
+// Background thread that rewrites stats.json every interval until stopped
+mutex statsDumperMutex;
+condition_variable statsDumperWake;
+bool statsDumperStop = false;
+thread statsDumperThread;
+
+void startStatsDumper(int intervalSeconds) {
+    if (intervalSeconds <= 0) return;
+    statsDumperThread = thread([intervalSeconds]() {
+        unique_lock<mutex> lock(statsDumperMutex);
+        while (!statsDumperWake.wait_for(lock, chrono::seconds(intervalSeconds), [] { return statsDumperStop; })) {
+            dumpStatsFile();
+        }
+    });
+}
+
+// Stop the dumper and write one final dump so the file reflects the whole run
+void stopStatsDumper() {
+    if (!statsDumperThread.joinable()) return;
+    {
+        lock_guard<mutex> lock(statsDumperMutex);
+        statsDumperStop = true;
+    }
+    statsDumperWake.notify_one();
+    statsDumperThread.join();
+    dumpStatsFile();
+}
+
+// ---------------------------------------------------------------------------
+// Profiling mode (--profile FILE)
+// ProfileSpan records each hot operation with wall time and, where the kernel
+// allows perf_event_open, per-thread hardware counters. Spans are buffered per
+// thread and written on exit as Chrome trace-event JSON, which chrome://tracing
+// and Perfetto display as a timeline with the counters in each span's args.
+// ---------------------------------------------------------------------------
+
+// One finished span
+struct ProfileEvent {
+    const char* name;
+    uint64_t startNs;
+    uint64_t durationNs;
+    bool counted;
+    PerfCounters counters;
+};
+
+// Per-thread event buffer; owned by the registry so it survives its thread
+struct ProfileBuffer {
+    long tid;
+    vector<ProfileEvent> events;
+};
+
+bool profilingEnabled = false;
+string profileTraceFile;
+auto profileStartTime = chrono::steady_clock::now();
+mutex profileBuffersMutex;
+vector<unique_ptr<ProfileBuffer>> profileBuffers;
+atomic<bool> perfWarningShown(false);
+
+uint64_t profileClockNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - profileStartTime).count();
+}
+
+// Hardware counter group for the calling thread: cycles leads, the rest follow
+struct PerfGroup {
+    int fds[4] = {-1, -1, -1, -1};
+    bool available = false;
+
+    PerfGroup() {
+        const uint64_t configs[4] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                     PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for (int i = 0; i < 4; ++i) {
+            perf_event_attr attr = {};
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = configs[i];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+            if (fds[i] < 0) {
+                if (!perfWarningShown.exchange(true)) {
+                    cerr << "Warning: hardware counters unavailable (perf_event_open failed); "
+                         << "profiling wall time only.\n";
+                }
+                return;
+            }
+        }
+        available = true;
+    }
+
+    ~PerfGroup() {
+        for (int fd : fds) {
+            if (fd >= 0) close(fd);
+        }
+    }
+};
+
+bool readPerfCounters(PerfCounters& counters) {
+    thread_local PerfGroup group;
+    if (!group.available) return false;
+    uint64_t data[5]; // Group read layout: counter count, then one value per counter
+    if (read(group.fds[0], data, sizeof(data)) != (ssize_t)sizeof(data)) return false;
+    counters.cycles = data[1];
+    counters.instructions = data[2];
+    counters.cacheMisses = data[3];
+    counters.branchMisses = data[4];
+    return true;
+}
+
+void recordProfileSpan(const char* name, uint64_t startNs, uint64_t endNs,
+                       const PerfCounters& start, const PerfCounters& end, bool counted) {
+    thread_local ProfileBuffer* buffer = nullptr;
+    if (!buffer) {
+        lock_guard<mutex> lock(profileBuffersMutex);
+        profileBuffers.push_back(unique_ptr<ProfileBuffer>(new ProfileBuffer()));
+        buffer = profileBuffers.back().get();
+        buffer->tid = syscall(SYS_gettid);
+    }
+    ProfileEvent event;
+    event.name = name;
+    event.startNs = startNs;
+    event.durationNs = endNs - startNs;
+    event.counted = counted;
+    if (counted) {
+        event.counters.cycles = end.cycles - start.cycles;
+        event.counters.instructions = end.instructions - start.instructions;
+        event.counters.cacheMisses = end.cacheMisses - start.cacheMisses;
+        event.counters.branchMisses = end.branchMisses - start.branchMisses;
+    }
+    buffer->events.push_back(event);
+}
+
+void startProfiling(const string& traceFile) {
+    profileTraceFile = traceFile;
+    profileStartTime = chrono::steady_clock::now();
+    profilingEnabled = true;
+}
+
+// Write every buffered span as a Chrome trace; call once worker threads have finished
+void stopProfiling() {
+    if (!profilingEnabled) return;
+    profilingEnabled = false;
+
+    ofstream outFile(profileTraceFile);
+    if (!outFile) {
+        cerr << "Error: Unable to open " << profileTraceFile << " for writing.\n";
+        return;
+    }
+    outFile << fixed << setprecision(3) << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+    long pid = getpid();
+    size_t written = 0;
+    lock_guard<mutex> lock(profileBuffersMutex);
+    for (const auto& buffer : profileBuffers) {
+        for (const auto& e : buffer->events) {
+            outFile << (written++ ? ",\n" : "")
+                    << "{\"name\": \"" << e.name << "\", \"cat\": \"bank\", \"ph\": \"X\""
+                    << ", \"ts\": " << e.startNs / 1000.0 << ", \"dur\": " << e.durationNs / 1000.0
+                    << ", \"pid\": " << pid << ", \"tid\": " << buffer->tid;
+            if (e.counted) {
+                const PerfCounters& c = e.counters;
+                outFile << ", \"args\": {\"cycles\": " << c.cycles
+                        << ", \"instructions\": " << c.instructions
+                        << ", \"ipc\": " << (c.cycles ? (double)c.instructions / c.cycles : 0.0)
+                        << ", \"cache_misses\": " << c.cacheMisses
+                        << ", \"branch_misses\": " << c.branchMisses << "}";
+            }
+            outFile << "}";
+        }
+    }
+    outFile << "\n]}\n";
+    cerr << "Wrote " << written << " profile spans to " << profileTraceFile << "\n";
+}
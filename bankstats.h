@@ -0,0 +1,108 @@
+// Instrumentation for the engine: per-operation latency histograms and counters
+// (always on, dumped to stats.json) and the opt-in --profile Chrome trace.
+#ifndef BANKSTATS_H
+#define BANKSTATS_H
+
+#include "bankengine.h"
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Operations tracked by the latency histograms
+enum StatOp {
+    STAT_DEPOSIT,
+    STAT_WITHDRAW,
+    STAT_TRANSFER,
+    STAT_INTEREST,
+    STAT_FREEZE,
+    STAT_REPAY,
+    STAT_BULK_FREEZE,
+    STAT_IMPORT,
+    STAT_STANDING_ORDERS,
+    STAT_AUTO_DEBIT,
+    STAT_CLEARING,
+    STAT_LOAD_ACCOUNTS,
+    STAT_SAVE_ACCOUNTS,
+    STAT_LOAD_LOANBOOK,
+    STAT_SAVE_LOANBOOK,
+    STAT_LOAD_TRANSACTIONS,
+    STAT_SAVE_TRANSACTIONS,
+    STAT_OP_COUNT           // Number of tracked operations (not an operation)
+};
+
+void recordLatency(StatOp op, uint64_t ns);
+void recordRejection(OpStatus status);
+void recordBytesPersisted(StatOp op, long long bytes);
+
+// Print the merged statistics as a table
+void printStatistics(std::ostream& out);
+
+// Rewrite stats.json in the current directory every intervalSeconds (0 disables);
+// stopping writes one final dump
+void startStatsDumper(int intervalSeconds);
+void stopStatsDumper();
+
+// Times one operation from construction to destruction and records it in the
+// calling thread's stats shard; reject() also counts why the operation failed
+class OpTimer {
+public:
+    explicit OpTimer(StatOp op) : op(op), start(std::chrono::steady_clock::now()) {}
+    ~OpTimer() {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        recordLatency(op, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+    OpStatus reject(OpStatus status) {
+        recordRejection(status);
+        return status;
+    }
+private:
+    StatOp op;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Hardware counter readings taken at the start and end of a profiled span
+struct PerfCounters {
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t cacheMisses;
+    uint64_t branchMisses;
+};
+
+extern bool profilingEnabled; // Set by startProfiling(); spans do nothing while this is false
+uint64_t profileClockNs();
+bool readPerfCounters(PerfCounters& counters);
+void recordProfileSpan(const char* name, uint64_t startNs, uint64_t endNs,
+                       const PerfCounters& start, const PerfCounters& end, bool counted);
+
+// Begin recording spans; stopProfiling() writes them to traceFile as Chrome trace JSON
+// and must run after any worker threads have finished
+void startProfiling(const std::string& traceFile);
+void stopProfiling();
+
+// Marks one span in the --profile Chrome trace, with wall time plus the cycles,
+// instructions, cache misses and branch misses counted on this thread meanwhile
+class ProfileSpan {
+public:
+    explicit ProfileSpan(const char* name) : name(name), active(profilingEnabled) {
+        if (!active) return;
+        haveCounters = readPerfCounters(startCounters);
+        startNs = profileClockNs();
+    }
+    ~ProfileSpan() {
+        if (!active) return;
+        uint64_t endNs = profileClockNs();
+        PerfCounters endCounters;
+        bool counted = haveCounters && readPerfCounters(endCounters);
+        recordProfileSpan(name, startNs, endNs, startCounters, endCounters, counted);
+    }
+private:
+    const char* name;
+    bool active;
+    bool haveCounters = false;
+    uint64_t startNs = 0;
+    PerfCounters startCounters;
+};
+
+#endif
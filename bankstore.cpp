@@ -0,0 +1,469 @@
+#include "bankstore.h"
+#include "bankidempotency.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>      // for open()
+#include <sys/stat.h>   // for fstat()
+#include <unistd.h>     // for pread(), pwrite(), ftruncate(), close()
+
+using namespace std;
+
+static const size_t PAGE_SIZE = 4096;
+static const uint64_t STORE_MAGIC = 0x3145524f54534b42ULL; // "BKSTORE1"
+static const uint64_t BLOOM_MAGIC = 0x314d4f4f4c424b42ULL; // "BKBLOOM1"
+static const uint32_t LEAF_PAGE = 1;
+static const uint32_t INNER_PAGE = 2;
+
+struct StoreHeader {
+    uint64_t magic;
+    uint32_t pageSize;
+    uint32_t root;
+    uint32_t pageCount;
+    uint32_t height;            // Levels, 1 while the root is a leaf
+    uint64_t records;
+    uint64_t bloomGeneration;   // Matches the bloom file when that covers every stored number
+};
+
+static const size_t LEAF_SLOTS = (PAGE_SIZE - 16) / sizeof(StoredAccount);
+static const size_t INNER_SLOTS = (PAGE_SIZE - 16 - sizeof(uint32_t)) / (sizeof(int32_t) + sizeof(uint32_t));
+
+// Records sorted by number; next is the right sibling, 0 for the last leaf (page 0 is the header)
+struct LeafPage {
+    uint32_t kind;
+    uint32_t count;
+    uint32_t next;
+    uint32_t unused;
+    StoredAccount records[LEAF_SLOTS];
+};
+
+// children[i] holds the numbers from keys[i - 1] up to, but not including, keys[i]
+struct InnerPage {
+    uint32_t kind;
+    uint32_t count;             // Keys; there is one more child
+    uint32_t unused[2];
+    int32_t keys[INNER_SLOTS];
+    uint32_t children[INNER_SLOTS + 1];
+};
+
+union StorePage {
+    StoreHeader header;
+    LeafPage leaf;
+    InnerPage inner;
+    char bytes[PAGE_SIZE];
+};
+
+static_assert(sizeof(StoredAccount) == 96, "leaf records are 96 bytes");
+static_assert(sizeof(StorePage) == PAGE_SIZE, "a page must be exactly PAGE_SIZE bytes");
+
+// Bloom file: magic, generation and word count, then the words
+struct BloomFileHeader {
+    uint64_t magic;
+    uint64_t generation;
+    uint64_t words;
+};
+
+static bool byNumber(const StoredAccount& account, int32_t accountNumber) {
+    return account.accountNumber < accountNumber;
+}
+
+// ---------------------------------------------------------------------------
+// Bloom filter: a power-of-two bit array probed by double hashing
+// ---------------------------------------------------------------------------
+
+void BloomFilter::reset(size_t expectedKeys) {
+    size_t words = 1;
+    while (words * 64 < max<size_t>(expectedKeys, 1) * BITS_PER_KEY) words <<= 1;
+    bits.assign(words, 0);
+}
+
+void BloomFilter::add(int32_t key) {
+    uint64_t h = fnv1a(&key, sizeof(key));
+    uint64_t step = (h >> 32) | 1, mask = bits.size() * 64 - 1;
+    for (int i = 0; i < PROBES; ++i, h += step) bits[(h & mask) >> 6] |= 1ULL << (h & 63);
+}
+
+bool BloomFilter::mightContain(int32_t key) const {
+    if (bits.empty()) return true;
+    uint64_t h = fnv1a(&key, sizeof(key));
+    uint64_t step = (h >> 32) | 1, mask = bits.size() * 64 - 1;
+    for (int i = 0; i < PROBES; ++i, h += step) {
+        if (!((bits[(h & mask) >> 6] >> (h & 63)) & 1)) return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Account store
+// ---------------------------------------------------------------------------
+
+AccountStore::AccountStore() = default;
+
+AccountStore::~AccountStore() {
+    close();
+}
+
+bool AccountStore::open(const string& storePath, size_t cachePageCount) {
+    close();
+    int f = ::open(storePath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (f < 0) return false;
+    fd = f;
+    path = storePath;
+    size_t frameCount = max<size_t>(cachePageCount, 8);
+    pages.assign(frameCount + 1, StorePage());
+    frames.assign(frameCount, Frame{0, false, false});
+    resident.clear();
+    clockHand = 0;
+    counters = StoreStats();
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    if (st.st_size == 0) {
+        initialise();
+        flush();
+        return true;
+    }
+    const StoreHeader& h = pages[0].header;
+    if (pread(fd, &pages[0], PAGE_SIZE, 0) != (ssize_t)PAGE_SIZE || h.magic != STORE_MAGIC ||
+        h.pageSize != PAGE_SIZE || h.root == 0 || h.root >= h.pageCount) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    headerDirty = false;
+    if (!loadBloom()) rebuildBloom();
+    return true;
+}
+
+void AccountStore::close() {
+    if (fd < 0) return;
+    flush();
+    ::close(fd);
+    fd = -1;
+    pages.clear();
+    frames.clear();
+    resident.clear();
+}
+
+size_t AccountStore::size() const {
+    return fd >= 0 ? pages[0].header.records : 0;
+}
+
+size_t AccountStore::pageCount() const {
+    return fd >= 0 ? pages[0].header.pageCount : 0;
+}
+
+// An empty tree: the header and one empty leaf as the root
+void AccountStore::initialise() {
+    StoreHeader& h = pages[0].header;
+    memset(&pages[0], 0, PAGE_SIZE);
+    h.magic = STORE_MAGIC;
+    h.pageSize = PAGE_SIZE;
+    h.pageCount = 1;
+    h.height = 1;
+    h.root = allocatePage();
+    StorePage root;
+    memset(&root, 0, PAGE_SIZE);
+    root.leaf.kind = LEAF_PAGE;
+    writePage(h.root, root);
+    headerDirty = true;
+    bloom.reset(1024);
+    bloomDirty = true;
+}
+
+// Frame holding a page, evicting with the CLOCK hand if it is not resident. A page
+// that is about to be overwritten whole need not be read (load false).
+size_t AccountStore::frameFor(uint32_t pageNumber, bool load) {
+    auto it = resident.find(pageNumber);
+    if (it != resident.end()) {
+        ++counters.cacheHits;
+        frames[it->second].referenced = true;
+        return it->second;
+    }
+    while (true) {
+        size_t index = clockHand;
+        Frame& frame = frames[index];
+        clockHand = (clockHand + 1) % frames.size();
+        if (frame.pageNumber != 0 && frame.referenced) {
+            frame.referenced = false;
+            continue;
+        }
+        if (frame.pageNumber != 0) {
+            writeBack(index);
+            resident.erase(frame.pageNumber);
+        }
+        frame = Frame{pageNumber, false, true};
+        resident[pageNumber] = index;
+        StorePage& page = pages[index + 1];
+        if (load) {
+            ++counters.cacheMisses;
+            if (pread(fd, &page, PAGE_SIZE, (off_t)pageNumber * PAGE_SIZE) != (ssize_t)PAGE_SIZE) {
+                memset(&page, 0, PAGE_SIZE);
+            }
+        }
+        return index;
+    }
+}
+
+const StorePage& AccountStore::readPage(uint32_t pageNumber) {
+    return pages[frameFor(pageNumber, true) + 1];
+}
+
+void AccountStore::writePage(uint32_t pageNumber, const StorePage& page) {
+    size_t index = frameFor(pageNumber, false);
+    pages[index + 1] = page;
+    frames[index].dirty = true;
+}
+
+void AccountStore::writeBack(size_t index) {
+    Frame& frame = frames[index];
+    if (!frame.dirty) return;
+    if (pwrite(fd, &pages[index + 1], PAGE_SIZE, (off_t)frame.pageNumber * PAGE_SIZE) == (ssize_t)PAGE_SIZE) {
+        ++counters.pagesWritten;
+    }
+    frame.dirty = false;
+}
+
+uint32_t AccountStore::allocatePage() {
+    headerDirty = true;
+    return pages[0].header.pageCount++;
+}
+
+uint32_t AccountStore::leafFor(int accountNumber) {
+    const StoreHeader& h = pages[0].header;
+    uint32_t pageNumber = h.root;
+    for (uint32_t level = 1; level < h.height; ++level) {
+        const InnerPage& inner = readPage(pageNumber).inner;
+        size_t i = upper_bound(inner.keys, inner.keys + inner.count, (int32_t)accountNumber) - inner.keys;
+        pageNumber = inner.children[i];
+    }
+    return pageNumber;
+}
+
+bool AccountStore::find(int accountNumber, StoredAccount& account) {
+    if (fd < 0) return false;
+    if (!bloom.mightContain(accountNumber)) {
+        ++counters.bloomRejects;
+        return false;
+    }
+    const LeafPage& leaf = readPage(leafFor(accountNumber)).leaf;
+    const StoredAccount* end = leaf.records + leaf.count;
+    const StoredAccount* pos = lower_bound(leaf.records, end, (int32_t)accountNumber, byNumber);
+    if (pos == end || pos->accountNumber != accountNumber) return false;
+    account = *pos;
+    return true;
+}
+
+// Insert below pageNumber; true if the page split, with the new right page and the
+// first number it holds in splitPage and splitKey. A full page on the right edge of
+// the tree that is appended to keeps everything it has, so numbers inserted in order
+// (as a full save writes them) fill their pages instead of leaving them half empty.
+bool AccountStore::insertInto(uint32_t pageNumber, bool rightmost, const StoredAccount& account,
+                              int32_t& splitKey, uint32_t& splitPage, bool& added) {
+    StorePage node = readPage(pageNumber);
+    StorePage sibling;
+    memset(&sibling, 0, PAGE_SIZE);
+
+    if (node.leaf.kind == LEAF_PAGE) {
+        LeafPage& leaf = node.leaf;
+        StoredAccount* end = leaf.records + leaf.count;
+        StoredAccount* pos = lower_bound(leaf.records, end, account.accountNumber, byNumber);
+        if (pos != end && pos->accountNumber == account.accountNumber) {
+            *pos = account;
+            writePage(pageNumber, node);
+            return false;
+        }
+        added = true;
+        if (leaf.count < LEAF_SLOTS) {
+            move_backward(pos, end, end + 1);
+            *pos = account;
+            ++leaf.count;
+            writePage(pageNumber, node);
+            return false;
+        }
+        // Full: the upper half moves to a new right sibling
+        vector<StoredAccount> all(leaf.records, end);
+        all.insert(all.begin() + (pos - leaf.records), account);
+        size_t left = rightmost && pos == end ? leaf.count : all.size() / 2;
+        splitPage = allocatePage();
+        sibling.leaf.kind = LEAF_PAGE;
+        sibling.leaf.count = all.size() - left;
+        sibling.leaf.next = leaf.next;
+        copy(all.begin() + left, all.end(), sibling.leaf.records);
+        leaf.count = left;
+        leaf.next = splitPage;
+        copy(all.begin(), all.begin() + left, leaf.records);
+        splitKey = sibling.leaf.records[0].accountNumber;
+        writePage(pageNumber, node);
+        writePage(splitPage, sibling);
+        return true;
+    }
+
+    InnerPage& inner = node.inner;
+    size_t i = upper_bound(inner.keys, inner.keys + inner.count, account.accountNumber) - inner.keys;
+    int32_t childKey;
+    uint32_t childPage;
+    bool appending = rightmost && i == inner.count;
+    if (!insertInto(inner.children[i], appending, account, childKey, childPage, added)) return false;
+    if (inner.count < INNER_SLOTS) {
+        move_backward(inner.keys + i, inner.keys + inner.count, inner.keys + inner.count + 1);
+        move_backward(inner.children + i + 1, inner.children + inner.count + 1, inner.children + inner.count + 2);
+        inner.keys[i] = childKey;
+        inner.children[i + 1] = childPage;
+        ++inner.count;
+        writePage(pageNumber, node);
+        return false;
+    }
+    // Full: the middle key moves up and the keys after it to a new right sibling
+    vector<int32_t> keys(inner.keys, inner.keys + inner.count);
+    vector<uint32_t> children(inner.children, inner.children + inner.count + 1);
+    keys.insert(keys.begin() + i, childKey);
+    children.insert(children.begin() + i + 1, childPage);
+    size_t mid = appending ? keys.size() - 1 : keys.size() / 2;
+    splitPage = allocatePage();
+    sibling.inner.kind = INNER_PAGE;
+    sibling.inner.count = keys.size() - mid - 1;
+    copy(keys.begin() + mid + 1, keys.end(), sibling.inner.keys);
+    copy(children.begin() + mid + 1, children.end(), sibling.inner.children);
+    inner.count = mid;
+    copy(keys.begin(), keys.begin() + mid, inner.keys);
+    copy(children.begin(), children.begin() + mid + 1, inner.children);
+    splitKey = keys[mid];
+    writePage(pageNumber, node);
+    writePage(splitPage, sibling);
+    return true;
+}
+
+bool AccountStore::put(const StoredAccount& account) {
+    if (fd < 0 || !memchr(account.customerName, '\0', sizeof(account.customerName))) return false;
+    StoreHeader& h = pages[0].header;
+    int32_t splitKey;
+    uint32_t splitPage;
+    bool added = false;
+    if (insertInto(h.root, true, account, splitKey, splitPage, added)) {
+        // The root split: the tree grows a level
+        StorePage root;
+        memset(&root, 0, PAGE_SIZE);
+        root.inner.kind = INNER_PAGE;
+        root.inner.count = 1;
+        root.inner.keys[0] = splitKey;
+        root.inner.children[0] = h.root;
+        root.inner.children[1] = splitPage;
+        h.root = allocatePage();
+        ++h.height;
+        writePage(h.root, root);
+    }
+    if (!added) return true;
+    ++h.records;
+    headerDirty = true;
+    if (h.records > bloom.capacity()) {
+        rebuildBloom();
+    } else {
+        bloom.add(account.accountNumber);
+        bloomDirty = true;
+    }
+    return true;
+}
+
+bool AccountStore::erase(int accountNumber) {
+    if (fd < 0 || !bloom.mightContain(accountNumber)) return false;
+    uint32_t pageNumber = leafFor(accountNumber);
+    StorePage node = readPage(pageNumber);
+    LeafPage& leaf = node.leaf;
+    StoredAccount* end = leaf.records + leaf.count;
+    StoredAccount* pos = lower_bound(leaf.records, end, (int32_t)accountNumber, byNumber);
+    if (pos == end || pos->accountNumber != accountNumber) return false;
+    move(pos + 1, end, pos);
+    --leaf.count;
+    writePage(pageNumber, node);
+    --pages[0].header.records;
+    headerDirty = true;
+    return true;
+}
+
+void AccountStore::clear() {
+    if (fd < 0) return;
+    for (Frame& frame : frames) frame = Frame{0, false, false};
+    resident.clear();
+    if (ftruncate(fd, 0) != 0) return;
+    initialise();
+}
+
+void AccountStore::forEach(const function<void(const StoredAccount&)>& visit) {
+    if (fd < 0) return;
+    const StoreHeader& h = pages[0].header;
+    uint32_t pageNumber = h.root;
+    for (uint32_t level = 1; level < h.height; ++level) pageNumber = readPage(pageNumber).inner.children[0];
+    while (pageNumber != 0) {
+        StorePage leaf = readPage(pageNumber);
+        for (uint32_t i = 0; i < leaf.leaf.count; ++i) visit(leaf.leaf.records[i]);
+        pageNumber = leaf.leaf.next;
+    }
+}
+
+// The bloom file goes first with a new generation, and the header that names it
+// last, so a crash in between leaves a mismatch and the filter is rebuilt
+size_t AccountStore::flush() {
+    if (fd < 0) return 0;
+    size_t bytes = 0;
+    if (bloomDirty) {
+        bytes += saveBloom();
+        bloomDirty = false;
+    }
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (!frames[i].dirty) continue;
+        writeBack(i);
+        bytes += PAGE_SIZE;
+    }
+    if (headerDirty) {
+        if (pwrite(fd, &pages[0], PAGE_SIZE, 0) == (ssize_t)PAGE_SIZE) ++counters.pagesWritten;
+        bytes += PAGE_SIZE;
+        headerDirty = false;
+    }
+    return bytes;
+}
+
+// Sized for twice the records stored, so it is rebuilt each time the tree doubles
+void AccountStore::rebuildBloom() {
+    bloom.reset(max<size_t>(2 * pages[0].header.records, 1024));
+    forEach([this](const StoredAccount& account) { bloom.add(account.accountNumber); });
+    bloomDirty = true;
+}
+
+bool AccountStore::loadBloom() {
+    int f = ::open((path + ".bloom").c_str(), O_RDONLY);
+    if (f < 0) return false;
+    BloomFileHeader h;
+    bool ok = pread(f, &h, sizeof(h), 0) == (ssize_t)sizeof(h) && h.magic == BLOOM_MAGIC &&
+              h.generation == pages[0].header.bloomGeneration && h.words > 0 && (h.words & (h.words - 1)) == 0;
+    vector<uint64_t> words;
+    if (ok) {
+        words.resize(h.words);
+        size_t length = words.size() * sizeof(uint64_t);
+        ok = pread(f, words.data(), length, sizeof(h)) == (ssize_t)length;
+    }
+    ::close(f);
+    if (ok) bloom.assign(move(words));
+    return ok;
+}
+
+size_t AccountStore::saveBloom() {
+    // The generation moves on even if the write fails, so an older file is not trusted
+    StoreHeader& header = pages[0].header;
+    BloomFileHeader h = {BLOOM_MAGIC, ++header.bloomGeneration, bloom.words().size()};
+    headerDirty = true;
+    string tmpFile = path + ".bloom.tmp";
+    int f = ::open(tmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (f < 0) return 0;
+    size_t length = bloom.words().size() * sizeof(uint64_t);
+    bool ok = pwrite(f, &h, sizeof(h), 0) == (ssize_t)sizeof(h) &&
+              pwrite(f, bloom.words().data(), length, sizeof(h)) == (ssize_t)length;
+    ::close(f);
+    if (!ok || rename(tmpFile.c_str(), (path + ".bloom").c_str()) != 0) return 0;
+    return sizeof(h) + length;
+}
@@ -0,0 +1,130 @@
+// Disk-resident account store: a B+tree keyed by account number in a file of 4 KiB
+// pages, read and written through a page cache of bounded size. Leaves hold fixed
+// 96-byte records and are chained for in-order scans; inner pages fan out about 500
+// ways, so a lookup in millions of accounts touches three or four pages and only the
+// pages in use need to be in memory. Pages are replaced by the CLOCK algorithm and
+// dirty ones written back when evicted or flushed.
+//
+// A bloom filter over the stored numbers answers most lookups of a number that is not
+// there without reading a page; it is saved beside the tree and rebuilt by a scan if
+// it is missing or older than the tree.
+//
+// BankEngine uses the store as the persistence format for its accounts, which it
+// still holds in memory: the cache bounds the store's own pages, not the engine.
+#ifndef BANKSTORE_H
+#define BANKSTORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Bloom filter over 32-bit keys; no false negatives, about 1% false positives at
+// ten bits per key
+class BloomFilter {
+public:
+    void reset(size_t expectedKeys);
+    void add(int32_t key);
+    bool mightContain(int32_t key) const;
+    size_t capacity() const { return bits.size() * 64 / BITS_PER_KEY; }    // Keys before the rate degrades
+
+    const std::vector<uint64_t>& words() const { return bits; }
+    void assign(std::vector<uint64_t> words) { bits = std::move(words); }
+
+private:
+    static const size_t BITS_PER_KEY = 10;
+    static const int PROBES = 7;
+    std::vector<uint64_t> bits;
+};
+
+// One account as stored in a leaf
+struct StoredAccount {
+    int32_t accountNumber;
+    uint32_t frozen;
+    double balance;
+    double interestRate;
+    int64_t lastAccrual;
+    char customerName[64];      // NUL-terminated, so at most 63 characters
+};
+
+struct StoreStats {
+    uint64_t cacheHits = 0;
+    uint64_t cacheMisses = 0;   // Each one a page read from the file
+    uint64_t pagesWritten = 0;
+    uint64_t bloomRejects = 0;  // Lookups answered by the bloom filter alone
+};
+
+union StorePage;               // Page layouts, defined in bankstore.cpp
+
+class AccountStore {
+public:
+    AccountStore();
+    AccountStore(const AccountStore&) = delete;
+    AccountStore& operator=(const AccountStore&) = delete;
+    ~AccountStore();
+
+    // Open the tree at path, creating an empty one if needed, with room for cachePages
+    // pages (at least 8) in memory
+    bool open(const std::string& path, size_t cachePages);
+    // Flush and close
+    void close();
+    bool isOpen() const { return fd >= 0; }
+
+    size_t size() const;                        // Records stored
+    size_t pageCount() const;
+    size_t cachePages() const { return frames.size(); }
+
+    bool find(int accountNumber, StoredAccount& account);
+    bool contains(int accountNumber) { StoredAccount unused; return find(accountNumber, unused); }
+    // Insert the record, or replace the one with its number. A record whose name
+    // fills customerName without a terminator is refused rather than cut short.
+    bool put(const StoredAccount& account);
+    // Whether a name fits in a record whole
+    static bool fitsName(const std::string& name) { return name.size() < sizeof(StoredAccount::customerName); }
+    // Remove a number; leaves are not merged, and pages emptied stay in the file
+    // until the next clear()
+    bool erase(int accountNumber);
+    // Drop every record and shrink the file back to an empty tree
+    void clear();
+    // Every record in account number order
+    void forEach(const std::function<void(const StoredAccount&)>& visit);
+
+    // Write back dirty pages, then the header and the bloom filter; returns the bytes written
+    size_t flush();
+    const StoreStats& stats() const { return counters; }
+
+private:
+    struct Frame {
+        uint32_t pageNumber;
+        bool dirty;
+        bool referenced;        // Second chance for the CLOCK hand
+    };
+    // A page read stays valid only until the next page is fetched
+    const StorePage& readPage(uint32_t pageNumber);
+    void writePage(uint32_t pageNumber, const StorePage& page);
+    size_t frameFor(uint32_t pageNumber, bool load);
+    void writeBack(size_t frame);
+    uint32_t allocatePage();
+    void initialise();
+    bool insertInto(uint32_t pageNumber, bool rightmost, const StoredAccount& account, int32_t& splitKey,
+                    uint32_t& splitPage, bool& added);
+    uint32_t leafFor(int accountNumber);
+    void rebuildBloom();
+    bool loadBloom();
+    size_t saveBloom();
+
+    int fd = -1;
+    std::string path;
+    std::vector<StorePage> pages;               // The header (page 0), then one page per frame
+    std::vector<Frame> frames;
+    std::unordered_map<uint32_t, size_t> resident;  // Page number -> frame
+    size_t clockHand = 0;
+    bool headerDirty = false;
+    BloomFilter bloom;
+    bool bloomDirty = false;
+    StoreStats counters;
+};
+
+#endif
@@ -1,68 +1,26 @@
+// Interactive banking system with frozen accounts and a transaction log.
+// Build: g++ -std=c++17 -O2 -pthread banksystem.cpp bankengine.cpp bankstats.cpp bankvelocity.cpp bankidempotency.cpp bankschedule.cpp bankrank.cpp banksearch.cpp bankcolumns.cpp bankcdc.cpp bankreplica.cpp bankshard.cpp bankstore.cpp -o banksystem
+#include "bankengine.h"
+#include "bankstats.h"
+
 #include <iostream>
 #include <vector>
 #include <string>
-#include <fstream>
 #include <sstream>
-#include <algorithm>
+#include <chrono>
+#include <ctime>
 #include <cstdlib> // for system("clear")
 #include <unistd.h> // for sleep()
-#include <ctime>
 
 using namespace std;
 
-// Trim function to remove leading and trailing spaces from input strings
-string trim(const string &str) {
-    size_t first = str.find_first_not_of(' ');
-    if (first == string::npos) return "";
-    size_t last = str.find_last_not_of(' ');
-    return str.substr(first, (last - first + 1));
-}
-
-// Structure to represent a bank account with account number, customer name, balance, interest rate, and frozen status
-struct Account {
-    int accountNumber;          // Unique account number assigned by user
-    string customerName;        // Name of the account holder
-    double balance;             // Current balance in the account
-    double interestRate;        // Annual interest rate in percentage
-    bool isFrozen;              // Account frozen status: true if frozen, false if active
-};
-
-// Structure to represent a transaction with ID, date/time, type, amount, and balance after transaction
-struct Transaction {
-    int transactionID;
-    int accountNumber;
-    string dateTime;
-    string type;               // deposit, withdrawal, transfer_in, transfer_out
-    double amount;
-    double balanceAfter;
-};
-
-// Structure to represent a loan with loan ID, customer name, loan amount, interest rate, duration, and remaining balance
-struct Loan {
-    int loanID;                 // Unique loan identifier generated automatically
-    string customerName;        // Name of the loan customer
-    double loanAmount;          // Original loan amount
-    double interestRate;        // Interest rate for the loan in percentage
-    int duration;               // Duration of the loan in months
-    double remainingBalance;    // Remaining balance to be repaid
-};
-
-// Global vectors to store all accounts, loans, and transactions in memory
-vector<Account> accounts;
-vector<Loan> loanBook;
-vector<Transaction> transactions;
-
-// File names used to persist account, loan, and transaction data between program runs
-const string accountsFile = "accounts.txt";
-const string loanBookFile = "loanbook.txt";
-const string transactionsFile = "transactions.txt";
+// All account, loan and transaction state lives in the engine; this file only prompts
+BankEngine bank(FileFormat::Extended);
+bool askIdempotencyKeys = false;    // Prompt for a retry key on money movements
+StandbyReceiver standby;            // Receives the primary's shipments while standing by
+bool standingBy = false;            // True until a standby is promoted or exits
 
 // Function declarations for account management operations
-void loadAccounts();
-void saveAccounts();
-bool accountNumberExists(int);
-int findAccountIndexByNumber(int);
-int findAccountIndexByName(const string&);
 void createAccount();
 void depositFunds();
 void withdrawFunds();
@@ -75,28 +33,98 @@ void deleteAllAccounts();
 void searchAccount();
 void freezeAccount();
 void unfreezeAccount();
+void bulkFreezeAccounts();
+void importAccounts();
+void createStandingOrder();
+void cancelStandingOrder();
+void listStandingOrders();
+void runDueStandingOrders();
 void viewTransactionHistory();
-void loadTransactions();
-void saveTransactions();
-int generateTransactionID();
-string getCurrentDateTime();
+void generateMonthlyStatements();
+void viewStatistics();
+std::string readIdempotencyKey();
+bool reportKeyProblem(OpStatus status);
+bool runStandby(const std::string& socketPath);
 
 // Function declarations for loan management operations
-void loadLoanBook();
-void saveLoanBook();
-int generateUniqueLoanID();
-Loan* findLoanByID(int);
 void createLoanAgreement();
 void makeMonthlyRepayment();
 void displayLoanBook();
+void linkLoanAccount();
+void runLoanAutoDebit();
+void clearTransferBatch();
+void viewRankings();
+void queryAccounts();
+
+int main(int argc, char* argv[]) {
+    // Statistics are dumped to stats.json every few seconds; --stats-interval 0 turns this off.
+    // --profile FILE records a Chrome trace of the hot operations, written on exit.
+    // --velocity-window/--velocity-max-amount/--velocity-max-count limit how much and how
+    // often an account may be debited per window; crossing a limit freezes the account.
+    // --compact-threshold N sets how many closed accounts trigger a background compaction.
+    // --idempotency-keys 1 asks for an optional retry key on deposits, withdrawals, transfers
+    // and repayments; --idempotency-ttl SECONDS and --idempotency-max-keys N bound the keys kept.
+    // --cdc-ring PATH publishes every change to a shared-memory ring that other processes
+    // can tail (e.g. bankbench --tail-cdc PATH); --cdc-capacity N sets its size in events.
+    // --standby SOCKET runs this process as a read-only hot standby, fed by a primary started
+    // with --replicate-to SOCKET, until it is promoted. Use a separate data directory for each.
+    // --account-store PATH keeps the accounts in a disk B+tree instead of accounts.txt, with
+    // --store-cache-pages N pages of 4 KiB cached in memory.
+    int statsInterval = 10;
+    string profileFile;
+    VelocityLimits limits;
+    int idempotencyTtl = 24 * 3600;
+    size_t idempotencyMaxKeys = 1 << 20;
+    string cdcRing;
+    size_t cdcCapacity = 1 << 16;
+    string standbySocket, replicaSocket;
+    string accountStore;
+    size_t storeCachePages = 4096;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        if (arg == "--stats-interval") statsInterval = atoi(argv[i + 1]);
+        else if (arg == "--profile") profileFile = argv[i + 1];
+        else if (arg == "--velocity-window") limits.windowSeconds = atoi(argv[i + 1]);
+        else if (arg == "--velocity-max-amount") limits.maxAmount = atof(argv[i + 1]);
+        else if (arg == "--velocity-max-count") limits.maxCount = atoi(argv[i + 1]);
+        else if (arg == "--compact-threshold") bank.setCompactionThreshold(atoi(argv[i + 1]));
+        else if (arg == "--idempotency-keys") askIdempotencyKeys = atoi(argv[i + 1]) != 0;
+        else if (arg == "--idempotency-ttl") idempotencyTtl = atoi(argv[i + 1]);
+        else if (arg == "--idempotency-max-keys") idempotencyMaxKeys = strtoul(argv[i + 1], nullptr, 10);
+        else if (arg == "--cdc-ring") cdcRing = argv[i + 1];
+        else if (arg == "--cdc-capacity") cdcCapacity = strtoul(argv[i + 1], nullptr, 10);
+        else if (arg == "--standby") standbySocket = argv[i + 1];
+        else if (arg == "--replicate-to") replicaSocket = argv[i + 1];
+        else if (arg == "--account-store") accountStore = argv[i + 1];
+        else if (arg == "--store-cache-pages") storeCachePages = strtoul(argv[i + 1], nullptr, 10);
+    }
+    startStatsDumper(statsInterval);
+    if (!profileFile.empty()) startProfiling(profileFile);
+    bank.setVelocityLimits(limits);
+    bank.setIdempotencyLimits(idempotencyMaxKeys, idempotencyTtl);
 
-int main() {
-    loadAccounts();
-    loadLoanBook();
-    loadTransactions();
+    if (!accountStore.empty() && !bank.enableAccountStore(accountStore, storeCachePages)) {
+        cerr << "Warning: Unable to open account store " << accountStore << "; using accounts.txt.\n";
+    }
+    bank.loadAll(true); // The menu comes up while transactions.txt is still loading
+    if (!cdcRing.empty() && !bank.enableChangeFeed(cdcRing, cdcCapacity)) {
+        cerr << "Warning: Unable to open change feed " << cdcRing
+             << " (a ring of another capacity is left alone); changes will not be published.\n";
+    }
+    if (!standbySocket.empty() && !runStandby(standbySocket)) {
+        stopStatsDumper();
+        stopProfiling();
+        return 0;
+    }
+    if (!replicaSocket.empty() && !bank.enableReplication(replicaSocket)) {
+        cerr << "Warning: Unable to reach the standby at " << replicaSocket << "; running without one.\n";
+    }
 
     int choice;
     do {
+        // Standing orders fall due on the wall clock; pay whatever came due since the last prompt
+        runDueStandingOrders();
+
         cout << "\nBanking System Menu:\n"
              << "0. Exit\n"
              << "1. Create Account\n"
@@ -104,7 +132,7 @@ int main() {
              << "3. Withdraw Funds\n"
              << "4. Transfer Funds\n"
              << "5. View Current Balance\n"
-             << "6. Calculate and Add Interest\n"
+             << "6. Post Accrued Interest\n"
              << "7. Close Account\n"
              << "8. List All Accounts\n"
              << "9. Delete All Accounts\n"
@@ -116,15 +144,25 @@ int main() {
              << "15. Freeze Account\n"
              << "16. Unfreeze Account\n"
              << "17. View Transaction History\n"
+             << "18. Generate Monthly Statements\n"
+             << "19. View Statistics\n"
+             << "20. Bulk Freeze/Unfreeze from List File\n"
+             << "21. Import Accounts from CSV\n"
+             << "22. Create Standing Order\n"
+             << "23. Cancel Standing Order\n"
+             << "24. List Standing Orders\n"
+             << "25. Link Loan to Account for Auto-Debit\n"
+             << "26. Run Monthly Loan Auto-Debit\n"
+             << "27. View Balance and Loan Rankings\n"
+             << "28. Query Accounts (filter and totals)\n"
+             << "29. Clear Transfer Batch from File (netting)\n"
              << "Enter your choice: ";
         cin >> choice;
         cin.ignore();
 
         switch(choice) {
             case 0:
-                saveAccounts();
-                saveLoanBook();
-                saveTransactions();
+                bank.saveAll();
                 cout << "Exiting program. Data saved.\n";
                 break;
             case 1:
@@ -155,7 +193,7 @@ int main() {
                 deleteAllAccounts();
                 break;
             case 10:
-                loadLoanBook();
+                bank.loadLoanBook();
                 cout << "Loan book loaded from file.\n";
                 break;
             case 11:
@@ -179,66 +217,52 @@ int main() {
             case 17:
                 viewTransactionHistory();
                 break;
+            case 18:
+                generateMonthlyStatements();
+                break;
+            case 19:
+                viewStatistics();
+                break;
+            case 20:
+                bulkFreezeAccounts();
+                break;
+            case 21:
+                importAccounts();
+                break;
+            case 22:
+                createStandingOrder();
+                break;
+            case 23:
+                cancelStandingOrder();
+                break;
+            case 24:
+                listStandingOrders();
+                break;
+            case 25:
+                linkLoanAccount();
+                break;
+            case 26:
+                runLoanAutoDebit();
+                break;
+            case 27:
+                viewRankings();
+                break;
+            case 28:
+                queryAccounts();
+                break;
+            case 29:
+                clearTransferBatch();
+                break;
             default:
                 cout << "Invalid choice. Please try again.\n";
         }
     } while(choice != 0);
 
+    stopStatsDumper();
+    stopProfiling();
     return 0;
 }
 
-void loadAccounts() {
-    accounts.clear();
-    ifstream inFile(accountsFile);
-    if (!inFile) return;
-    string line;
-    while (getline(inFile, line)) {
-        istringstream iss(line);
-        Account acc;
-        string name;
-        int frozenInt;
-        if (iss >> acc.accountNumber) {
-            iss.ignore();
-            getline(iss, name, '|');
-            acc.customerName = trim(name);
-            iss >> acc.balance >> acc.interestRate >> frozenInt;
-            acc.isFrozen = (frozenInt == 1);
-            accounts.push_back(acc);
-        }
-    }
-    inFile.close();
-}
-
-void saveAccounts() {
-    ofstream outFile(accountsFile);
-    for (const auto& acc : accounts) {
-        outFile << acc.accountNumber << " " << acc.customerName << "|" << " "
-                << acc.balance << " " << acc.interestRate << " " << (acc.isFrozen ? 1 : 0) << "\n";
-    }
-    outFile.close();
-}
-
-bool accountNumberExists(int accountNumber) {
-    for (const auto& acc : accounts) {
-        if (acc.accountNumber == accountNumber) return true;
-    }
-    return false;
-}
-
-int findAccountIndexByNumber(int accountNumber) {
-    for (size_t i = 0; i < accounts.size(); ++i) {
-        if (accounts[i].accountNumber == accountNumber) return i;
-    }
-    return -1;
-}
-
-int findAccountIndexByName(const string& name) {
-    for (size_t i = 0; i < accounts.size(); ++i) {
-        if (accounts[i].customerName == name) return i;
-    }
-    return -1;
-}
-
 void createAccount() {
     Account newAcc;
     int accNum;
@@ -246,10 +270,10 @@ void createAccount() {
         cout << "Enter account number: ";
         cin >> accNum;
         cin.ignore();
-        if (accountNumberExists(accNum)) {
+        if (bank.accountNumberExists(accNum)) {
             cout << "Account number already exists. Please enter a different number.\n";
         }
-    } while (accountNumberExists(accNum));
+    } while (bank.accountNumberExists(accNum));
     newAcc.accountNumber = accNum;
 
     cout << "Enter customer name: ";
@@ -264,10 +288,22 @@ void createAccount() {
     cin >> newAcc.interestRate;
     cin.ignore();
 
-    newAcc.isFrozen = false;
-
-    accounts.push_back(newAcc);
-    saveAccounts();
+    switch (bank.createAccount(newAcc)) {
+        case OP_OK:
+            break;
+        case OP_DUPLICATE_ACCOUNT:
+            cout << "Account number already exists. Account not created.\n";
+            return;
+        case OP_CLOSED:
+            cout << "Account number belonged to a closed account and cannot be reused. Account not created.\n";
+            return;
+        case OP_NAME_TOO_LONG:
+            cout << "Customer name is too long for the account store (63 characters at most). Account not created.\n";
+            return;
+        default:
+            cout << "Unable to create the account.\n";
+            return;
+    }
 
     cout << "Account created successfully.\n"
          << "Account Number: " << newAcc.accountNumber << "\n"
@@ -282,13 +318,12 @@ void depositFunds() {
     cin >> accNum;
     cin.ignore();
 
-    int idx = findAccountIndexByNumber(accNum);
-    if (idx == -1) {
+    if (!bank.findAccount(accNum)) {
         cout << "Account not found.\n";
         return;
     }
 
-    if (accounts[idx].isFrozen) {
+    if (bank.isFrozen(accNum)) {
         cout << "Account is frozen. Cannot perform deposit.\n";
         return;
     }
@@ -298,27 +333,14 @@ void depositFunds() {
     cin >> amount;
     cin.ignore();
 
-    if (amount <= 0) {
+    OpStatus status = bank.deposit(accNum, amount, readIdempotencyKey());
+    if (reportKeyProblem(status)) return;
+    if (status != OP_OK) {
         cout << "Invalid deposit amount.\n";
         return;
     }
 
-    accounts[idx].balance += amount;
-
-    // Log transaction
-    Transaction t;
-    t.transactionID = generateTransactionID();
-    t.accountNumber = accNum;
-    t.dateTime = getCurrentDateTime();
-    t.type = "deposit";
-    t.amount = amount;
-    t.balanceAfter = accounts[idx].balance;
-    transactions.push_back(t);
-
-    saveAccounts();
-    saveTransactions();
-
-    cout << "Deposit successful. New balance: " << accounts[idx].balance << "\n";
+    cout << "Deposit successful. New balance: " << bank.findAccount(accNum)->balance << "\n";
 }
 
 void withdrawFunds() {
@@ -327,13 +349,12 @@ void withdrawFunds() {
     cin >> accNum;
     cin.ignore();
 
-    int idx = findAccountIndexByNumber(accNum);
-    if (idx == -1) {
+    if (!bank.findAccount(accNum)) {
         cout << "Account not found.\n";
         return;
     }
 
-    if (accounts[idx].isFrozen) {
+    if (bank.isFrozen(accNum)) {
         cout << "Account is frozen. Cannot perform withdrawal.\n";
         return;
     }
@@ -343,32 +364,22 @@ void withdrawFunds() {
     cin >> amount;
     cin.ignore();
 
-    if (amount <= 0) {
+    OpStatus status = bank.withdraw(accNum, amount, readIdempotencyKey());
+    if (reportKeyProblem(status)) return;
+    if (status == OP_INVALID_AMOUNT) {
         cout << "Invalid withdrawal amount.\n";
         return;
     }
-
-    if (amount > accounts[idx].balance) {
+    if (status == OP_INSUFFICIENT_FUNDS) {
         cout << "Insufficient funds.\n";
         return;
     }
+    if (status == OP_VELOCITY_LIMIT) {
+        cout << "Withdrawal exceeds the account's velocity limit. The account has been frozen for review.\n";
+        return;
+    }
 
-    accounts[idx].balance -= amount;
-
-    // Log transaction
-    Transaction t;
-    t.transactionID = generateTransactionID();
-    t.accountNumber = accNum;
-    t.dateTime = getCurrentDateTime();
-    t.type = "withdrawal";
-    t.amount = amount;
-    t.balanceAfter = accounts[idx].balance;
-    transactions.push_back(t);
-
-    saveAccounts();
-    saveTransactions();
-
-    cout << "Withdrawal successful. New balance: " << accounts[idx].balance << "\n";
+    cout << "Withdrawal successful. New balance: " << bank.findAccount(accNum)->balance << "\n";
 }
 
 void transferFunds() {
@@ -377,13 +388,12 @@ void transferFunds() {
     cin >> srcAccNum;
     cin.ignore();
 
-    int srcIdx = findAccountIndexByNumber(srcAccNum);
-    if (srcIdx == -1) {
+    if (!bank.findAccount(srcAccNum)) {
         cout << "Source account not found.\n";
         return;
     }
 
-    if (accounts[srcIdx].isFrozen) {
+    if (bank.isFrozen(srcAccNum)) {
         cout << "Source account is frozen. Cannot perform transfer.\n";
         return;
     }
@@ -393,13 +403,12 @@ void transferFunds() {
     cin >> destAccNum;
     cin.ignore();
 
-    int destIdx = findAccountIndexByNumber(destAccNum);
-    if (destIdx == -1) {
+    if (!bank.findAccount(destAccNum)) {
         cout << "Destination account not found.\n";
         return;
     }
 
-    if (accounts[destIdx].isFrozen) {
+    if (bank.isFrozen(destAccNum)) {
         cout << "Destination account is frozen. Cannot receive transfer.\n";
         return;
     }
@@ -409,44 +418,33 @@ void transferFunds() {
     cin >> amount;
     cin.ignore();
 
-    if (amount <= 0) {
-        cout << "Invalid transfer amount.\n";
-        return;
-    }
-
-    if (amount > accounts[srcIdx].balance) {
-        cout << "Insufficient funds in source account.\n";
-        return;
+    OpStatus status = bank.transfer(srcAccNum, destAccNum, amount, readIdempotencyKey());
+    if (reportKeyProblem(status)) return;
+    switch (status) {
+        case OP_OK:
+            break;
+        case OP_SAME_ACCOUNT:
+            cout << "Source and destination accounts cannot be the same.\n";
+            return;
+        case OP_INSUFFICIENT_FUNDS:
+            cout << "Insufficient funds in source account.\n";
+            return;
+        case OP_VELOCITY_LIMIT:
+            cout << "Transfer exceeds the source account's velocity limit. The account has been frozen for review.\n";
+            return;
+        default:
+            cout << "Invalid transfer amount.\n";
+            return;
     }
 
-    accounts[srcIdx].balance -= amount;
-    accounts[destIdx].balance += amount;
-
-    // Log transactions for both accounts
-    Transaction tOut;
-    tOut.transactionID = generateTransactionID();
-    tOut.accountNumber = srcAccNum;
-    tOut.dateTime = getCurrentDateTime();
-    tOut.type = "transfer_out";
-    tOut.amount = amount;
-    tOut.balanceAfter = accounts[srcIdx].balance;
-    transactions.push_back(tOut);
-
-    Transaction tIn;
-    tIn.transactionID = generateTransactionID();
-    tIn.accountNumber = destAccNum;
-    tIn.dateTime = getCurrentDateTime();
-    tIn.type = "transfer_in";
-    tIn.amount = amount;
-    tIn.balanceAfter = accounts[destIdx].balance;
-    transactions.push_back(tIn);
-
-    saveAccounts();
-    saveTransactions();
-
     cout << "Transfer successful.\n"
-         << "Source account new balance: " << accounts[srcIdx].balance << "\n"
-         << "Destination account new balance: " << accounts[destIdx].balance << "\n";
+         << "Source account new balance: " << bank.findAccount(srcAccNum)->balance << "\n"
+         << "Destination account new balance: " << bank.findAccount(destAccNum)->balance << "\n";
+}
+
+// While standing by, keep shipments from landing in the middle of a read
+unique_lock<mutex> holdReplication() {
+    return standingBy ? standby.pause() : unique_lock<mutex>();
 }
 
 void viewCurrentBalance() {
@@ -455,32 +453,28 @@ void viewCurrentBalance() {
     cin >> accNum;
     cin.ignore();
 
-    int idx = findAccountIndexByNumber(accNum);
-    if (idx == -1) {
+    auto hold = holdReplication();
+    const Account* acc = bank.findAccount(accNum);
+    if (!acc) {
         cout << "Account not found.\n";
         return;
     }
 
-    cout << "Current balance: " << accounts[idx].balance << "\n";
+    cout << "Current balance: " << bank.balanceWithInterest(*acc) << "\n";
 }
 
 void calculateAndAddInterest() {
-    cout << "Enter account number to calculate interest: ";
+    cout << "Enter account number to post accrued interest to: ";
     int accNum;
     cin >> accNum;
     cin.ignore();
 
-    int idx = findAccountIndexByNumber(accNum);
-    if (idx == -1) {
+    if (bank.addInterest(accNum) != OP_OK) {
         cout << "Account not found.\n";
         return;
     }
 
-    double interest = accounts[idx].balance * (accounts[idx].interestRate / 100.0);
-    accounts[idx].balance += interest;
-    saveAccounts();
-
-    cout << "Interest added. New balance: " << accounts[idx].balance << "\n";
+    cout << "Interest accrued to date has been posted. New balance: " << bank.findAccount(accNum)->balance << "\n";
 }
 
 void closeAccount() {
@@ -489,19 +483,16 @@ void closeAccount() {
     cin >> accNum;
     cin.ignore();
 
-    for (size_t i = 0; i < accounts.size(); ++i) {
-        if (accounts[i].accountNumber == accNum) {
-            accounts.erase(accounts.begin() + i);
-            saveAccounts();
-            cout << "Account closed successfully.\n";
-            return;
-        }
+    if (bank.closeAccount(accNum) != OP_OK) {
+        cout << "Account not found.\n";
+        return;
     }
-    cout << "Account not found.\n";
+    cout << "Account closed successfully.\n";
 }
 
 void listAllAccounts() {
-    if (accounts.empty()) {
+    AccountSnapshot book = bank.snapshotAccounts(); // Consistent view even if writes continue
+    if (book.liveCount == 0) {
         cout << "No accounts found.\n";
         return;
     }
@@ -509,25 +500,37 @@ void listAllAccounts() {
     system("clear");
 
     cout << "Accounts List:\n";
-    for (const auto& a : accounts) {
+    for (size_t i = 0; i < book.accounts.size(); ++i) {
+        if (book.isClosedAt(i)) continue;
+        const Account& a = book.accounts[i];
         cout << "Account Number: " << a.accountNumber << "\n"
              << "Customer Name: " << a.customerName << "\n"
-             << "Balance: " << a.balance << "\n"
+             << "Balance: " << bank.balanceWithInterest(a) << "\n"
              << "Interest Rate: " << a.interestRate << "%\n"
-             << "Status: " << (a.isFrozen ? "Frozen" : "Active") << "\n"
+             << "Status: " << (book.isFrozenAt(i) ? "Frozen" : "Active") << "\n"
              << "-------------------------\n";
     }
     sleep(5);
 }
 
 void deleteAllAccounts() {
-    accounts.clear();
-    saveAccounts();
+    bank.deleteAllAccounts();
     cout << "All accounts deleted.\n";
 }
 
+// Print the details of one account found by searchAccount
+void printFoundAccount(const Account& acc) {
+    cout << "Account found:\n"
+         << "Account Number: " << acc.accountNumber << "\n"
+         << "Customer Name: " << acc.customerName << "\n"
+         << "Balance: " << bank.balanceWithInterest(acc) << "\n"
+         << "Interest Rate: " << acc.interestRate << "%\n"
+         << "Status: " << (bank.isFrozen(acc.accountNumber) ? "Frozen" : "Active") << "\n";
+}
+
 void searchAccount() {
-    cout << "Search by:\n1. Account Number\n2. Account Holder's Name\nEnter choice: ";
+    cout << "Search by:\n1. Account Number\n2. Account Holder's Name\n3. Approximate Name (accounts and loans)\n"
+         << "Enter choice: ";
     int choice;
     cin >> choice;
     cin.ignore();
@@ -538,38 +541,48 @@ void searchAccount() {
         cin >> accNum;
         cin.ignore();
 
-        int idx = findAccountIndexByNumber(accNum);
-        if (idx == -1) {
+        const Account* acc = bank.findAccount(accNum);
+        if (!acc) {
             cout << "Account not found.\n";
             return;
         }
-
-        const Account& acc = accounts[idx];
-        cout << "Account found:\n"
-             << "Account Number: " << acc.accountNumber << "\n"
-             << "Customer Name: " << acc.customerName << "\n"
-             << "Balance: " << acc.balance << "\n"
-             << "Interest Rate: " << acc.interestRate << "%\n"
-             << "Status: " << (acc.isFrozen ? "Frozen" : "Active") << "\n";
+        printFoundAccount(*acc);
     } else if (choice == 2) {
         cout << "Enter account holder's name: ";
         string name;
         getline(cin, name);
-        name = trim(name);
 
-        int idx = findAccountIndexByName(name);
-        if (idx == -1) {
+        // Every account and loan the customer holds, whatever the case or spacing
+        const vector<int>& accountNumbers = bank.findAccountNumbersByName(name);
+        const vector<int>& loanIDs = bank.findLoanIDsByName(name);
+        if (accountNumbers.empty() && loanIDs.empty()) {
             cout << "Account not found.\n";
             return;
         }
+        for (int accNum : accountNumbers) {
+            printFoundAccount(*bank.findAccount(accNum));
+            cout << "-------------------------\n";
+        }
+        for (int loanID : loanIDs) {
+            const Loan* loan = bank.findLoanByID(loanID);
+            cout << "Loan " << loan->loanID << ": remaining balance " << loan->remainingBalance << "\n";
+        }
+    } else if (choice == 3) {
+        cout << "Enter name, typos allowed: ";
+        string name;
+        getline(cin, name);
 
-        const Account& acc = accounts[idx];
-        cout << "Account found:\n"
-             << "Account Number: " << acc.accountNumber << "\n"
-             << "Customer Name: " << acc.customerName << "\n"
-             << "Balance: " << acc.balance << "\n"
-             << "Interest Rate: " << acc.interestRate << "%\n"
-             << "Status: " << (acc.isFrozen ? "Frozen" : "Active") << "\n";
+        vector<NameSearchHit> hits = bank.searchCustomerNames(name);
+        if (hits.empty()) {
+            cout << "No matching names found.\n";
+            return;
+        }
+        cout << hits.size() << " match(es), closest first:\n";
+        for (const NameSearchHit& hit : hits) {
+            cout << (hit.loan ? "Loan " : "Account ") << hit.id << ": " << hit.customerName
+                 << " (" << hit.distance << (hit.distance == 1 ? " typo" : " typos")
+                 << (hit.wholeName ? "" : ", one word") << ")\n";
+        }
     } else {
         cout << "Invalid choice.\n";
     }
@@ -581,19 +594,16 @@ void freezeAccount() {
     cin >> accNum;
     cin.ignore();
 
-    int idx = findAccountIndexByNumber(accNum);
-    if (idx == -1) {
+    OpStatus status = bank.setFrozen(accNum, true);
+    if (status == OP_NOT_FOUND) {
         cout << "Account not found.\n";
         return;
     }
-
-    if (accounts[idx].isFrozen) {
+    if (status == OP_NO_CHANGE) {
         cout << "Account is already frozen.\n";
         return;
     }
 
-    accounts[idx].isFrozen = true;
-    saveAccounts();
     cout << "Account frozen successfully.\n";
 }
 
@@ -603,30 +613,83 @@ void unfreezeAccount() {
     cin >> accNum;
     cin.ignore();
 
-    int idx = findAccountIndexByNumber(accNum);
-    if (idx == -1) {
+    OpStatus status = bank.setFrozen(accNum, false);
+    if (status == OP_NOT_FOUND) {
         cout << "Account not found.\n";
         return;
     }
-
-    if (!accounts[idx].isFrozen) {
+    if (status == OP_NO_CHANGE) {
         cout << "Account is not frozen.\n";
         return;
     }
 
-    accounts[idx].isFrozen = false;
-    saveAccounts();
     cout << "Account unfrozen successfully.\n";
 }
 
+// Freeze or unfreeze every account listed in a file (one account number per line)
+void bulkFreezeAccounts() {
+    cout << "1. Freeze listed accounts\n2. Unfreeze listed accounts\nEnter choice: ";
+    int choice;
+    cin >> choice;
+    cin.ignore();
+    if (choice != 1 && choice != 2) {
+        cout << "Invalid choice.\n";
+        return;
+    }
+
+    cout << "Enter path of the account list file: ";
+    string path;
+    getline(cin, path);
+
+    vector<int> accountNumbers;
+    size_t skipped = 0;
+    if (!readAccountList(trim(path), accountNumbers, skipped)) {
+        cout << "Unable to open " << path << ".\n";
+        return;
+    }
+
+    BulkFreezeReport report = bank.setFrozenBulk(accountNumbers, choice == 1);
+    cout << (choice == 1 ? "Frozen: " : "Unfrozen: ") << report.changed << "\n"
+         << "Already " << (choice == 1 ? "frozen" : "active") << " or listed twice: " << report.unchanged << "\n"
+         << "Not found: " << report.notFound.size() << "\n"
+         << "Unreadable lines skipped: " << skipped << "\n";
+    for (size_t i = 0; i < report.notFound.size() && i < 10; ++i) {
+        cout << "  missing account " << report.notFound[i] << "\n";
+    }
+    if (report.notFound.size() > 10) {
+        cout << "  ... and " << report.notFound.size() - 10 << " more\n";
+    }
+}
+
+// Create accounts in bulk from a CSV file; rejected rows are listed in <file>.rejects.csv
+void importAccounts() {
+    cout << "Enter path of the CSV file (number,name,balance,rate[,frozen]): ";
+    string path;
+    getline(cin, path);
+    path = trim(path);
+
+    ImportReport report = bank.importAccounts(path, path + ".rejects.csv");
+    if (!report.opened) {
+        cout << "Unable to open " << path << ".\n";
+        return;
+    }
+    cout << "Rows read: " << report.rows << "\n"
+         << "Accounts imported: " << report.imported << "\n"
+         << "Rows rejected: " << report.rejected << "\n";
+    if (!report.rejectFile.empty()) {
+        cout << "Reject report: " << report.rejectFile << "\n";
+    }
+    cout << "Validated with " << report.workers << " threads in " << report.seconds << " s\n";
+}
+
 void viewTransactionHistory() {
     cout << "Enter account number to view transaction history: ";
     int accNum;
     cin >> accNum;
     cin.ignore();
 
-    int idx = findAccountIndexByNumber(accNum);
-    if (idx == -1) {
+    auto hold = holdReplication();
+    if (!bank.accountNumberExists(accNum)) {
         cout << "Account not found.\n";
         return;
     }
@@ -635,133 +698,70 @@ void viewTransactionHistory() {
     cout << "ID\tDate & Time\t\tType\t\tAmount\tBalance After\n";
     cout << "-----------------------------------------------------------------\n";
 
-    bool found = false;
-    for (const auto& t : transactions) {
-        if (t.accountNumber == accNum) {
-            cout << t.transactionID << "\t" << t.dateTime << "\t" << t.type << "\t\t"
-                 << t.amount << "\t" << t.balanceAfter << "\n";
-            found = true;
-        }
+    vector<Transaction> history = bank.getTransactionHistory(accNum);
+    for (const auto& t : history) {
+        cout << t.transactionID << "\t" << t.dateTime << "\t" << t.type << "\t\t"
+             << t.amount << "\t" << t.balanceAfter << "\n";
     }
 
-    if (!found) {
+    if (history.empty()) {
         cout << "No transactions found for this account.\n";
     }
 }
 
-void loadTransactions() {
-    transactions.clear();
-    ifstream inFile(transactionsFile);
-    if (!inFile) return;
-    string line;
-    while (getline(inFile, line)) {
-        istringstream iss(line);
-        Transaction t;
-        if (iss >> t.transactionID >> t.accountNumber) {
-            iss.ignore();
-            getline(iss, t.dateTime, '|');
-            iss >> t.type >> t.amount >> t.balanceAfter;
-            transactions.push_back(t);
-        }
-    }
-    inFile.close();
-}
-
-void saveTransactions() {
-    ofstream outFile(transactionsFile);
-    for (const auto& t : transactions) {
-        outFile << t.transactionID << " " << t.accountNumber << " " << t.dateTime << "| "
-                << t.type << " " << t.amount << " " << t.balanceAfter << "\n";
-    }
-    outFile.close();
-}
-
-int generateTransactionID() {
-    int maxID = 0;
-    for (const auto& t : transactions) {
-        if (t.transactionID > maxID) maxID = t.transactionID;
+void generateMonthlyStatements() {
+    cout << "Enter statement month (YYYY-MM): ";
+    string month;
+    getline(cin, month);
+    month = trim(month);
+    if (month.size() != 7 || month[4] != '-') {
+        cout << "Invalid month. Use the format YYYY-MM.\n";
+        return;
     }
-    return maxID + 1;
-}
 
-string getCurrentDateTime() {
-    time_t now = time(0);
-    tm *ltm = localtime(&now);
-    char buffer[20];
-    snprintf(buffer, sizeof(buffer), "%04d-%02d-%02d %02d:%02d:%02d",
-             1900 + ltm->tm_year, 1 + ltm->tm_mon, ltm->tm_mday,
-             ltm->tm_hour, ltm->tm_min, ltm->tm_sec);
-    return string(buffer);
-}
-
-// Loan-related functions remain unchanged (omitted here for brevity)
-void loadLoanBook() {
-    loanBook.clear();
-    ifstream inFile(loanBookFile);
-    if (!inFile) return;
-    string line;
-    while (getline(inFile, line)) {
-        istringstream iss(line);
-        Loan loan;
-        string name;
-        if (iss >> loan.loanID) {
-            iss.ignore();
-            getline(iss, name, '|');
-            loan.customerName = trim(name);
-            iss >> loan.loanAmount >> loan.interestRate >> loan.duration >> loan.remainingBalance;
-            loanBook.push_back(loan);
-        }
+    cout << "Output:\n1. One file per account\n2. Single combined file\nEnter choice: ";
+    int mode;
+    cin >> mode;
+    cin.ignore();
+    if (mode != 1 && mode != 2) {
+        cout << "Invalid choice.\n";
+        return;
     }
-    inFile.close();
-}
 
-void saveLoanBook() {
-    ofstream outFile(loanBookFile);
-    for (const auto& loan : loanBook) {
-        outFile << loan.loanID << " " << loan.customerName << "|" << " "
-                << loan.loanAmount << " " << loan.interestRate << " "
-                << loan.duration << " " << loan.remainingBalance << "\n";
-    }
-    outFile.close();
-}
+    StatementReport report = bank.generateStatements(month, mode == 2);
+    double seconds = report.seconds;
 
-int generateUniqueLoanID() {
-    int maxID = 0;
-    for (const auto& loan : loanBook) {
-        if (loan.loanID > maxID) maxID = loan.loanID;
-    }
-    return maxID + 1;
+    cout << "Generated " << report.statements << " statements for " << month
+         << " from " << report.entries << " transactions into " << report.target << "\n"
+         << "Workers: " << report.workers << "\n"
+         << "Elapsed: " << seconds << " s\n"
+         << "Throughput: " << (seconds > 0 ? report.scanned / seconds : 0) << " transactions/s, "
+         << (seconds > 0 ? report.statements / seconds : 0) << " statements/s\n"
+         << "Peak memory: " << report.peakMemoryMb << " MB\n";
 }
 
-Loan* findLoanByID(int id) {
-    for (auto& loan : loanBook) {
-        if (loan.loanID == id) return &loan;
-    }
-    return nullptr;
+void viewStatistics() {
+    printStatistics(cout);
 }
 
 void createLoanAgreement() {
-    Loan newLoan;
-    newLoan.loanID = generateUniqueLoanID();
-
     cout << "Enter customer name: ";
     string name;
     getline(cin, name);
-    newLoan.customerName = trim(name);
+    name = trim(name);
 
+    double amount, rate;
+    int duration;
     cout << "Enter loan amount: ";
-    cin >> newLoan.loanAmount;
+    cin >> amount;
 
     cout << "Enter interest rate (percent): ";
-    cin >> newLoan.interestRate;
+    cin >> rate;
 
     cout << "Enter duration (months): ";
-    cin >> newLoan.duration;
+    cin >> duration;
 
-    newLoan.remainingBalance = newLoan.loanAmount;
-
-    loanBook.push_back(newLoan);
-    saveLoanBook();
+    Loan newLoan = bank.createLoan(name, amount, rate, duration);
 
     system("clear");
 
@@ -783,7 +783,7 @@ void makeMonthlyRepayment() {
     cin >> id;
     cin.ignore();
 
-    Loan* loan = findLoanByID(id);
+    const Loan* loan = bank.findLoanByID(id);
     if (!loan) {
         cout << "Loan ID not found.\n";
         return;
@@ -793,34 +793,418 @@ void makeMonthlyRepayment() {
     cout << "Enter repayment amount: ";
     double repayment;
     cin >> repayment;
+    cin.ignore();
 
-    if (repayment > loan->remainingBalance) {
+    OpStatus status = bank.repayLoan(id, repayment, readIdempotencyKey());
+    if (reportKeyProblem(status)) return;
+    if (status == OP_INVALID_AMOUNT) {
+        cout << "Repayment amount must be positive. Transaction cancelled.\n";
+        return;
+    }
+    if (status == OP_OVERPAYMENT) {
         cout << "Repayment amount exceeds remaining balance. Transaction cancelled.\n";
         return;
     }
 
-    loan->remainingBalance -= repayment;
-    saveLoanBook();
-
     cout << "Repayment successful. Updated remaining balance: " << loan->remainingBalance << "\n";
 }
 
 void displayLoanBook() {
+    PagedSnapshot<Loan> loanBook = bank.snapshotLoans();
     if (loanBook.empty()) {
         cout << "Loan book is empty.\n";
         return;
     }
 
     cout << "Loan Book:\n";
-    for (const auto& loan : loanBook) {
+    for (size_t i = 0; i < loanBook.size(); ++i) {
+        const Loan& loan = loanBook[i];
         cout << "Loan ID: " << loan.loanID << "\n"
              << "Customer Name: " << loan.customerName << "\n"
              << "Loan Amount: " << loan.loanAmount << "\n"
              << "Interest Rate: " << loan.interestRate << "%\n"
              << "Duration: " << loan.duration << " months\n"
-             << "Remaining Balance: " << loan.remainingBalance << "\n"
-             << "-------------------------\n";
+             << "Remaining Balance: " << loan.remainingBalance << "\n";
+        if (loan.linkedAccountNumber != 0) cout << "Auto-Debit Account: " << loan.linkedAccountNumber << "\n";
+        cout << "-------------------------\n";
     }
     system("clear");
     sleep(5);
 }
+
+// Set up a recurring transfer; the first payment is due after the given number of days
+void createStandingOrder() {
+    int srcAccNum, destAccNum, periodDays, firstInDays;
+    double amount;
+    cout << "Enter source account number: ";
+    cin >> srcAccNum;
+    cout << "Enter destination account number: ";
+    cin >> destAccNum;
+    cout << "Enter amount per payment: ";
+    cin >> amount;
+    cout << "Enter period in days: ";
+    cin >> periodDays;
+    cout << "Enter days until the first payment (0 for now): ";
+    cin >> firstInDays;
+    cin.ignore();
+
+    if (periodDays <= 0 || firstInDays < 0) {
+        cout << "Period must be at least one day.\n";
+        return;
+    }
+
+    int orderID = 0;
+    OpStatus status = bank.createStandingOrder(srcAccNum, destAccNum, amount, periodDays * 86400,
+                                               time(nullptr) + (int64_t)firstInDays * 86400, orderID);
+    switch (status) {
+        case OP_OK:
+            cout << "Standing order " << orderID << " created.\n";
+            break;
+        case OP_NOT_FOUND:
+            cout << "Source account not found.\n";
+            break;
+        case OP_DEST_NOT_FOUND:
+            cout << "Destination account not found.\n";
+            break;
+        case OP_SAME_ACCOUNT:
+            cout << "Source and destination accounts cannot be the same.\n";
+            break;
+        default:
+            cout << "Invalid standing order amount.\n";
+    }
+}
+
+void cancelStandingOrder() {
+    cout << "Enter standing order ID to cancel: ";
+    int orderID;
+    cin >> orderID;
+    cin.ignore();
+
+    if (bank.cancelStandingOrder(orderID) != OP_OK) {
+        cout << "Standing order not found.\n";
+        return;
+    }
+    cout << "Standing order " << orderID << " cancelled.\n";
+}
+
+void listStandingOrders() {
+    size_t shown = 0;
+    for (const StandingOrder& order : bank.getStandingOrders()) {
+        if (order.orderID == 0) continue;
+        time_t due = (time_t)order.nextDue;
+        tm local;
+        localtime_r(&due, &local);
+        char dueText[32];
+        strftime(dueText, sizeof(dueText), "%Y-%m-%d %H:%M", &local);
+        cout << "Order " << order.orderID << ": " << order.amount << " from " << order.srcAccountNumber
+             << " to " << order.destAccountNumber << " every " << order.periodSeconds / 86400 << " day(s), "
+             << (order.suspended ? "suspended" : string("next due ") + dueText);
+        if (order.failures > 0) cout << " (" << order.failures << " failed in a row)";
+        cout << "\n";
+        ++shown;
+    }
+    if (shown == 0) cout << "No standing orders.\n";
+}
+
+// Pay every standing order that has come due and say what happened, if anything did
+void runDueStandingOrders() {
+    StandingOrderReport report = bank.runStandingOrders(time(nullptr));
+    if (report.due == 0) return;
+    cout << "\nStanding orders: " << report.paid << " of " << report.due << " paid, total "
+         << report.amountMoved << "\n";
+    for (const StandingOrderFailure& failure : report.failures) {
+        cout << "  order " << failure.orderID << " failed: " << opStatusName(failure.status)
+             << (failure.suspended ? " (suspended)" : " (will retry next period)") << "\n";
+    }
+}
+
+void linkLoanAccount() {
+    cout << "Enter loan ID: ";
+    int id;
+    cin >> id;
+    cout << "Enter account number to debit installments from (0 to unlink): ";
+    int accNum;
+    cin >> accNum;
+    cin.ignore();
+
+    switch (bank.linkLoanAccount(id, accNum)) {
+        case OP_OK:
+            if (accNum == 0) cout << "Loan " << id << " unlinked.\n";
+            else cout << "Loan " << id << " will be debited from account " << accNum << ".\n";
+            break;
+        case OP_NOT_FOUND:
+            cout << "Loan ID not found.\n";
+            break;
+        default:
+            cout << "Account not found.\n";
+    }
+}
+
+// Collect this month's installment for every linked loan; refusals go to autodebit_failures.csv
+void runLoanAutoDebit() {
+    AutoDebitReport report = bank.autoDebitLoans("autodebit_failures.csv");
+    cout << "Auto-debit complete.\n"
+         << "Linked loans due: " << report.loans << "\n"
+         << "Already collected this month: " << report.alreadyDebited << "\n"
+         << "Installments collected: " << report.debited << " (total " << report.collected << ")\n"
+         << "Failed debits: " << report.failures.size() << "\n"
+         << "Workers: " << report.workers << ", time: " << report.seconds << " s\n";
+    for (size_t i = 0; i < report.failures.size() && i < 10; ++i) {
+        const AutoDebitFailure& f = report.failures[i];
+        cout << "  loan " << f.loanID << " (account " << f.accountNumber << "): " << opStatusName(f.status) << "\n";
+    }
+    if (report.failures.size() > 10) {
+        cout << "  ... and " << report.failures.size() - 10 << " more\n";
+    }
+    if (!report.failureFile.empty()) cout << "Failed debits written to " << report.failureFile << "\n";
+}
+
+// Settle a file of transfers as one netted batch; each refused line is listed with its reason
+void clearTransferBatch() {
+    cout << "Enter path of the transfer batch file (source,destination,amount): ";
+    string path;
+    getline(cin, path);
+    path = trim(path);
+
+    vector<BatchTransfer> batch;
+    size_t skipped = 0;
+    if (!readTransferBatch(path, batch, skipped)) {
+        cout << "Unable to open " << path << ".\n";
+        return;
+    }
+    ClearingReport report = bank.clearTransfers(batch);
+    cout << "Transfers cleared: " << report.cleared << " of " << report.transfers << " (total " << report.gross
+         << ")\n"
+         << "Net amount moved: " << report.net << " across " << report.accounts << " accounts\n"
+         << "Unreadable lines skipped: " << skipped << "\n";
+    size_t shown = 0;
+    for (size_t i = 0; i < report.statuses.size(); ++i) {
+        if (report.statuses[i] == OP_OK) continue;
+        if (++shown > 10) {
+            cout << "  ... and " << report.transfers - report.cleared - 10 << " more refused\n";
+            break;
+        }
+        const BatchTransfer& t = batch[i];
+        cout << "  " << t.srcAccountNumber << " -> " << t.destAccountNumber << " " << t.amount << ": "
+             << opStatusName(report.statuses[i]) << "\n";
+    }
+}
+
+// Key read by the last readIdempotencyKey, for settling it if it comes back in doubt
+string lastIdempotencyKey;
+
+// Optional retry key for the next money movement; empty when keys are not in use.
+// Entering the same key again replays the first attempt's outcome instead of repeating it.
+string readIdempotencyKey() {
+    lastIdempotencyKey.clear();
+    if (!askIdempotencyKeys) return "";
+    cout << "Idempotency key (press Enter for none): ";
+    string key;
+    getline(cin, key);
+    lastIdempotencyKey = trim(key);
+    return lastIdempotencyKey;
+}
+
+// Explain a rejected idempotency key; returns false for every other status
+bool reportKeyProblem(OpStatus status) {
+    if (status == OP_KEY_REUSED) {
+        cout << "That idempotency key was already used for a different request. Nothing was changed.\n";
+        return true;
+    }
+    if (status == OP_KEY_IN_DOUBT) {
+        cout << "The first attempt with that key was interrupted and may have gone through.\n"
+             << "Check the account (or loan), then enter y if the change is there, n if it is not,\n"
+             << "or press Enter to leave the key in doubt: ";
+        string answer;
+        getline(cin, answer);
+        answer = trim(answer);
+        if (answer == "y" || answer == "Y") {
+            bank.resolveKeyInDoubt(lastIdempotencyKey, true);
+            cout << "Recorded as done; retries with that key will not repeat it.\n";
+        } else if (answer == "n" || answer == "N") {
+            bank.resolveKeyInDoubt(lastIdempotencyKey, false);
+            cout << "Recorded as not done; try again with the same key to run it.\n";
+        }
+        return true;
+    }
+    if (status == OP_INVALID_KEY) {
+        cout << "Idempotency keys are up to 64 characters with no spaces. Nothing was changed.\n";
+        return true;
+    }
+    return false;
+}
+
+// Largest balances and loans, or where one account stands among all of them
+void viewRankings() {
+    cout << "Rankings:\n1. Largest Balances\n2. Largest Outstanding Loans\n3. Rank of an Account\n"
+         << "4. Balance Percentiles\nEnter choice: ";
+    int choice;
+    cin >> choice;
+    cin.ignore();
+
+    const RankIndex& balances = bank.balanceRanking();
+    if (choice == 1 || choice == 2) {
+        cout << "How many to list: ";
+        size_t n;
+        cin >> n;
+        cin.ignore();
+        int position = 0;
+        if (choice == 1) {
+            for (const RankEntry& e : balances.top(n)) {
+                const Account* acc = bank.findAccount(e.key);
+                cout << ++position << ". Account " << e.key << " (" << (acc ? acc->customerName : "") << "): "
+                     << e.value << "\n";
+            }
+        } else {
+            for (const RankEntry& e : bank.loanRanking().top(n)) {
+                const Loan* loan = bank.findLoanByID(e.key);
+                cout << ++position << ". Loan " << e.key << " (" << (loan ? loan->customerName : "") << "): "
+                     << e.value << "\n";
+            }
+        }
+        if (position == 0) cout << "Nothing to rank.\n";
+    } else if (choice == 3) {
+        cout << "Enter account number: ";
+        int accNum;
+        cin >> accNum;
+        cin.ignore();
+        size_t rank = balances.rank(accNum);
+        if (rank == 0) {
+            cout << "Account not found.\n";
+            return;
+        }
+        cout << "Rank " << rank << " of " << balances.size() << " by balance ("
+             << balances.percentileOf(accNum) << "% of accounts hold less)\n";
+    } else if (choice == 4) {
+        if (balances.size() == 0) {
+            cout << "No accounts found.\n";
+            return;
+        }
+        for (double p : {10.0, 25.0, 50.0, 75.0, 90.0, 99.0}) {
+            cout << "P" << p << ": " << balances.valueAtPercentile(p) << "\n";
+        }
+    } else {
+        cout << "Invalid choice.\n";
+    }
+}
+
+// Parse "field op value", e.g. "balance >= 1000" or "rate < 2"
+bool parseCondition(const string& text, FieldCondition& condition) {
+    istringstream iss(text);
+    string field, op;
+    if (!(iss >> field >> op >> condition.value)) return false;
+    if (field == "balance") condition.field = AccountField::Balance;
+    else if (field == "rate") condition.field = AccountField::InterestRate;
+    else return false;
+    if (op == "<") condition.op = CompareOp::Less;
+    else if (op == "<=") condition.op = CompareOp::LessEqual;
+    else if (op == ">") condition.op = CompareOp::Greater;
+    else if (op == ">=") condition.op = CompareOp::GreaterEqual;
+    else if (op == "=" || op == "==") condition.op = CompareOp::Equal;
+    else if (op == "!=") condition.op = CompareOp::NotEqual;
+    else return false;
+    return true;
+}
+
+// Ad-hoc filter over the accounts with count, total, minimum, maximum and average
+void queryAccounts() {
+    AccountQuery query;
+    cout << "Status (1 = frozen only, 0 = active only, -1 = any): ";
+    cin >> query.frozen;
+    cin.ignore();
+
+    cout << "Enter conditions as 'field op value' (field: balance or rate; op: < <= > >= = !=),\n"
+         << "one per line. All conditions in a group must hold; a line 'or' starts another group.\n"
+         << "A blank line ends the query:\n";
+    query.anyOf.emplace_back();
+    string line;
+    while (getline(cin, line) && !trim(line).empty()) {
+        FieldCondition condition;
+        if (trim(line) == "or") query.anyOf.emplace_back();
+        else if (parseCondition(line, condition)) query.anyOf.back().push_back(condition);
+        else cout << "Ignored: " << line << "\n";
+    }
+
+    cout << "Total which field (balance or rate): ";
+    string field;
+    getline(cin, field);
+    AccountField aggregate = trim(field) == "rate" ? AccountField::InterestRate : AccountField::Balance;
+
+    vector<int> matches;
+    AccountAggregate result = bank.queryAccounts(query, aggregate, &matches);
+    cout << "Matching accounts: " << result.count << "\n";
+    if (result.count == 0) return;
+    cout << "Total: " << result.sum << "\n"
+         << "Minimum: " << result.min << "\n"
+         << "Maximum: " << result.max << "\n"
+         << "Average: " << result.sum / result.count << "\n"
+         << "List the account numbers? (y/n): ";
+    string answer;
+    getline(cin, answer);
+    if (trim(answer) == "y") {
+        for (int accNum : matches) cout << accNum << "\n";
+    }
+}
+
+// Follow the primary until promoted: only balances and history can be read, and each
+// read sees the state between two shipments. Returns true once promoted to primary,
+// false if the user exits instead.
+bool runStandby(const string& socketPath) {
+    standingBy = true;
+    if (!standby.start(socketPath, [](const string& batch) { return bank.applyReplicationBatch(batch); })) {
+        cerr << "Error: Unable to listen on " << socketPath << ".\n";
+        standingBy = false;
+        return false;
+    }
+    cout << "Standing by for a primary on " << socketPath << ".\n";
+
+    int choice;
+    do {
+        cout << "\nStandby Menu (read-only):\n"
+             << "0. Exit\n"
+             << "1. View Current Balance\n"
+             << "2. View Transaction History\n"
+             << "3. Replication Status\n"
+             << "4. Promote to Primary\n"
+             << "Enter your choice: ";
+        cin >> choice;
+        cin.ignore();
+
+        switch (choice) {
+            case 0:
+                cout << "Exiting standby. Nothing saved.\n";
+                break;
+            case 1:
+                viewCurrentBalance();
+                break;
+            case 2:
+                viewTransactionHistory();
+                break;
+            case 3: {
+                int64_t now = chrono::duration_cast<chrono::nanoseconds>(
+                    chrono::steady_clock::now().time_since_epoch()).count();
+                cout << "Primary: " << (standby.primaryConnected() ? "connected" : "not connected") << "\n"
+                     << "Shipments applied: " << standby.batchesApplied() << "\n";
+                if (standby.lastBatchNs() != 0) {
+                    cout << "Last shipment: " << (now - standby.lastBatchNs()) / 1000000 << " ms ago\n";
+                }
+                break;
+            }
+            case 4: {
+                auto start = chrono::steady_clock::now();
+                standby.stop();
+                standingBy = false;
+                bank.saveAll();
+                double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                cout << "Promoted to primary in " << ms << " ms; the full menu is now available.\n";
+                return true;
+            }
+            default:
+                cout << "Invalid choice. Please try again.\n";
+        }
+    } while (choice != 0);
+
+    standby.stop();
+    standingBy = false;
+    return false;
+}
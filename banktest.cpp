@@ -0,0 +1,1301 @@
+// Regression tests for BankEngine and the account store, run as one program.
+// Build: g++ -std=c++17 -O2 -pthread banktest.cpp bankengine.cpp bankstats.cpp bankvelocity.cpp bankidempotency.cpp bankschedule.cpp bankrank.cpp banksearch.cpp bankcolumns.cpp bankcdc.cpp bankreplica.cpp bankshard.cpp bankstore.cpp -o banktest
+//   ./banktest [--dir DIR]
+// Each test works in a fresh subdirectory of DIR (default "banktest"). Prints PASS
+// or FAIL per test and exits non-zero if any check failed.
+// Add -fsanitize=thread to run the tests that read on other threads (snapshots,
+// lazy_loading) under the race detector.
+#include "bankcdc.h"
+#include "bankcolumns.h"
+#include "bankengine.h"
+#include "bankrank.h"
+#include "bankreplica.h"
+#include "bankschedule.h"
+#include "banksearch.h"
+#include "bankshard.h"
+#include "bankstore.h"
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <tuple>
+#include <string>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <sstream>
+#include <random>
+#include <ctime>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>   // for opendir()
+#include <sys/stat.h> // for mkdir()
+
+using namespace std;
+
+static size_t failedChecks = 0;   // Over the whole run
+static size_t testFailures = 0;   // Checks failed by the current test
+
+// Record one check of the current test
+static void check(bool ok, const string& what) {
+    if (ok) return;
+    cout << "    failed: " << what << "\n";
+    ++testFailures;
+    ++failedChecks;
+}
+
+static bool near(double a, double b) { return fabs(a - b) < 1e-9; }
+
+// Empty (or create) dir/name and return its path. Only files are removed; a test that
+// makes subdirectories empties them itself.
+static string freshDir(const string& dir, const string& name) {
+    string path = dir + "/" + name;
+    mkdir(path.c_str(), 0755);
+    if (DIR* d = opendir(path.c_str())) {
+        while (dirent* entry = readdir(d)) {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+                remove((path + "/" + entry->d_name).c_str());
+            }
+        }
+        closedir(d);
+    }
+    return path;
+}
+
+// An account with no interest, so balances stay exact however long a test takes
+static Account testAccount(int accountNumber, double balance) {
+    Account acc = {};
+    acc.accountNumber = accountNumber;
+    acc.customerName = "Test Customer " + to_string(accountNumber);
+    acc.balance = balance;
+    acc.interestRate = 0;
+    return acc;
+}
+
+static double balanceOf(BankEngine& bank, int accountNumber) {
+    const Account* acc = bank.findAccount(accountNumber);
+    return acc ? acc->balance : NAN;
+}
+
+static string readFile(const string& path) {
+    string data;
+    if (FILE* in = fopen(path.c_str(), "rb")) {
+        char buffer[4096];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) data.append(buffer, n);
+        fclose(in);
+    }
+    return data;
+}
+
+static void writeFile(const string& path, const string& data) {
+    if (FILE* out = fopen(path.c_str(), "wb")) {
+        fwrite(data.data(), 1, data.size(), out);
+        fclose(out);
+    }
+}
+
+// Drop the last line of a file, as if the process died before writing it
+static void dropLastLine(const string& path) {
+    string data = readFile(path);
+    if (!data.empty()) data.pop_back();
+    writeFile(path, data.substr(0, data.rfind('\n') + 1));
+}
+
+// Closing tombstones accounts in place until a background compaction drops them;
+// afterwards every survivor is found at its new index with its balance and frozen
+// flag, and closed numbers stay retired, also after a reload
+static void testCompaction(const string& dir) {
+    const int count = 40;
+    auto closed = [](int n) { return n % 3 == 0; };
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        bank.loadAll();
+        bank.setCompactionThreshold(10);
+        for (int n = 1; n <= count; ++n) bank.createAccount(testAccount(n, n * 10));
+        for (int n = 7; n <= count; n += 7) bank.setFrozen(n, true);
+        for (int n = 1; n <= count; ++n) {
+            if (closed(n)) check(bank.closeAccount(n) == OP_OK, "the account closes");
+        }
+        bank.waitForCompaction();
+        check(bank.tombstoneCount() < 10, "compaction dropped the tombstones");
+        check(bank.getAccounts().size() == bank.liveAccountCount() + bank.tombstoneCount(),
+              "the book holds only live accounts and tombstones");
+    }
+    for (int reload = 0; reload < 2; ++reload) {
+        BankEngine bank(FileFormat::Extended, dir);
+        bank.loadAll();
+        string when = reload ? " after a reload" : "";
+        check(bank.liveAccountCount() == (size_t)(count - count / 3), "closed accounts are gone" + when);
+        bool survivors = true, retired = true;
+        for (int n = 1; n <= count; ++n) {
+            if (closed(n)) {
+                retired = retired && bank.findAccount(n) == nullptr && bank.accountNumberExists(n);
+                continue;
+            }
+            int idx = bank.findAccountIndexByNumber(n);
+            survivors = survivors && idx != -1 && bank.getAccounts()[idx].accountNumber == n &&
+                        near(bank.getAccounts()[idx].balance, n * 10) && bank.isFrozenAt(idx) == (n % 7 == 0);
+        }
+        check(survivors, "every survivor keeps its balance and frozen flag" + when);
+        check(retired, "closed numbers are not found but still exist" + when);
+        check(bank.createAccount(testAccount(3, 0)) == OP_CLOSED, "a closed number is not reused" + when);
+        check(bank.deposit(4, 1) == OP_OK && near(balanceOf(bank, 4), 41), "a survivor still takes writes" + when);
+        bank.withdraw(4, 1);
+    }
+}
+
+// A bulk import keeps the first row of each number in the file, whichever worker
+// reads it, refuses numbers already open or closed and malformed rows, and reports
+// every refusal with its line
+static void testImport(const string& dir) {
+    const string csvPath = dir + "/import.csv", rejectPath = dir + "/import_rejects.csv";
+    const int count = 3000;
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        bank.loadAll();
+        bank.createAccount(testAccount(5, 1));
+        bank.createAccount(testAccount(6, 1));
+        bank.closeAccount(6);
+    }
+    ostringstream csv;
+    csv << "number,name,balance,rate,frozen\n";
+    for (int n = 1; n <= count; ++n) csv << n << ",Holder " << n << "," << n << ",0," << (n % 2) << "\n";
+    csv << "\n";
+    for (int n = 1; n <= count; n += 100) csv << n << ",Late " << n << ",1,0\n";  // Duplicates, later in the file
+    csv << "x,Bad Number,1,0\n" << "9001,,1,0\n" << "9002,Bad|Name,1,0\n" << "9003,Negative,-1,0\n"
+        << "9004,Bad Flag,1,0,2\n" << "9005,Too,Few\n";
+    writeFile(csvPath, csv.str());
+
+    const size_t duplicates = (count + 99) / 100, malformed = 6;
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        bank.loadAll();
+        ImportReport report = bank.importAccounts(csvPath, rejectPath);
+        check(report.opened && report.rows == count + duplicates + malformed, "every data row is read");
+        check(report.imported == count - 2, "every new number is imported once");
+        check(report.rejected == duplicates + malformed + 2, "every other row is rejected");
+        check(report.rejectFile == rejectPath, "the reject report is written");
+    }
+    BankEngine bank(FileFormat::Extended, dir);
+    bank.loadAll();
+    bool firstKept = true;
+    for (int n = 1; n <= count; ++n) {
+        if (n == 5 || n == 6) continue;
+        const Account* acc = bank.findAccount(n);
+        firstKept = firstKept && acc && acc->customerName == "Holder " + to_string(n) && near(acc->balance, n) &&
+                    bank.isFrozen(n) == (n % 2 == 1);
+    }
+    check(firstKept, "the first row of each number is kept, frozen flag included, after a reload");
+    check(bank.findAccount(5)->customerName == "Test Customer 5", "an open account is not overwritten");
+    check(bank.findAccount(6) == nullptr, "a closed number is not reopened");
+    string rejects = readFile(rejectPath);
+    check(rejects.find("account number already exists") != string::npos &&
+          rejects.find("account number belongs to a closed account") != string::npos &&
+          rejects.find("\"duplicate of line 2\"") != string::npos && rejects.find("invalid balance") != string::npos,
+          "each rejected row carries its reason");
+    check((size_t)count_if(rejects.begin(), rejects.end(), [](char c) { return c == '\n'; }) ==
+              duplicates + malformed + 3, "the report has a line per rejected row and a header");
+}
+
+// Snapshots taken on another thread while transfers run each see a whole number of
+// transfers (the total never moves, with interest off), and one held from the start
+// still reads the opening balances at the end. Build with -fsanitize=thread to have
+// the race detector watch the reader too.
+static void testSnapshots(const string& dir) {
+    const int count = 600, transfers = 3000;
+    BankEngine bank(FileFormat::Basic, dir);
+    bank.loadAll();
+    vector<Account> opening;
+    for (int n = 1; n <= count; ++n) opening.push_back(testAccount(n, 1000));
+    bank.replaceAll(opening, {}, {});
+    AccountSnapshot first = bank.snapshotAccounts();
+
+    atomic<bool> writing(true);
+    size_t taken = 0;
+    bool totalsHeld = true, versionsRose = true;
+    thread reader([&]() {
+        uint64_t lastVersion = 0;
+        while (writing.load()) {
+            AccountSnapshot snap = bank.snapshotAccounts();
+            double total = 0;
+            for (size_t i = 0; i < snap.accounts.size(); ++i) total += snap.accounts[i].balance;
+            totalsHeld = totalsHeld && near(total, 1000.0 * count) && snap.liveCount == (size_t)count;
+            versionsRose = versionsRose && snap.accounts.version() >= lastVersion;
+            lastVersion = snap.accounts.version();
+            ++taken;
+        }
+    });
+    for (int i = 0; i < transfers; ++i) {
+        // Each touches accounts on two different snapshot pages
+        int src = 1 + (i * 7) % count, dest = 1 + (i * 13 + 300) % count;
+        if (src != dest) bank.transfer(src, dest, 1 + i % 5);
+    }
+    writing = false;
+    reader.join();
+    check(taken > 0, "the reader took snapshots during the transfers");
+    check(totalsHeld, "every snapshot holds the same total");
+    check(versionsRose, "snapshot versions never go back");
+    bool unchanged = first.accounts.size() == (size_t)count;
+    for (size_t i = 0; unchanged && i < first.accounts.size(); ++i) unchanged = first.accounts[i].balance == 1000;
+    check(unchanged, "a snapshot held across the writes still reads the opening balances");
+}
+
+// The timer wheel fires exactly the armed timers that are due, in due order, checked
+// against a plain list through random arming, moving, cancelling and advancing over
+// every level, including timers armed in the past
+static void testTimerWheel(const string&) {
+    const uint32_t timers = 2000;
+    const int64_t start = 1000;
+    mt19937_64 random(38);
+    TimerWheel wheel(start);
+    vector<int64_t> due(timers + 1, -1);   // Brute force: due tick of each armed timer
+    int64_t processed = start - 1;
+    bool matched = true, ordered = true, sized = true;
+    size_t firedTotal = 0;
+    for (int step = 0; step < 300 && matched; ++step) {
+        for (int k = 0; k < 50; ++k) {
+            uint32_t id = 1 + random() % timers;
+            if (random() % 5 == 0) {
+                wheel.cancel(id);
+                due[id] = -1;
+                continue;
+            }
+            // Spread across the levels: up to 2^(6 * level) ticks ahead, some in the past
+            int level = random() % TimerWheel::LEVELS;
+            int64_t tick = processed + 1 + (int64_t)(random() % (1ULL << (6 * level + 6)));
+            if (random() % 20 == 0) tick = processed - (int64_t)(random() % 100);
+            wheel.schedule(id, tick);
+            due[id] = max(tick, processed + 1);
+        }
+        int64_t to = processed + 1 + (int64_t)(random() % (step % 10 == 0 ? 1 << 20 : 200));
+        vector<uint32_t> fired;
+        wheel.advance(to, fired);
+        vector<uint32_t> expected;
+        for (uint32_t id = 1; id <= timers; ++id) {
+            if (due[id] != -1 && due[id] <= to) expected.push_back(id);
+        }
+        for (size_t i = 1; i < fired.size(); ++i) ordered = ordered && due[fired[i - 1]] <= due[fired[i]];
+        vector<uint32_t> sortedFired = fired;
+        sort(sortedFired.begin(), sortedFired.end());
+        matched = sortedFired == expected;
+        firedTotal += fired.size();
+        for (uint32_t id : fired) due[id] = -1;
+        processed = to;
+        sized = sized && wheel.size() == (size_t)count_if(due.begin(), due.end(), [](int64_t d) { return d != -1; });
+    }
+    check(matched && firedTotal > timers, "each advance fires exactly the armed timers that are due");
+    check(ordered, "timers fire in due order");
+    check(sized, "the armed count matches after every advance");
+}
+
+// Standing orders pay when due, skip periods missed between runs rather than paying
+// them in a burst, suspend after repeated refusals, and survive a reload
+static void testStandingOrders(const string& dir) {
+    const int64_t t0 = time(nullptr);
+    int paying = 0, cancelled = 0, failing = 0;
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        bank.loadAll();
+        bank.createAccount(testAccount(1, 100));
+        bank.createAccount(testAccount(2, 0));
+        bank.createAccount(testAccount(3, 0));
+        check(bank.createStandingOrder(1, 2, 10, 100, t0 + 50, paying) == OP_OK, "an order is created");
+        bank.createStandingOrder(1, 2, 1, 60, t0 + 60, cancelled);
+        bank.createStandingOrder(1, 3, 1000, 100, t0 + 50, failing);
+        check(bank.cancelStandingOrder(cancelled) == OP_OK && bank.standingOrderCount() == 2, "an order is cancelled");
+
+        check(bank.runStandingOrders(t0 + 49).due == 0, "nothing is paid early");
+        StandingOrderReport first = bank.runStandingOrders(t0 + 50);
+        check(first.due == 2 && first.paid == 1 && first.failures.size() == 1 &&
+              first.failures[0].status == OP_INSUFFICIENT_FUNDS && !first.failures[0].suspended,
+              "due orders run and a short payer is refused");
+        StandingOrderReport late = bank.runStandingOrders(t0 + 400);
+        check(late.paid == 1 && near(balanceOf(bank, 2), 20), "missed periods are paid once, not in a burst");
+        check(bank.findStandingOrder(paying)->nextDue == t0 + 450, "the next payment falls on the period");
+        StandingOrderReport third = bank.runStandingOrders(t0 + 450);
+        check(third.failures.size() == 1 && third.failures[0].suspended && bank.standingOrderCount() == 1,
+              "the third refusal in a row suspends the order");
+    }
+    BankEngine bank(FileFormat::Extended, dir);
+    bank.loadAll();
+    check(bank.standingOrderCount() == 1 && bank.findStandingOrder(failing)->suspended &&
+          bank.findStandingOrder(cancelled) == nullptr, "orders are reloaded as they were left");
+    StandingOrderReport reloaded = bank.runStandingOrders(t0 + 10000);
+    check(reloaded.due == 1 && reloaded.paid == 1, "only the armed order runs after the reload");
+    check(near(balanceOf(bank, 1), 60) && near(balanceOf(bank, 2), 40) && near(balanceOf(bank, 3), 0),
+          "every payment moved the money once");
+}
+
+// Top-N, rank, rank lookup and percentiles agree with a sort of the same entries
+// through random inserts, moves and removals with many tied values, and the engine's
+// balance ranking follows deposits, transfers and closures
+static void testRank(const string& dir) {
+    mt19937 random(41);
+    RankIndex index;
+    map<int, double> entries;
+    bool topMatched = true, ranksMatched = true, percentilesMatched = true;
+    for (int round = 0; round < 200; ++round) {
+        for (int k = 0; k < 25; ++k) {
+            int key = random() % 500;
+            if (random() % 4 == 0) {
+                index.erase(key);
+                entries.erase(key);
+            } else {
+                double value = (double)(random() % 40);   // Plenty of ties
+                index.set(key, value);
+                entries[key] = value;
+            }
+        }
+        vector<RankEntry> sorted;
+        for (const auto& e : entries) sorted.push_back({e.first, e.second});
+        stable_sort(sorted.begin(), sorted.end(), [](const RankEntry& a, const RankEntry& b) { return a.value > b.value; });
+        if (index.size() != sorted.size()) {
+            topMatched = false;
+            break;
+        }
+        size_t n = random() % (sorted.size() + 5);
+        vector<RankEntry> top = index.top(n);
+        topMatched = topMatched && top.size() == min(n, sorted.size());
+        for (size_t i = 0; i < top.size(); ++i) {
+            topMatched = topMatched && top[i].key == sorted[i].key && top[i].value == sorted[i].value;
+        }
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            RankEntry at;
+            ranksMatched = ranksMatched && index.rank(sorted[i].key) == i + 1 && index.at(i + 1, at) &&
+                           at.key == sorted[i].key;
+        }
+        RankEntry beyond;
+        ranksMatched = ranksMatched && index.rank(1000) == 0 && !index.at(sorted.size() + 1, beyond);
+        if (sorted.empty()) continue;
+        for (double percent : {0.0, 1.0, 25.0, 50.0, 90.0, 99.9, 100.0}) {
+            size_t ascending = max<size_t>(1, min(sorted.size(), (size_t)ceil(percent / 100 * sorted.size())));
+            percentilesMatched = percentilesMatched &&
+                                 index.valueAtPercentile(percent) == sorted[sorted.size() - ascending].value;
+        }
+        const RankEntry& middle = sorted[sorted.size() / 2];
+        percentilesMatched = percentilesMatched &&
+                             near(index.percentileOf(middle.key),
+                                  100.0 * (sorted.size() - (sorted.size() / 2 + 1)) / sorted.size());
+    }
+    check(topMatched, "top lists the largest entries, ties by ascending key");
+    check(ranksMatched, "rank and at agree with the sorted position");
+    check(percentilesMatched, "percentiles agree with the sorted values");
+
+    BankEngine bank(FileFormat::Extended, dir);
+    bank.loadAll();
+    for (int n = 1; n <= 30; ++n) bank.createAccount(testAccount(n, n % 7 * 10));
+    for (int n = 1; n <= 30; n += 4) bank.deposit(n, n);
+    for (int n = 2; n <= 30; n += 5) bank.transfer(n, 31 - n, 5);
+    for (int n = 3; n <= 30; n += 9) bank.closeAccount(n);
+    vector<RankEntry> live;
+    for (size_t i = 0; i < bank.getAccounts().size(); ++i) {
+        if (!bank.isClosedAt(i)) live.push_back({bank.getAccounts()[i].accountNumber, bank.getAccounts()[i].balance});
+    }
+    sort(live.begin(), live.end(), [](const RankEntry& a, const RankEntry& b) {
+        return a.value != b.value ? a.value > b.value : a.key < b.key;
+    });
+    vector<RankEntry> ranked = bank.balanceRanking().top(live.size() + 1);
+    bool followed = ranked.size() == live.size();
+    for (size_t i = 0; followed && i < live.size(); ++i) {
+        followed = ranked[i].key == live[i].key && near(ranked[i].value, live[i].value);
+    }
+    check(followed, "the balance ranking follows every write and drops closed accounts");
+}
+
+// Plain Levenshtein distance, the whole table
+static int levenshtein(const string& a, const string& b) {
+    vector<vector<int>> d(a.size() + 1, vector<int>(b.size() + 1));
+    for (size_t i = 0; i <= a.size(); ++i) d[i][0] = (int)i;
+    for (size_t j = 0; j <= b.size(); ++j) d[0][j] = (int)j;
+    for (size_t i = 1; i <= a.size(); ++i) {
+        for (size_t j = 1; j <= b.size(); ++j) {
+            d[i][j] = min({d[i - 1][j] + 1, d[i][j - 1] + 1, d[i - 1][j - 1] + (a[i - 1] != b[j - 1])});
+        }
+    }
+    return d[a.size()][b.size()];
+}
+
+// Typo-tolerant search finds exactly what comparing the query with every name finds,
+// checked on random names as they are added, renamed and removed, including after
+// enough removals to compact the index
+static void testFuzzySearch(const string&) {
+    mt19937 random(42);
+    const string letters = "aeiorstnlm";
+    auto word = [&]() {
+        string w;
+        for (int i = 3 + random() % 5; i > 0; --i) w += letters[random() % letters.size()];
+        return w;
+    };
+    auto name = [&]() {
+        string n = word();
+        for (int i = random() % 3; i > 0; --i) n += " " + word();
+        return n;
+    };
+    auto misspell = [&](string s) {
+        for (int i = random() % 4; i > 0 && !s.empty(); --i) {
+            size_t at = random() % s.size();
+            switch (random() % 3) {
+                case 0: s.erase(at, 1); break;
+                case 1: s.insert(at, 1, letters[random() % letters.size()]); break;
+                default: s[at] = letters[random() % letters.size()]; break;
+            }
+        }
+        return s;
+    };
+
+    NameIndex index;
+    map<int, string> names;     // Live keys and their names
+    bool matched = true;
+    auto searchAll = [&]() {
+        vector<string> pool;
+        for (const auto& e : names) pool.push_back(e.second);
+        for (int q = 0; q < 100 && matched; ++q) {
+            string picked = pool[random() % pool.size()];
+            if (random() % 2) {
+                size_t space = picked.find(' ');
+                picked = picked.substr(0, space);   // One word, which may match a surname
+            }
+            string query = misspell(picked);
+            int maxDistance = (int)(random() % 5) - 1;
+            // The distance the index will use, lowered for short queries
+            string padded = "  " + query + " ";
+            set<string> grams;
+            for (size_t i = 0; i + 2 < padded.size(); ++i) grams.insert(padded.substr(i, 3));
+            bool oneWord = query.find(' ') == string::npos;
+            int k = maxDistance >= 0 ? maxDistance : (query.size() <= 4 ? 1 : 2);
+            while (k > 0 && (int)grams.size() - 3 * k - (oneWord ? 1 : 0) < 1) --k;
+
+            vector<NameMatch> expected;
+            for (const auto& e : names) {
+                int whole = levenshtein(query, e.second), best = k + 1;
+                if (oneWord && whole > 0) {
+                    istringstream words(e.second);
+                    string w;
+                    while (words >> w) best = min(best, levenshtein(query, w));
+                }
+                if (whole <= k && whole <= best) expected.push_back({e.first, whole, true});
+                else if (best <= k) expected.push_back({e.first, best, false});
+            }
+            sort(expected.begin(), expected.end(), [](const NameMatch& a, const NameMatch& b) {
+                if (a.distance != b.distance) return a.distance < b.distance;
+                if (a.wholeName != b.wholeName) return a.wholeName;
+                return a.key < b.key;
+            });
+            vector<NameMatch> found = index.search(query, maxDistance);
+            matched = found.size() == expected.size();
+            for (size_t i = 0; matched && i < found.size(); ++i) {
+                matched = found[i].key == expected[i].key && found[i].distance == expected[i].distance &&
+                          found[i].wholeName == expected[i].wholeName;
+            }
+            if (!matched) cerr << "    query \"" << query << "\" within " << maxDistance << "\n";
+        }
+    };
+
+    for (int key = 1; key <= 1500; ++key) {
+        names[key] = name();
+        index.add(key, names[key]);
+    }
+    searchAll();
+    check(matched, "search matches a brute-force scan");
+    for (int key = 1; key <= 600; ++key) {
+        index.remove(key);
+        names.erase(key);
+    }
+    for (int key = 1400; key <= 1500; ++key) {
+        names[key] = name();
+        index.add(key, names[key]);     // Renamed
+    }
+    searchAll();
+    check(matched, "search matches after removals and renames");
+    // Over 1024 removed entries, outnumbering the live ones, compacts the index
+    for (int key = 601; key <= 1100; ++key) {
+        index.remove(key);
+        names.erase(key);
+    }
+    searchAll();
+    check(matched && index.size() == names.size(), "search matches after compaction");
+    for (int key = 2000; key < 2500; ++key) {
+        names[key] = name();
+        index.add(key, names[key]);
+    }
+    searchAll();
+    check(matched, "search matches names added after compaction");
+}
+
+// Exact name lookups list every key under a name, whatever its case and spacing, in
+// the order they were added; accounts leave the list when closed, and loans share it
+// under their own lookup
+static void testExactNames(const string& dir) {
+    NameIndex index;
+    index.add(1, "Ada Lovelace");
+    index.add(2, "  ada   LOVELACE ");
+    index.add(3, "Charles Babbage");
+    index.add(4, "ada lovelace");
+    index.add(2, "Grace Hopper");      // Renamed
+    check(index.lookup("ADA lovelace") == vector<int>({1, 4}), "every key under a name, in the order added");
+    index.remove(1);
+    index.add(1, "Ada Lovelace");
+    check(index.lookup("ada lovelace") == vector<int>({4, 1}), "a key added again goes to the end");
+    check(index.lookup("Grace  Hopper") == vector<int>({2}) && index.lookup("Ada").empty(),
+          "only whole names match");
+
+    BankEngine bank(FileFormat::Extended, dir);
+    bank.loadAll();
+    for (int n = 1; n <= 6; ++n) {
+        Account acc = testAccount(n, 10);
+        acc.customerName = n % 2 ? "Alan Turing" : "Alan Kay";
+        bank.createAccount(acc);
+    }
+    bank.closeAccount(3);
+    Loan loan;
+    bank.createLoan("alan turing", 100, 0, 10, "", loan);
+    check(bank.findAccountNumbersByName("ALAN TURING") == vector<int>({1, 5}), "closed accounts leave the list");
+    check(bank.findLoanIDsByName("Alan Turing") == vector<int>({loan.loanID}), "loans are listed under their name");
+    check(bank.findAccountIndexByName("Alan Kay") != -1 &&
+          bank.getAccounts()[bank.findAccountIndexByName("Alan Kay")].accountNumber == 2,
+          "the first account under a name is found by its exact spelling");
+}
+
+// Filter and aggregate scans give the same answer as testing every row one by one,
+// for random queries over random rows, whatever number of threads they are split
+// across; the engine's queries follow its writes and closures
+static void testColumnScans(const string& dir) {
+    mt19937 random(44);
+    const size_t rows = 64 * 97 + 29;
+    AccountColumns columns;
+    vector<double> balances(rows), rates(rows);
+    vector<uint64_t> frozenBits((rows + 63) / 64, 0), closedBits((rows + 63) / 64, 0);
+    for (size_t i = 0; i < rows; ++i) {
+        balances[i] = (double)(random() % 200) * 5;    // Ties, for Equal and NotEqual
+        rates[i] = (double)(random() % 10) / 2;
+        columns.push(1000 + (int)i, balances[i], rates[i]);
+        if (random() % 4 == 0) frozenBits[i / 64] |= 1ULL << (i % 64);
+        if (random() % 6 == 0) closedBits[i / 64] |= 1ULL << (i % 64);
+    }
+    auto passes = [](double v, const FieldCondition& c) {
+        switch (c.op) {
+            case CompareOp::Less: return v < c.value;
+            case CompareOp::LessEqual: return v <= c.value;
+            case CompareOp::Greater: return v > c.value;
+            case CompareOp::GreaterEqual: return v >= c.value;
+            case CompareOp::Equal: return v == c.value;
+            default: return v != c.value;
+        }
+    };
+    bool matched = true, splitsAgree = true;
+    for (int q = 0; q < 300; ++q) {
+        AccountQuery query;
+        query.frozen = (int)(random() % 3) - 1;
+        for (int g = random() % 4; g > 0; --g) {
+            vector<FieldCondition> group;
+            for (int c = 1 + random() % 3; c > 0; --c) {
+                bool balance = random() % 2;
+                double value = balance ? balances[random() % rows] : rates[random() % rows];
+                group.push_back({balance ? AccountField::Balance : AccountField::InterestRate,
+                                 (CompareOp)(random() % 6), value});
+            }
+            query.anyOf.push_back(group);
+        }
+        AccountField aggregate = random() % 2 ? AccountField::Balance : AccountField::InterestRate;
+
+        AccountAggregate expected;
+        vector<int> expectedMatches;
+        for (size_t i = 0; i < rows; ++i) {
+            bool frozen = (frozenBits[i / 64] >> (i % 64)) & 1;
+            if ((closedBits[i / 64] >> (i % 64)) & 1) continue;
+            if (query.frozen != -1 && frozen != (query.frozen == 1)) continue;
+            bool selected = query.anyOf.empty();
+            for (const auto& group : query.anyOf) {
+                bool all = true;
+                for (const FieldCondition& c : group) {
+                    all = all && passes(c.field == AccountField::Balance ? balances[i] : rates[i], c);
+                }
+                selected = selected || all;
+            }
+            if (!selected) continue;
+            double v = aggregate == AccountField::Balance ? balances[i] : rates[i];
+            expected.min = expected.count == 0 ? v : min(expected.min, v);
+            expected.max = expected.count == 0 ? v : max(expected.max, v);
+            expected.sum += v;
+            ++expected.count;
+            expectedMatches.push_back(1000 + (int)i);
+        }
+        for (size_t workers : {1, 2, 3, 8, 200}) {
+            vector<int> found;
+            AccountAggregate result = columns.evaluate(query, aggregate, frozenBits, closedBits, &found, workers);
+            bool same = result.count == expected.count && near(result.sum, expected.sum) &&
+                        result.min == expected.min && result.max == expected.max && found == expectedMatches;
+            if (workers == 1) matched = matched && same;
+            else splitsAgree = splitsAgree && same;
+        }
+    }
+    check(matched, "a scan on one thread matches testing every row");
+    check(splitsAgree, "a scan split across threads gives the same answer and order");
+
+    BankEngine bank(FileFormat::Extended, dir);
+    bank.loadAll();
+    for (int n = 1; n <= 100; ++n) bank.createAccount(testAccount(n, n));
+    for (int n = 1; n <= 100; n += 10) bank.deposit(n, 1000);
+    for (int n = 5; n <= 100; n += 10) bank.closeAccount(n);
+    bank.setFrozen(11, true);
+    AccountQuery rich;
+    rich.anyOf = {{{AccountField::Balance, CompareOp::Greater, 1000}}};
+    vector<int> found;
+    AccountAggregate result = bank.queryAccounts(rich, AccountField::Balance, &found);
+    check(result.count == 10 && near(result.sum, 10 * 1000 + 460) && found.front() == 1 && found.back() == 91,
+          "engine queries see deposits");
+    rich.frozen = 1;
+    check(bank.queryAccounts(rich).count == 1, "engine queries see freezes");
+    AccountQuery all;
+    check(bank.queryAccounts(all).count == 90, "engine queries skip closed accounts");
+}
+
+// The change feed carries every change in order once it is saved: a reader on another
+// thread finds each transaction it is handed already in transactions.txt. A reader a
+// whole ring behind is told so, sequence numbers carry on across a restart, and a
+// ring of another size is refused.
+static void testChangeFeed(const string& dir) {
+    const string ringPath = dir + "/changes.ring", logFile = dir + "/transactions.txt";
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        bank.loadAll();
+        check(bank.enableChangeFeed(ringPath, 16), "the feed opens");
+        ChangeFeedReader reader;
+        check(reader.open(ringPath), "a reader maps the ring");
+        bank.createAccount(testAccount(1, 50));
+        bank.createAccount(testAccount(2, 0));
+        bank.transfer(1, 2, 20);
+        check(bank.withdraw(2, 100) == OP_INSUFFICIENT_FUNDS, "a refused withdrawal");
+        bank.setFrozen(2, true);
+        bank.closeAccount(1);
+        const vector<tuple<uint32_t, int, double, double, string>> expected = {
+            {CHANGE_ACCOUNT_OPENED, 1, 50, 50, ""}, {CHANGE_ACCOUNT_OPENED, 2, 0, 0, ""},
+            {CHANGE_TRANSACTION, 1, 20, 30, "transfer_out"}, {CHANGE_TRANSACTION, 2, 20, 20, "transfer_in"},
+            {CHANGE_FROZEN, 2, 0, 0, ""}, {CHANGE_ACCOUNT_CLOSED, 1, 30, 30, ""}};
+        bool inOrder = true;
+        ChangeEvent event;
+        for (size_t i = 0; i < expected.size(); ++i) {
+            inOrder = inOrder && reader.read(event) == CHANGE_READ && event.sequence == i + 1 &&
+                      event.type == get<0>(expected[i]) && event.accountNumber == get<1>(expected[i]) &&
+                      event.kind == get<4>(expected[i]);
+            if (event.type != CHANGE_FROZEN) {
+                inOrder = inOrder && near(event.amount, get<2>(expected[i])) && near(event.balanceAfter, get<3>(expected[i]));
+            }
+        }
+        check(inOrder, "every change is published once, in order, and nothing for a refusal");
+        check(reader.read(event) == CHANGE_EMPTY, "the reader has caught up");
+
+        // Published only after the save: the reader checks the log for each record
+        bank.createAccount(testAccount(3, 0));
+        atomic<bool> writing(true);
+        size_t seen = 0;
+        bool saved = true;
+        thread tail([&]() {
+            for (;;) {
+                bool done = !writing.load();
+                ChangeEvent e;
+                ChangeRead r;
+                while ((r = reader.read(e)) == CHANGE_READ) {
+                    if (e.type != CHANGE_TRANSACTION) continue;
+                    ++seen;
+                    string record = "\n" + to_string(e.transactionID) + " 3 ";
+                    saved = saved && ("\n" + readFile(logFile)).find(record) != string::npos;
+                }
+                if (r == CHANGE_LOST) saved = false;
+                if (done) break;
+                this_thread::yield();
+            }
+        });
+        for (int i = 0; i < 10; ++i) bank.deposit(3, 1);
+        writing = false;
+        tail.join();
+        check(seen == 10 && saved, "each transaction is in the log before it is published");
+
+        for (int i = 0; i < 40; ++i) bank.deposit(3, 1);
+        check(reader.read(event) == CHANGE_LOST && reader.position() == reader.oldestSequence(),
+              "a reader lapped by the writer is told and moved to the oldest event");
+    }
+    uint64_t next;
+    {
+        ChangeFeedReader reader;
+        reader.open(ringPath);
+        next = reader.nextSequence();
+    }
+    BankEngine bank(FileFormat::Extended, dir);
+    bank.loadAll();
+    check(!bank.enableChangeFeed(ringPath, 32), "a ring of another size is refused");
+    check(bank.enableChangeFeed(ringPath, 16), "the ring reopens at its own size");
+    ChangeFeedReader reader;
+    reader.open(ringPath);
+    bank.deposit(3, 1);
+    ChangeEvent event;
+    check(reader.read(event) == CHANGE_READ && event.sequence == next, "sequence numbers carry on after a restart");
+}
+
+// A hot standby holds every change before the primary's operation returns, and once
+// promoted it has the primary's accounts, closures, loans and log exactly, also after
+// saving and reloading its own files
+static void testReplication(const string& dir) {
+    const string primaryDir = freshDir(dir, "primary"), standbyDir = freshDir(dir, "standby");
+    const string socketPath = dir + "/standby.sock";
+    BankEngine standby(FileFormat::Extended, standbyDir);
+    StandbyReceiver receiver;
+    check(receiver.start(socketPath, [&](const string& batch) { return standby.applyReplicationBatch(batch); }),
+          "the standby listens");
+
+    BankEngine primary(FileFormat::Extended, primaryDir);
+    primary.loadAll();
+    for (int n = 1; n <= 5; ++n) primary.createAccount(testAccount(n, 100));
+    check(primary.enableReplication(socketPath) && primary.isReplicating(), "the primary ships a full copy");
+    bool heldOnReturn = true;
+    auto standbyBalance = [&](int n) {
+        auto paused = receiver.pause();
+        return balanceOf(standby, n);
+    };
+    for (int i = 0; i < 20; ++i) {
+        int src = 1 + i % 5, dest = 1 + (i + 2) % 5;
+        primary.transfer(src, dest, 1 + i);
+        heldOnReturn = heldOnReturn && near(standbyBalance(src), balanceOf(primary, src)) &&
+                       near(standbyBalance(dest), balanceOf(primary, dest));
+    }
+    check(heldOnReturn, "each transfer is on the standby when it returns");
+    primary.createAccount(testAccount(6, 0));
+    primary.setFrozen(2, true);
+    primary.closeAccount(4);
+    primary.clearTransfers({{1, 3, 5}, {3, 5, 7}, {6, 1, 1}});
+    Loan loan;
+    primary.createLoan("Test Borrower", 500, 0, 10, "", loan);
+    primary.repayLoan(loan.loanID, 120);
+
+    receiver.stop();    // Promote
+    check(!receiver.primaryConnected(), "the standby is promoted");
+    primary.deposit(1, 1);
+    check(!primary.isReplicating(), "the primary drops a standby that went away and carries on");
+    primary.withdraw(1, 1);
+
+    auto sameBook = [&](BankEngine& copy, const string& when) {
+        bool accounts = copy.liveAccountCount() == primary.liveAccountCount();
+        for (int n = 1; n <= 6; ++n) {
+            const Account* a = primary.findAccount(n);
+            const Account* b = copy.findAccount(n);
+            accounts = accounts && (a == nullptr) == (b == nullptr) && copy.accountNumberExists(n);
+            if (a && b) {
+                accounts = accounts && a->customerName == b->customerName && near(a->balance, b->balance) &&
+                           primary.isFrozen(n) == copy.isFrozen(n);
+            }
+        }
+        check(accounts, "accounts, freezes and closures match the primary" + when);
+        const vector<Loan>& loans = copy.getLoanBook();
+        check(loans.size() == 1 && loans[0].loanID == loan.loanID && near(loans[0].remainingBalance, 380),
+              "loans match the primary" + when);
+        const vector<Transaction>& mine = primary.getTransactions();
+        const vector<Transaction>& theirs = copy.getTransactions();
+        // The deposit and withdrawal made after the promotion are the primary's alone
+        bool logged = theirs.size() + 2 == mine.size();
+        for (size_t i = 0; logged && i < theirs.size(); ++i) {
+            logged = theirs[i].transactionID == mine[i].transactionID &&
+                     theirs[i].accountNumber == mine[i].accountNumber && theirs[i].type == mine[i].type &&
+                     near(theirs[i].amount, mine[i].amount) && near(theirs[i].balanceAfter, mine[i].balanceAfter);
+        }
+        check(logged, "the log matches the primary's up to the promotion" + when);
+    };
+    sameBook(standby, "");
+    standby.saveAll();
+    BankEngine reloaded(FileFormat::Extended, standbyDir);
+    reloaded.loadAll();
+    sameBook(reloaded, " after a reload");
+
+    BankEngine other(FileFormat::Extended, freshDir(dir, "other"));
+    check(!other.applyReplicationBatch("R basic\n"), "a shipment in the other file format is refused");
+}
+
+// A retried keyed request returns its first result without acting again, also after a
+// restart; the same key on a different request is refused with OP_KEY_REUSED
+static void testIdempotentRetry(const string& dir) {
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        bank.loadAll();
+        check(bank.createAccount(testAccount(1, 100), "open-1") == OP_OK, "keyed create succeeds");
+        check(bank.createAccount(testAccount(1, 100), "open-1") == OP_OK, "retried create returns OP_OK");
+        Account otherRate = testAccount(2, 100);
+        otherRate.interestRate = 2;
+        check(bank.createAccount(otherRate, "open-1") == OP_KEY_REUSED, "create with another request is refused");
+
+        check(bank.deposit(1, 25, "dep-1") == OP_OK, "keyed deposit succeeds");
+        check(bank.deposit(1, 25, "dep-1") == OP_OK, "retried deposit returns OP_OK");
+        check(near(balanceOf(bank, 1), 125), "retried deposit is applied once");
+        check(bank.deposit(1, 30, "dep-1") == OP_KEY_REUSED, "deposit of another amount is refused");
+        check(bank.withdraw(1, 25, "dep-1") == OP_KEY_REUSED, "another operation under the key is refused");
+        check(near(balanceOf(bank, 1), 125), "refused requests change nothing");
+    }
+    BankEngine bank(FileFormat::Extended, dir);
+    bank.loadAll();
+    check(bank.deposit(1, 25, "dep-1") == OP_OK, "retry after a restart returns OP_OK");
+    check(bank.deposit(1, 30, "dep-1") == OP_KEY_REUSED, "key still refuses another request after a restart");
+    check(near(balanceOf(bank, 1), 125), "retry after a restart is not applied again");
+}
+
+// A key left pending by a crash between its two journal records is settled from the
+// transaction log on restart, whichever file the crash kept; other operations stay
+// in doubt until resolveKeyInDoubt settles them
+static void testInDoubtKeys(const string& dir) {
+    const string accountsFile = dir + "/accounts.txt", logFile = dir + "/transactions.txt";
+    const string journalFile = dir + "/idempotency.journal";
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        bank.loadAll();
+        bank.createAccount(testAccount(1, 100));
+    }
+    const string accountsBefore = readFile(accountsFile), logBefore = readFile(logFile);
+
+    // Died after saving the log but before the balances and the result
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        bank.loadAll();
+        bank.deposit(1, 25, "logged");
+    }
+    writeFile(accountsFile, accountsBefore);
+    dropLastLine(journalFile);
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        bank.loadAll();
+        check(near(balanceOf(bank, 1), 125), "a logged posting's balance is restored on load");
+        check(bank.deposit(1, 25, "logged") == OP_OK, "a logged posting's key answers OP_OK");
+        check(near(balanceOf(bank, 1), 125), "a logged posting is not run again");
+    }
+
+    // Died before saving anything but the pending record
+    writeFile(accountsFile, accountsBefore);
+    writeFile(logFile, logBefore);
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        bank.loadAll();
+        bank.deposit(1, 25, "unlogged");
+    }
+    writeFile(accountsFile, accountsBefore);
+    writeFile(logFile, logBefore);
+    dropLastLine(journalFile);
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        bank.loadAll();
+        check(near(balanceOf(bank, 1), 100), "an unlogged posting left no trace");
+        check(bank.deposit(1, 25, "unlogged") == OP_OK, "an unlogged posting's key lets the retry run");
+        check(near(balanceOf(bank, 1), 125), "the retry is applied once");
+        check(bank.deposit(1, 25, "unlogged") == OP_OK && near(balanceOf(bank, 1), 125), "and remembered");
+    }
+
+    // An operation that logs nothing cannot be settled from the log
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        bank.loadAll();
+        bank.setFrozen(1, true, "freeze");
+    }
+    dropLastLine(journalFile);
+    BankEngine bank(FileFormat::Extended, dir);
+    bank.loadAll();
+    check(bank.setFrozen(1, true, "freeze") == OP_KEY_IN_DOUBT, "a pending freeze stays in doubt");
+    check(bank.resolveKeyInDoubt("freeze", true) == OP_OK, "an operator settles it");
+    check(bank.setFrozen(1, true, "freeze") == OP_OK, "the settled key answers OP_OK");
+    check(bank.resolveKeyInDoubt("freeze", false) == OP_NO_CHANGE, "a settled key is not in doubt");
+    check(bank.resolveKeyInDoubt("missing", false) == OP_NOT_FOUND, "an unknown key is not found");
+}
+
+static int testMonth = 0;
+static int64_t testMonthClock() { return 1700000000 + testMonth * 31 * 86400LL; }
+
+// A second auto-debit run in the same month collects nothing, also after a restart
+static void testAutoDebitRerun(const string& dir) {
+    testMonth = 0;
+    int loanID;
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        bank.setInterestClock(testMonthClock);
+        bank.loadAll();
+        bank.createAccount(testAccount(1, 1000));
+        Loan loan = bank.createLoan("Test Customer 1", 120, 0, 12);
+        loanID = loan.loanID;
+        check(bank.linkLoanAccount(loanID, 1) == OP_OK, "loan links to the account");
+
+        AutoDebitReport first = bank.autoDebitLoans("failures.csv");
+        check(first.debited == 1 && near(first.collected, 10), "first run collects one installment");
+        AutoDebitReport second = bank.autoDebitLoans("failures.csv");
+        check(second.debited == 0 && second.alreadyDebited == 1, "second run in the month collects nothing");
+        check(near(balanceOf(bank, 1), 990), "account is debited once");
+    }
+    BankEngine bank(FileFormat::Extended, dir);
+    bank.setInterestClock(testMonthClock);
+    bank.loadAll();
+    AutoDebitReport rerun = bank.autoDebitLoans("failures.csv");
+    check(rerun.debited == 0 && rerun.alreadyDebited == 1, "run after a restart in the month collects nothing");
+    testMonth = 1;
+    AutoDebitReport next = bank.autoDebitLoans("failures.csv");
+    check(next.debited == 1, "next month's run collects again");
+    check(near(balanceOf(bank, 1), 980), "account is debited once a month");
+    const Loan* loan = bank.findLoanByID(loanID);
+    check(loan && near(loan->remainingBalance, 100), "loan balance falls once a month");
+}
+
+// Offsetting transfers cannot slip past a velocity limit by cancelling out; the
+// account frozen mid-batch takes nothing in or out, and no logged balance goes negative
+static void testNettingVelocity(const string& dir) {
+    BankEngine bank(FileFormat::Extended, dir);
+    bank.loadAll();
+    VelocityLimits limits;
+    limits.windowSeconds = 3600;
+    limits.maxAmount = 200;
+    bank.setVelocityLimits(limits);
+    for (int n = 1; n <= 3; ++n) bank.createAccount(testAccount(n, 100));
+
+    ClearingReport over = bank.clearTransfers({{1, 2, 500}, {2, 1, 500}, {3, 1, 50}});
+    check(over.cleared == 0, "offsetting transfers over the limit do not clear");
+    check(over.statuses[0] == OP_VELOCITY_LIMIT, "the first payer over the limit is refused");
+    check(over.statuses[2] == OP_DEST_FROZEN, "a credit to the account frozen mid-batch is refused");
+    check(bank.isFrozen(1), "the payer over the limit is frozen");
+    for (int n = 1; n <= 3; ++n) check(near(balanceOf(bank, n), 100), "balances are untouched");
+
+    ClearingReport under = bank.clearTransfers({{2, 3, 150}, {3, 2, 150}});
+    check(under.cleared == 2 && near(under.net, 0), "offsetting transfers under the limit clear with no net");
+    for (const Transaction& t : bank.getTransactions()) {
+        if (t.type == "transfer_out" || t.type == "transfer_in") check(t.balanceAfter >= 0, "no logged balance is negative");
+    }
+    check(near(balanceOf(bank, 2), 100) && near(balanceOf(bank, 3), 100), "netted balances are unchanged");
+}
+
+// Every transfer out counts against the velocity limits on its own, so a batch cannot
+// send more debits than maxCount allows by having them netted into one
+static void testNettingVelocityCount(const string& dir) {
+    BankEngine bank(FileFormat::Extended, dir);
+    bank.loadAll();
+    VelocityLimits limits;
+    limits.windowSeconds = 3600;
+    limits.maxCount = 2;
+    bank.setVelocityLimits(limits);
+    for (int n = 1; n <= 3; ++n) bank.createAccount(testAccount(n, 100));
+
+    vector<BatchTransfer> batch;
+    for (int i = 0; i < 10; ++i) batch.push_back({1, 2, 10});
+    batch.push_back({3, 1, 5});
+    ClearingReport report = bank.clearTransfers(batch);
+    check(report.cleared == 2, "only maxCount transfers out clear");
+    check(report.statuses[1] == OP_OK && report.statuses[2] == OP_VELOCITY_LIMIT,
+          "the first transfer over the count is refused");
+    check(report.statuses[10] == OP_DEST_FROZEN, "a later credit to the frozen account is refused");
+    check(bank.isFrozen(1), "the account over the count is frozen");
+    check(near(balanceOf(bank, 1), 80) && near(balanceOf(bank, 2), 120) && near(balanceOf(bank, 3), 100),
+          "the cleared transfers are posted");
+}
+
+// An account whose transfers are all refused is left exactly as it was, however the
+// amounts added and backed out of its position round
+static void testNettingRefusedExact(const string& dir) {
+    BankEngine bank(FileFormat::Extended, dir);
+    bank.loadAll();
+    for (int n = 1; n <= 3; ++n) bank.createAccount(testAccount(n, 0));
+    ClearingReport report = bank.clearTransfers({{1, 2, 0.1}, {1, 2, 0.2}, {2, 3, 0.1}, {2, 3, 0.2}});
+    check(report.cleared == 0, "no transfer clears without funds");
+    check(report.accounts == 0 && report.net == 0, "no account is counted as settled");
+    bool untouched = true;
+    for (int n = 1; n <= 3; ++n) untouched = untouched && balanceOf(bank, n) == 0;
+    check(untouched, "every balance is still exactly zero");
+}
+
+static ShardRequest shardRequest(ShardOp op, int accountNumber, double amount, uint64_t txid) {
+    ShardRequest request = {};
+    request.op = op;
+    request.accountNumber = accountNumber;
+    request.amount = amount;
+    request.txid = txid;
+    return request;
+}
+
+// A prepared cross-shard transfer survives a restart of both shards with its
+// reservation held, and a commit redelivered after a crash is not posted twice
+static void testTwoPhaseRecovery(const string& dir) {
+    const string source = freshDir(dir, "2pc-source"), dest = freshDir(dir, "2pc-dest");
+    const uint64_t txid = 7;
+    {
+        BankEngine a(FileFormat::Extended, source), b(FileFormat::Extended, dest);
+        a.loadAll();
+        b.loadAll();
+        a.createAccount(testAccount(1, 100));
+        b.createAccount(testAccount(2, 100));
+        ShardServer serverA(a, source + "/prepare.log"), serverB(b, dest + "/prepare.log");
+        check(serverA.handle(shardRequest(SHARD_PREPARE_DEBIT, 1, 40, txid)).status == OP_OK, "source votes yes");
+        check(serverB.handle(shardRequest(SHARD_PREPARE_CREDIT, 2, 40, txid)).status == OP_OK, "destination votes yes");
+    }
+
+    // Both shards restart with the transfer in doubt
+    string preparedLog;
+    {
+        BankEngine a(FileFormat::Extended, source), b(FileFormat::Extended, dest);
+        a.loadAll();
+        b.loadAll();
+        ShardServer serverA(a, source + "/prepare.log"), serverB(b, dest + "/prepare.log");
+        check(serverA.handle(shardRequest(SHARD_WITHDRAW, 1, 70, 0)).status == OP_INSUFFICIENT_FUNDS,
+              "the reservation is held across a restart");
+        FILE* in = fopen((source + "/prepare.log").c_str(), "r");
+        char buffer[4096];
+        size_t n = in ? fread(buffer, 1, sizeof(buffer), in) : 0;
+        if (in) fclose(in);
+        preparedLog.assign(buffer, n);
+        check(serverA.handle(shardRequest(SHARD_COMMIT, 1, 0, txid)).status == OP_OK, "source commits");
+        check(serverB.handle(shardRequest(SHARD_COMMIT, 2, 0, txid)).status == OP_OK, "destination commits");
+        check(near(balanceOf(a, 1), 60) && near(balanceOf(b, 2), 140), "the transfer is posted");
+    }
+
+    // The source crashes after posting its leg but before logging the decision
+    if (FILE* out = fopen((source + "/prepare.log").c_str(), "w")) {
+        fwrite(preparedLog.data(), 1, preparedLog.size(), out);
+        fclose(out);
+    }
+    BankEngine a(FileFormat::Extended, source);
+    a.loadAll();
+    ShardServer serverA(a, source + "/prepare.log");
+    check(serverA.handle(shardRequest(SHARD_COMMIT, 1, 0, txid)).status == OP_OK, "redelivered commit is accepted");
+    check(near(balanceOf(a, 1), 60), "redelivered commit is not posted twice");
+    check(serverA.handle(shardRequest(SHARD_WITHDRAW, 1, 60, 0)).status == OP_OK, "the reservation is released");
+}
+
+// A shard that dies inside a commit, between its key's pending and result records,
+// finishes the leg exactly once when the commit is redelivered after its restart:
+// whether the crash came before or after the posting reached the transaction log
+static void testCommitInDoubt(const string& dir) {
+    const string prepareLog = dir + "/prepare.log", journalFile = dir + "/idempotency.journal";
+    const string accountsFile = dir + "/accounts.txt", logFile = dir + "/transactions.txt";
+    const uint64_t txid = 11;
+    for (int logged = 0; logged < 2; ++logged) {
+        freshDir(dir, "");
+        {
+            BankEngine shard(FileFormat::Extended, dir);
+            shard.loadAll();
+            shard.createAccount(testAccount(1, 100));
+            ShardServer server(shard, prepareLog);
+            server.handle(shardRequest(SHARD_PREPARE_DEBIT, 1, 40, txid));
+        }
+        const string accountsBefore = readFile(accountsFile), logBefore = readFile(logFile);
+        const string preparedBefore = readFile(prepareLog);
+        {
+            BankEngine shard(FileFormat::Extended, dir);
+            shard.loadAll();
+            ShardServer server(shard, prepareLog);
+            server.handle(shardRequest(SHARD_COMMIT, 1, 0, txid));
+        }
+        // What the kill leaves: the pending record, and the log only if it got that far
+        dropLastLine(journalFile);
+        writeFile(prepareLog, preparedBefore);
+        writeFile(accountsFile, accountsBefore);
+        if (!logged) writeFile(logFile, logBefore);
+
+        BankEngine shard(FileFormat::Extended, dir);
+        shard.loadAll();
+        ShardServer server(shard, prepareLog);
+        string when = logged ? " (killed after the log was saved)" : " (killed before the log was saved)";
+        check(server.handle(shardRequest(SHARD_WITHDRAW, 1, 70, 0)).status == OP_INSUFFICIENT_FUNDS,
+              "the leg is still reserved" + when);
+        check(server.handle(shardRequest(SHARD_COMMIT, 1, 0, txid)).status == OP_OK, "the redelivered commit finishes" + when);
+        check(near(balanceOf(shard, 1), 60), "the leg is posted once" + when);
+        size_t postings = 0;
+        for (const Transaction& t : shard.getTransactionHistory(1)) postings += t.type == "transfer_out";
+        check(postings == 1, "the leg is logged once" + when);
+        check(server.handle(shardRequest(SHARD_WITHDRAW, 1, 60, 0)).status == OP_OK, "the reservation is released" + when);
+    }
+}
+
+// Names too long for a shard request are refused on both ends rather than cut short
+static void testShardNames(const string& dir) {
+    BankEngine engine(FileFormat::Extended, dir);
+    engine.loadAll();
+    ShardServer server(engine, dir + "/prepare.log");
+    ShardRequest create = shardRequest(SHARD_CREATE, 1, 10, 0);
+    memset(create.name, 'x', sizeof(create.name));
+    check(server.handle(create).status == OP_NAME_TOO_LONG, "the shard refuses an unterminated name");
+    check(!engine.findAccount(1), "nothing is created");
+    create.name[sizeof(create.name) - 1] = '\0';
+    check(server.handle(create).status == OP_OK, "a name of 31 characters is accepted");
+    check(engine.findAccount(1) && engine.findAccount(1)->customerName == string(31, 'x'), "and kept whole");
+
+    ShardedLedger ledger;   // Refused before any shard is asked, so none is needed
+    Account longName = testAccount(2, 10);
+    longName.customerName = string(32, 'y');
+    check(ledger.createAccount(longName) == OP_NAME_TOO_LONG, "the client refuses a name over 31 characters");
+}
+
+// Records put and erased survive a close and reopen; names that do not fit are refused
+static void testStoreReopen(const string& dir) {
+    const string path = dir + "/accounts.db";
+    const int count = 5000;     // Enough for several leaf splits and an inner level
+    {
+        AccountStore store;
+        check(store.open(path, 16), "store opens");
+        for (int i = 0; i < count; ++i) {
+            StoredAccount acc = {};
+            acc.accountNumber = 1000 + i;
+            acc.balance = i;
+            snprintf(acc.customerName, sizeof(acc.customerName), "Customer %d", i);
+            check(store.put(acc), "record is stored");
+        }
+        for (int i = 0; i < count; i += 3) check(store.erase(1000 + i), "record is erased");
+        StoredAccount replaced = {};
+        replaced.accountNumber = 1001;
+        replaced.balance = -1;
+        store.put(replaced);
+
+        StoredAccount tooLong = {};
+        tooLong.accountNumber = 1;
+        memset(tooLong.customerName, 'x', sizeof(tooLong.customerName));
+        check(!store.put(tooLong), "a name with no room for its terminator is refused");
+        check(!AccountStore::fitsName(string(64, 'x')) && AccountStore::fitsName(string(63, 'x')),
+              "names of up to 63 characters fit");
+        store.close();
+    }
+    AccountStore store;
+    check(store.open(path, 16), "store reopens");
+    check(store.size() == (size_t)(count - (count + 2) / 3), "record count survives the reopen");
+    StoredAccount found;
+    check(!store.find(1, found), "the refused record is absent");
+    bool allFound = true;
+    for (int i = 0; i < count; ++i) {
+        bool present = store.find(1000 + i, found);
+        if (i % 3 == 0) {
+            allFound = allFound && !present;
+        } else {
+            double balance = i == 1 ? -1 : i;
+            allFound = allFound && present && near(found.balance, balance);
+        }
+    }
+    check(allFound, "every record reads back as written, and erased ones are gone");
+    int last = 0;
+    bool ordered = true;
+    store.forEach([&](const StoredAccount& acc) {
+        ordered = ordered && acc.accountNumber > last;
+        last = acc.accountNumber;
+    });
+    check(ordered, "a scan returns records in number order");
+}
+
+// With the store enabled, a name it cannot hold never reaches the book, so the store
+// and accounts.txt never hold two different versions of the accounts
+static void testStoreNames(const string& dir) {
+    freshDir(dir, "");
+    const string storePath = dir + "/accounts.store", longName(70, 'n');
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        bank.loadAll();
+        bank.createAccount(testAccount(1, 10));
+        Account named = testAccount(2, 20);
+        named.customerName = longName;
+        check(bank.createAccount(named) == OP_OK, "accounts.txt takes a long name");
+    }
+    const string accountsBefore = readFile(dir + "/accounts.txt");
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        check(bank.enableAccountStore(storePath, 16), "the store opens");
+        bank.loadAll();
+        check(!bank.hasAccountStore(), "the store is not filled from a file holding a long name");
+        bank.deposit(1, 5);
+        check(near(balanceOf(bank, 1), 15) && near(balanceOf(bank, 2), 20), "the accounts are kept in memory");
+    }
+    check(readFile(dir + "/accounts.txt") != accountsBefore, "saves still go to accounts.txt");
+    {
+        AccountStore store;
+        check(store.open(storePath, 16) && store.size() == 0, "nothing was written to the store");
+    }
+
+    freshDir(dir, "");
+    BankEngine bank(FileFormat::Extended, dir);
+    check(bank.enableAccountStore(storePath, 16), "an empty store opens");
+    bank.loadAll();
+    bank.createAccount(testAccount(1, 10));
+    Account named = testAccount(2, 20);
+    named.customerName = longName;
+    check(bank.createAccount(named) == OP_NAME_TOO_LONG, "createAccount refuses a long name");
+    check(!bank.applyReplicationBatch("A 3 " + longName + "| 30 0 0 0\n"), "a shipped account with a long name is refused");
+    check(bank.findAccount(3) == nullptr, "the refused account is not in the book");
+    bank.deposit(1, 5);
+    check(bank.hasAccountStore(), "the store stays enabled");
+    check(readFile(dir + "/accounts.txt").empty(), "accounts.txt is never written beside the store");
+}
+
+// History lookups made while transactions.txt is still loading in the background
+// see every record, including while writers save over the file
+static void testLazyLoading(const string& dir) {
+    const int logged = 200000;
+    {
+        BankEngine bank(FileFormat::Extended, dir);
+        vector<Transaction> log;
+        log.reserve(logged);
+        for (int i = 1; i <= logged; ++i) log.push_back({i, 1 + i % 2, "2026-01-01 00:00:00", "deposit", 1, (double)i});
+        bank.replaceAll({testAccount(1, 0), testAccount(2, 0)}, {}, move(log));
+        bank.saveAll();
+    }
+    BankEngine bank(FileFormat::Extended, dir);
+    bank.loadAll(true);
+    atomic<bool> writing{true};
+    atomic<size_t> shortReads{0}, reads{0};
+    thread reader([&] {
+        while (writing) {
+            if (bank.getTransactionHistory(1).size() < (size_t)logged / 2) ++shortReads;
+            ++reads;
+        }
+    });
+    for (int i = 0; i < 20; ++i) bank.deposit(2, 1);
+    writing = false;
+    reader.join();
+    check(reads > 0 && shortReads == 0, "no history read during loading or saving came back short");
+    check(bank.transactionsLoaded(), "the log is installed once a writer needs it");
+    check(bank.getTransactionHistory(2).size() == (size_t)logged / 2 + 20, "history includes the new records");
+}
+
+int main(int argc, char* argv[]) {
+    string dir = "banktest";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        if (arg == "--dir") {
+            dir = argv[i + 1];
+        } else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 2;
+        }
+    }
+    mkdir(dir.c_str(), 0755);
+
+    const vector<pair<string, function<void(const string&)>>> tests = {
+        {"compaction", testCompaction},
+        {"import", testImport},
+        {"snapshots", testSnapshots},
+        {"timer_wheel", testTimerWheel},
+        {"standing_orders", testStandingOrders},
+        {"rank", testRank},
+        {"fuzzy_search", testFuzzySearch},
+        {"exact_names", testExactNames},
+        {"column_scans", testColumnScans},
+        {"change_feed", testChangeFeed},
+        {"replication", testReplication},
+        {"idempotent_retry", testIdempotentRetry},
+        {"in_doubt_keys", testInDoubtKeys},
+        {"auto_debit_rerun", testAutoDebitRerun},
+        {"netting_velocity", testNettingVelocity},
+        {"netting_velocity_count", testNettingVelocityCount},
+        {"netting_refused_exact", testNettingRefusedExact},
+        {"two_phase_recovery", testTwoPhaseRecovery},
+        {"commit_in_doubt", testCommitInDoubt},
+        {"shard_names", testShardNames},
+        {"store_reopen", testStoreReopen},
+        {"store_names", testStoreNames},
+        {"lazy_loading", testLazyLoading},
+    };
+    size_t failedTests = 0;
+    for (const auto& test : tests) {
+        testFailures = 0;
+        test.second(freshDir(dir, test.first));
+        cout << (testFailures == 0 ? "PASS " : "FAIL ") << test.first << "\n";
+        if (testFailures > 0) ++failedTests;
+    }
+    cout << tests.size() - failedTests << " of " << tests.size() << " tests passed ("
+         << failedChecks << " failed checks)\n";
+    return failedTests == 0 ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+#include "bankvelocity.h"
+
+#include <ctime>
+
+using namespace std;
+
+static const uint32_t EMPTY_CAPACITY = 0;
+
+int64_t velocityClockNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Fibonacci hashing: spreads sequential account numbers across the table
+static size_t slotHash(int accountNumber, size_t mask) {
+    return ((uint32_t)accountNumber * 2654435769u) & mask;
+}
+
+void VelocityGuard::configure(const VelocityLimits& newLimits) {
+    limits = newLimits;
+    windowNs = (int64_t)limits.windowSeconds * 1000000000LL;
+    clear();
+}
+
+void VelocityGuard::clear() {
+    slots.assign(64, Slot{0, 0, 0, EMPTY_CAPACITY, 0, 0});
+    pool.clear();
+    used = 0;
+    liveDebits = 0;
+}
+
+size_t VelocityGuard::findSlot(int accountNumber) const {
+    size_t mask = slots.size() - 1;
+    for (size_t i = slotHash(accountNumber, mask); ; i = (i + 1) & mask) {
+        if (slots[i].capacity == EMPTY_CAPACITY) return i;
+        if (slots[i].accountNumber == accountNumber) return i;
+    }
+}
+
+uint32_t VelocityGuard::allocateRing(uint32_t capacity) {
+    uint32_t offset = (uint32_t)pool.size();
+    pool.resize(pool.size() + capacity);
+    liveDebits += capacity;
+    return offset;
+}
+
+// Claim a slot for a new account, growing the table first if it would pass half full
+size_t VelocityGuard::insertSlot(int accountNumber) {
+    if ((used + 1) * 2 > slots.size()) rebuild(slots.size() * 2);
+    size_t i = findSlot(accountNumber);
+    uint32_t capacity = 4;
+    while (limits.maxCount > 0 && capacity < (uint32_t)limits.maxCount) capacity *= 2;
+    slots[i] = Slot{accountNumber, 0, 0, capacity, allocateRing(capacity), 0};
+    ++used;
+    return i;
+}
+
+// Re-insert every occupied slot into a table of slotCount entries and copy the
+// live rings into a fresh pool, dropping space left behind by grown or reset rings
+void VelocityGuard::rebuild(size_t slotCount) {
+    vector<Slot> oldSlots;
+    vector<Debit> oldPool;
+    oldSlots.swap(slots);
+    oldPool.swap(pool);
+    slots.assign(slotCount, Slot{0, 0, 0, EMPTY_CAPACITY, 0, 0});
+    pool.reserve(liveDebits);
+    liveDebits = 0;
+
+    for (const Slot& old : oldSlots) {
+        if (old.capacity == EMPTY_CAPACITY) continue;
+        Slot& s = slots[findSlot(old.accountNumber)];
+        s = old;
+        s.ringOffset = allocateRing(old.capacity);
+        for (uint32_t k = 0; k < old.capacity; ++k) {
+            pool[s.ringOffset + k] = oldPool[old.ringOffset + k];
+        }
+    }
+}
+
+// Drop debits that have slid out of the window. Each debit is pushed and expired
+// once, so this is O(1) amortized per check.
+void VelocityGuard::expire(Slot& s, int64_t nowNs) {
+    const Debit* ring = &pool[s.ringOffset];
+    uint32_t mask = s.capacity - 1;
+    while (s.count > 0 && nowNs - ring[s.head].timeNs >= windowNs) {
+        s.total -= ring[s.head].amount;
+        s.head = (s.head + 1) & mask;
+        --s.count;
+    }
+    if (s.count == 0) s.total = 0; // Shed accumulated rounding error
+}
+
+// Append a debit, doubling the ring when full. With a count limit the ring is sized
+// for maxCount up front and never grows.
+void VelocityGuard::push(Slot& s, const Debit& debit) {
+    if (s.count == s.capacity) {
+        uint32_t grownCapacity = s.capacity * 2;
+        uint32_t offset = allocateRing(grownCapacity);
+        for (uint32_t k = 0; k < s.count; ++k) {
+            pool[offset + k] = pool[s.ringOffset + ((s.head + k) & (s.capacity - 1))];
+        }
+        liveDebits -= s.capacity;
+        s.ringOffset = offset;
+        s.capacity = grownCapacity;
+        s.head = 0;
+    }
+    pool[s.ringOffset + ((s.head + s.count) & (s.capacity - 1))] = debit;
+    ++s.count;
+    s.total += debit.amount;
+}
+
+bool VelocityGuard::allow(int accountNumber, double amount, int64_t nowNs) {
+    if (!enabled()) return true;
+    size_t i = findSlot(accountNumber);
+    if (slots[i].capacity == EMPTY_CAPACITY) i = insertSlot(accountNumber);
+    Slot& s = slots[i];
+    expire(s, nowNs);
+
+    if (limits.maxCount > 0 && s.count + 1 > (uint32_t)limits.maxCount) return false;
+    if (limits.maxAmount > 0 && s.total + amount > limits.maxAmount) return false;
+
+    push(s, {nowNs, amount});
+    return true;
+}
+
+// Remove an account's slot, shifting later entries of its probe run back so
+// lookups never stop early at the hole
+void VelocityGuard::reset(int accountNumber) {
+    if (slots.empty()) return;
+    size_t mask = slots.size() - 1;
+    size_t hole = findSlot(accountNumber);
+    if (slots[hole].capacity == EMPTY_CAPACITY) return;
+    liveDebits -= slots[hole].capacity;
+    --used;
+
+    for (size_t i = (hole + 1) & mask; slots[i].capacity != EMPTY_CAPACITY; i = (i + 1) & mask) {
+        size_t home = slotHash(slots[i].accountNumber, mask);
+        // Move the entry into the hole unless its home lies cyclically in (hole, i]
+        bool homeBetween = (hole < i) ? (home > hole && home <= i) : (home > hole || home <= i);
+        if (!homeBetween) {
+            slots[hole] = slots[i];
+            hole = i;
+        }
+    }
+    slots[hole].capacity = EMPTY_CAPACITY;
+
+    // Reclaim ring space once most of the pool belongs to removed or outgrown rings
+    if (pool.size() > 1024 && liveDebits * 2 < pool.size()) rebuild(slots.size());
+}
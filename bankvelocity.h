@@ -0,0 +1,73 @@
+// Velocity checks on money leaving an account: how much and how often an account
+// may be debited within a sliding time window. Each account keeps a ring buffer of
+// its recent debits, so a check costs O(1) amortized and never reads the
+// transaction log.
+#ifndef BANKVELOCITY_H
+#define BANKVELOCITY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sliding-window limits applied to withdrawals and outgoing transfers
+struct VelocityLimits {
+    int windowSeconds = 0;      // Length of the sliding window; 0 disables the checks
+    double maxAmount = 0;       // Most that may leave an account per window; 0 means no limit
+    int maxCount = 0;           // Most debits per window; 0 means no limit
+};
+
+// Monotonic clock used for the windows, in nanoseconds. It is the coarse kernel
+// clock (a few milliseconds of resolution), which is plenty for windows measured
+// in seconds and several times cheaper to read than steady_clock.
+int64_t velocityClockNs();
+
+class VelocityGuard {
+public:
+    void configure(const VelocityLimits& newLimits);
+    const VelocityLimits& getLimits() const { return limits; }
+    bool enabled() const { return windowNs > 0 && (limits.maxAmount > 0 || limits.maxCount > 0); }
+
+    // Record a debit if it keeps the account within its limits. Returns false, and
+    // records nothing, when the debit would cross either limit.
+    bool allow(int accountNumber, double amount, int64_t nowNs);
+
+    // Forget an account's history, e.g. after it is unfrozen or closed
+    void reset(int accountNumber);
+    void clear();
+
+private:
+    struct Debit {
+        int64_t timeNs;
+        double amount;
+    };
+
+    // One account's window: debits still inside it sit in pool[ringOffset ...
+    // ringOffset + capacity), oldest at head. capacity is a power of two; 0 marks
+    // an empty slot.
+    struct Slot {
+        int accountNumber;
+        uint32_t head;
+        uint32_t count;
+        uint32_t capacity;
+        uint32_t ringOffset;
+        double total;           // Sum of the amounts in the ring
+    };
+
+    // Open-addressing table (linear probing) keyed by account number, so a check
+    // touches one slot and one ring instead of chasing hash-node pointers
+    size_t findSlot(int accountNumber) const;
+    size_t insertSlot(int accountNumber);
+    void rebuild(size_t slotCount);
+    uint32_t allocateRing(uint32_t capacity);
+    void expire(Slot& s, int64_t nowNs);
+    void push(Slot& s, const Debit& debit);
+
+    VelocityLimits limits;
+    int64_t windowNs = 0;
+    std::vector<Slot> slots;    // Power-of-two size, at most half full
+    std::vector<Debit> pool;    // Ring storage for every slot
+    size_t used = 0;            // Occupied slots
+    size_t liveDebits = 0;      // Pool entries owned by occupied slots
+};
+
+#endif